@@ -4,3 +4,12 @@
 
 COMPONENT_ADD_INCLUDEDIRS := .
 COMPONENT_SRCDIRS := .
+
+# Host stack backend, follows the Bluetooth host selected in menuconfig.
+ifdef CONFIG_BT_NIMBLE_ENABLED
+COMPONENT_OBJEXCLUDE := neil_ble_gatts.o neil_ble_gatts_attr_db.o neil_ble_gatts_gap.o \
+	neil_ble_gatts_handle_map.o neil_ble_gatts_trace.o neil_ble_gatts_write.o
+else
+COMPONENT_OBJEXCLUDE := neil_ble_gatts_nimble.o neil_ble_gatts_nimble_db.o \
+	neil_ble_gatts_l2cap.o
+endif
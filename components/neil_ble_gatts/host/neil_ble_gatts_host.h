@@ -0,0 +1,310 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_host.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Host (Linux) port of the component.
+///
+///             ESP-IDF, FreeRTOS and Bluedroid are provided over POSIX, so
+///             the component and an application using it run off target.
+///             The Bluedroid replacement keeps the threading of the real
+///             stack (every callback on one BTC task) and its event order,
+///             and serves links of its own instead of a radio: events are
+///             injected through this interface, responses and notifications
+///             reported to an observer. An HCI transport
+///             (neil_ble_gatts_host_hci.c) drives both against a controller,
+///             such as one emulated by BlueZ `btvirt`.
+///
+///             The application provides `app_main`, run on a main task by
+///             `main` (neil_ble_gatts_host_main.c), see README.md.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_gap_ble_api.h"
+#include "esp_gatts_api.h"
+#include "freertos/FreeRTOS.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Task stacks are this many times the requested size, for the deeper frames
+/// of the host C library.
+#ifndef NEIL_BLE_GATTS_HOST_STACK_SCALE
+#define NEIL_BLE_GATTS_HOST_STACK_SCALE 4
+#endif
+
+/// Smallest task stack (bytes).
+#ifndef NEIL_BLE_GATTS_HOST_STACK_MIN
+#define NEIL_BLE_GATTS_HOST_STACK_MIN (32 * 1024)
+#endif
+
+/// Size of the heap `heap_caps_get_free_size` reports from (bytes).
+#ifndef NEIL_BLE_GATTS_HOST_HEAP_SIZE
+#define NEIL_BLE_GATTS_HOST_HEAP_SIZE (160 * 1024)
+#endif
+
+/// First attribute handle given to application tables, as on the target.
+#define NEIL_BLE_GATTS_HOST_HANDLE_BASE 0x28
+
+/// Highest attribute handle given out (at most 0xFFFF, one pointer each).
+#ifndef NEIL_BLE_GATTS_HOST_HANDLE_MAX
+#define NEIL_BLE_GATTS_HOST_HANDLE_MAX 0x0400
+#endif
+
+/// Longest device name kept (as BTM_MAX_LOC_BD_NAME_LEN).
+#define NEIL_BLE_GATTS_HOST_DEVICE_NAME_MAX 64
+
+// -------------------------------------------------------------
+// Application
+// -------------------------------------------------------------
+
+/**
+ * @brief       Application entry-point, run on the main task.
+ */
+void app_main(void);
+
+// -------------------------------------------------------------
+// Stack Observation
+// -------------------------------------------------------------
+
+/// What the stack transmitted.
+typedef enum {
+    NEIL_BLE_GATTS_HOST_TX_RESPONSE = 0, ///< `esp_ble_gatts_send_response`
+    NEIL_BLE_GATTS_HOST_TX_NOTIFY,       ///< `esp_ble_gatts_send_indicate`
+    NEIL_BLE_GATTS_HOST_TX_ADV_START,    ///< `esp_ble_gap_start_advertising`
+    NEIL_BLE_GATTS_HOST_TX_ADV_STOP,     ///< `esp_ble_gap_stop_advertising`
+    NEIL_BLE_GATTS_HOST_TX_DISCONNECT,   ///< `esp_ble_gap_disconnect`
+} neil_ble_gatts_host_tx_kind_t;
+
+/**
+ * @brief       Response, notification or GAP procedure handed to the stack.
+ *
+ *              GAP procedures only set `kind` (and `conn_id` for
+ *              disconnections), see `neil_ble_gatts_host_gap_get`.
+ */
+typedef struct {
+    neil_ble_gatts_host_tx_kind_t kind;
+    uint16_t conn_id;
+    uint32_t trans_id; ///< Request answered (responses only).
+    uint16_t handle;
+    esp_gatt_status_t status;
+    const uint8_t *value; ///< NULL for responses without a value.
+    uint16_t len;         ///< Value length, before the ATT MTU is applied.
+} neil_ble_gatts_host_tx_t;
+
+/**
+ * @brief       Observer of transmissions, called on the task handing them to
+ *              the stack.
+ */
+typedef void (*neil_ble_gatts_host_tx_cb_t)(const neil_ble_gatts_host_tx_t *tx,
+                                            void *arg);
+
+/**
+ * @brief       Set (or clear, with NULL) the transmission observer.
+ */
+void neil_ble_gatts_host_set_tx_cb(neil_ble_gatts_host_tx_cb_t cb, void *arg);
+
+/**
+ * @brief       Whether notifications are reported sent (`ESP_GATTS_CONF_EVT`)
+ *              as soon as they are handed over, the default.
+ *
+ *              Turned off, completions are only delivered through
+ *              `neil_ble_gatts_host_gatts_event`.
+ */
+void neil_ble_gatts_host_set_auto_conf(bool enabled);
+
+/**
+ * @brief       Whether the stack completes link procedures itself, the
+ *              default: disconnections are reported at once and pairing
+ *              succeeds.
+ *
+ *              Turned off while a controller carries the links, disconnections
+ *              wait for `neil_ble_gatts_host_disconnect` and pairing fails, as
+ *              no security manager runs. Connection parameters, PHY and RSSI
+ *              are still answered at once.
+ */
+void neil_ble_gatts_host_set_auto_link(bool enabled);
+
+// -------------------------------------------------------------
+// Stack State
+// -------------------------------------------------------------
+
+/**
+ * @brief       Interface of a registered application profile.
+ *
+ * @return      ESP_GATT_IF_NONE if `app_id` is not registered.
+ */
+esp_gatt_if_t neil_ble_gatts_host_gatts_if(uint16_t app_id);
+
+/**
+ * @brief       Whether the stack advertises.
+ */
+bool neil_ble_gatts_host_advertising(void);
+
+/**
+ * @brief       Attribute held by the stack.
+ */
+typedef struct {
+    uint16_t handle;
+    esp_gatt_if_t gatts_if;
+    esp_bt_uuid_t uuid;
+    esp_gatt_perm_t perm;
+    uint8_t auto_rsp;   ///< ESP_GATT_AUTO_RSP if the stack serves the value.
+    uint16_t max_len;
+    uint16_t len;
+    const uint8_t *value;
+} neil_ble_gatts_host_attr_t;
+
+/**
+ * @brief       Get an attribute of a started service.
+ *
+ *              `value` stays valid while the service is registered.
+ *
+ * @return      false if no started service holds `handle`.
+ */
+bool neil_ble_gatts_host_attr_get(uint16_t handle, neil_ble_gatts_host_attr_t *out);
+
+/**
+ * @brief       Get the first attribute of a started service at or after
+ *              `handle`.
+ *
+ * @return      false if there is none.
+ */
+bool neil_ble_gatts_host_attr_next(uint16_t handle, neil_ble_gatts_host_attr_t *out);
+
+/**
+ * @brief       Advertising state and data of the stack.
+ */
+typedef struct {
+    bool advertising;
+    esp_ble_adv_params_t adv_params; ///< Of the last start.
+    uint8_t adv_data[ESP_BLE_ADV_DATA_LEN_MAX];
+    uint8_t adv_data_len;
+    uint8_t scan_rsp_data[ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+    uint8_t scan_rsp_data_len;
+    char device_name[NEIL_BLE_GATTS_HOST_DEVICE_NAME_MAX + 1];
+} neil_ble_gatts_host_gap_t;
+
+/**
+ * @brief       Get the advertising state and data of the stack.
+ */
+void neil_ble_gatts_host_gap_get(neil_ble_gatts_host_gap_t *out);
+
+/**
+ * @brief       Wait until the BTC task has handled every posted event,
+ *              including those posted while waiting.
+ *
+ * @return      ESP_ERR_TIMEOUT if events kept coming for `timeout`.
+ */
+esp_err_t neil_ble_gatts_host_settle(TickType_t timeout);
+
+/**
+ * @brief       Heap allocations (malloc, calloc, realloc) made so far by the
+ *              application, the component and the port, from any task.
+ *
+ *              Allocations inside the C library are not counted.
+ */
+uint32_t neil_ble_gatts_host_alloc_count(void);
+
+// -------------------------------------------------------------
+// Event Injection
+// -------------------------------------------------------------
+//
+// Events are handled on the BTC task, the caller waits for the callback to
+// return. Connection, MTU and disconnection events also update the links of
+// the stack, as a peer would.
+
+/**
+ * @brief       Deliver a GATTS event to the registered callback.
+ *
+ * @return      Nanoseconds spent in the callback, -1 if Bluedroid is not
+ *              enabled.
+ */
+int64_t neil_ble_gatts_host_gatts_event(esp_gatts_cb_event_t event,
+                                        esp_gatt_if_t gatts_if,
+                                        esp_ble_gatts_cb_param_t *param);
+
+/**
+ * @brief       Deliver a GAP event to the registered callback.
+ *
+ * @return      Nanoseconds spent in the callback, -1 if Bluedroid is not
+ *              enabled.
+ */
+int64_t neil_ble_gatts_host_gap_event(esp_gap_ble_cb_event_t event,
+                                      esp_ble_gap_cb_param_t *param);
+
+/**
+ * @brief       Connect a peer, reported to every registered profile.
+ */
+esp_err_t neil_ble_gatts_host_connect(uint16_t conn_id, const esp_bd_addr_t bda);
+
+/**
+ * @brief       Disconnect a peer, reported to every registered profile.
+ */
+esp_err_t neil_ble_gatts_host_disconnect(uint16_t conn_id,
+                                         esp_gatt_conn_reason_t reason);
+
+/**
+ * @brief       Exchange the ATT MTU of a link, reported to every registered
+ *              profile.
+ */
+esp_err_t neil_ble_gatts_host_set_mtu(uint16_t conn_id, uint16_t mtu);
+
+// -------------------------------------------------------------
+// Trace Replay
+// -------------------------------------------------------------
+
+/**
+ * @brief       Options of `neil_ble_gatts_host_replay`.
+ */
+typedef struct {
+    const char *trace_path;  ///< Binary trace, or hex log with `hex`.
+    bool hex;                ///< Trace printed as "TRACE <hex>" lines.
+    bool realtime;           ///< Keep the recorded spacing of events.
+    uint16_t repeat;         ///< Passes over the trace (0 counts as 1).
+    const char *report_path; ///< JSON report file, NULL for stdout only.
+} neil_ble_gatts_host_replay_opts_t;
+
+/**
+ * @brief       Feed a recorded trace back through the running application
+ *              and report the processing time of each event.
+ *
+ *              Call once the application has started its contexts.
+ *
+ * @return      0 on success, non-zero if the trace cannot be replayed.
+ */
+int neil_ble_gatts_host_replay(const neil_ble_gatts_host_replay_opts_t *opts);
+
+// -------------------------------------------------------------
+// HCI Transport
+// -------------------------------------------------------------
+
+/**
+ * @brief       Options of `neil_ble_gatts_host_hci_start`.
+ */
+typedef struct {
+    const char *h4_path; ///< H4 stream on a unix socket, as `btvirt -s` serves.
+    uint16_t hci_dev;    ///< Linux HCI user channel, when `h4_path` is NULL.
+    uint16_t mtu;        ///< ATT MTU offered to clients (0 for 517).
+} neil_ble_gatts_host_hci_opts_t;
+
+/**
+ * @brief       Serve the stack's links through a Bluetooth controller.
+ *
+ *              Resets the controller, then carries advertising, connections
+ *              and ATT over it (see neil_ble_gatts_host_hci.c), turning
+ *              `auto_conf` and `auto_link` off. Call before `app_main` runs.
+ *              A user channel needs the device down and CAP_NET_ADMIN.
+ *
+ * @return      ESP_FAIL if the transport cannot be opened or the controller
+ *              does not answer.
+ */
+esp_err_t neil_ble_gatts_host_hci_start(const neil_ble_gatts_host_hci_opts_t *opts);
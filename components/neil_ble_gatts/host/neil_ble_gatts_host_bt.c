@@ -0,0 +1,1731 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_host_bt.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Controller and Bluedroid replacement.
+///
+///             API calls take effect at once and post their completion
+///             events to a BTC task, which runs every callback in order, as
+///             Bluedroid does. Attribute tables are copied and given handles
+///             from 0x28 up; links only exist once a connection is injected,
+///             by a test or by the HCI transport.
+///
+///             Limits and return codes follow Bluedroid where the component
+///             depends on them: CONFIG_BT_GATT_MAX_SR_ATTRIBUTES per table,
+///             ESP_ERR_INVALID_STATE while Bluedroid is not enabled and
+///             ESP_FAIL when the BTC queue is full.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_bt.h"
+#include "esp_bt_main.h"
+#include "esp_gap_ble_api.h"
+#include "esp_gatts_api.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "neil_ble_gatts_host.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Events waiting for the BTC task (as BTC_TASK_QUEUE_LEN).
+#define BTC_QUEUE_LEN 60
+
+/// Stack of the BTC task (as BTC_TASK_STACK_SIZE).
+#define BTC_TASK_STACK 4096
+
+/// Highest attribute handle given out.
+#define HANDLE_MAX NEIL_BLE_GATTS_HOST_HANDLE_MAX
+
+/// Bonded peers kept (as CONFIG_BT_SMP_MAX_BONDS).
+#define BOND_MAX 15
+
+/// Signal strength reported for every link (dBm).
+#define LINK_RSSI -50
+
+/// Logging tag.
+static const char *TAG = "NEIL BLE GATTS Host";
+
+/// Logging tag of the Bluedroid GATT layer, for the errors it reports.
+static const char *GATT_TAG = "BT_GATT";
+
+// -------------------------------------------------------------
+// State
+// -------------------------------------------------------------
+
+/**
+ * @brief       Attribute of a created table.
+ */
+typedef struct {
+    neil_ble_gatts_host_attr_t attr;
+    uint16_t service_handle; ///< Declaration of the enclosing service.
+    bool started;
+    uint8_t *value; ///< `max_len` bytes, owned.
+} host_attr_t;
+
+/**
+ * @brief       Link to a peer.
+ */
+typedef struct {
+    bool used;
+    uint16_t conn_id;
+    esp_bd_addr_t bda;
+    uint16_t mtu;
+    bool pending;      ///< A request awaits its response.
+    uint32_t trans_id; ///< Request awaiting its response.
+} host_link_t;
+
+static struct {
+    pthread_mutex_t lock;
+
+    esp_bt_controller_status_t controller;
+    esp_bluedroid_status_t bluedroid;
+    bool ble_mem_released;
+
+    esp_gatts_cb_t gatts_cb;
+    esp_gap_ble_cb_t gap_cb;
+
+    // --- Registered application profiles, interface = index + 1
+    struct {
+        bool used;
+        uint16_t app_id;
+    } apps[CONFIG_BT_GATT_MAX_SR_PROFILES];
+
+    host_attr_t *attrs[HANDLE_MAX + 1];
+    host_link_t links[CONFIG_BT_ACL_CONNECTIONS];
+
+    // --- GAP
+    bool advertising;
+    esp_ble_adv_params_t adv_params;
+    char device_name[NEIL_BLE_GATTS_HOST_DEVICE_NAME_MAX + 1];
+    uint8_t adv_data[ESP_BLE_ADV_DATA_LEN_MAX];
+    uint8_t adv_data_len;
+    uint8_t scan_rsp_data[ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+    uint8_t scan_rsp_data_len;
+
+    // --- Security
+    esp_ble_auth_req_t auth_req;
+    esp_ble_io_cap_t iocap;
+    uint32_t passkey;
+    esp_ble_bond_dev_t bonds[BOND_MAX];
+    int bond_num;
+
+    // --- Observation
+    neil_ble_gatts_host_tx_cb_t tx_cb;
+    void *tx_arg;
+    bool auto_conf;
+    bool auto_link;
+} bt = {
+    .lock      = PTHREAD_MUTEX_INITIALIZER,
+    .iocap     = ESP_IO_CAP_NONE,
+    .auto_conf = true,
+    .auto_link = true,
+};
+
+// -------------------------------------------------------------
+// BTC Task
+// -------------------------------------------------------------
+
+typedef enum {
+    BTC_MSG_GATTS = 0,
+    BTC_MSG_GAP,
+    BTC_MSG_SYNC, ///< Nothing to deliver, wakes the poster.
+} btc_msg_kind_t;
+
+/**
+ * @brief       Event queued for the BTC task.
+ */
+typedef struct {
+    btc_msg_kind_t kind;
+    int event;
+    esp_gatt_if_t gatts_if;
+    union {
+        esp_ble_gatts_cb_param_t gatts;
+        esp_ble_gap_cb_param_t gap;
+    } param;
+    void *owned;            ///< Freed once delivered.
+    SemaphoreHandle_t done; ///< Given once delivered, if set.
+    int64_t *ns;            ///< Time spent in the callback, if set.
+} btc_msg_t;
+
+static QueueHandle_t btc_queue       = NULL;
+static TaskHandle_t btc_task_handle  = NULL;
+static SemaphoreHandle_t btc_waiting = NULL; ///< Serializes synchronous posters.
+static SemaphoreHandle_t btc_done    = NULL;
+
+static int64_t time_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void btc_deliver(btc_msg_t *msg) {
+    pthread_mutex_lock(&bt.lock);
+    const esp_gatts_cb_t gatts_cb = bt.gatts_cb;
+    const esp_gap_ble_cb_t gap_cb = bt.gap_cb;
+    pthread_mutex_unlock(&bt.lock);
+
+    const int64_t start_ns = time_ns();
+
+    if (msg->kind == BTC_MSG_GATTS && gatts_cb != NULL) {
+        gatts_cb(msg->event, msg->gatts_if, &msg->param.gatts);
+    } else if (msg->kind == BTC_MSG_GAP && gap_cb != NULL) {
+        gap_cb(msg->event, &msg->param.gap);
+    }
+
+    if (msg->ns != NULL) {
+        *msg->ns = time_ns() - start_ns;
+    }
+
+    free(msg->owned);
+
+    if (msg->done != NULL) {
+        xSemaphoreGive(msg->done);
+    }
+}
+
+static void btc_task(void *arg) {
+    btc_msg_t msg;
+
+    for (;;) {
+        if (xQueueReceive(btc_queue, &msg, portMAX_DELAY) == pdPASS) {
+            btc_deliver(&msg);
+        }
+    }
+}
+
+static bool btc_on_task(void) { return xTaskGetCurrentTaskHandle() == btc_task_handle; }
+
+/**
+ * @brief       Queue an event for the BTC task.
+ *
+ *              Posters block while the queue is full, except the BTC task
+ *              itself, which would never drain it.
+ */
+static esp_err_t btc_post(btc_msg_t *msg) {
+    const TickType_t wait = btc_on_task() ? 0 : portMAX_DELAY;
+
+    if (xQueueSend(btc_queue, msg, wait) != pdPASS) {
+        ESP_LOGE(TAG, "BTC queue full, event %d dropped", msg->event);
+        free(msg->owned);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief       Queue an event and wait for its callback to return.
+ */
+static esp_err_t btc_post_wait(btc_msg_t *msg) {
+    // --- Already on the BTC task: deliver in place, the queue is behind us
+    if (btc_on_task()) {
+        btc_deliver(msg);
+        return ESP_OK;
+    }
+
+    xSemaphoreTake(btc_waiting, portMAX_DELAY);
+
+    msg->done     = btc_done;
+    esp_err_t ret = btc_post(msg);
+    if (ret == ESP_OK) {
+        xSemaphoreTake(btc_done, portMAX_DELAY);
+    }
+
+    xSemaphoreGive(btc_waiting);
+
+    return ret;
+}
+
+static esp_err_t gatts_post(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
+                            const esp_ble_gatts_cb_param_t *param, void *owned) {
+    btc_msg_t msg = {
+        .kind     = BTC_MSG_GATTS,
+        .event    = event,
+        .gatts_if = gatts_if,
+        .owned    = owned,
+    };
+    if (param != NULL) {
+        msg.param.gatts = *param;
+    }
+    return btc_post(&msg);
+}
+
+static esp_err_t gap_post(esp_gap_ble_cb_event_t event,
+                          const esp_ble_gap_cb_param_t *param) {
+    btc_msg_t msg = {
+        .kind  = BTC_MSG_GAP,
+        .event = event,
+    };
+    if (param != NULL) {
+        msg.param.gap = *param;
+    }
+    return btc_post(&msg);
+}
+
+/**
+ * @brief       Whether API calls are accepted, as `esp_bluedroid_get_status`.
+ */
+static bool bluedroid_enabled(void) {
+    pthread_mutex_lock(&bt.lock);
+    const bool enabled = bt.bluedroid == ESP_BLUEDROID_STATUS_ENABLED;
+    pthread_mutex_unlock(&bt.lock);
+    return enabled;
+}
+
+// -------------------------------------------------------------
+// Links
+// -------------------------------------------------------------
+//
+// Callers hold `bt.lock`.
+
+static host_link_t *link_find(uint16_t conn_id) {
+    for (size_t i = 0; i < CONFIG_BT_ACL_CONNECTIONS; i++) {
+        if (bt.links[i].used && bt.links[i].conn_id == conn_id) {
+            return bt.links + i;
+        }
+    }
+    return NULL;
+}
+
+static host_link_t *link_find_bda(const esp_bd_addr_t bda) {
+    for (size_t i = 0; i < CONFIG_BT_ACL_CONNECTIONS; i++) {
+        if (bt.links[i].used && memcmp(bt.links[i].bda, bda, ESP_BD_ADDR_LEN) == 0) {
+            return bt.links + i;
+        }
+    }
+    return NULL;
+}
+
+static host_link_t *link_open(uint16_t conn_id, const esp_bd_addr_t bda) {
+    host_link_t *link = link_find(conn_id);
+
+    for (size_t i = 0; link == NULL && i < CONFIG_BT_ACL_CONNECTIONS; i++) {
+        if (!bt.links[i].used) {
+            link = bt.links + i;
+        }
+    }
+
+    if (link != NULL) {
+        *link = (host_link_t){
+            .used    = true,
+            .conn_id = conn_id,
+            .mtu     = ESP_GATT_DEF_BLE_MTU_SIZE,
+        };
+        memcpy(link->bda, bda, ESP_BD_ADDR_LEN);
+
+        // --- The controller stops advertising once connected
+        bt.advertising = false;
+    }
+
+    return link;
+}
+
+/**
+ * @brief       Track what an injected event does to the links.
+ */
+static void link_update(esp_gatts_cb_event_t event, esp_ble_gatts_cb_param_t *param) {
+    pthread_mutex_lock(&bt.lock);
+
+    host_link_t *link = NULL;
+
+    switch (event) {
+    case ESP_GATTS_CONNECT_EVT:
+        if (link_open(param->connect.conn_id, param->connect.remote_bda) == NULL) {
+            ESP_LOGW(TAG, "No link left for connection %u", param->connect.conn_id);
+        }
+        break;
+
+    case ESP_GATTS_DISCONNECT_EVT:
+        link = link_find(param->disconnect.conn_id);
+        if (link != NULL) {
+            link->used = false;
+        }
+        break;
+
+    case ESP_GATTS_MTU_EVT:
+        link = link_find(param->mtu.conn_id);
+        if (link != NULL) {
+            link->mtu = param->mtu.mtu;
+        }
+        break;
+
+    case ESP_GATTS_READ_EVT:
+        link = link_find(param->read.conn_id);
+        if (link != NULL && param->read.need_rsp) {
+            link->pending  = true;
+            link->trans_id = param->read.trans_id;
+        }
+        break;
+
+    case ESP_GATTS_WRITE_EVT:
+        link = link_find(param->write.conn_id);
+        if (link != NULL && param->write.need_rsp) {
+            link->pending  = true;
+            link->trans_id = param->write.trans_id;
+        }
+
+        // --- Values of attributes the stack serves are stored before delivery
+        host_attr_t *attr = param->write.handle <= HANDLE_MAX
+                                ? bt.attrs[param->write.handle]
+                                : NULL;
+        if (attr != NULL && attr->attr.auto_rsp == ESP_GATT_AUTO_RSP &&
+            !param->write.is_prep &&
+            param->write.offset + param->write.len <= attr->attr.max_len) {
+            memcpy(attr->value + param->write.offset, param->write.value,
+                   param->write.len);
+            attr->attr.len = param->write.offset + param->write.len;
+        }
+        break;
+
+    case ESP_GATTS_EXEC_WRITE_EVT:
+        link = link_find(param->exec_write.conn_id);
+        if (link != NULL) {
+            link->pending  = true;
+            link->trans_id = param->exec_write.trans_id;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+}
+
+/**
+ * @brief       Report a GAP procedure to the transmission observer.
+ */
+static void tx_report_gap(neil_ble_gatts_host_tx_kind_t kind, uint16_t conn_id) {
+    pthread_mutex_lock(&bt.lock);
+    const neil_ble_gatts_host_tx_cb_t cb = bt.tx_cb;
+    void *const cb_arg                   = bt.tx_arg;
+    pthread_mutex_unlock(&bt.lock);
+
+    if (cb != NULL) {
+        const neil_ble_gatts_host_tx_t tx = {.kind = kind, .conn_id = conn_id};
+        cb(&tx, cb_arg);
+    }
+}
+
+// -------------------------------------------------------------
+// Controller
+// -------------------------------------------------------------
+
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg) {
+    pthread_mutex_lock(&bt.lock);
+
+    esp_err_t ret = ESP_OK;
+    if (bt.controller != ESP_BT_CONTROLLER_STATUS_IDLE || bt.ble_mem_released) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else {
+        bt.controller = ESP_BT_CONTROLLER_STATUS_INITED;
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+    return ret;
+}
+
+esp_err_t esp_bt_controller_deinit(void) {
+    pthread_mutex_lock(&bt.lock);
+
+    esp_err_t ret = ESP_OK;
+    if (bt.controller != ESP_BT_CONTROLLER_STATUS_INITED) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else {
+        bt.controller = ESP_BT_CONTROLLER_STATUS_IDLE;
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+    return ret;
+}
+
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode) {
+    pthread_mutex_lock(&bt.lock);
+
+    esp_err_t ret = ESP_OK;
+    if (bt.controller != ESP_BT_CONTROLLER_STATUS_INITED) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else {
+        bt.controller = ESP_BT_CONTROLLER_STATUS_ENABLED;
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+    return ret;
+}
+
+esp_err_t esp_bt_controller_disable(void) {
+    pthread_mutex_lock(&bt.lock);
+
+    esp_err_t ret = ESP_OK;
+    if (bt.controller != ESP_BT_CONTROLLER_STATUS_ENABLED) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else {
+        bt.controller = ESP_BT_CONTROLLER_STATUS_INITED;
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+    return ret;
+}
+
+esp_bt_controller_status_t esp_bt_controller_get_status(void) {
+    pthread_mutex_lock(&bt.lock);
+    const esp_bt_controller_status_t status = bt.controller;
+    pthread_mutex_unlock(&bt.lock);
+    return status;
+}
+
+esp_err_t esp_bt_controller_mem_release(esp_bt_mode_t mode) {
+    pthread_mutex_lock(&bt.lock);
+
+    esp_err_t ret = ESP_OK;
+    if (bt.controller != ESP_BT_CONTROLLER_STATUS_IDLE) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else if (mode & ESP_BT_MODE_BLE) {
+        bt.ble_mem_released = true;
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+    return ret;
+}
+
+esp_err_t esp_bt_mem_release(esp_bt_mode_t mode) {
+    return esp_bt_controller_mem_release(mode);
+}
+
+// -------------------------------------------------------------
+// Bluedroid
+// -------------------------------------------------------------
+
+esp_bluedroid_status_t esp_bluedroid_get_status(void) {
+    pthread_mutex_lock(&bt.lock);
+    const esp_bluedroid_status_t status = bt.bluedroid;
+    pthread_mutex_unlock(&bt.lock);
+    return status;
+}
+
+esp_err_t esp_bluedroid_init(void) {
+    pthread_mutex_lock(&bt.lock);
+
+    esp_err_t ret = ESP_OK;
+    if (bt.controller != ESP_BT_CONTROLLER_STATUS_ENABLED ||
+        bt.bluedroid != ESP_BLUEDROID_STATUS_UNINITIALIZED) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else {
+        bt.bluedroid = ESP_BLUEDROID_STATUS_INITIALIZED;
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+    return ret;
+}
+
+esp_err_t esp_bluedroid_deinit(void) {
+    pthread_mutex_lock(&bt.lock);
+
+    esp_err_t ret = ESP_OK;
+    if (bt.bluedroid != ESP_BLUEDROID_STATUS_INITIALIZED) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else {
+        bt.bluedroid = ESP_BLUEDROID_STATUS_UNINITIALIZED;
+        bt.gatts_cb  = NULL;
+        bt.gap_cb    = NULL;
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+    return ret;
+}
+
+esp_err_t esp_bluedroid_enable(void) {
+    pthread_mutex_lock(&bt.lock);
+
+    if (bt.bluedroid != ESP_BLUEDROID_STATUS_INITIALIZED) {
+        pthread_mutex_unlock(&bt.lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // NOTE: The BTC task outlives a disable, nothing is posted meanwhile.
+    if (btc_queue == NULL) {
+        btc_queue   = xQueueCreate(BTC_QUEUE_LEN, sizeof(btc_msg_t));
+        btc_waiting = xSemaphoreCreateMutex();
+        btc_done    = xSemaphoreCreateBinary();
+        xTaskCreate(btc_task, "BTC_TASK", BTC_TASK_STACK, NULL, 19, &btc_task_handle);
+    }
+
+    bt.bluedroid = ESP_BLUEDROID_STATUS_ENABLED;
+
+    pthread_mutex_unlock(&bt.lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_disable(void) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // --- Let posted events reach the application first
+    neil_ble_gatts_host_settle(portMAX_DELAY);
+
+    pthread_mutex_lock(&bt.lock);
+
+    bt.bluedroid   = ESP_BLUEDROID_STATUS_INITIALIZED;
+    bt.advertising = false;
+    memset(bt.apps, 0, sizeof(bt.apps));
+    memset(bt.links, 0, sizeof(bt.links));
+
+    for (size_t handle = 0; handle <= HANDLE_MAX; handle++) {
+        if (bt.attrs[handle] != NULL) {
+            free(bt.attrs[handle]->value);
+            free(bt.attrs[handle]);
+            bt.attrs[handle] = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+    return ESP_OK;
+}
+
+// -------------------------------------------------------------
+// GATTS
+// -------------------------------------------------------------
+
+esp_err_t esp_ble_gatts_register_callback(esp_gatts_cb_t callback) {
+    if (esp_bluedroid_get_status() == ESP_BLUEDROID_STATUS_UNINITIALIZED) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+    bt.gatts_cb = callback;
+    pthread_mutex_unlock(&bt.lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_app_register(uint16_t app_id) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+
+    esp_gatt_if_t gatts_if = ESP_GATT_IF_NONE;
+    for (size_t i = 0; i < CONFIG_BT_GATT_MAX_SR_PROFILES; i++) {
+        if (!bt.apps[i].used) {
+            bt.apps[i].used   = true;
+            bt.apps[i].app_id = app_id;
+            gatts_if          = i + 1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+
+    const esp_ble_gatts_cb_param_t param = {
+        .reg = {
+            .status =
+                gatts_if != ESP_GATT_IF_NONE ? ESP_GATT_OK : ESP_GATT_NO_RESOURCES,
+            .app_id = app_id,
+        },
+    };
+
+    return gatts_post(ESP_GATTS_REG_EVT, gatts_if, &param, NULL);
+}
+
+esp_err_t esp_ble_gatts_app_unregister(esp_gatt_if_t gatts_if) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+
+    if (gatts_if == 0 || gatts_if > CONFIG_BT_GATT_MAX_SR_PROFILES ||
+        !bt.apps[gatts_if - 1].used) {
+        pthread_mutex_unlock(&bt.lock);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    bt.apps[gatts_if - 1].used = false;
+
+    // --- Services of the profile go with it
+    for (size_t handle = 0; handle <= HANDLE_MAX; handle++) {
+        if (bt.attrs[handle] != NULL && bt.attrs[handle]->attr.gatts_if == gatts_if) {
+            free(bt.attrs[handle]->value);
+            free(bt.attrs[handle]);
+            bt.attrs[handle] = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+
+    return gatts_post(ESP_GATTS_UNREG_EVT, gatts_if, NULL, NULL);
+}
+
+/**
+ * @brief       Copy an attribute description into the database.
+ */
+static host_attr_t *attr_copy(const esp_gatts_attr_db_t *db, esp_gatt_if_t gatts_if,
+                              uint16_t handle) {
+    const esp_attr_desc_t *desc = &db->att_desc;
+
+    host_attr_t *attr = calloc(1, sizeof(*attr));
+    if (attr == NULL) {
+        return NULL;
+    }
+
+    const uint16_t max_len = desc->max_length > desc->length ? desc->max_length
+                                                             : desc->length;
+    attr->value = calloc(1, max_len > 0 ? max_len : 1);
+    if (attr->value == NULL) {
+        free(attr);
+        return NULL;
+    }
+
+    if (desc->value != NULL) {
+        memcpy(attr->value, desc->value, desc->length);
+    }
+
+    attr->attr = (neil_ble_gatts_host_attr_t){
+        .handle   = handle,
+        .gatts_if = gatts_if,
+        .uuid     = {.len = desc->uuid_length},
+        .perm     = desc->perm,
+        .auto_rsp = db->attr_control.auto_rsp,
+        .max_len  = max_len,
+        .len      = desc->length,
+        .value    = attr->value,
+    };
+
+    switch (desc->uuid_length) {
+    case ESP_UUID_LEN_16:
+        memcpy(&attr->attr.uuid.uuid.uuid16, desc->uuid_p, ESP_UUID_LEN_16);
+        break;
+    case ESP_UUID_LEN_32:
+        memcpy(&attr->attr.uuid.uuid.uuid32, desc->uuid_p, ESP_UUID_LEN_32);
+        break;
+    case ESP_UUID_LEN_128:
+        memcpy(attr->attr.uuid.uuid.uuid128, desc->uuid_p, ESP_UUID_LEN_128);
+        break;
+    default:
+        break;
+    }
+
+    return attr;
+}
+
+static bool attr_is_service(const host_attr_t *attr) {
+    return attr->attr.uuid.len == ESP_UUID_LEN_16 &&
+           (attr->attr.uuid.uuid.uuid16 == ESP_GATT_UUID_PRI_SERVICE ||
+            attr->attr.uuid.uuid.uuid16 == ESP_GATT_UUID_SEC_SERVICE);
+}
+
+esp_err_t esp_ble_gatts_create_attr_tab(const esp_gatts_attr_db_t *gatts_attr_db,
+                                        esp_gatt_if_t gatts_if, uint16_t max_nb_attr,
+                                        uint8_t srvc_inst_id) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (max_nb_attr > CONFIG_BT_GATT_MAX_SR_ATTRIBUTES) {
+        ESP_LOGE(TAG, "The number of attribute should not be greater than %d",
+                 CONFIG_BT_GATT_MAX_SR_ATTRIBUTES);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint16_t *handles = calloc(max_nb_attr > 0 ? max_nb_attr : 1, sizeof(uint16_t));
+    if (handles == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_gatt_status_t status = ESP_GATT_OK;
+
+    pthread_mutex_lock(&bt.lock);
+
+    // --- Lowest run of free handles
+    uint32_t base = NEIL_BLE_GATTS_HOST_HANDLE_BASE;
+    for (uint16_t run = 0; base + run <= HANDLE_MAX && run < max_nb_attr;) {
+        if (bt.attrs[base + run] != NULL) {
+            base += run + 1;
+            run = 0;
+        } else {
+            run++;
+        }
+    }
+
+    if (max_nb_attr == 0 || gatts_attr_db[0].att_desc.uuid_length != ESP_UUID_LEN_16 ||
+        base + max_nb_attr - 1 > HANDLE_MAX) {
+        status = max_nb_attr == 0 ? ESP_GATT_ILLEGAL_PARAMETER : ESP_GATT_NO_RESOURCES;
+    }
+
+    uint16_t service_handle = 0;
+
+    for (uint16_t i = 0; status == ESP_GATT_OK && i < max_nb_attr; i++) {
+        host_attr_t *attr = attr_copy(gatts_attr_db + i, gatts_if, base + i);
+        if (attr == NULL) {
+            status = ESP_GATT_NO_RESOURCES;
+            break;
+        }
+
+        if (attr_is_service(attr)) {
+            service_handle = base + i;
+        }
+        attr->service_handle = service_handle;
+
+        bt.attrs[base + i] = attr;
+        handles[i]         = base + i;
+    }
+
+    // --- All or nothing
+    if (status != ESP_GATT_OK) {
+        for (uint16_t i = 0; i < max_nb_attr && handles[i] != 0; i++) {
+            free(bt.attrs[handles[i]]->value);
+            free(bt.attrs[handles[i]]);
+            bt.attrs[handles[i]] = NULL;
+            handles[i]           = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+
+    esp_ble_gatts_cb_param_t param = {
+        .add_attr_tab = {
+            .status      = status,
+            .svc_inst_id = srvc_inst_id,
+            .num_handle  = status == ESP_GATT_OK ? max_nb_attr : 0,
+            .handles     = handles,
+        },
+    };
+
+    if (max_nb_attr > 0 && gatts_attr_db[0].att_desc.value != NULL) {
+        esp_bt_uuid_t *svc_uuid = &param.add_attr_tab.svc_uuid;
+        svc_uuid->len           = gatts_attr_db[0].att_desc.length;
+        if (svc_uuid->len == ESP_UUID_LEN_16 || svc_uuid->len == ESP_UUID_LEN_32 ||
+            svc_uuid->len == ESP_UUID_LEN_128) {
+            memcpy(&svc_uuid->uuid, gatts_attr_db[0].att_desc.value, svc_uuid->len);
+        }
+    }
+
+    return gatts_post(ESP_GATTS_CREAT_ATTR_TAB_EVT, gatts_if, &param, handles);
+}
+
+static esp_err_t service_set_started(uint16_t service_handle, bool started,
+                                     esp_gatts_cb_event_t event) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+
+    host_attr_t *decl = service_handle <= HANDLE_MAX ? bt.attrs[service_handle] : NULL;
+
+    esp_gatt_status_t status = ESP_GATT_OK;
+    esp_gatt_if_t gatts_if   = ESP_GATT_IF_NONE;
+
+    if (decl == NULL || !attr_is_service(decl)) {
+        status = ESP_GATT_NOT_FOUND;
+    } else if (decl->started == started) {
+        status = started ? ESP_GATT_SERVICE_STARTED : ESP_GATT_WRONG_STATE;
+    } else {
+        gatts_if = decl->attr.gatts_if;
+        for (uint32_t handle = service_handle;
+             handle <= HANDLE_MAX && bt.attrs[handle] != NULL &&
+             bt.attrs[handle]->service_handle == service_handle;
+             handle++) {
+            bt.attrs[handle]->started = started;
+        }
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+
+    const esp_ble_gatts_cb_param_t param = {
+        .start = {.status = status, .service_handle = service_handle},
+    };
+
+    return gatts_post(event, gatts_if, &param, NULL);
+}
+
+esp_err_t esp_ble_gatts_start_service(uint16_t service_handle) {
+    return service_set_started(service_handle, true, ESP_GATTS_START_EVT);
+}
+
+esp_err_t esp_ble_gatts_stop_service(uint16_t service_handle) {
+    return service_set_started(service_handle, false, ESP_GATTS_STOP_EVT);
+}
+
+esp_err_t esp_ble_gatts_send_indicate(esp_gatt_if_t gatts_if, uint16_t conn_id,
+                                      uint16_t attr_handle, uint16_t value_len,
+                                      uint8_t *value, bool need_confirm) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (value_len > ESP_GATT_MAX_ATTR_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+    const bool linked                    = link_find(conn_id) != NULL;
+    const neil_ble_gatts_host_tx_cb_t cb = bt.tx_cb;
+    void *const cb_arg                   = bt.tx_arg;
+    const bool auto_conf                 = bt.auto_conf;
+    pthread_mutex_unlock(&bt.lock);
+
+    if (linked && cb != NULL) {
+        const neil_ble_gatts_host_tx_t tx = {
+            .kind    = NEIL_BLE_GATTS_HOST_TX_NOTIFY,
+            .conn_id = conn_id,
+            .handle  = attr_handle,
+            .status  = ESP_GATT_OK,
+            .value   = value,
+            .len     = value_len,
+        };
+        cb(&tx, cb_arg);
+    }
+
+    // --- A missing link completes at once, as the GATT layer rejects it
+    if (!linked || auto_conf) {
+        const esp_ble_gatts_cb_param_t param = {
+            .conf = {
+                .status  = linked ? ESP_GATT_OK : ESP_GATT_ILLEGAL_PARAMETER,
+                .conn_id = conn_id,
+                .handle  = attr_handle,
+                .len     = value_len,
+            },
+        };
+        return gatts_post(ESP_GATTS_CONF_EVT, gatts_if, &param, NULL);
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_send_response(esp_gatt_if_t gatts_if, uint16_t conn_id,
+                                      uint32_t trans_id, esp_gatt_status_t status,
+                                      esp_gatt_rsp_t *rsp) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+
+    host_link_t *link = link_find(conn_id);
+    const bool known  = link != NULL && link->pending && link->trans_id == trans_id;
+    if (known) {
+        link->pending = false;
+    }
+
+    const neil_ble_gatts_host_tx_cb_t cb = bt.tx_cb;
+    void *const cb_arg                   = bt.tx_arg;
+
+    pthread_mutex_unlock(&bt.lock);
+
+    // NOTE: Bluedroid drops responses to unknown requests, so does this.
+    if (!known) {
+        ESP_LOGE(GATT_TAG, "Response to unknown request %" PRIu32 " on connection %u",
+                 trans_id, conn_id);
+    } else if (cb != NULL) {
+        const neil_ble_gatts_host_tx_t tx = {
+            .kind     = NEIL_BLE_GATTS_HOST_TX_RESPONSE,
+            .conn_id  = conn_id,
+            .trans_id = trans_id,
+            .handle   = rsp != NULL ? rsp->attr_value.handle : 0,
+            .status   = status,
+            .value    = rsp != NULL ? rsp->attr_value.value : NULL,
+            .len      = rsp != NULL ? rsp->attr_value.len : 0,
+        };
+        cb(&tx, cb_arg);
+    }
+
+    const esp_ble_gatts_cb_param_t param = {
+        .rsp = {
+            .status = known ? ESP_GATT_OK : ESP_GATT_ERROR,
+            .handle = rsp != NULL ? rsp->attr_value.handle : 0,
+        },
+    };
+
+    return gatts_post(ESP_GATTS_RESPONSE_EVT, gatts_if, &param, NULL);
+}
+
+// -------------------------------------------------------------
+// GAP - Advertising
+// -------------------------------------------------------------
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback) {
+    if (esp_bluedroid_get_status() == ESP_BLUEDROID_STATUS_UNINITIALIZED) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+    bt.gap_cb = callback;
+    pthread_mutex_unlock(&bt.lock);
+    return ESP_OK;
+}
+
+/// AD types (Core Specification Supplement, Part A).
+#define AD_FLAGS         0x01
+#define AD_UUID16_ALL    0x03
+#define AD_UUID128_ALL   0x07
+#define AD_NAME_SHORT    0x08
+#define AD_NAME_COMPLETE 0x09
+#define AD_TX_POWER      0x0A
+#define AD_CONN_INTERVAL 0x12
+#define AD_SERVICE_DATA  0x16
+#define AD_APPEARANCE    0x19
+#define AD_MANUFACTURER  0xFF
+
+/**
+ * @brief       Append one AD structure, if it fits.
+ */
+static bool ad_put(uint8_t *out, uint8_t *len, uint8_t max, uint8_t type,
+                   const void *data, uint8_t data_len) {
+    if (*len + 2 + data_len > max) {
+        return false;
+    }
+
+    out[(*len)++] = data_len + 1;
+    out[(*len)++] = type;
+    memcpy(out + *len, data, data_len);
+    *len += data_len;
+
+    return true;
+}
+
+/**
+ * @brief       Encode advertising data, as `BTM_BleWriteAdvData` lays it out.
+ *
+ * @return      false if some of it did not fit.
+ */
+static bool ad_encode(const esp_ble_adv_data_t *data, const char *name, uint8_t *out,
+                      uint8_t *len) {
+    const uint8_t max = ESP_BLE_ADV_DATA_LEN_MAX;
+    bool fits         = true;
+
+    *len = 0;
+
+    if (data->flag != 0) {
+        fits &= ad_put(out, len, max, AD_FLAGS, &data->flag, 1);
+    }
+
+    // --- 128-bit UUIDs on the Bluetooth base are sent as 16-bit ones
+    static const uint8_t base_uuid[ESP_UUID_LEN_128] = {
+        0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
+        0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    };
+
+    uint8_t uuid16[ESP_BLE_ADV_DATA_LEN_MAX];
+    size_t uuid16_len = 0;
+    uint8_t uuid128[ESP_BLE_ADV_DATA_LEN_MAX];
+    size_t uuid128_len = 0;
+
+    for (uint16_t at = 0; data->p_service_uuid != NULL &&
+                          at + ESP_UUID_LEN_128 <= data->service_uuid_len;
+         at += ESP_UUID_LEN_128) {
+        const uint8_t *uuid = data->p_service_uuid + at;
+
+        if (memcmp(uuid, base_uuid, 12) == 0 && uuid[14] == 0 && uuid[15] == 0 &&
+            uuid16_len + 2 <= sizeof(uuid16)) {
+            uuid16[uuid16_len++] = uuid[12];
+            uuid16[uuid16_len++] = uuid[13];
+        } else if (uuid128_len + ESP_UUID_LEN_128 <= sizeof(uuid128)) {
+            memcpy(uuid128 + uuid128_len, uuid, ESP_UUID_LEN_128);
+            uuid128_len += ESP_UUID_LEN_128;
+        } else {
+            fits = false;
+        }
+    }
+
+    if (uuid16_len > 0) {
+        fits &= ad_put(out, len, max, AD_UUID16_ALL, uuid16, uuid16_len);
+    }
+    if (uuid128_len > 0) {
+        fits &= ad_put(out, len, max, AD_UUID128_ALL, uuid128, uuid128_len);
+    }
+
+    if (data->include_txpower) {
+        const int8_t tx_power = 3;
+        fits &= ad_put(out, len, max, AD_TX_POWER, &tx_power, 1);
+    }
+
+    if (data->min_interval > 0 && data->max_interval > 0) {
+        const uint8_t interval[4] = {
+            data->min_interval & 0xFF,
+            data->min_interval >> 8,
+            data->max_interval & 0xFF,
+            data->max_interval >> 8,
+        };
+        fits &= ad_put(out, len, max, AD_CONN_INTERVAL, interval, sizeof(interval));
+    }
+
+    if (data->appearance != 0) {
+        const uint8_t appearance[2] = {data->appearance & 0xFF, data->appearance >> 8};
+        fits &= ad_put(out, len, max, AD_APPEARANCE, appearance, sizeof(appearance));
+    }
+
+    if (data->manufacturer_len > 0 && data->p_manufacturer_data != NULL) {
+        fits &= data->manufacturer_len <= max &&
+                ad_put(out, len, max, AD_MANUFACTURER, data->p_manufacturer_data,
+                       data->manufacturer_len);
+    }
+
+    if (data->service_data_len > 0 && data->p_service_data != NULL) {
+        fits &= data->service_data_len <= max &&
+                ad_put(out, len, max, AD_SERVICE_DATA, data->p_service_data,
+                       data->service_data_len);
+    }
+
+    // --- The name takes what is left, shortened if need be
+    if (data->include_name && name[0] != '\0') {
+        const size_t name_len = strlen(name);
+        const int room        = max - *len - 2;
+
+        if (room >= (int)name_len) {
+            ad_put(out, len, max, AD_NAME_COMPLETE, name, name_len);
+        } else if (room > 0) {
+            ad_put(out, len, max, AD_NAME_SHORT, name, room);
+        }
+    }
+
+    return fits;
+}
+
+esp_err_t esp_ble_gap_config_adv_data(esp_ble_adv_data_t *adv_data) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (adv_data == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+
+    uint8_t *out = adv_data->set_scan_rsp ? bt.scan_rsp_data : bt.adv_data;
+    uint8_t *len = adv_data->set_scan_rsp ? &bt.scan_rsp_data_len : &bt.adv_data_len;
+
+    const bool fits = ad_encode(adv_data, bt.device_name, out, len);
+
+    pthread_mutex_unlock(&bt.lock);
+
+    if (!fits) {
+        ESP_LOGW(TAG, "%s data exceeds %d bytes, truncated",
+                 adv_data->set_scan_rsp ? "Scan response" : "Advertising",
+                 ESP_BLE_ADV_DATA_LEN_MAX);
+    }
+
+    const esp_ble_gap_cb_param_t param = {
+        .adv_data_cmpl = {.status = ESP_BT_STATUS_SUCCESS},
+    };
+
+    return gap_post(adv_data->set_scan_rsp ? ESP_GAP_BLE_SCAN_RSP_DATA_SET_COMPLETE_EVT
+                                           : ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT,
+                    &param);
+}
+
+esp_err_t esp_ble_gap_start_advertising(esp_ble_adv_params_t *adv_params) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (adv_params == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+    bt.advertising = true;
+    bt.adv_params  = *adv_params;
+    pthread_mutex_unlock(&bt.lock);
+
+    tx_report_gap(NEIL_BLE_GATTS_HOST_TX_ADV_START, 0);
+
+    const esp_ble_gap_cb_param_t param = {
+        .adv_start_cmpl = {.status = ESP_BT_STATUS_SUCCESS},
+    };
+
+    return gap_post(ESP_GAP_BLE_ADV_START_COMPLETE_EVT, &param);
+}
+
+esp_err_t esp_ble_gap_stop_advertising(void) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+    bt.advertising = false;
+    pthread_mutex_unlock(&bt.lock);
+
+    tx_report_gap(NEIL_BLE_GATTS_HOST_TX_ADV_STOP, 0);
+
+    const esp_ble_gap_cb_param_t param = {
+        .adv_stop_cmpl = {.status = ESP_BT_STATUS_SUCCESS},
+    };
+
+    return gap_post(ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT, &param);
+}
+
+esp_err_t esp_ble_gap_set_device_name(const char *name) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (name == NULL || strlen(name) > NEIL_BLE_GATTS_HOST_DEVICE_NAME_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+    strcpy(bt.device_name, name);
+    pthread_mutex_unlock(&bt.lock);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_config_local_privacy(bool privacy_enable) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    const esp_ble_gap_cb_param_t param = {
+        .local_privacy_cmpl = {.status = ESP_BT_STATUS_SUCCESS},
+    };
+
+    return gap_post(ESP_GAP_BLE_SET_LOCAL_PRIVACY_COMPLETE_EVT, &param);
+}
+
+// -------------------------------------------------------------
+// GAP - Links
+// -------------------------------------------------------------
+
+esp_err_t esp_ble_gap_update_conn_params(esp_ble_conn_update_params_t *params) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+    const bool linked = link_find_bda(params->bda) != NULL;
+    pthread_mutex_unlock(&bt.lock);
+
+    esp_ble_gap_cb_param_t param = {
+        .update_conn_params = {
+            .status   = linked ? ESP_BT_STATUS_SUCCESS : ESP_BT_STATUS_FAIL,
+            .min_int  = params->min_int,
+            .max_int  = params->max_int,
+            .latency  = params->latency,
+            .conn_int = params->max_int,
+            .timeout  = params->timeout,
+        },
+    };
+    memcpy(param.update_conn_params.bda, params->bda, ESP_BD_ADDR_LEN);
+
+    return gap_post(ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT, &param);
+}
+
+esp_err_t esp_ble_gap_read_rssi(esp_bd_addr_t remote_addr) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+    const bool linked = link_find_bda(remote_addr) != NULL;
+    pthread_mutex_unlock(&bt.lock);
+
+    esp_ble_gap_cb_param_t param = {
+        .read_rssi_cmpl = {
+            .status = linked ? ESP_BT_STATUS_SUCCESS : ESP_BT_STATUS_FAIL,
+            .rssi   = linked ? LINK_RSSI : 0,
+        },
+    };
+    memcpy(param.read_rssi_cmpl.remote_addr, remote_addr, ESP_BD_ADDR_LEN);
+
+    return gap_post(ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT, &param);
+}
+
+esp_err_t esp_ble_gap_disconnect(esp_bd_addr_t remote_device) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+    host_link_t *link      = link_find_bda(remote_device);
+    const uint16_t conn_id = link != NULL ? link->conn_id : 0;
+    const bool auto_link   = bt.auto_link;
+    pthread_mutex_unlock(&bt.lock);
+
+    if (link == NULL) {
+        return ESP_FAIL;
+    }
+
+    // --- The controller reports the link gone (neil_ble_gatts_host_disconnect)
+    if (!auto_link) {
+        tx_report_gap(NEIL_BLE_GATTS_HOST_TX_DISCONNECT, conn_id);
+        return ESP_OK;
+    }
+
+    // --- Reported once the link is gone, as the controller completes it
+    esp_ble_gatts_cb_param_t param = {
+        .disconnect = {
+            .conn_id = conn_id,
+            .reason  = ESP_GATT_CONN_TERMINATE_LOCAL_HOST,
+        },
+    };
+    memcpy(param.disconnect.remote_bda, remote_device, ESP_BD_ADDR_LEN);
+
+    link_update(ESP_GATTS_DISCONNECT_EVT, &param);
+
+    esp_err_t ret = ESP_OK;
+    for (uint16_t app_id = 0; app_id < CONFIG_BT_GATT_MAX_SR_PROFILES; app_id++) {
+        pthread_mutex_lock(&bt.lock);
+        const bool used = bt.apps[app_id].used;
+        pthread_mutex_unlock(&bt.lock);
+
+        if (used && ret == ESP_OK) {
+            ret = gatts_post(ESP_GATTS_DISCONNECT_EVT, app_id + 1, &param, NULL);
+        }
+    }
+
+    return ret;
+}
+
+esp_err_t esp_ble_gap_set_preferred_phy(esp_bd_addr_t bd_addr,
+                                        esp_ble_gap_all_phys_t all_phys_mask,
+                                        esp_ble_gap_phy_mask_t tx_phy_mask,
+                                        esp_ble_gap_phy_mask_t rx_phy_mask,
+                                        esp_ble_gap_prefer_phy_options_t phy_options) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+    const bool linked = link_find_bda(bd_addr) != NULL;
+    pthread_mutex_unlock(&bt.lock);
+
+    // --- The peer takes the fastest PHY offered
+    esp_ble_gap_phy_t tx_phy = ESP_BLE_GAP_PHY_1M;
+    if (tx_phy_mask & ESP_BLE_GAP_PHY_2M_PREF_MASK) {
+        tx_phy = ESP_BLE_GAP_PHY_2M;
+    } else if (tx_phy_mask & ESP_BLE_GAP_PHY_CODED_PREF_MASK) {
+        tx_phy = ESP_BLE_GAP_PHY_CODED;
+    }
+
+    esp_ble_gap_cb_param_t param = {
+        .phy_update = {
+            .status = linked ? ESP_BT_STATUS_SUCCESS : ESP_BT_STATUS_FAIL,
+            .tx_phy = tx_phy,
+            .rx_phy = tx_phy,
+        },
+    };
+    memcpy(param.phy_update.bda, bd_addr, ESP_BD_ADDR_LEN);
+
+    return gap_post(ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT, &param);
+}
+
+// -------------------------------------------------------------
+// GAP - Security
+// -------------------------------------------------------------
+
+esp_err_t esp_ble_gap_set_security_param(esp_ble_sm_param_t param_type, void *value,
+                                         uint8_t len) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (value == NULL || len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+
+    switch (param_type) {
+    case ESP_BLE_SM_AUTHEN_REQ_MODE:
+        bt.auth_req = *(uint8_t *)value;
+        break;
+    case ESP_BLE_SM_IOCAP_MODE:
+        bt.iocap = *(uint8_t *)value;
+        break;
+    case ESP_BLE_SM_SET_STATIC_PASSKEY:
+        if (len == sizeof(uint32_t)) {
+            memcpy(&bt.passkey, value, sizeof(uint32_t));
+        }
+        break;
+    default:
+        break;
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_set_encryption(esp_bd_addr_t bd_addr, esp_ble_sec_act_t sec_act) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+
+    // --- No security manager runs beside a controller, pairing fails
+    const bool linked = link_find_bda(bd_addr) != NULL && bt.auto_link;
+
+    // --- Without IO there is nothing to protect against MITM (Just Works)
+    const bool display = bt.iocap == ESP_IO_CAP_OUT || bt.iocap == ESP_IO_CAP_IO ||
+                         bt.iocap == ESP_IO_CAP_KBDISP;
+    esp_ble_auth_req_t auth_mode = bt.auth_req & ~ESP_LE_AUTH_REQ_MITM;
+    if (display) {
+        auth_mode |= bt.auth_req & ESP_LE_AUTH_REQ_MITM;
+    }
+
+    const uint32_t passkey = bt.passkey;
+
+    // --- Bond, replacing an earlier one with the peer
+    if (linked && (auth_mode & ESP_LE_AUTH_BOND)) {
+        int i = 0;
+        while (i < bt.bond_num &&
+               memcmp(bt.bonds[i].bd_addr, bd_addr, ESP_BD_ADDR_LEN) != 0) {
+            i++;
+        }
+        if (i < BOND_MAX) {
+            memcpy(bt.bonds[i].bd_addr, bd_addr, ESP_BD_ADDR_LEN);
+            bt.bonds[i].bond_key.key_mask = ESP_LE_KEY_PENC | ESP_LE_KEY_PID;
+            bt.bond_num += i == bt.bond_num;
+        }
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+
+    esp_ble_gap_cb_param_t param = {0};
+
+    if (linked && display && (auth_mode & ESP_LE_AUTH_REQ_MITM)) {
+        memcpy(param.ble_security.key_notif.bd_addr, bd_addr, ESP_BD_ADDR_LEN);
+        param.ble_security.key_notif.passkey = passkey;
+
+        esp_err_t ret = gap_post(ESP_GAP_BLE_PASSKEY_NOTIF_EVT, &param);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+
+    param = (esp_ble_gap_cb_param_t){
+        .ble_security.auth_cmpl = {
+            .key_present = linked,
+            .success     = linked,
+            .fail_reason = linked ? 0 : ESP_BT_STATUS_RMT_DEV_DOWN,
+            .addr_type   = BLE_ADDR_TYPE_PUBLIC,
+            .auth_mode   = linked ? auth_mode : 0,
+        },
+    };
+    memcpy(param.ble_security.auth_cmpl.bd_addr, bd_addr, ESP_BD_ADDR_LEN);
+
+    return gap_post(ESP_GAP_BLE_AUTH_CMPL_EVT, &param);
+}
+
+esp_err_t esp_ble_gap_security_rsp(esp_bd_addr_t bd_addr, bool accept) {
+    return bluedroid_enabled() ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_ble_passkey_reply(esp_bd_addr_t bd_addr, bool accept, uint32_t passkey) {
+    return bluedroid_enabled() ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_ble_confirm_reply(esp_bd_addr_t bd_addr, bool accept) {
+    return bluedroid_enabled() ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_ble_oob_req_reply(esp_bd_addr_t bd_addr, uint8_t *TK, uint8_t len) {
+    return bluedroid_enabled() ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+int esp_ble_get_bond_device_num(void) {
+    pthread_mutex_lock(&bt.lock);
+    const int num = bt.bond_num;
+    pthread_mutex_unlock(&bt.lock);
+    return num;
+}
+
+esp_err_t esp_ble_get_bond_device_list(int *dev_num, esp_ble_bond_dev_t *dev_list) {
+    if (dev_num == NULL || dev_list == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+    *dev_num = *dev_num < bt.bond_num ? *dev_num : bt.bond_num;
+    memcpy(dev_list, bt.bonds, *dev_num * sizeof(esp_ble_bond_dev_t));
+    pthread_mutex_unlock(&bt.lock);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_remove_bond_device(esp_bd_addr_t bd_addr) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&bt.lock);
+
+    int i = 0;
+    while (i < bt.bond_num &&
+           memcmp(bt.bonds[i].bd_addr, bd_addr, ESP_BD_ADDR_LEN) != 0) {
+        i++;
+    }
+
+    const bool found = i < bt.bond_num;
+    if (found) {
+        memmove(bt.bonds + i, bt.bonds + i + 1,
+                (bt.bond_num - i - 1) * sizeof(esp_ble_bond_dev_t));
+        bt.bond_num--;
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+
+    esp_ble_gap_cb_param_t param = {
+        .remove_bond_dev_cmpl = {
+            .status = found ? ESP_BT_STATUS_SUCCESS : ESP_BT_STATUS_FAIL,
+        },
+    };
+    memcpy(param.remove_bond_dev_cmpl.bd_addr, bd_addr, ESP_BD_ADDR_LEN);
+
+    return gap_post(ESP_GAP_BLE_REMOVE_BOND_DEV_COMPLETE_EVT, &param);
+}
+
+// -------------------------------------------------------------
+// Host Interface
+// -------------------------------------------------------------
+
+void neil_ble_gatts_host_set_tx_cb(neil_ble_gatts_host_tx_cb_t cb, void *arg) {
+    pthread_mutex_lock(&bt.lock);
+    bt.tx_cb  = cb;
+    bt.tx_arg = arg;
+    pthread_mutex_unlock(&bt.lock);
+}
+
+void neil_ble_gatts_host_set_auto_conf(bool enabled) {
+    pthread_mutex_lock(&bt.lock);
+    bt.auto_conf = enabled;
+    pthread_mutex_unlock(&bt.lock);
+}
+
+void neil_ble_gatts_host_set_auto_link(bool enabled) {
+    pthread_mutex_lock(&bt.lock);
+    bt.auto_link = enabled;
+    pthread_mutex_unlock(&bt.lock);
+}
+
+esp_gatt_if_t neil_ble_gatts_host_gatts_if(uint16_t app_id) {
+    pthread_mutex_lock(&bt.lock);
+
+    esp_gatt_if_t gatts_if = ESP_GATT_IF_NONE;
+    for (size_t i = 0; i < CONFIG_BT_GATT_MAX_SR_PROFILES; i++) {
+        if (bt.apps[i].used && bt.apps[i].app_id == app_id) {
+            gatts_if = i + 1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+
+    return gatts_if;
+}
+
+bool neil_ble_gatts_host_advertising(void) {
+    pthread_mutex_lock(&bt.lock);
+    const bool advertising = bt.advertising;
+    pthread_mutex_unlock(&bt.lock);
+    return advertising;
+}
+
+bool neil_ble_gatts_host_attr_get(uint16_t handle, neil_ble_gatts_host_attr_t *out) {
+    pthread_mutex_lock(&bt.lock);
+
+    const host_attr_t *attr = handle <= HANDLE_MAX ? bt.attrs[handle] : NULL;
+    const bool found        = attr != NULL && attr->started;
+    if (found) {
+        *out = attr->attr;
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+
+    return found;
+}
+
+bool neil_ble_gatts_host_attr_next(uint16_t handle, neil_ble_gatts_host_attr_t *out) {
+    pthread_mutex_lock(&bt.lock);
+
+    const host_attr_t *attr = NULL;
+    for (uint32_t h = handle; attr == NULL && h <= HANDLE_MAX; h++) {
+        if (bt.attrs[h] != NULL && bt.attrs[h]->started) {
+            attr = bt.attrs[h];
+        }
+    }
+
+    if (attr != NULL) {
+        *out = attr->attr;
+    }
+
+    pthread_mutex_unlock(&bt.lock);
+
+    return attr != NULL;
+}
+
+void neil_ble_gatts_host_gap_get(neil_ble_gatts_host_gap_t *out) {
+    pthread_mutex_lock(&bt.lock);
+
+    *out = (neil_ble_gatts_host_gap_t){
+        .advertising       = bt.advertising,
+        .adv_params        = bt.adv_params,
+        .adv_data_len      = bt.adv_data_len,
+        .scan_rsp_data_len = bt.scan_rsp_data_len,
+    };
+    memcpy(out->adv_data, bt.adv_data, sizeof(out->adv_data));
+    memcpy(out->scan_rsp_data, bt.scan_rsp_data, sizeof(out->scan_rsp_data));
+    strcpy(out->device_name, bt.device_name);
+
+    pthread_mutex_unlock(&bt.lock);
+}
+
+esp_err_t neil_ble_gatts_host_settle(TickType_t timeout) {
+    // --- The BTC task would wait on itself
+    if (!bluedroid_enabled() || btc_on_task()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    const TickType_t start = xTaskGetTickCount();
+
+    // --- Each pass waits out what was queued, until nothing was
+    for (;;) {
+        btc_msg_t msg = {.kind = BTC_MSG_SYNC};
+        btc_post_wait(&msg);
+
+        if (uxQueueMessagesWaiting(btc_queue) == 0) {
+            return ESP_OK;
+        }
+
+        if (timeout != portMAX_DELAY && xTaskGetTickCount() - start >= timeout) {
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+}
+
+int64_t neil_ble_gatts_host_gatts_event(esp_gatts_cb_event_t event,
+                                        esp_gatt_if_t gatts_if,
+                                        esp_ble_gatts_cb_param_t *param) {
+    if (!bluedroid_enabled()) {
+        return -1;
+    }
+
+    link_update(event, param);
+
+    int64_t ns    = 0;
+    btc_msg_t msg = {
+        .kind        = BTC_MSG_GATTS,
+        .event       = event,
+        .gatts_if    = gatts_if,
+        .param.gatts = *param,
+        .ns          = &ns,
+    };
+
+    return btc_post_wait(&msg) == ESP_OK ? ns : -1;
+}
+
+int64_t neil_ble_gatts_host_gap_event(esp_gap_ble_cb_event_t event,
+                                      esp_ble_gap_cb_param_t *param) {
+    if (!bluedroid_enabled()) {
+        return -1;
+    }
+
+    int64_t ns    = 0;
+    btc_msg_t msg = {
+        .kind      = BTC_MSG_GAP,
+        .event     = event,
+        .param.gap = *param,
+        .ns        = &ns,
+    };
+
+    return btc_post_wait(&msg) == ESP_OK ? ns : -1;
+}
+
+/**
+ * @brief       Deliver a link event to every registered profile.
+ */
+static esp_err_t link_event(esp_gatts_cb_event_t event,
+                            esp_ble_gatts_cb_param_t *param) {
+    if (!bluedroid_enabled()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    bool delivered = false;
+
+    for (uint16_t app_id = 0; app_id < CONFIG_BT_GATT_MAX_SR_PROFILES; app_id++) {
+        pthread_mutex_lock(&bt.lock);
+        const bool used = bt.apps[app_id].used;
+        pthread_mutex_unlock(&bt.lock);
+
+        if (!used) {
+            continue;
+        }
+
+        // --- Links follow the first delivery only
+        if (!delivered) {
+            link_update(event, param);
+            delivered = true;
+        }
+
+        int64_t ns    = 0;
+        btc_msg_t msg = {
+            .kind        = BTC_MSG_GATTS,
+            .event       = event,
+            .gatts_if    = app_id + 1,
+            .param.gatts = *param,
+            .ns          = &ns,
+        };
+        esp_err_t ret = btc_post_wait(&msg);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+
+    return delivered ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t neil_ble_gatts_host_connect(uint16_t conn_id, const esp_bd_addr_t bda) {
+    esp_ble_gatts_cb_param_t param = {
+        .connect = {
+            .conn_id     = conn_id,
+            .link_role   = 1, // Peripheral
+            .conn_params = {.interval = 24, .latency = 0, .timeout = 400},
+        },
+    };
+    memcpy(param.connect.remote_bda, bda, ESP_BD_ADDR_LEN);
+
+    return link_event(ESP_GATTS_CONNECT_EVT, &param);
+}
+
+esp_err_t neil_ble_gatts_host_disconnect(uint16_t conn_id,
+                                         esp_gatt_conn_reason_t reason) {
+    pthread_mutex_lock(&bt.lock);
+    host_link_t *link = link_find(conn_id);
+    esp_bd_addr_t bda = {0};
+    if (link != NULL) {
+        memcpy(bda, link->bda, ESP_BD_ADDR_LEN);
+    }
+    pthread_mutex_unlock(&bt.lock);
+
+    if (link == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_ble_gatts_cb_param_t param = {
+        .disconnect = {.conn_id = conn_id, .reason = reason},
+    };
+    memcpy(param.disconnect.remote_bda, bda, ESP_BD_ADDR_LEN);
+
+    return link_event(ESP_GATTS_DISCONNECT_EVT, &param);
+}
+
+esp_err_t neil_ble_gatts_host_set_mtu(uint16_t conn_id, uint16_t mtu) {
+    esp_ble_gatts_cb_param_t param = {
+        .mtu = {.conn_id = conn_id, .mtu = mtu},
+    };
+
+    return link_event(ESP_GATTS_MTU_EVT, &param);
+}
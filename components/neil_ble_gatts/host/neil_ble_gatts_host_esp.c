@@ -0,0 +1,848 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_host_esp.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      ESP-IDF services on POSIX: logging, error names, esp_timer,
+///             capability and multi heaps, NVS (in memory) and esp_random.
+
+#define _GNU_SOURCE
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "multi_heap.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#include "neil_ble_gatts_host.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Tags given a level of their own.
+#define LOG_TAGS_MAX 16
+
+/// Blobs held across every namespace.
+#define NVS_ENTRIES_MAX 64
+
+/// Namespaces opened.
+#define NVS_NAMESPACES_MAX 8
+
+/// Stack of the esp_timer task (as CONFIG_ESP_TIMER_TASK_STACK_SIZE).
+#define TIMER_TASK_STACK 3584
+
+// -------------------------------------------------------------
+// Error Codes
+// -------------------------------------------------------------
+
+#define ERR_NAME(code) {code, #code}
+
+static const struct {
+    esp_err_t code;
+    const char *name;
+} err_names[] = {
+    ERR_NAME(ESP_OK),
+    ERR_NAME(ESP_FAIL),
+    ERR_NAME(ESP_ERR_NO_MEM),
+    ERR_NAME(ESP_ERR_INVALID_ARG),
+    ERR_NAME(ESP_ERR_INVALID_STATE),
+    ERR_NAME(ESP_ERR_INVALID_SIZE),
+    ERR_NAME(ESP_ERR_NOT_FOUND),
+    ERR_NAME(ESP_ERR_NOT_SUPPORTED),
+    ERR_NAME(ESP_ERR_TIMEOUT),
+    ERR_NAME(ESP_ERR_INVALID_RESPONSE),
+    ERR_NAME(ESP_ERR_INVALID_CRC),
+    ERR_NAME(ESP_ERR_INVALID_VERSION),
+    ERR_NAME(ESP_ERR_INVALID_MAC),
+    ERR_NAME(ESP_ERR_NOT_FINISHED),
+    ERR_NAME(ESP_ERR_NVS_NOT_INITIALIZED),
+    ERR_NAME(ESP_ERR_NVS_NOT_FOUND),
+    ERR_NAME(ESP_ERR_NVS_INVALID_HANDLE),
+    ERR_NAME(ESP_ERR_NVS_INVALID_NAME),
+    ERR_NAME(ESP_ERR_NVS_INVALID_LENGTH),
+    ERR_NAME(ESP_ERR_NVS_NO_FREE_PAGES),
+    ERR_NAME(ESP_ERR_NVS_NEW_VERSION_FOUND),
+};
+
+const char *esp_err_to_name(esp_err_t code) {
+    for (size_t i = 0; i < sizeof(err_names) / sizeof(err_names[0]); i++) {
+        if (err_names[i].code == code) {
+            return err_names[i].name;
+        }
+    }
+    return "UNKNOWN ERROR";
+}
+
+void _esp_error_check_failed(esp_err_t rc, const char *file, int line,
+                             const char *function, const char *expression) {
+    fprintf(stderr, "ESP_ERROR_CHECK failed: esp_err_t 0x%x (%s) at %s:%d\n", rc,
+            esp_err_to_name(rc), file, line);
+    fprintf(stderr, "file: \"%s\" line %d\nfunc: %s\nexpression: %s\n", file, line,
+            function, expression);
+    abort();
+}
+
+// -------------------------------------------------------------
+// Logging
+// -------------------------------------------------------------
+
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+    const char *tag;
+    esp_log_level_t level;
+} log_tags[LOG_TAGS_MAX];
+
+static size_t log_tag_count = 0;
+
+static esp_log_level_t log_default_level = CONFIG_LOG_DEFAULT_LEVEL;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    pthread_mutex_lock(&log_lock);
+
+    if (strcmp(tag, "*") == 0) {
+        log_default_level = level;
+        log_tag_count     = 0;
+        pthread_mutex_unlock(&log_lock);
+        return;
+    }
+
+    size_t i = 0;
+    while (i < log_tag_count && strcmp(log_tags[i].tag, tag) != 0) {
+        i++;
+    }
+
+    if (i < LOG_TAGS_MAX) {
+        // NOTE: As ESP-IDF, the tag is kept by reference.
+        log_tags[i].tag   = tag;
+        log_tags[i].level = level;
+        log_tag_count += i == log_tag_count;
+    }
+
+    pthread_mutex_unlock(&log_lock);
+}
+
+esp_log_level_t esp_log_level_get(const char *tag) {
+    pthread_mutex_lock(&log_lock);
+
+    esp_log_level_t level = log_default_level;
+    for (size_t i = 0; i < log_tag_count; i++) {
+        if (strcmp(log_tags[i].tag, tag) == 0) {
+            level = log_tags[i].level;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&log_lock);
+
+    return level;
+}
+
+uint32_t esp_log_timestamp(void) { return (uint32_t)(esp_timer_get_time() / 1000); }
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+    if (level > esp_log_level_get(tag)) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+
+    // --- One record at a time, as the UART lock of the target
+    flockfile(stdout);
+    vprintf(format, args);
+    fflush(stdout);
+    funlockfile(stdout);
+
+    va_end(args);
+}
+
+void esp_log_buffer_hex_internal(const char *tag, const void *buffer, uint16_t buff_len,
+                                 esp_log_level_t level) {
+    const uint8_t *bytes = buffer;
+
+    for (uint16_t at = 0; at < buff_len; at += 16) {
+        char line[16 * 3 + 1] = {0};
+        const uint16_t n      = buff_len - at < 16 ? buff_len - at : 16;
+
+        for (uint16_t i = 0; i < n; i++) {
+            snprintf(line + i * 3, 4, "%02x ", bytes[at + i]);
+        }
+        line[n * 3 - 1] = '\0';
+
+        ESP_LOG_LEVEL(level, tag, "%s", line);
+    }
+}
+
+// -------------------------------------------------------------
+// esp_timer
+// -------------------------------------------------------------
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    int64_t alarm_us;   ///< Next expiry, 0 while stopped.
+    uint64_t period_us; ///< 0 for one-shot timers.
+    struct esp_timer *next;
+};
+
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_changed;
+static struct esp_timer *timer_list    = NULL;
+static TaskHandle_t timer_task_handle  = NULL;
+static pthread_once_t timer_start_once = PTHREAD_ONCE_INIT;
+
+static struct timespec timer_epoch;
+static pthread_once_t timer_epoch_once = PTHREAD_ONCE_INIT;
+
+static void timer_epoch_init(void) { clock_gettime(CLOCK_MONOTONIC, &timer_epoch); }
+
+int64_t esp_timer_get_time(void) {
+    pthread_once(&timer_epoch_once, timer_epoch_init);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - timer_epoch.tv_sec) * 1000000LL +
+           (now.tv_nsec - timer_epoch.tv_nsec) / 1000;
+}
+
+/**
+ * @brief       Run expired timers (unlocked while calling back), then wait for
+ *              the next to expire or the list to change.
+ */
+static void timer_task(void *arg) {
+    pthread_mutex_lock(&timer_lock);
+
+    for (;;) {
+        const int64_t now_us  = esp_timer_get_time();
+        int64_t next_us       = INT64_MAX;
+        struct esp_timer *due = NULL;
+
+        for (struct esp_timer *t = timer_list; t != NULL; t = t->next) {
+            if (t->alarm_us != 0 && t->alarm_us <= now_us) {
+                due = t;
+                break;
+            }
+            if (t->alarm_us != 0 && t->alarm_us < next_us) {
+                next_us = t->alarm_us;
+            }
+        }
+
+        if (due != NULL) {
+            due->alarm_us = due->period_us != 0 ? due->alarm_us + due->period_us : 0;
+
+            const esp_timer_cb_t callback = due->callback;
+            void *const cb_arg            = due->arg;
+
+            pthread_mutex_unlock(&timer_lock);
+            callback(cb_arg);
+            pthread_mutex_lock(&timer_lock);
+            continue;
+        }
+
+        if (next_us == INT64_MAX) {
+            pthread_cond_wait(&timer_changed, &timer_lock);
+            continue;
+        }
+
+        // --- esp_timer_get_time counts from the first call on CLOCK_MONOTONIC
+        struct timespec at;
+        clock_gettime(CLOCK_MONOTONIC, &at);
+        const int64_t wait_us = next_us - now_us;
+        at.tv_sec += wait_us / 1000000;
+        at.tv_nsec += (wait_us % 1000000) * 1000;
+        if (at.tv_nsec >= 1000000000L) {
+            at.tv_sec++;
+            at.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&timer_changed, &timer_lock, &at);
+    }
+}
+
+static void timer_start(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timer_changed, &attr);
+    pthread_condattr_destroy(&attr);
+
+    xTaskCreate(timer_task, "esp_timer", TIMER_TASK_STACK, NULL, 22,
+                &timer_task_handle);
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args,
+                           esp_timer_handle_t *out_handle) {
+    if (create_args == NULL || create_args->callback == NULL || out_handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_once(&timer_start_once, timer_start);
+
+    struct esp_timer *timer = calloc(1, sizeof(*timer));
+    if (timer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->callback = create_args->callback;
+    timer->arg      = create_args->arg;
+
+    pthread_mutex_lock(&timer_lock);
+    timer->next = timer_list;
+    timer_list  = timer;
+    pthread_mutex_unlock(&timer_lock);
+
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t timer_arm(esp_timer_handle_t timer, uint64_t timeout_us,
+                           uint64_t period_us) {
+    if (timer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&timer_lock);
+
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+    if (timer->alarm_us == 0) {
+        timer->alarm_us  = esp_timer_get_time() + (int64_t)timeout_us;
+        timer->alarm_us += timer->alarm_us == 0; // 0 means stopped
+        timer->period_us = period_us;
+        pthread_cond_signal(&timer_changed);
+        ret = ESP_OK;
+    }
+
+    pthread_mutex_unlock(&timer_lock);
+
+    return ret;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return timer_arm(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+    return timer_arm(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if (timer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&timer_lock);
+    const esp_err_t ret = timer->alarm_us != 0 ? ESP_OK : ESP_ERR_INVALID_STATE;
+    timer->alarm_us     = 0;
+    pthread_mutex_unlock(&timer_lock);
+
+    return ret;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    if (timer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&timer_lock);
+
+    if (timer->alarm_us != 0) {
+        pthread_mutex_unlock(&timer_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    for (struct esp_timer **link = &timer_list; *link != NULL; link = &(*link)->next) {
+        if (*link == timer) {
+            *link = timer->next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&timer_lock);
+
+    free(timer);
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) {
+    pthread_mutex_lock(&timer_lock);
+    const bool active = timer != NULL && timer->alarm_us != 0;
+    pthread_mutex_unlock(&timer_lock);
+    return active;
+}
+
+// -------------------------------------------------------------
+// Capability Heap
+// -------------------------------------------------------------
+//
+// Blocks come from the C library; sizes are tracked to report what a heap of
+// NEIL_BLE_GATTS_HOST_HEAP_SIZE would have left.
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t heap_used          = 0;
+static size_t heap_used_max      = 0;
+
+static void heap_account(void *block, bool taken) {
+    if (block == NULL) {
+        return;
+    }
+
+    const size_t len = malloc_usable_size(block);
+
+    pthread_mutex_lock(&heap_lock);
+    heap_used = taken ? heap_used + len : heap_used - len;
+    if (heap_used > heap_used_max) {
+        heap_used_max = heap_used;
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps) {
+    void *block = malloc(size);
+    heap_account(block, true);
+    return block;
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+    void *block = calloc(n, size);
+    heap_account(block, true);
+    return block;
+}
+
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps) {
+    const size_t len = ptr != NULL ? malloc_usable_size(ptr) : 0;
+
+    void *block = realloc(ptr, size);
+    if (block == NULL && size > 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&heap_lock);
+    heap_used -= len;
+    pthread_mutex_unlock(&heap_lock);
+    heap_account(block, true);
+
+    return block;
+}
+
+void heap_caps_free(void *ptr) {
+    heap_account(ptr, false);
+    free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+    pthread_mutex_lock(&heap_lock);
+    const size_t used = heap_used;
+    pthread_mutex_unlock(&heap_lock);
+
+    return used < NEIL_BLE_GATTS_HOST_HEAP_SIZE ? NEIL_BLE_GATTS_HOST_HEAP_SIZE - used
+                                                : 0;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+    pthread_mutex_lock(&heap_lock);
+    const size_t used = heap_used_max;
+    pthread_mutex_unlock(&heap_lock);
+
+    return used < NEIL_BLE_GATTS_HOST_HEAP_SIZE ? NEIL_BLE_GATTS_HOST_HEAP_SIZE - used
+                                                : 0;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    return heap_caps_get_free_size(caps);
+}
+
+// -------------------------------------------------------------
+// Allocation Counting
+// -------------------------------------------------------------
+//
+// The library is linked with `--wrap` for the allocators (CMakeLists.txt), so
+// every allocation of the application, the component and this port is
+// counted, but not those of the C library itself.
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static atomic_uint alloc_count = 0;
+
+void *__wrap_malloc(size_t size) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    return __real_realloc(ptr, size);
+}
+
+uint32_t neil_ble_gatts_host_alloc_count(void) {
+    return atomic_load_explicit(&alloc_count, memory_order_relaxed);
+}
+
+// -------------------------------------------------------------
+// Multi Heap
+// -------------------------------------------------------------
+//
+// First fit over a caller's buffer, blocks split on allocation and merged with
+// their free neighbours on release, as the TLSF heap reports it.
+
+typedef struct heap_block {
+    size_t len; ///< Including this header.
+    bool used;
+} heap_block_t;
+
+#define HEAP_ALIGN       sizeof(max_align_t)
+#define HEAP_HEADER_SIZE ((sizeof(heap_block_t) + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1))
+
+struct multi_heap_info {
+    uint8_t *start;
+    size_t len;
+    size_t free;
+    size_t free_min;
+    portMUX_TYPE *lock;
+};
+
+static heap_block_t *heap_next(multi_heap_handle_t heap, heap_block_t *block) {
+    uint8_t *next = (uint8_t *)block + block->len;
+    return next < heap->start + heap->len ? (heap_block_t *)next : NULL;
+}
+
+multi_heap_handle_t multi_heap_register(void *start, size_t size) {
+    // --- Align the start, the heap header lives at the front of the buffer
+    uint8_t *at =
+        (uint8_t *)(((uintptr_t)start + HEAP_ALIGN - 1) & ~(uintptr_t)(HEAP_ALIGN - 1));
+    const size_t lost = at - (uint8_t *)start;
+    const size_t head = (sizeof(struct multi_heap_info) + HEAP_ALIGN - 1) &
+                        ~(HEAP_ALIGN - 1);
+
+    if (size < lost + head + 2 * HEAP_HEADER_SIZE) {
+        return NULL;
+    }
+
+    multi_heap_handle_t heap = (multi_heap_handle_t)at;
+    heap->start              = at + head;
+    heap->len                = (size - lost - head) & ~(HEAP_ALIGN - 1);
+    heap->free               = heap->len - HEAP_HEADER_SIZE;
+    heap->free_min           = heap->free;
+    heap->lock               = NULL;
+
+    heap_block_t *first = (heap_block_t *)heap->start;
+    first->len          = heap->len;
+    first->used         = false;
+
+    return heap;
+}
+
+void multi_heap_set_lock(multi_heap_handle_t heap, void *lock) { heap->lock = lock; }
+
+static void heap_lock_take(multi_heap_handle_t heap) {
+    if (heap->lock != NULL) {
+        portENTER_CRITICAL(heap->lock);
+    }
+}
+
+static void heap_lock_give(multi_heap_handle_t heap) {
+    if (heap->lock != NULL) {
+        portEXIT_CRITICAL(heap->lock);
+    }
+}
+
+void *multi_heap_malloc(multi_heap_handle_t heap, size_t size) {
+    if (heap == NULL || size == 0) {
+        return NULL;
+    }
+
+    const size_t need =
+        HEAP_HEADER_SIZE + ((size + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1));
+    void *out = NULL;
+
+    heap_lock_take(heap);
+
+    for (heap_block_t *b = (heap_block_t *)heap->start; b != NULL;
+         b               = heap_next(heap, b)) {
+        if (b->used || b->len < need) {
+            continue;
+        }
+
+        // --- Split off the rest if it can hold a block of its own
+        if (b->len - need > HEAP_HEADER_SIZE) {
+            heap_block_t *rest = (heap_block_t *)((uint8_t *)b + need);
+            rest->len          = b->len - need;
+            rest->used         = false;
+            b->len             = need;
+            heap->free -= need;
+        } else {
+            heap->free -= b->len;
+        }
+
+        b->used = true;
+        out     = (uint8_t *)b + HEAP_HEADER_SIZE;
+
+        if (heap->free < heap->free_min) {
+            heap->free_min = heap->free;
+        }
+        break;
+    }
+
+    heap_lock_give(heap);
+
+    return out;
+}
+
+void multi_heap_free(multi_heap_handle_t heap, void *p) {
+    if (heap == NULL || p == NULL) {
+        return;
+    }
+
+    heap_lock_take(heap);
+
+    heap_block_t *block = (heap_block_t *)((uint8_t *)p - HEAP_HEADER_SIZE);
+    block->used         = false;
+    heap->free += block->len;
+
+    // --- Merge runs of free blocks (the heaps here are a few blocks long)
+    for (heap_block_t *b = (heap_block_t *)heap->start; b != NULL;
+         b               = heap_next(heap, b)) {
+        heap_block_t *next;
+        while (!b->used && (next = heap_next(heap, b)) != NULL && !next->used) {
+            b->len += next->len;
+        }
+    }
+
+    heap_lock_give(heap);
+}
+
+size_t multi_heap_free_size(multi_heap_handle_t heap) {
+    return heap != NULL ? heap->free : 0;
+}
+
+size_t multi_heap_minimum_free_size(multi_heap_handle_t heap) {
+    return heap != NULL ? heap->free_min : 0;
+}
+
+// -------------------------------------------------------------
+// NVS
+// -------------------------------------------------------------
+//
+// Blobs live for the run of the process: an empty flash on every start.
+
+static pthread_mutex_t nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char nvs_namespaces[NVS_NAMESPACES_MAX][NVS_KEY_NAME_MAX_SIZE];
+
+static struct {
+    nvs_handle_t ns; ///< Namespace index + 1, 0 for a free entry.
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    void *value;
+    size_t len;
+} nvs_entries[NVS_ENTRIES_MAX];
+
+static bool nvs_ready = false;
+
+esp_err_t nvs_flash_init(void) {
+    nvs_ready = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    pthread_mutex_lock(&nvs_lock);
+    for (size_t i = 0; i < NVS_ENTRIES_MAX; i++) {
+        free(nvs_entries[i].value);
+        nvs_entries[i].ns    = 0;
+        nvs_entries[i].value = NULL;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode,
+                   nvs_handle_t *out_handle) {
+    if (!nvs_ready) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    if (name == NULL || strlen(name) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+
+    pthread_mutex_lock(&nvs_lock);
+
+    esp_err_t ret = ESP_ERR_NVS_NOT_FOUND;
+    for (size_t i = 0; i < NVS_NAMESPACES_MAX; i++) {
+        if (strcmp(nvs_namespaces[i], name) == 0) {
+            *out_handle = i + 1;
+            ret         = ESP_OK;
+            break;
+        }
+        // --- As NVS, a namespace is created when first opened for writing
+        if (nvs_namespaces[i][0] == '\0' && open_mode == NVS_READWRITE) {
+            strcpy(nvs_namespaces[i], name);
+            *out_handle = i + 1;
+            ret         = ESP_OK;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&nvs_lock);
+
+    return ret;
+}
+
+static int nvs_find(nvs_handle_t handle, const char *key) {
+    for (int i = 0; i < NVS_ENTRIES_MAX; i++) {
+        if (nvs_entries[i].ns == handle && strcmp(nvs_entries[i].key, key) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value,
+                       size_t length) {
+    if (handle == 0 || handle > NVS_NAMESPACES_MAX) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (key == NULL || strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+
+    void *copy = malloc(length > 0 ? length : 1);
+    if (copy == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(copy, value, length);
+
+    pthread_mutex_lock(&nvs_lock);
+
+    int i = nvs_find(handle, key);
+    if (i < 0) {
+        i = nvs_find(0, "");
+    }
+
+    esp_err_t ret = ESP_ERR_NVS_NO_FREE_PAGES;
+    if (i >= 0) {
+        free(nvs_entries[i].value);
+        nvs_entries[i].ns    = handle;
+        nvs_entries[i].value = copy;
+        nvs_entries[i].len   = length;
+        strcpy(nvs_entries[i].key, key);
+        copy = NULL;
+        ret  = ESP_OK;
+    }
+
+    pthread_mutex_unlock(&nvs_lock);
+
+    free(copy);
+    return ret;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value,
+                       size_t *length) {
+    if (handle == 0 || handle > NVS_NAMESPACES_MAX) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    pthread_mutex_lock(&nvs_lock);
+
+    esp_err_t ret = ESP_ERR_NVS_NOT_FOUND;
+    const int i   = nvs_find(handle, key);
+
+    if (i >= 0 && out_value == NULL) {
+        *length = nvs_entries[i].len;
+        ret     = ESP_OK;
+    } else if (i >= 0 && *length < nvs_entries[i].len) {
+        *length = nvs_entries[i].len;
+        ret     = ESP_ERR_NVS_INVALID_LENGTH;
+    } else if (i >= 0) {
+        memcpy(out_value, nvs_entries[i].value, nvs_entries[i].len);
+        *length = nvs_entries[i].len;
+        ret     = ESP_OK;
+    }
+
+    pthread_mutex_unlock(&nvs_lock);
+
+    return ret;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+    pthread_mutex_lock(&nvs_lock);
+
+    esp_err_t ret = ESP_ERR_NVS_NOT_FOUND;
+    const int i   = nvs_find(handle, key);
+    if (i >= 0) {
+        free(nvs_entries[i].value);
+        nvs_entries[i].ns     = 0;
+        nvs_entries[i].value  = NULL;
+        nvs_entries[i].key[0] = '\0';
+        ret                   = ESP_OK;
+    }
+
+    pthread_mutex_unlock(&nvs_lock);
+
+    return ret;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    return handle != 0 && handle <= NVS_NAMESPACES_MAX ? ESP_OK
+                                                       : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+void nvs_close(nvs_handle_t handle) {}
+
+// -------------------------------------------------------------
+// Random Numbers
+// -------------------------------------------------------------
+
+uint32_t esp_random(void) {
+    // --- xorshift32, seeded from the clock on first use
+    static uint32_t state = 0;
+
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    portENTER_CRITICAL(&lock);
+
+    if (state == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        state = (uint32_t)now.tv_nsec ^ (uint32_t)now.tv_sec ^ 0x9E3779B9u;
+        state += state == 0;
+    }
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    const uint32_t value = state;
+
+    portEXIT_CRITICAL(&lock);
+
+    return value;
+}
+
+void esp_fill_random(void *buf, size_t len) {
+    uint8_t *bytes = buf;
+    for (size_t i = 0; i < len; i += 4) {
+        const uint32_t word = esp_random();
+        memcpy(bytes + i, &word, len - i < 4 ? len - i : 4);
+    }
+}
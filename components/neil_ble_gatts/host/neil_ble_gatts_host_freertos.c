@@ -0,0 +1,535 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_host_freertos.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      FreeRTOS on POSIX threads.
+///
+///             Tasks are detached threads on stacks allocated and painted
+///             here, so `uxTaskGetStackHighWaterMark` scans them as the
+///             kernel does. Blocking primitives are a mutex and condition
+///             variable each; timeouts are counted in ticks of
+///             CONFIG_FREERTOS_HZ from a monotonic clock.
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "neil_ble_gatts_host.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Byte unused stack is painted with (as tskSTACK_FILL_BYTE).
+#define STACK_FILL_BYTE 0xA5
+
+/// Longest task name kept (as configMAX_TASK_NAME_LEN).
+#define TASK_NAME_LEN 16
+
+// -------------------------------------------------------------
+// Time
+// -------------------------------------------------------------
+
+static struct timespec time_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now;
+}
+
+/**
+ * @brief       Absolute deadline `ticks` from now, for timed waits.
+ */
+static struct timespec deadline_in(TickType_t ticks) {
+    struct timespec at = time_now();
+    const uint64_t ns  = (uint64_t)ticks * 1000000000ULL / configTICK_RATE_HZ;
+
+    at.tv_sec += ns / 1000000000ULL;
+    at.tv_nsec += ns % 1000000000ULL;
+    if (at.tv_nsec >= 1000000000L) {
+        at.tv_sec++;
+        at.tv_nsec -= 1000000000L;
+    }
+
+    return at;
+}
+
+/**
+ * @brief       Wait on a condition until woken or `deadline` (NULL: forever).
+ *
+ * @return      false once the deadline has passed.
+ */
+static bool cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                      const struct timespec *deadline) {
+    if (deadline == NULL) {
+        pthread_cond_wait(cond, mutex);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, mutex, deadline) != ETIMEDOUT;
+}
+
+static void cond_init(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static struct timespec time_start;
+static pthread_once_t time_start_once = PTHREAD_ONCE_INIT;
+
+static void time_start_init(void) { time_start = time_now(); }
+
+TickType_t xTaskGetTickCount(void) {
+    pthread_once(&time_start_once, time_start_init);
+
+    const struct timespec now = time_now();
+    const int64_t ns = (now.tv_sec - time_start.tv_sec) * 1000000000LL +
+                       (now.tv_nsec - time_start.tv_nsec);
+
+    return (TickType_t)(ns * configTICK_RATE_HZ / 1000000000LL);
+}
+
+// -------------------------------------------------------------
+// Critical Sections
+// -------------------------------------------------------------
+
+// --- One lock for every section, as a single core masking interrupts.
+static pthread_mutex_t critical_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+void vPortEnterCritical(portMUX_TYPE *mux) { pthread_mutex_lock(&critical_lock); }
+
+void vPortExitCritical(portMUX_TYPE *mux) { pthread_mutex_unlock(&critical_lock); }
+
+// -------------------------------------------------------------
+// Tasks
+// -------------------------------------------------------------
+
+struct tskTaskControlBlock {
+    char name[TASK_NAME_LEN];
+    TaskFunction_t code;
+    void *arg;
+
+    // --- Lowest address of the stack, NULL for threads not created here.
+    uint8_t *stack;
+    size_t stack_len;
+
+    // --- Notification value (counting semaphore use only).
+    pthread_mutex_t lock;
+    pthread_cond_t notified;
+    uint32_t notify_value;
+};
+
+static __thread TaskHandle_t task_self = NULL;
+
+static TaskHandle_t task_alloc(const char *name) {
+    TaskHandle_t task = calloc(1, sizeof(*task));
+    if (task == NULL) {
+        return NULL;
+    }
+
+    snprintf(task->name, sizeof(task->name), "%s", name);
+    pthread_mutex_init(&task->lock, NULL);
+    cond_init(&task->notified);
+
+    return task;
+}
+
+static void *task_entry(void *arg) {
+    task_self = arg;
+    task_self->code(task_self->arg);
+
+    // NOTE: A FreeRTOS task must not return, the kernel would abort.
+    fprintf(stderr, "Task %s returned\n", task_self->name);
+    abort();
+}
+
+BaseType_t xTaskCreate(TaskFunction_t pxTaskCode, const char *pcName,
+                       configSTACK_DEPTH_TYPE usStackDepth, void *pvParameters,
+                       UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask) {
+
+    TaskHandle_t task = task_alloc(pcName);
+    if (task == NULL) {
+        return pdFAIL;
+    }
+
+    size_t stack_len = (size_t)usStackDepth * NEIL_BLE_GATTS_HOST_STACK_SCALE;
+    if (stack_len < NEIL_BLE_GATTS_HOST_STACK_MIN) {
+        stack_len = NEIL_BLE_GATTS_HOST_STACK_MIN;
+    }
+    stack_len = (stack_len + 4095) & ~(size_t)4095;
+
+    task->code      = pxTaskCode;
+    task->arg       = pvParameters;
+    task->stack_len = stack_len;
+
+    if (posix_memalign((void **)&task->stack, 4096, stack_len) != 0) {
+        free(task);
+        return pdFAIL;
+    }
+    memset(task->stack, STACK_FILL_BYTE, stack_len);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, task->stack, stack_len);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    pthread_t thread;
+    const int err = pthread_create(&thread, &attr, task_entry, task);
+    pthread_attr_destroy(&attr);
+
+    if (err != 0) {
+        free(task->stack);
+        free(task);
+        return pdFAIL;
+    }
+
+    if (pxCreatedTask != NULL) {
+        *pxCreatedTask = task;
+    }
+
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pxTaskCode, const char *pcName,
+                                   uint32_t usStackDepth, void *pvParameters,
+                                   UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask,
+                                   BaseType_t xCoreID) {
+    return xTaskCreate(pxTaskCode, pcName, usStackDepth, pvParameters, uxPriority,
+                       pxCreatedTask);
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete) {
+    // NOTE: Only a task deleting itself is supported; its control block and
+    //       stack stay allocated, the exiting thread still runs on them.
+    if (xTaskToDelete == NULL || xTaskToDelete == task_self) {
+        pthread_exit(NULL);
+    }
+
+    fprintf(stderr, "vTaskDelete of another task is not supported\n");
+    abort();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    // --- Threads not created as tasks (main, C library) get a stackless one
+    if (task_self == NULL) {
+        task_self = task_alloc("pthread");
+    }
+    return task_self;
+}
+
+const char *pcTaskGetName(TaskHandle_t xTaskToQuery) {
+    TaskHandle_t task =
+        xTaskToQuery != NULL ? xTaskToQuery : xTaskGetCurrentTaskHandle();
+    return task->name;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask) {
+    TaskHandle_t task = xTask != NULL ? xTask : xTaskGetCurrentTaskHandle();
+
+    if (task->stack == NULL) {
+        return 0;
+    }
+
+    // --- The stack grows down, paint left at the bottom was never reached
+    size_t free_len = 0;
+    while (free_len < task->stack_len && task->stack[free_len] == STACK_FILL_BYTE) {
+        free_len++;
+    }
+
+    return free_len;
+}
+
+uint8_t *pxTaskGetStackStart(TaskHandle_t xTask) {
+    TaskHandle_t task = xTask != NULL ? xTask : xTaskGetCurrentTaskHandle();
+    return task->stack;
+}
+
+void vTaskDelay(TickType_t xTicksToDelay) {
+    const struct timespec at = deadline_in(xTicksToDelay);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL) == EINTR) {
+    }
+}
+
+void vTaskDelayUntil(TickType_t *pxPreviousWakeTime, TickType_t xTimeIncrement) {
+    *pxPreviousWakeTime += xTimeIncrement;
+
+    const TickType_t wait = *pxPreviousWakeTime - xTaskGetTickCount();
+
+    // --- Already past the wake time (as the kernel, no catching up)
+    if (wait > 0 && wait <= xTimeIncrement) {
+        vTaskDelay(wait);
+    }
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+    const struct timespec at = deadline_in(xTicksToWait);
+
+    pthread_mutex_lock(&task->lock);
+
+    while (task->notify_value == 0 && xTicksToWait > 0 &&
+           cond_wait(&task->notified, &task->lock,
+                     xTicksToWait == portMAX_DELAY ? NULL : &at)) {
+    }
+
+    const uint32_t value = task->notify_value;
+    if (value > 0) {
+        task->notify_value = xClearCountOnExit ? 0 : value - 1;
+    }
+
+    pthread_mutex_unlock(&task->lock);
+
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify) {
+    pthread_mutex_lock(&xTaskToNotify->lock);
+    xTaskToNotify->notify_value++;
+    pthread_cond_signal(&xTaskToNotify->notified);
+    pthread_mutex_unlock(&xTaskToNotify->lock);
+
+    return pdPASS;
+}
+
+// -------------------------------------------------------------
+// Queues and Semaphores
+// -------------------------------------------------------------
+
+struct QueueDefinition {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+
+    UBaseType_t length;
+    UBaseType_t item_size; ///< 0 for semaphores.
+    UBaseType_t count;
+    UBaseType_t head; ///< Next item received.
+    uint8_t *items;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize) {
+    if (uxQueueLength == 0) {
+        return NULL;
+    }
+
+    QueueHandle_t queue = calloc(1, sizeof(*queue) + uxQueueLength * uxItemSize);
+    if (queue == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&queue->lock, NULL);
+    cond_init(&queue->not_empty);
+    cond_init(&queue->not_full);
+    queue->length    = uxQueueLength;
+    queue->item_size = uxItemSize;
+    queue->items     = (uint8_t *)(queue + 1);
+
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t xQueue) {
+    if (xQueue == NULL) {
+        return;
+    }
+    pthread_cond_destroy(&xQueue->not_empty);
+    pthread_cond_destroy(&xQueue->not_full);
+    pthread_mutex_destroy(&xQueue->lock);
+    free(xQueue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue,
+                      TickType_t xTicksToWait) {
+
+    const struct timespec at = deadline_in(xTicksToWait);
+
+    pthread_mutex_lock(&xQueue->lock);
+
+    while (xQueue->count == xQueue->length && xTicksToWait > 0 &&
+           cond_wait(&xQueue->not_full, &xQueue->lock,
+                     xTicksToWait == portMAX_DELAY ? NULL : &at)) {
+    }
+
+    const bool sent = xQueue->count < xQueue->length;
+
+    if (sent) {
+        const UBaseType_t tail = (xQueue->head + xQueue->count) % xQueue->length;
+        // --- Semaphores are queues of empty items, given without one
+        if (xQueue->item_size > 0 && pvItemToQueue != NULL) {
+            memcpy(xQueue->items + tail * xQueue->item_size, pvItemToQueue,
+                   xQueue->item_size);
+        }
+        xQueue->count++;
+        pthread_cond_signal(&xQueue->not_empty);
+    }
+
+    pthread_mutex_unlock(&xQueue->lock);
+
+    return sent ? pdPASS : pdFAIL;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer,
+                         TickType_t xTicksToWait) {
+
+    const struct timespec at = deadline_in(xTicksToWait);
+
+    pthread_mutex_lock(&xQueue->lock);
+
+    while (xQueue->count == 0 && xTicksToWait > 0 &&
+           cond_wait(&xQueue->not_empty, &xQueue->lock,
+                     xTicksToWait == portMAX_DELAY ? NULL : &at)) {
+    }
+
+    const bool received = xQueue->count > 0;
+
+    if (received) {
+        if (xQueue->item_size > 0 && pvBuffer != NULL) {
+            memcpy(pvBuffer, xQueue->items + xQueue->head * xQueue->item_size,
+                   xQueue->item_size);
+        }
+        xQueue->head = (xQueue->head + 1) % xQueue->length;
+        xQueue->count--;
+        pthread_cond_signal(&xQueue->not_full);
+    }
+
+    pthread_mutex_unlock(&xQueue->lock);
+
+    return received ? pdPASS : pdFAIL;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue) {
+    pthread_mutex_lock(&xQueue->lock);
+    const UBaseType_t count = xQueue->count;
+    pthread_mutex_unlock(&xQueue->lock);
+    return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t uxMaxCount,
+                                           UBaseType_t uxInitialCount) {
+    SemaphoreHandle_t sem = xQueueCreate(uxMaxCount, 0);
+    if (sem != NULL) {
+        sem->count = uxInitialCount;
+    }
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+// NOTE: Without priorities there is nothing to inherit, a mutex is a binary
+//       semaphore created given.
+SemaphoreHandle_t xSemaphoreCreateMutex(void) { return xSemaphoreCreateCounting(1, 1); }
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime) {
+    return xQueueReceive(xSemaphore, NULL, xBlockTime);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore) {
+    return xQueueSend(xSemaphore, NULL, 0);
+}
+
+// -------------------------------------------------------------
+// Event Groups
+// -------------------------------------------------------------
+
+struct EventGroupDef_t {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void) {
+    EventGroupHandle_t group = calloc(1, sizeof(*group));
+    if (group != NULL) {
+        pthread_mutex_init(&group->lock, NULL);
+        cond_init(&group->changed);
+    }
+    return group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t xEventGroup) {
+    if (xEventGroup == NULL) {
+        return;
+    }
+    pthread_cond_destroy(&xEventGroup->changed);
+    pthread_mutex_destroy(&xEventGroup->lock);
+    free(xEventGroup);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t xEventGroup,
+                               const EventBits_t uxBitsToSet) {
+    pthread_mutex_lock(&xEventGroup->lock);
+    xEventGroup->bits |= uxBitsToSet;
+    const EventBits_t bits = xEventGroup->bits;
+    pthread_cond_broadcast(&xEventGroup->changed);
+    pthread_mutex_unlock(&xEventGroup->lock);
+    return bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t xEventGroup,
+                                 const EventBits_t uxBitsToClear) {
+    pthread_mutex_lock(&xEventGroup->lock);
+    const EventBits_t bits = xEventGroup->bits;
+    xEventGroup->bits &= ~uxBitsToClear;
+    pthread_mutex_unlock(&xEventGroup->lock);
+    return bits;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t xEventGroup) {
+    pthread_mutex_lock(&xEventGroup->lock);
+    const EventBits_t bits = xEventGroup->bits;
+    pthread_mutex_unlock(&xEventGroup->lock);
+    return bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t xEventGroup,
+                                const EventBits_t uxBitsToWaitFor,
+                                const BaseType_t xClearOnExit,
+                                const BaseType_t xWaitForAllBits,
+                                TickType_t xTicksToWait) {
+
+    const struct timespec at = deadline_in(xTicksToWait);
+
+    pthread_mutex_lock(&xEventGroup->lock);
+
+    for (;;) {
+        const EventBits_t set = xEventGroup->bits & uxBitsToWaitFor;
+        const bool met = xWaitForAllBits ? set == uxBitsToWaitFor : set != 0;
+
+        if (met || xTicksToWait == 0 ||
+            !cond_wait(&xEventGroup->changed, &xEventGroup->lock,
+                       xTicksToWait == portMAX_DELAY ? NULL : &at)) {
+            break;
+        }
+    }
+
+    const EventBits_t bits = xEventGroup->bits;
+    const EventBits_t set  = bits & uxBitsToWaitFor;
+
+    if (xClearOnExit &&
+        (xWaitForAllBits ? set == uxBitsToWaitFor : set != 0)) {
+        xEventGroup->bits &= ~uxBitsToWaitFor;
+    }
+
+    pthread_mutex_unlock(&xEventGroup->lock);
+
+    return bits;
+}
@@ -0,0 +1,1712 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_host_hci.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      HCI transport.
+///
+///             Drives the Bluedroid replacement against a Bluetooth
+///             controller, reached over an H4 stream on a unix socket (as
+///             BlueZ `btvirt -s` serves) or a Linux HCI user channel. What a
+///             GATT server peripheral needs runs on top of it:
+///
+///             - Advertising follows the GAP calls of the application, with
+///               its data, from the controller's public address (no privacy).
+///             - Connections and disconnections reach every profile.
+///             - An ATT bearer per link answers discovery from the attribute
+///               tables, beside the GATT and GAP services of the stack at
+///               0x0001 and 0x0014, and turns requests on attributes the
+///               application responds to into GATTS events. Their responses
+///               go back as ATT PDUs.
+///             - Notifications complete (`ESP_GATTS_CONF_EVT`) once handed to
+///               the controller, within its ACL buffers.
+///             - Pairing is refused (no security manager), L2CAP signalling
+///               requests rejected.
+///
+///             A receive task handles controller events and inbound data; a
+///             transmit task sends commands one at a time, and data as the
+///             controller's buffers allow.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_gatts_api.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "neil_ble_gatts_host.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Packets waiting for the transmit task.
+#define TX_QUEUE_LEN 64
+
+/// Stack of the transport tasks.
+#define TASK_STACK 4096
+
+/// Wait for a command to complete.
+#define CMD_TIMEOUT_MS 2000
+
+/// Largest L2CAP PDU carried (basic header and the largest ATT PDU).
+#define PDU_MAX (L2CAP_HDR_LEN + ESP_GATT_MAX_MTU_SIZE)
+
+/// Logging tag.
+static const char *TAG = "NEIL BLE GATTS HCI";
+
+// -------------------------------------------------------------
+// Protocol
+// -------------------------------------------------------------
+
+// --- H4 packet types
+#define H4_CMD   0x01
+#define H4_ACL   0x02
+#define H4_EVENT 0x04
+
+// --- Commands (OGF << 10 | OCF)
+#define HCI_DISCONNECT          0x0406
+#define HCI_SET_EVENT_MASK      0x0C01
+#define HCI_RESET               0x0C03
+#define HCI_READ_BUFFER_SIZE    0x1005
+#define HCI_READ_BD_ADDR        0x1009
+#define HCI_LE_SET_EVENT_MASK   0x2001
+#define HCI_LE_READ_BUFFER_SIZE 0x2002
+#define HCI_LE_SET_ADV_PARAMS   0x2006
+#define HCI_LE_SET_ADV_DATA     0x2008
+#define HCI_LE_SET_SCAN_RSP     0x2009
+#define HCI_LE_SET_ADV_ENABLE   0x200A
+
+// --- Events
+#define HCI_EV_DISCONN_COMPLETE 0x05
+#define HCI_EV_CMD_COMPLETE     0x0E
+#define HCI_EV_CMD_STATUS       0x0F
+#define HCI_EV_HW_ERROR         0x10
+#define HCI_EV_NUM_COMPLETED    0x13
+#define HCI_EV_LE_META          0x3E
+#define HCI_LE_CONN_COMPLETE    0x01
+
+// --- ACL packet boundary flags
+#define ACL_START 0x02
+#define ACL_CONT  0x01
+
+// --- L2CAP fixed channels
+#define L2CAP_HDR_LEN 4
+#define L2CAP_CID_ATT 0x0004
+#define L2CAP_CID_SIG 0x0005
+#define L2CAP_CID_SMP 0x0006
+
+// --- L2CAP LE signalling
+#define SIG_CMD_REJECT       0x01
+#define SIG_DISCONN_RSP      0x07
+#define SIG_CONN_PARAM_RSP   0x13
+#define SIG_LE_CONN_REQ      0x14
+#define SIG_LE_CONN_RSP      0x15
+#define SIG_ECRED_CONN_RSP   0x18
+#define SIG_ECRED_RECONF_RSP 0x1A
+
+/// LE credit-based connection refused: SPSM not supported.
+#define SIG_LE_SPSM_UNSUPPORTED 0x0002
+
+// --- SMP
+#define SMP_PAIRING_REQ           0x01
+#define SMP_PAIRING_FAILED        0x05
+#define SMP_SECURITY_REQ          0x0B
+#define SMP_PAIRING_NOT_SUPPORTED 0x05
+
+// --- ATT opcodes
+#define ATT_ERROR_RSP       0x01
+#define ATT_MTU_REQ         0x02
+#define ATT_MTU_RSP         0x03
+#define ATT_FIND_INFO_REQ   0x04
+#define ATT_FIND_INFO_RSP   0x05
+#define ATT_FIND_TYPE_REQ   0x06
+#define ATT_FIND_TYPE_RSP   0x07
+#define ATT_READ_TYPE_REQ   0x08
+#define ATT_READ_TYPE_RSP   0x09
+#define ATT_READ_REQ        0x0A
+#define ATT_READ_RSP        0x0B
+#define ATT_READ_BLOB_REQ   0x0C
+#define ATT_READ_BLOB_RSP   0x0D
+#define ATT_READ_GROUP_REQ  0x10
+#define ATT_READ_GROUP_RSP  0x11
+#define ATT_WRITE_REQ       0x12
+#define ATT_WRITE_RSP       0x13
+#define ATT_PREP_WRITE_REQ  0x16
+#define ATT_PREP_WRITE_RSP  0x17
+#define ATT_EXEC_WRITE_REQ  0x18
+#define ATT_EXEC_WRITE_RSP  0x19
+#define ATT_NOTIFY          0x1B
+#define ATT_CONFIRM         0x1E
+#define ATT_WRITE_CMD       0x52
+#define ATT_COMMAND_FLAG    0x40
+
+/// Bytes of a Bluetooth Base UUID around a 16 or 32-bit UUID (little-endian).
+static const uint8_t BASE_UUID[ESP_UUID_LEN_128] = {
+    0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
+    0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+// -------------------------------------------------------------
+// Stack Services
+// -------------------------------------------------------------
+//
+// Bluedroid serves GATT and GAP itself, below the application tables.
+// Characteristic declarations hold their properties only, as in tables.
+
+static const uint8_t GATT_SVC_UUID[] = {0x01, 0x18};
+static const uint8_t GAP_SVC_UUID[]  = {0x00, 0x18};
+static const uint8_t PROP_INDICATE[] = {ESP_GATT_CHAR_PROP_BIT_INDICATE};
+static const uint8_t PROP_READ[]     = {ESP_GATT_CHAR_PROP_BIT_READ};
+static const uint8_t ZEROS[4]        = {0};
+
+#define PERM_R  ESP_GATT_PERM_READ
+#define PERM_RW (ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE)
+
+#define STACK_ATTR(h, u, p, v, l)                                                   \
+    {                                                                               \
+        .handle = (h), .uuid = {.len = ESP_UUID_LEN_16, .uuid = {.uuid16 = (u)}},   \
+        .perm = (p), .auto_rsp = ESP_GATT_AUTO_RSP, .max_len = (l), .len = (l),     \
+        .value = (v),                                                               \
+    }
+
+/// Device name handle, its value follows `esp_ble_gap_set_device_name`.
+#define HANDLE_DEVICE_NAME 0x0016
+
+static const neil_ble_gatts_host_attr_t stack_attrs[] = {
+    STACK_ATTR(0x0001, ESP_GATT_UUID_PRI_SERVICE, PERM_R, GATT_SVC_UUID, 2),
+    STACK_ATTR(0x0002, ESP_GATT_UUID_CHAR_DECLARE, PERM_R, PROP_INDICATE, 1),
+    STACK_ATTR(0x0003, ESP_GATT_UUID_GATT_SRV_CHGD, 0, ZEROS, 4),
+    STACK_ATTR(0x0004, ESP_GATT_UUID_CHAR_CLIENT_CONFIG, PERM_RW, ZEROS, 2),
+    STACK_ATTR(0x0014, ESP_GATT_UUID_PRI_SERVICE, PERM_R, GAP_SVC_UUID, 2),
+    STACK_ATTR(0x0015, ESP_GATT_UUID_CHAR_DECLARE, PERM_R, PROP_READ, 1),
+    STACK_ATTR(HANDLE_DEVICE_NAME, ESP_GATT_UUID_GAP_DEVICE_NAME, PERM_R, NULL, 0),
+    STACK_ATTR(0x0017, ESP_GATT_UUID_CHAR_DECLARE, PERM_R, PROP_READ, 1),
+    STACK_ATTR(0x0018, ESP_GATT_UUID_GAP_ICON, PERM_R, ZEROS, 2),
+};
+
+// -------------------------------------------------------------
+// State
+// -------------------------------------------------------------
+
+/**
+ * @brief       Packet waiting for the transmit task.
+ */
+typedef struct {
+    uint8_t type;    ///< H4_CMD or H4_ACL.
+    uint16_t conn;   ///< Connection handle (ACL).
+    uint16_t notify; ///< Notified attribute, completed once sent (ACL).
+    uint16_t len;
+    uint8_t data[PDU_MAX]; ///< Command (opcode, length, parameters) or L2CAP PDU.
+} tx_packet_t;
+
+/**
+ * @brief       Link to a central, named by its connection handle.
+ */
+typedef struct {
+    bool used;
+    uint16_t conn;
+    esp_bd_addr_t bda;
+    uint16_t mtu;
+    uint16_t acl_sent; ///< ACL packets the controller holds.
+
+    // --- L2CAP reassembly
+    uint8_t rx[PDU_MAX];
+    uint16_t rx_len;
+    bool rx_drop; ///< PDU too large, skipped up to its end.
+
+    // --- ATT request awaiting the application's response
+    uint8_t req_opcode; ///< 0 if none.
+    uint16_t req_handle;
+    uint16_t req_offset;
+    uint32_t trans_id;
+    esp_gatt_if_t prep_if; ///< Profile holding prepared writes.
+} hci_link_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    int fd;
+    uint16_t local_mtu;
+    QueueHandle_t tx_queue;
+
+    // --- Controller
+    uint16_t acl_len;
+    uint16_t acl_credits;
+    uint16_t cmd_opcode; ///< Command awaiting completion, 0 if none.
+    bool cmd_done;
+    uint8_t cmd_rsp[16]; ///< Return parameters, status first.
+    uint8_t cmd_rsp_len;
+
+    uint32_t trans_id;
+    hci_link_t links[CONFIG_BT_ACL_CONNECTIONS];
+
+    // --- Receive task only
+    char device_name[NEIL_BLE_GATTS_HOST_DEVICE_NAME_MAX + 1];
+} hci = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .fd   = -1,
+};
+
+/// Callers hold `hci.lock`.
+static hci_link_t *link_find(uint16_t conn) {
+    for (size_t i = 0; i < CONFIG_BT_ACL_CONNECTIONS; i++) {
+        if (hci.links[i].used && hci.links[i].conn == conn) {
+            return hci.links + i;
+        }
+    }
+    return NULL;
+}
+
+static void put_le16(uint8_t *out, uint16_t value) {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+static uint16_t get_le16(const uint8_t *in) { return in[0] | in[1] << 8; }
+
+// -------------------------------------------------------------
+// Transmission
+// -------------------------------------------------------------
+
+static bool write_all(const uint8_t *data, size_t len) {
+    while (len > 0) {
+        const ssize_t n = write(hci.fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ESP_LOGE(TAG, "Controller write failed: %s", strerror(errno));
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * @brief       Send a command and wait for its completion.
+ *
+ * @return      Command status, 0xFF if the controller did not answer.
+ */
+static uint8_t cmd_send(uint16_t opcode, const uint8_t *params, uint8_t len,
+                        uint8_t *rsp, uint8_t rsp_size) {
+    uint8_t packet[4 + UINT8_MAX] = {H4_CMD, opcode & 0xFF, opcode >> 8, len};
+    memcpy(packet + 4, params, len);
+
+    pthread_mutex_lock(&hci.lock);
+    hci.cmd_opcode = opcode;
+    hci.cmd_done   = false;
+    pthread_mutex_unlock(&hci.lock);
+
+    if (!write_all(packet, 4 + len)) {
+        return 0xFF;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += CMD_TIMEOUT_MS / 1000;
+
+    pthread_mutex_lock(&hci.lock);
+
+    while (!hci.cmd_done &&
+           pthread_cond_timedwait(&hci.cond, &hci.lock, &deadline) != ETIMEDOUT) {
+    }
+
+    uint8_t status = 0xFF;
+    if (hci.cmd_done) {
+        status = hci.cmd_rsp_len > 0 ? hci.cmd_rsp[0] : 0;
+        if (rsp != NULL) {
+            memcpy(rsp, hci.cmd_rsp,
+                   hci.cmd_rsp_len < rsp_size ? hci.cmd_rsp_len : rsp_size);
+        }
+    }
+    hci.cmd_opcode = 0;
+
+    pthread_mutex_unlock(&hci.lock);
+
+    if (status != 0) {
+        ESP_LOGW(TAG, "Command 0x%04x failed (status 0x%02x)", opcode, status);
+    }
+
+    return status;
+}
+
+/**
+ * @brief       Queue a packet for the transmit task.
+ *
+ *              Never blocks: the receive task must keep returning buffers,
+ *              and the BTC task must not wait on the transmit task.
+ */
+static void tx_queue(const tx_packet_t *packet) {
+    if (xQueueSend(hci.tx_queue, packet, 0) != pdPASS) {
+        ESP_LOGW(TAG, "Transmit queue full, packet dropped");
+    }
+}
+
+static void tx_cmd(uint16_t opcode, const uint8_t *params, uint8_t len) {
+    tx_packet_t packet = {.type = H4_CMD, .len = 3 + len};
+    put_le16(packet.data, opcode);
+    packet.data[2] = len;
+    memcpy(packet.data + 3, params, len);
+    tx_queue(&packet);
+}
+
+/**
+ * @brief       Queue an L2CAP PDU, its payload already at `data + L2CAP_HDR_LEN`.
+ */
+static void tx_l2cap(tx_packet_t *packet, uint16_t conn, uint16_t cid, uint16_t len) {
+    packet->type = H4_ACL;
+    packet->conn = conn;
+    packet->len  = L2CAP_HDR_LEN + len;
+    put_le16(packet->data, len);
+    put_le16(packet->data + 2, cid);
+    tx_queue(packet);
+}
+
+/**
+ * @brief       Send an L2CAP PDU in ACL packets, each once the controller has
+ *              a buffer for it.
+ *
+ * @return      false if the link went away.
+ */
+static bool acl_send(const tx_packet_t *packet) {
+    for (uint16_t at = 0; at < packet->len;) {
+        const uint16_t chunk = packet->len - at < hci.acl_len ? packet->len - at
+                                                              : hci.acl_len;
+
+        pthread_mutex_lock(&hci.lock);
+        while (hci.acl_credits == 0 && link_find(packet->conn) != NULL) {
+            pthread_cond_wait(&hci.cond, &hci.lock);
+        }
+        hci_link_t *link = link_find(packet->conn);
+        if (link != NULL) {
+            hci.acl_credits--;
+            link->acl_sent++;
+        }
+        pthread_mutex_unlock(&hci.lock);
+
+        if (link == NULL) {
+            return false;
+        }
+
+        const uint16_t flags = (at == 0 ? ACL_START : ACL_CONT) << 12;
+
+        uint8_t header[5] = {H4_ACL};
+        put_le16(header + 1, packet->conn | flags);
+        put_le16(header + 3, chunk);
+
+        // NOTE: Both writes land in one packet on a user channel only when
+        //       joined, so the packet is assembled first.
+        uint8_t acl[sizeof(header) + PDU_MAX];
+        memcpy(acl, header, sizeof(header));
+        memcpy(acl + sizeof(header), packet->data + at, chunk);
+        if (!write_all(acl, sizeof(header) + chunk)) {
+            return false;
+        }
+
+        at += chunk;
+    }
+
+    return true;
+}
+
+static void tx_task(void *arg) {
+    static tx_packet_t packet;
+
+    for (;;) {
+        if (xQueueReceive(hci.tx_queue, &packet, portMAX_DELAY) != pdPASS) {
+            continue;
+        }
+
+        if (packet.type == H4_CMD) {
+            cmd_send(get_le16(packet.data), packet.data + 3, packet.data[2], NULL, 0);
+            continue;
+        }
+
+        const bool sent = acl_send(&packet);
+
+        if (packet.notify != 0) {
+            neil_ble_gatts_host_attr_t attr;
+            if (!neil_ble_gatts_host_attr_get(packet.notify, &attr)) {
+                continue;
+            }
+
+            esp_ble_gatts_cb_param_t param = {
+                .conf = {
+                    .status  = sent ? ESP_GATT_OK : ESP_GATT_ERROR,
+                    .conn_id = packet.conn,
+                    .handle  = packet.notify,
+                    .len     = packet.len - L2CAP_HDR_LEN - 3,
+                    .value   = packet.data + L2CAP_HDR_LEN + 3,
+                },
+            };
+            neil_ble_gatts_host_gatts_event(ESP_GATTS_CONF_EVT, attr.gatts_if, &param);
+        }
+    }
+}
+
+// -------------------------------------------------------------
+// Advertising
+// -------------------------------------------------------------
+
+static void adv_start(void) {
+    neil_ble_gatts_host_gap_t gap;
+    neil_ble_gatts_host_gap_get(&gap);
+
+    const esp_ble_adv_params_t *adv = &gap.adv_params;
+
+    // --- No resolving list is programmed, the public address stands in
+    uint8_t params[15] = {0};
+    put_le16(params, adv->adv_int_min);
+    put_le16(params + 2, adv->adv_int_max);
+    params[4] = adv->adv_type;
+    params[5] = 0x00; // Public
+    params[6] = adv->peer_addr_type;
+    for (int i = 0; i < ESP_BD_ADDR_LEN; i++) {
+        params[7 + i] = adv->peer_addr[ESP_BD_ADDR_LEN - 1 - i];
+    }
+    params[13] = adv->channel_map;
+    params[14] = adv->adv_filter_policy;
+    tx_cmd(HCI_LE_SET_ADV_PARAMS, params, sizeof(params));
+
+    uint8_t data[1 + ESP_BLE_ADV_DATA_LEN_MAX] = {gap.adv_data_len};
+    memcpy(data + 1, gap.adv_data, gap.adv_data_len);
+    tx_cmd(HCI_LE_SET_ADV_DATA, data, sizeof(data));
+
+    data[0] = gap.scan_rsp_data_len;
+    memset(data + 1, 0, ESP_BLE_ADV_DATA_LEN_MAX);
+    memcpy(data + 1, gap.scan_rsp_data, gap.scan_rsp_data_len);
+    tx_cmd(HCI_LE_SET_SCAN_RSP, data, sizeof(data));
+
+    tx_cmd(HCI_LE_SET_ADV_ENABLE, (const uint8_t[]){0x01}, 1);
+}
+
+// -------------------------------------------------------------
+// Attributes
+// -------------------------------------------------------------
+//
+// Receive task only.
+
+/**
+ * @brief       First attribute at or after `handle`, of the stack services
+ *              or the started application tables.
+ */
+static bool attr_next(uint16_t handle, neil_ble_gatts_host_attr_t *out) {
+    for (size_t i = 0; i < sizeof(stack_attrs) / sizeof(stack_attrs[0]); i++) {
+        if (stack_attrs[i].handle < handle) {
+            continue;
+        }
+
+        *out = stack_attrs[i];
+
+        if (out->handle == HANDLE_DEVICE_NAME) {
+            neil_ble_gatts_host_gap_t gap;
+            neil_ble_gatts_host_gap_get(&gap);
+            strcpy(hci.device_name, gap.device_name);
+
+            out->value = (const uint8_t *)hci.device_name;
+            out->len   = strlen(hci.device_name);
+        }
+        return true;
+    }
+
+    return neil_ble_gatts_host_attr_next(handle, out);
+}
+
+static bool attr_get(uint16_t handle, neil_ble_gatts_host_attr_t *out) {
+    return handle != 0 && attr_next(handle, out) && out->handle == handle;
+}
+
+static bool attr_is_uuid16(const neil_ble_gatts_host_attr_t *attr, uint16_t uuid) {
+    return attr->uuid.len == ESP_UUID_LEN_16 && attr->uuid.uuid.uuid16 == uuid;
+}
+
+static bool attr_is_service(const neil_ble_gatts_host_attr_t *attr) {
+    return attr_is_uuid16(attr, ESP_GATT_UUID_PRI_SERVICE) ||
+           attr_is_uuid16(attr, ESP_GATT_UUID_SEC_SERVICE);
+}
+
+/**
+ * @brief       Whether the stack serves the value rather than the
+ *              application: declarations, as Bluedroid builds them into its
+ *              database whatever the table says, and `ESP_GATT_AUTO_RSP`.
+ */
+static bool attr_served(const neil_ble_gatts_host_attr_t *attr) {
+    return attr_is_service(attr) ||
+           attr_is_uuid16(attr, ESP_GATT_UUID_INCLUDE_SERVICE) ||
+           attr_is_uuid16(attr, ESP_GATT_UUID_CHAR_DECLARE) ||
+           attr->auto_rsp == ESP_GATT_AUTO_RSP;
+}
+
+/**
+ * @brief       128-bit form of a UUID (little-endian).
+ */
+static void uuid_wide(const esp_bt_uuid_t *uuid, uint8_t *out) {
+    memcpy(out, BASE_UUID, ESP_UUID_LEN_128);
+
+    switch (uuid->len) {
+    case ESP_UUID_LEN_16:
+        put_le16(out + 12, uuid->uuid.uuid16);
+        break;
+    case ESP_UUID_LEN_32:
+        put_le16(out + 12, uuid->uuid.uuid32 & 0xFFFF);
+        put_le16(out + 14, uuid->uuid.uuid32 >> 16);
+        break;
+    default:
+        memcpy(out, uuid->uuid.uuid128, ESP_UUID_LEN_128);
+        break;
+    }
+}
+
+/**
+ * @brief       Put a UUID as ATT carries it, 16-bit when it has that form.
+ *
+ * @return      Bytes written.
+ */
+static uint8_t uuid_put(const esp_bt_uuid_t *uuid, uint8_t *out) {
+    if (uuid->len == ESP_UUID_LEN_16) {
+        put_le16(out, uuid->uuid.uuid16);
+        return ESP_UUID_LEN_16;
+    }
+    uuid_wide(uuid, out);
+    return ESP_UUID_LEN_128;
+}
+
+static bool uuid_match(const esp_bt_uuid_t *uuid, const uint8_t *raw, uint16_t len) {
+    esp_bt_uuid_t other = {.len = len};
+    if (len == ESP_UUID_LEN_16) {
+        other.uuid.uuid16 = get_le16(raw);
+    } else if (len == ESP_UUID_LEN_128) {
+        memcpy(other.uuid.uuid128, raw, ESP_UUID_LEN_128);
+    } else {
+        return false;
+    }
+
+    uint8_t a[ESP_UUID_LEN_128];
+    uint8_t b[ESP_UUID_LEN_128];
+    uuid_wide(uuid, a);
+    uuid_wide(&other, b);
+    return memcmp(a, b, ESP_UUID_LEN_128) == 0;
+}
+
+/**
+ * @brief       Value of a stack-served attribute as ATT reads it.
+ *
+ *              Characteristic declarations gain the value handle and UUID
+ *              of the attribute that follows.
+ *
+ * @return      Length.
+ */
+static uint16_t attr_value(const neil_ble_gatts_host_attr_t *attr, uint8_t *out) {
+    if (attr_is_uuid16(attr, ESP_GATT_UUID_CHAR_DECLARE)) {
+        neil_ble_gatts_host_attr_t value_attr;
+        if (!attr_get(attr->handle + 1, &value_attr)) {
+            return 0;
+        }
+        out[0] = attr->len > 0 ? attr->value[0] : 0;
+        put_le16(out + 1, attr->handle + 1);
+        return 3 + uuid_put(&value_attr.uuid, out + 3);
+    }
+
+    if (attr->len > 0) {
+        memcpy(out, attr->value, attr->len);
+    }
+    return attr->len;
+}
+
+/**
+ * @brief       Last handle of the service declared at `handle`.
+ */
+static uint16_t service_end(uint16_t handle) {
+    neil_ble_gatts_host_attr_t attr;
+    uint16_t end = handle;
+
+    while (attr_next(end + 1, &attr) && !attr_is_service(&attr)) {
+        end = attr.handle;
+    }
+    return end;
+}
+
+static esp_gatt_status_t attr_access(const neil_ble_gatts_host_attr_t *attr,
+                                     bool write) {
+    const esp_gatt_perm_t plain = write ? ESP_GATT_PERM_WRITE : ESP_GATT_PERM_READ;
+    const esp_gatt_perm_t secure =
+        write ? ESP_GATT_PERM_WRITE_ENCRYPTED | ESP_GATT_PERM_WRITE_ENC_MITM |
+                    ESP_GATT_PERM_WRITE_SIGNED | ESP_GATT_PERM_WRITE_SIGNED_MITM
+              : ESP_GATT_PERM_READ_ENCRYPTED | ESP_GATT_PERM_READ_ENC_MITM;
+
+    if (attr->perm & plain) {
+        return ESP_GATT_OK;
+    }
+
+    // --- Links are never encrypted
+    if (attr->perm & secure) {
+        return ESP_GATT_INSUF_AUTHENTICATION;
+    }
+
+    return write ? ESP_GATT_WRITE_NOT_PERMIT : ESP_GATT_READ_NOT_PERMIT;
+}
+
+// -------------------------------------------------------------
+// ATT Bearer
+// -------------------------------------------------------------
+
+static void att_send(uint16_t conn, tx_packet_t *packet, uint16_t len) {
+    tx_l2cap(packet, conn, L2CAP_CID_ATT, len);
+}
+
+static void att_error(uint16_t conn, uint8_t opcode, uint16_t handle,
+                      esp_gatt_status_t status) {
+    tx_packet_t packet = {0};
+    uint8_t *pdu       = packet.data + L2CAP_HDR_LEN;
+
+    pdu[0] = ATT_ERROR_RSP;
+    pdu[1] = opcode;
+    put_le16(pdu + 2, handle);
+    pdu[4] = status;
+    att_send(conn, &packet, 5);
+}
+
+/**
+ * @brief       Hand a request to the application, the response follows
+ *              through `tx_observe`.
+ */
+static void att_dispatch(hci_link_t *link, uint8_t opcode, esp_gatts_cb_event_t event,
+                         esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param) {
+    pthread_mutex_lock(&hci.lock);
+    link->req_opcode = opcode;
+    link->trans_id   = ++hci.trans_id;
+    pthread_mutex_unlock(&hci.lock);
+
+    // --- Read, write and execute parameters share their layout up to the address
+    param->read.conn_id  = link->conn;
+    param->read.trans_id = link->trans_id;
+    memcpy(param->read.bda, link->bda, ESP_BD_ADDR_LEN);
+
+    neil_ble_gatts_host_gatts_event(event, gatts_if, param);
+}
+
+static void att_read(hci_link_t *link, uint8_t opcode, uint16_t handle,
+                     uint16_t offset) {
+    neil_ble_gatts_host_attr_t attr;
+    if (!attr_get(handle, &attr)) {
+        att_error(link->conn, opcode, handle, ESP_GATT_INVALID_HANDLE);
+        return;
+    }
+
+    const esp_gatt_status_t status = attr_access(&attr, false);
+    if (status != ESP_GATT_OK) {
+        att_error(link->conn, opcode, handle, status);
+        return;
+    }
+
+    if (!attr_served(&attr)) {
+        link->req_handle = handle;
+        link->req_offset = offset;
+
+        esp_ble_gatts_cb_param_t param = {
+            .read = {
+                .handle   = handle,
+                .offset   = offset,
+                .is_long  = opcode == ATT_READ_BLOB_REQ,
+                .need_rsp = true,
+            },
+        };
+        att_dispatch(link, opcode, ESP_GATTS_READ_EVT, attr.gatts_if, &param);
+        return;
+    }
+
+    uint8_t value[ESP_GATT_MAX_ATTR_LEN + ESP_UUID_LEN_128];
+    const uint16_t len = attr_value(&attr, value);
+
+    if (offset > len) {
+        att_error(link->conn, opcode, handle, ESP_GATT_INVALID_OFFSET);
+        return;
+    }
+
+    tx_packet_t packet = {0};
+    uint8_t *pdu       = packet.data + L2CAP_HDR_LEN;
+    const uint16_t out = len - offset < link->mtu - 1 ? len - offset : link->mtu - 1;
+
+    pdu[0] = opcode == ATT_READ_REQ ? ATT_READ_RSP : ATT_READ_BLOB_RSP;
+    memcpy(pdu + 1, value + offset, out);
+    att_send(link->conn, &packet, 1 + out);
+}
+
+static void att_find_info(hci_link_t *link, uint16_t start, uint16_t end) {
+    tx_packet_t packet = {0};
+    uint8_t *pdu       = packet.data + L2CAP_HDR_LEN;
+    uint16_t len       = 2;
+
+    neil_ble_gatts_host_attr_t attr;
+    for (uint16_t handle = start; handle <= end && attr_next(handle, &attr) &&
+                                  attr.handle <= end;
+         handle = attr.handle + 1) {
+        const uint8_t format = attr.uuid.len == ESP_UUID_LEN_16 ? 0x01 : 0x02;
+        const uint8_t size   = format == 0x01 ? 2 + 2 : 2 + 16;
+
+        if ((len > 2 && format != pdu[1]) || len + size > link->mtu) {
+            break;
+        }
+
+        pdu[1] = format;
+        put_le16(pdu + len, attr.handle);
+        uuid_put(&attr.uuid, pdu + len + 2);
+        len += size;
+
+        if (attr.handle == UINT16_MAX) {
+            break;
+        }
+    }
+
+    if (len == 2) {
+        att_error(link->conn, ATT_FIND_INFO_REQ, start, ESP_GATT_NOT_FOUND);
+        return;
+    }
+
+    pdu[0] = ATT_FIND_INFO_RSP;
+    att_send(link->conn, &packet, len);
+}
+
+static void att_find_type(hci_link_t *link, uint16_t start, uint16_t end,
+                          uint16_t type, const uint8_t *value, uint16_t value_len) {
+    tx_packet_t packet = {0};
+    uint8_t *pdu       = packet.data + L2CAP_HDR_LEN;
+    uint16_t len       = 1;
+
+    if (type != ESP_GATT_UUID_PRI_SERVICE) {
+        att_error(link->conn, ATT_FIND_TYPE_REQ, start, ESP_GATT_NOT_FOUND);
+        return;
+    }
+
+    neil_ble_gatts_host_attr_t attr;
+    for (uint16_t handle = start; handle <= end && attr_next(handle, &attr) &&
+                                  attr.handle <= end && len + 4 <= link->mtu;
+         handle = attr.handle + 1) {
+        if (!attr_is_uuid16(&attr, type) || attr.len != value_len ||
+            memcmp(attr.value, value, value_len) != 0) {
+            continue;
+        }
+
+        put_le16(pdu + len, attr.handle);
+        put_le16(pdu + len + 2, service_end(attr.handle));
+        len += 4;
+    }
+
+    if (len == 1) {
+        att_error(link->conn, ATT_FIND_TYPE_REQ, start, ESP_GATT_NOT_FOUND);
+        return;
+    }
+
+    pdu[0] = ATT_FIND_TYPE_RSP;
+    att_send(link->conn, &packet, len);
+}
+
+static void att_read_type(hci_link_t *link, uint16_t start, uint16_t end,
+                          const uint8_t *type, uint16_t type_len) {
+    tx_packet_t packet = {0};
+    uint8_t *pdu       = packet.data + L2CAP_HDR_LEN;
+    uint16_t len       = 2;
+
+    neil_ble_gatts_host_attr_t attr;
+    for (uint16_t handle = start; handle <= end && attr_next(handle, &attr) &&
+                                  attr.handle <= end;
+         handle = attr.handle + 1) {
+        if (!uuid_match(&attr.uuid, type, type_len)) {
+            continue;
+        }
+
+        const esp_gatt_status_t status = attr_access(&attr, false);
+
+        // --- Errors only stop the first entry
+        if (status != ESP_GATT_OK || !attr_served(&attr)) {
+            if (len > 2) {
+                break;
+            }
+            if (status != ESP_GATT_OK) {
+                att_error(link->conn, ATT_READ_TYPE_REQ, attr.handle, status);
+                return;
+            }
+
+            // --- A value of the application is read alone
+            link->req_handle = attr.handle;
+            link->req_offset = 0;
+
+            esp_ble_gatts_cb_param_t param = {
+                .read = {.handle = attr.handle, .need_rsp = true},
+            };
+            att_dispatch(link, ATT_READ_TYPE_REQ, ESP_GATTS_READ_EVT, attr.gatts_if,
+                         &param);
+            return;
+        }
+
+        uint8_t value[ESP_GATT_MAX_ATTR_LEN + ESP_UUID_LEN_128];
+        uint16_t value_len = attr_value(&attr, value);
+
+        const uint16_t value_max = link->mtu - 4 < 253 ? link->mtu - 4 : 253;
+        if (value_len > value_max) {
+            value_len = value_max;
+        }
+
+        if (len > 2 && (pdu[1] != 2 + value_len || len + 2 + value_len > link->mtu)) {
+            break;
+        }
+
+        pdu[1] = 2 + value_len;
+        put_le16(pdu + len, attr.handle);
+        memcpy(pdu + len + 2, value, value_len);
+        len += 2 + value_len;
+    }
+
+    if (len == 2) {
+        att_error(link->conn, ATT_READ_TYPE_REQ, start, ESP_GATT_NOT_FOUND);
+        return;
+    }
+
+    pdu[0] = ATT_READ_TYPE_RSP;
+    att_send(link->conn, &packet, len);
+}
+
+static void att_read_group(hci_link_t *link, uint16_t start, uint16_t end,
+                           const uint8_t *type, uint16_t type_len) {
+    const esp_bt_uuid_t primary = {
+        .len  = ESP_UUID_LEN_16,
+        .uuid = {.uuid16 = ESP_GATT_UUID_PRI_SERVICE},
+    };
+    const esp_bt_uuid_t secondary = {
+        .len  = ESP_UUID_LEN_16,
+        .uuid = {.uuid16 = ESP_GATT_UUID_SEC_SERVICE},
+    };
+
+    if (!uuid_match(&primary, type, type_len) &&
+        !uuid_match(&secondary, type, type_len)) {
+        att_error(link->conn, ATT_READ_GROUP_REQ, start, ESP_GATT_UNSUPPORT_GRP_TYPE);
+        return;
+    }
+
+    tx_packet_t packet = {0};
+    uint8_t *pdu       = packet.data + L2CAP_HDR_LEN;
+    uint16_t len       = 2;
+
+    neil_ble_gatts_host_attr_t attr;
+    for (uint16_t handle = start; handle <= end && attr_next(handle, &attr) &&
+                                  attr.handle <= end;
+         handle = attr.handle + 1) {
+        if (!uuid_match(&attr.uuid, type, type_len)) {
+            continue;
+        }
+
+        const uint8_t size = 4 + attr.len;
+        if (len > 2 && (pdu[1] != size || len + size > link->mtu)) {
+            break;
+        }
+
+        pdu[1] = size;
+        put_le16(pdu + len, attr.handle);
+        put_le16(pdu + len + 2, service_end(attr.handle));
+        memcpy(pdu + len + 4, attr.value, attr.len);
+        len += size;
+    }
+
+    if (len == 2) {
+        att_error(link->conn, ATT_READ_GROUP_REQ, start, ESP_GATT_NOT_FOUND);
+        return;
+    }
+
+    pdu[0] = ATT_READ_GROUP_RSP;
+    att_send(link->conn, &packet, len);
+}
+
+static void att_write(hci_link_t *link, uint8_t opcode, uint16_t handle,
+                      uint16_t offset, uint8_t *value, uint16_t len) {
+    const bool command = opcode == ATT_WRITE_CMD;
+
+    neil_ble_gatts_host_attr_t attr;
+    esp_gatt_status_t status = ESP_GATT_INVALID_HANDLE;
+    if (attr_get(handle, &attr)) {
+        status = attr_access(&attr, true);
+    }
+
+    // --- Prepared writes are assembled by the application
+    if (status == ESP_GATT_OK && attr_served(&attr) && opcode == ATT_PREP_WRITE_REQ) {
+        status = ESP_GATT_REQ_NOT_SUPPORTED;
+    }
+
+    if (status != ESP_GATT_OK) {
+        if (!command) {
+            att_error(link->conn, opcode, handle, status);
+        }
+        return;
+    }
+
+    esp_ble_gatts_cb_param_t param = {
+        .write = {
+            .conn_id  = link->conn,
+            .handle   = handle,
+            .offset   = offset,
+            .need_rsp = !command && !attr_served(&attr),
+            .is_prep  = opcode == ATT_PREP_WRITE_REQ,
+            .len      = len,
+            .value    = value,
+        },
+    };
+    memcpy(param.write.bda, link->bda, ESP_BD_ADDR_LEN);
+
+    if (param.write.need_rsp) {
+        link->req_handle = handle;
+        link->req_offset = offset;
+        if (param.write.is_prep) {
+            link->prep_if = attr.gatts_if;
+        }
+        att_dispatch(link, opcode, ESP_GATTS_WRITE_EVT, attr.gatts_if, &param);
+        return;
+    }
+
+    // --- Stack services keep their values, served ones are stored on delivery
+    if (attr.handle >= NEIL_BLE_GATTS_HOST_HANDLE_BASE) {
+        neil_ble_gatts_host_gatts_event(ESP_GATTS_WRITE_EVT, attr.gatts_if, &param);
+    }
+
+    if (!command) {
+        tx_packet_t packet = {0};
+        packet.data[L2CAP_HDR_LEN] = ATT_WRITE_RSP;
+        att_send(link->conn, &packet, 1);
+    }
+}
+
+static void att_exec_write(hci_link_t *link, uint8_t flags) {
+    if (link->prep_if == ESP_GATT_IF_NONE) {
+        tx_packet_t packet = {0};
+        packet.data[L2CAP_HDR_LEN] = ATT_EXEC_WRITE_RSP;
+        att_send(link->conn, &packet, 1);
+        return;
+    }
+
+    const esp_gatt_if_t gatts_if = link->prep_if;
+    link->prep_if                = ESP_GATT_IF_NONE;
+    link->req_handle             = 0;
+
+    esp_ble_gatts_cb_param_t param = {
+        .exec_write = {.exec_write_flag = flags},
+    };
+    att_dispatch(link, ATT_EXEC_WRITE_REQ, ESP_GATTS_EXEC_WRITE_EVT, gatts_if, &param);
+}
+
+static void att_mtu(hci_link_t *link, uint16_t client_mtu) {
+    uint16_t mtu = client_mtu < hci.local_mtu ? client_mtu : hci.local_mtu;
+    if (mtu < ESP_GATT_DEF_BLE_MTU_SIZE) {
+        mtu = ESP_GATT_DEF_BLE_MTU_SIZE;
+    }
+
+    tx_packet_t packet = {0};
+    uint8_t *pdu       = packet.data + L2CAP_HDR_LEN;
+
+    pdu[0] = ATT_MTU_RSP;
+    put_le16(pdu + 1, hci.local_mtu);
+    att_send(link->conn, &packet, 3);
+
+    pthread_mutex_lock(&hci.lock);
+    link->mtu = mtu;
+    pthread_mutex_unlock(&hci.lock);
+
+    neil_ble_gatts_host_set_mtu(link->conn, mtu);
+}
+
+static void att_receive(hci_link_t *link, uint8_t *pdu, uint16_t len) {
+    if (len == 0) {
+        return;
+    }
+
+    const uint8_t opcode = pdu[0];
+
+    // --- Fixed-size requests
+    static const uint8_t sizes[] = {
+        [ATT_MTU_REQ] = 3,       [ATT_FIND_INFO_REQ] = 5, [ATT_FIND_TYPE_REQ] = 7,
+        [ATT_READ_TYPE_REQ] = 7, [ATT_READ_REQ] = 3,      [ATT_READ_BLOB_REQ] = 5,
+        [ATT_READ_GROUP_REQ] = 7, [ATT_WRITE_REQ] = 3,    [ATT_PREP_WRITE_REQ] = 5,
+        [ATT_EXEC_WRITE_REQ] = 2,
+    };
+    const uint8_t min = opcode < sizeof(sizes) ? sizes[opcode] : 0;
+
+    if (len < min) {
+        att_error(link->conn, opcode, 0, ESP_GATT_INVALID_PDU);
+        return;
+    }
+
+    const uint16_t start = len >= 5 ? get_le16(pdu + 1) : 0;
+    const uint16_t end   = len >= 5 ? get_le16(pdu + 3) : 0;
+
+    // --- Handle ranges
+    if ((opcode == ATT_FIND_INFO_REQ || opcode == ATT_FIND_TYPE_REQ ||
+         opcode == ATT_READ_TYPE_REQ || opcode == ATT_READ_GROUP_REQ) &&
+        (start == 0 || start > end)) {
+        att_error(link->conn, opcode, start, ESP_GATT_INVALID_HANDLE);
+        return;
+    }
+
+    switch (opcode) {
+    case ATT_MTU_REQ:
+        att_mtu(link, get_le16(pdu + 1));
+        break;
+
+    case ATT_FIND_INFO_REQ:
+        att_find_info(link, start, end);
+        break;
+
+    case ATT_FIND_TYPE_REQ:
+        att_find_type(link, start, end, get_le16(pdu + 5), pdu + 7, len - 7);
+        break;
+
+    case ATT_READ_TYPE_REQ:
+        att_read_type(link, start, end, pdu + 5, len - 5);
+        break;
+
+    case ATT_READ_GROUP_REQ:
+        att_read_group(link, start, end, pdu + 5, len - 5);
+        break;
+
+    case ATT_READ_REQ:
+        att_read(link, opcode, get_le16(pdu + 1), 0);
+        break;
+
+    case ATT_READ_BLOB_REQ:
+        att_read(link, opcode, get_le16(pdu + 1), get_le16(pdu + 3));
+        break;
+
+    case ATT_WRITE_REQ:
+    case ATT_WRITE_CMD:
+        if (len >= 3) {
+            att_write(link, opcode, get_le16(pdu + 1), 0, pdu + 3, len - 3);
+        }
+        break;
+
+    case ATT_PREP_WRITE_REQ:
+        att_write(link, opcode, get_le16(pdu + 1), get_le16(pdu + 3), pdu + 5,
+                  len - 5);
+        break;
+
+    case ATT_EXEC_WRITE_REQ:
+        att_exec_write(link, pdu[1]);
+        break;
+
+    case ATT_CONFIRM:
+        break;
+
+    default:
+        // --- Commands go unanswered
+        if (!(opcode & ATT_COMMAND_FLAG)) {
+            att_error(link->conn, opcode, 0, ESP_GATT_REQ_NOT_SUPPORTED);
+        }
+        break;
+    }
+}
+
+// -------------------------------------------------------------
+// Stack Observation
+// -------------------------------------------------------------
+
+/**
+ * @brief       Answer a request of the application's attributes.
+ */
+static void tx_response(const neil_ble_gatts_host_tx_t *tx) {
+    pthread_mutex_lock(&hci.lock);
+
+    hci_link_t *link = link_find(tx->conn_id);
+    if (link == NULL || link->req_opcode == 0 || link->trans_id != tx->trans_id) {
+        pthread_mutex_unlock(&hci.lock);
+        return;
+    }
+
+    const uint8_t opcode  = link->req_opcode;
+    const uint16_t handle = link->req_handle;
+    const uint16_t offset = link->req_offset;
+    const uint16_t mtu    = link->mtu;
+    link->req_opcode      = 0;
+
+    pthread_mutex_unlock(&hci.lock);
+
+    if (tx->status != ESP_GATT_OK) {
+        att_error(tx->conn_id, opcode, handle, tx->status);
+        return;
+    }
+
+    tx_packet_t packet = {0};
+    uint8_t *pdu       = packet.data + L2CAP_HDR_LEN;
+    uint16_t len       = tx->value != NULL ? tx->len : 0;
+    uint16_t size      = 1;
+
+    switch (opcode) {
+    case ATT_READ_REQ:
+    case ATT_READ_BLOB_REQ:
+        pdu[0] = opcode == ATT_READ_REQ ? ATT_READ_RSP : ATT_READ_BLOB_RSP;
+        len    = len < mtu - 1 ? len : mtu - 1;
+        memcpy(pdu + 1, tx->value, len);
+        size += len;
+        break;
+
+    case ATT_READ_TYPE_REQ:
+        len    = len < mtu - 4 ? len : mtu - 4;
+        len    = len < 253 ? len : 253;
+        pdu[0] = ATT_READ_TYPE_RSP;
+        pdu[1] = 2 + len;
+        put_le16(pdu + 2, handle);
+        memcpy(pdu + 4, tx->value, len);
+        size += 3 + len;
+        break;
+
+    case ATT_WRITE_REQ:
+        pdu[0] = ATT_WRITE_RSP;
+        break;
+
+    case ATT_PREP_WRITE_REQ:
+        len    = len < mtu - 5 ? len : mtu - 5;
+        pdu[0] = ATT_PREP_WRITE_RSP;
+        put_le16(pdu + 1, handle);
+        put_le16(pdu + 3, offset);
+        memcpy(pdu + 5, tx->value, len);
+        size += 4 + len;
+        break;
+
+    case ATT_EXEC_WRITE_REQ:
+        pdu[0] = ATT_EXEC_WRITE_RSP;
+        break;
+
+    default:
+        return;
+    }
+
+    att_send(tx->conn_id, &packet, size);
+}
+
+static void tx_notify(const neil_ble_gatts_host_tx_t *tx) {
+    pthread_mutex_lock(&hci.lock);
+    const hci_link_t *link = link_find(tx->conn_id);
+    const uint16_t mtu     = link != NULL ? link->mtu : 0;
+    pthread_mutex_unlock(&hci.lock);
+
+    if (mtu == 0) {
+        return;
+    }
+
+    // --- Values longer than the MTU are truncated, as Bluedroid does
+    const uint16_t len = tx->len < mtu - 3 ? tx->len : mtu - 3;
+
+    tx_packet_t packet = {.notify = tx->handle};
+    uint8_t *pdu       = packet.data + L2CAP_HDR_LEN;
+
+    pdu[0] = ATT_NOTIFY;
+    put_le16(pdu + 1, tx->handle);
+    memcpy(pdu + 3, tx->value, len);
+    att_send(tx->conn_id, &packet, 3 + len);
+}
+
+/**
+ * @brief       Transmission observer, on the task handing it to the stack.
+ */
+static void tx_observe(const neil_ble_gatts_host_tx_t *tx, void *arg) {
+    switch (tx->kind) {
+    case NEIL_BLE_GATTS_HOST_TX_RESPONSE:
+        tx_response(tx);
+        break;
+
+    case NEIL_BLE_GATTS_HOST_TX_NOTIFY:
+        tx_notify(tx);
+        break;
+
+    case NEIL_BLE_GATTS_HOST_TX_ADV_START:
+        adv_start();
+        break;
+
+    case NEIL_BLE_GATTS_HOST_TX_ADV_STOP:
+        tx_cmd(HCI_LE_SET_ADV_ENABLE, (const uint8_t[]){0x00}, 1);
+        break;
+
+    case NEIL_BLE_GATTS_HOST_TX_DISCONNECT: {
+        uint8_t params[3] = {0, 0, ESP_GATT_CONN_TERMINATE_PEER_USER};
+        put_le16(params, tx->conn_id);
+        tx_cmd(HCI_DISCONNECT, params, sizeof(params));
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+// -------------------------------------------------------------
+// L2CAP
+// -------------------------------------------------------------
+
+static void sig_receive(hci_link_t *link, const uint8_t *cmd, uint16_t len) {
+    if (len < 4) {
+        return;
+    }
+
+    const uint8_t code = cmd[0];
+    const uint8_t id   = cmd[1];
+
+    tx_packet_t packet = {0};
+    uint8_t *rsp       = packet.data + L2CAP_HDR_LEN;
+
+    switch (code) {
+    // --- Responses need no answer
+    case SIG_CMD_REJECT:
+    case SIG_DISCONN_RSP:
+    case SIG_CONN_PARAM_RSP:
+    case SIG_LE_CONN_RSP:
+    case SIG_ECRED_CONN_RSP:
+    case SIG_ECRED_RECONF_RSP:
+        return;
+
+    // --- No channel server: refused
+    case SIG_LE_CONN_REQ:
+        rsp[0] = SIG_LE_CONN_RSP;
+        rsp[1] = id;
+        put_le16(rsp + 2, 10);
+        put_le16(rsp + 12, SIG_LE_SPSM_UNSUPPORTED);
+        tx_l2cap(&packet, link->conn, L2CAP_CID_SIG, 14);
+        return;
+
+    default:
+        rsp[0] = SIG_CMD_REJECT;
+        rsp[1] = id;
+        put_le16(rsp + 2, 2);
+        put_le16(rsp + 4, 0x0000); // Command not understood
+        tx_l2cap(&packet, link->conn, L2CAP_CID_SIG, 6);
+        return;
+    }
+}
+
+static void smp_receive(hci_link_t *link, const uint8_t *cmd, uint16_t len) {
+    if (len < 1 || (cmd[0] != SMP_PAIRING_REQ && cmd[0] != SMP_SECURITY_REQ)) {
+        return;
+    }
+
+    tx_packet_t packet = {0};
+    uint8_t *rsp       = packet.data + L2CAP_HDR_LEN;
+
+    rsp[0] = SMP_PAIRING_FAILED;
+    rsp[1] = SMP_PAIRING_NOT_SUPPORTED;
+    tx_l2cap(&packet, link->conn, L2CAP_CID_SMP, 2);
+}
+
+static void l2cap_receive(hci_link_t *link) {
+    const uint16_t len = get_le16(link->rx);
+    const uint16_t cid = get_le16(link->rx + 2);
+    uint8_t *payload   = link->rx + L2CAP_HDR_LEN;
+
+    switch (cid) {
+    case L2CAP_CID_ATT:
+        att_receive(link, payload, len);
+        break;
+    case L2CAP_CID_SIG:
+        sig_receive(link, payload, len);
+        break;
+    case L2CAP_CID_SMP:
+        smp_receive(link, payload, len);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief       Reassemble L2CAP PDUs from ACL packets.
+ */
+static void acl_receive(const uint8_t *packet, uint16_t len) {
+    const uint16_t conn  = get_le16(packet) & 0x0FFF;
+    const uint8_t flags  = get_le16(packet) >> 12 & 0x03;
+    const uint8_t *data  = packet + 4;
+    const uint16_t count = get_le16(packet + 2);
+
+    if (count + 4 > len) {
+        return;
+    }
+
+    // NOTE: Links only change on this task, so they are used unlocked here.
+    pthread_mutex_lock(&hci.lock);
+    hci_link_t *link = link_find(conn);
+    pthread_mutex_unlock(&hci.lock);
+
+    if (link == NULL) {
+        return;
+    }
+
+    if (flags != ACL_CONT) {
+        link->rx_len  = 0;
+        link->rx_drop = false;
+    }
+
+    if (link->rx_drop || link->rx_len + count > PDU_MAX) {
+        link->rx_drop = true;
+        return;
+    }
+
+    memcpy(link->rx + link->rx_len, data, count);
+    link->rx_len += count;
+
+    if (link->rx_len >= L2CAP_HDR_LEN &&
+        link->rx_len >= L2CAP_HDR_LEN + get_le16(link->rx)) {
+        l2cap_receive(link);
+        link->rx_len = 0;
+    }
+}
+
+// -------------------------------------------------------------
+// Events
+// -------------------------------------------------------------
+
+static void le_conn_complete(const uint8_t *ev, uint8_t len) {
+    // status, handle, role, peer type, peer address, interval, latency, timeout
+    if (len < 18 || ev[0] != 0) {
+        return;
+    }
+
+    const uint16_t conn = get_le16(ev + 1);
+
+    // --- Central role links are not served
+    if (ev[3] != 0x01) {
+        return;
+    }
+
+    esp_bd_addr_t bda;
+    for (int i = 0; i < ESP_BD_ADDR_LEN; i++) {
+        bda[i] = ev[5 + ESP_BD_ADDR_LEN - 1 - i];
+    }
+
+    pthread_mutex_lock(&hci.lock);
+
+    hci_link_t *link = NULL;
+    for (size_t i = 0; link == NULL && i < CONFIG_BT_ACL_CONNECTIONS; i++) {
+        if (!hci.links[i].used) {
+            link = hci.links + i;
+        }
+    }
+    if (link != NULL) {
+        memset(link, 0, sizeof(*link));
+        link->used = true;
+        link->conn = conn;
+        link->mtu  = ESP_GATT_DEF_BLE_MTU_SIZE;
+        memcpy(link->bda, bda, ESP_BD_ADDR_LEN);
+    }
+
+    pthread_mutex_unlock(&hci.lock);
+
+    if (link == NULL) {
+        ESP_LOGW(TAG, "No link left for connection 0x%04x", conn);
+        uint8_t params[3] = {0, 0, ESP_GATT_CONN_TERMINATE_LOCAL_HOST};
+        put_le16(params, conn);
+        tx_cmd(HCI_DISCONNECT, params, sizeof(params));
+        return;
+    }
+
+    ESP_LOGI(TAG, "Connected 0x%04x to %02x:%02x:%02x:%02x:%02x:%02x", conn, bda[0],
+             bda[1], bda[2], bda[3], bda[4], bda[5]);
+
+    neil_ble_gatts_host_connect(conn, bda);
+}
+
+static void disconn_complete(const uint8_t *ev, uint8_t len) {
+    // status, handle, reason
+    if (len < 4 || ev[0] != 0) {
+        return;
+    }
+
+    const uint16_t conn = get_le16(ev + 1);
+
+    pthread_mutex_lock(&hci.lock);
+
+    hci_link_t *link = link_find(conn);
+    if (link != NULL) {
+        // --- Packets the controller held are flushed, their buffers free
+        hci.acl_credits += link->acl_sent;
+        link->used = false;
+        pthread_cond_broadcast(&hci.cond);
+    }
+
+    pthread_mutex_unlock(&hci.lock);
+
+    if (link != NULL) {
+        ESP_LOGI(TAG, "Disconnected 0x%04x (reason 0x%02x)", conn, ev[3]);
+        neil_ble_gatts_host_disconnect(conn, ev[3]);
+    }
+}
+
+static void event_receive(const uint8_t *packet, uint8_t len) {
+    const uint8_t code = packet[0];
+    const uint8_t *ev  = packet + 2;
+    const uint8_t plen = packet[1];
+
+    if (plen + 2 > len) {
+        return;
+    }
+
+    switch (code) {
+    case HCI_EV_CMD_COMPLETE:
+    case HCI_EV_CMD_STATUS: {
+        // Complete: credits, opcode, parameters. Status: status, credits, opcode.
+        const bool complete   = code == HCI_EV_CMD_COMPLETE;
+        const uint8_t at      = complete ? 1 : 2;
+        if (plen < at + 2) {
+            break;
+        }
+        const uint16_t opcode = get_le16(ev + at);
+
+        pthread_mutex_lock(&hci.lock);
+        if (opcode != 0 && opcode == hci.cmd_opcode &&
+            (complete || ev[0] != 0 || opcode == HCI_DISCONNECT)) {
+            hci.cmd_rsp_len = complete ? plen - 3 : 1;
+            if (hci.cmd_rsp_len > sizeof(hci.cmd_rsp)) {
+                hci.cmd_rsp_len = sizeof(hci.cmd_rsp);
+            }
+            memcpy(hci.cmd_rsp, complete ? ev + 3 : ev, hci.cmd_rsp_len);
+            hci.cmd_done = true;
+            pthread_cond_broadcast(&hci.cond);
+        }
+        pthread_mutex_unlock(&hci.lock);
+        break;
+    }
+
+    case HCI_EV_NUM_COMPLETED: {
+        const uint8_t count = ev[0];
+        if (plen < 1 + count * 4) {
+            break;
+        }
+
+        pthread_mutex_lock(&hci.lock);
+        for (uint8_t i = 0; i < count; i++) {
+            const uint16_t conn = get_le16(ev + 1 + i * 4) & 0x0FFF;
+            const uint16_t done = get_le16(ev + 3 + i * 4);
+
+            hci_link_t *link = link_find(conn);
+            if (link != NULL) {
+                link->acl_sent -= done < link->acl_sent ? done : link->acl_sent;
+                hci.acl_credits += done;
+            }
+        }
+        pthread_cond_broadcast(&hci.cond);
+        pthread_mutex_unlock(&hci.lock);
+        break;
+    }
+
+    case HCI_EV_DISCONN_COMPLETE:
+        disconn_complete(ev, plen);
+        break;
+
+    case HCI_EV_LE_META:
+        if (plen > 0 && ev[0] == HCI_LE_CONN_COMPLETE) {
+            le_conn_complete(ev + 1, plen - 1);
+        }
+        break;
+
+    case HCI_EV_HW_ERROR:
+        ESP_LOGE(TAG, "Controller hardware error 0x%02x", plen > 0 ? ev[0] : 0);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief       Split the H4 stream into packets.
+ */
+static void rx_task(void *arg) {
+    static uint8_t buf[2 * (5 + PDU_MAX)];
+    size_t len = 0;
+
+    for (;;) {
+        const ssize_t n = read(hci.fd, buf + len, sizeof(buf) - len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ESP_LOGE(TAG, "Controller closed the transport");
+            exit(1);
+        }
+        len += n;
+
+        size_t at = 0;
+        while (at < len) {
+            const uint8_t *packet = buf + at + 1;
+            const size_t avail    = len - at - 1;
+            size_t size           = 0;
+
+            if (buf[at] == H4_EVENT && avail >= 2) {
+                size = 2 + packet[1];
+            } else if (buf[at] == H4_ACL && avail >= 4) {
+                size = 4 + get_le16(packet + 2);
+            } else if (buf[at] != H4_EVENT && buf[at] != H4_ACL) {
+                ESP_LOGE(TAG, "Unexpected H4 packet type 0x%02x", buf[at]);
+                exit(1);
+            }
+
+            if (size == 0 || avail < size) {
+                break;
+            }
+
+            if (buf[at] == H4_EVENT) {
+                event_receive(packet, size);
+            } else {
+                acl_receive(packet, size);
+            }
+            at += 1 + size;
+        }
+
+        memmove(buf, buf + at, len - at);
+        len -= at;
+
+        if (len == sizeof(buf)) {
+            ESP_LOGE(TAG, "H4 packet exceeds %zu bytes", sizeof(buf));
+            exit(1);
+        }
+    }
+}
+
+// -------------------------------------------------------------
+// Transport
+// -------------------------------------------------------------
+
+// --- Linux <bluetooth/hci.h>
+#define BTPROTO_HCI      1
+#define HCI_CHANNEL_USER 1
+
+struct sockaddr_hci {
+    sa_family_t hci_family;
+    unsigned short hci_dev;
+    unsigned short hci_channel;
+};
+
+static int transport_open(const neil_ble_gatts_host_hci_opts_t *opts) {
+    if (opts->h4_path != NULL) {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        if (strlen(opts->h4_path) >= sizeof(addr.sun_path)) {
+            return -1;
+        }
+        strcpy(addr.sun_path, opts->h4_path);
+
+        const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    const struct sockaddr_hci addr = {
+        .hci_family  = AF_BLUETOOTH,
+        .hci_dev     = opts->hci_dev,
+        .hci_channel = HCI_CHANNEL_USER,
+    };
+
+    const int fd = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC, BTPROTO_HCI);
+    if (fd >= 0 && bind(fd, (const struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief       Reset the controller and learn its buffers.
+ */
+static esp_err_t controller_setup(void) {
+    // --- Disconnection, hardware error, LE meta
+    static const uint8_t event_mask[8]    = {0x10, 0x80, 0, 0, 0, 0, 0, 0x20};
+    // --- LE connection complete, connection update complete
+    static const uint8_t le_event_mask[8] = {0x05};
+
+    uint8_t rsp[8] = {0};
+
+    if (cmd_send(HCI_RESET, NULL, 0, NULL, 0) != 0 ||
+        cmd_send(HCI_SET_EVENT_MASK, event_mask, 8, NULL, 0) != 0 ||
+        cmd_send(HCI_LE_SET_EVENT_MASK, le_event_mask, 8, NULL, 0) != 0 ||
+        cmd_send(HCI_LE_READ_BUFFER_SIZE, NULL, 0, rsp, sizeof(rsp)) != 0) {
+        return ESP_FAIL;
+    }
+
+    hci.acl_len     = get_le16(rsp + 1);
+    hci.acl_credits = rsp[3];
+
+    // --- Buffers shared with BR/EDR
+    if (hci.acl_len == 0 || hci.acl_credits == 0) {
+        if (cmd_send(HCI_READ_BUFFER_SIZE, NULL, 0, rsp, sizeof(rsp)) != 0) {
+            return ESP_FAIL;
+        }
+        hci.acl_len     = get_le16(rsp + 1);
+        hci.acl_credits = get_le16(rsp + 4);
+    }
+
+    if (hci.acl_len == 0 || hci.acl_credits == 0 ||
+        cmd_send(HCI_READ_BD_ADDR, NULL, 0, rsp, sizeof(rsp)) != 0) {
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Controller %02x:%02x:%02x:%02x:%02x:%02x, %u ACL buffers of %u B",
+             rsp[6], rsp[5], rsp[4], rsp[3], rsp[2], rsp[1], hci.acl_credits,
+             hci.acl_len);
+
+    return ESP_OK;
+}
+
+esp_err_t neil_ble_gatts_host_hci_start(const neil_ble_gatts_host_hci_opts_t *opts) {
+    if (hci.fd >= 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    hci.local_mtu = opts->mtu != 0 ? opts->mtu : ESP_GATT_MAX_MTU_SIZE;
+    if (hci.local_mtu < ESP_GATT_DEF_BLE_MTU_SIZE ||
+        hci.local_mtu > ESP_GATT_MAX_MTU_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    hci.fd = transport_open(opts);
+    if (hci.fd < 0 && opts->h4_path != NULL) {
+        ESP_LOGE(TAG, "Cannot open %s: %s", opts->h4_path, strerror(errno));
+        return ESP_FAIL;
+    }
+    if (hci.fd < 0) {
+        ESP_LOGE(TAG, "Cannot open hci%u: %s", opts->hci_dev, strerror(errno));
+        return ESP_FAIL;
+    }
+
+    hci.tx_queue = xQueueCreate(TX_QUEUE_LEN, sizeof(tx_packet_t));
+
+    if (hci.tx_queue == NULL ||
+        xTaskCreate(rx_task, "HCI_RX", TASK_STACK, NULL, 20, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t ret = controller_setup();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Controller setup failed");
+        return ret;
+    }
+
+    // --- From here on the controller carries links and completes notifications
+    neil_ble_gatts_host_set_auto_conf(false);
+    neil_ble_gatts_host_set_auto_link(false);
+    neil_ble_gatts_host_set_tx_cb(tx_observe, NULL);
+
+    if (xTaskCreate(tx_task, "HCI_TX", TASK_STACK, NULL, 20, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
@@ -0,0 +1,179 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_host_main.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Host (Linux) entry-point.
+///
+///             Runs `app_main` on a main task, as the ESP-IDF startup code
+///             does, then serves the application until killed, exits (for
+///             applications done once `app_main` returns), or replays a trace
+///             through it. Served through a controller (`--h4`, `--hci`),
+///             the application is reachable by real centrals:
+///
+///                 <app> [--exit | --replay TRACE [--hex] [--realtime]
+///                        [--repeat N] [--report FILE]
+///                        | (--h4 PATH | --hci N) [--mtu N]]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "neil_ble_gatts_host.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Time given to the application to settle after `app_main` returns.
+#define SETTLE_TIMEOUT pdMS_TO_TICKS(5000)
+
+/// Logging tag.
+static const char *TAG = "NEIL BLE GATTS Host";
+
+// -------------------------------------------------------------
+// Main Task
+// -------------------------------------------------------------
+
+static SemaphoreHandle_t main_done;
+
+static void main_task(void *arg) {
+    app_main();
+
+    // --- `app_main` may return on the target, the main task then ends
+    xSemaphoreGive(main_done);
+    vTaskDelete(NULL);
+}
+
+// -------------------------------------------------------------
+// Options
+// -------------------------------------------------------------
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [--exit | --replay TRACE [--hex] [--realtime] [--repeat N]"
+            " [--report FILE] | (--h4 PATH | --hci N) [--mtu N]]\n"
+            "\n"
+            "  --exit          exit once app_main returns\n"
+            "  --replay TRACE  replay an exported trace, print a JSON report\n"
+            "  --hex           TRACE is a log holding \"TRACE <hex>\" lines\n"
+            "  --realtime      keep the recorded spacing of events\n"
+            "  --repeat N      passes over the trace (default 1)\n"
+            "  --report FILE   also write the report to FILE\n"
+            "  --h4 PATH       serve through the controller on an H4 socket\n"
+            "                  (btvirt -s: /tmp/bt-server-le)\n"
+            "  --hci N         serve through controller hciN (user channel)\n"
+            "  --mtu N         ATT MTU offered to centrals (default 517)\n",
+            name);
+}
+
+static int options_parse(int argc, char **argv, bool *exit_done,
+                         neil_ble_gatts_host_replay_opts_t *opts,
+                         neil_ble_gatts_host_hci_opts_t *hci, bool *hci_used) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg   = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--replay") == 0 && value != NULL) {
+            opts->trace_path = value;
+            i++;
+        } else if (strcmp(arg, "--report") == 0 && value != NULL) {
+            opts->report_path = value;
+            i++;
+        } else if (strcmp(arg, "--repeat") == 0 && value != NULL) {
+            opts->repeat = strtoul(value, NULL, 0);
+            i++;
+        } else if (strcmp(arg, "--h4") == 0 && value != NULL) {
+            hci->h4_path = value;
+            *hci_used    = true;
+            i++;
+        } else if (strcmp(arg, "--hci") == 0 && value != NULL) {
+            hci->hci_dev = strtoul(value, NULL, 0);
+            *hci_used    = true;
+            i++;
+        } else if (strcmp(arg, "--mtu") == 0 && value != NULL) {
+            hci->mtu = strtoul(value, NULL, 0);
+            i++;
+        } else if (strcmp(arg, "--exit") == 0) {
+            *exit_done = true;
+        } else if (strcmp(arg, "--hex") == 0) {
+            opts->hex = true;
+        } else if (strcmp(arg, "--realtime") == 0) {
+            opts->realtime = true;
+        } else {
+            return 1;
+        }
+    }
+
+    const bool replay_opts =
+        opts->hex || opts->realtime || opts->repeat > 0 || opts->report_path != NULL;
+
+    // --- Replay options without a trace, or a replay beside exit
+    if ((replay_opts && opts->trace_path == NULL) ||
+        (*exit_done && opts->trace_path != NULL)) {
+        return 1;
+    }
+
+    // --- A controller carries the links, nothing else may inject them
+    if ((hci->mtu != 0 && !*hci_used) ||
+        (*hci_used && (*exit_done || opts->trace_path != NULL))) {
+        return 1;
+    }
+
+    return 0;
+}
+
+// -------------------------------------------------------------
+// Entry-Point
+// -------------------------------------------------------------
+
+int main(int argc, char **argv) {
+    neil_ble_gatts_host_replay_opts_t opts = {0};
+    neil_ble_gatts_host_hci_opts_t hci     = {0};
+    bool exit_done                         = false;
+    bool hci_used                          = false;
+
+    if (options_parse(argc, argv, &exit_done, &opts, &hci, &hci_used) != 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (hci_used && neil_ble_gatts_host_hci_start(&hci) != ESP_OK) {
+        return 1;
+    }
+
+    main_done = xSemaphoreCreateBinary();
+    if (main_done == NULL ||
+        xTaskCreate(main_task, "main", CONFIG_ESP_MAIN_TASK_STACK_SIZE, NULL, 1,
+                    NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Cannot start the main task");
+        return 1;
+    }
+
+    xSemaphoreTake(main_done, portMAX_DELAY);
+
+    if (exit_done) {
+        return 0;
+    }
+
+    // --- Serve until killed, as a device would
+    if (opts.trace_path == NULL) {
+        for (;;) {
+            vTaskDelay(portMAX_DELAY);
+        }
+    }
+
+    if (neil_ble_gatts_host_settle(SETTLE_TIMEOUT) != ESP_OK) {
+        ESP_LOGW(TAG, "Application still busy, replaying anyway");
+    }
+
+    return neil_ble_gatts_host_replay(&opts);
+}
@@ -0,0 +1,731 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_host_replay.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Trace replay.
+///
+///             Records of an exported trace (neil_ble_gatts_trace.h) are
+///             turned back into GATTS events and delivered to the running
+///             application, timing each callback. A record keeps the event,
+///             connection, handle and length, so the rest is rebuilt:
+///
+///             - Written values are zeros of the recorded length, except
+///               client configurations, which subscribe (0x0001).
+///             - Writes are acknowledged unless the characteristic only
+///               allows writes without response.
+///             - Writes followed by an execute on their connection are
+///               prepared writes, at running offsets.
+///             - Reads continue a long read (blob) while the previous
+///               response on the handle filled the ATT MTU.
+///
+///             Events the stack raises itself in answer to the application
+///             (registration, tables, service start, responses) are raised
+///             again by the replacement stack, and GAP events are numbered
+///             differently across ESP-IDF configurations; both are skipped
+///             and counted.
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_gatts_api.h"
+#include "esp_log.h"
+
+#include "neil_ble_gatts_host.h"
+#include "neil_ble_gatts_trace.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Event slots of the report (esp_gatts_cb_event_t values).
+#define EVENT_SLOTS (ESP_GATTS_SEND_SERVICE_CHANGE_EVT + 1)
+
+/// Connections followed at once (trace connection IDs are small).
+#define CONN_MAX 16
+
+/// Logging tag.
+static const char *TAG = "NEIL BLE GATTS Replay";
+
+static const char *const event_names[EVENT_SLOTS] = {
+    [ESP_GATTS_REG_EVT]            = "REG",
+    [ESP_GATTS_READ_EVT]           = "READ",
+    [ESP_GATTS_WRITE_EVT]          = "WRITE",
+    [ESP_GATTS_EXEC_WRITE_EVT]     = "EXEC_WRITE",
+    [ESP_GATTS_MTU_EVT]            = "MTU",
+    [ESP_GATTS_CONF_EVT]           = "CONF",
+    [ESP_GATTS_UNREG_EVT]          = "UNREG",
+    [ESP_GATTS_START_EVT]          = "START",
+    [ESP_GATTS_STOP_EVT]           = "STOP",
+    [ESP_GATTS_CONNECT_EVT]        = "CONNECT",
+    [ESP_GATTS_DISCONNECT_EVT]     = "DISCONNECT",
+    [ESP_GATTS_CONGEST_EVT]        = "CONGEST",
+    [ESP_GATTS_RESPONSE_EVT]       = "RESPONSE",
+    [ESP_GATTS_CREAT_ATTR_TAB_EVT] = "CREAT_ATTR_TAB",
+};
+
+// -------------------------------------------------------------
+// Trace Loading
+// -------------------------------------------------------------
+
+typedef struct {
+    neil_ble_gatts_trace_hdr_t hdr;
+    neil_ble_gatts_trace_rec_t *recs;
+    uint16_t count; ///< Records present (a cut trace holds fewer than `hdr`).
+} trace_t;
+
+static int hex_digit(int c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/**
+ * @brief       Collect the bytes of "TRACE <hex>" lines of a log, in place.
+ */
+static size_t hex_log_decode(uint8_t *data, size_t len) {
+    size_t out = 0;
+    size_t at  = 0;
+
+    while (at < len) {
+        size_t eol = at;
+        while (eol < len && data[eol] != '\n') {
+            eol++;
+        }
+
+        // --- Bytes after the marker, up to the end of the line
+        const char *marker = memmem(data + at, eol - at, "TRACE ", 6);
+        if (marker != NULL) {
+            size_t pos = (const uint8_t *)marker - data + 6;
+            int high   = -1;
+
+            for (; pos < eol; pos++) {
+                const int digit = hex_digit(data[pos]);
+                if (digit < 0) {
+                    continue;
+                }
+                if (high < 0) {
+                    high = digit;
+                } else {
+                    data[out++] = high << 4 | digit;
+                    high        = -1;
+                }
+            }
+        }
+
+        at = eol + 1;
+    }
+
+    return out;
+}
+
+static int trace_load(const char *path, bool hex, trace_t *trace) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        ESP_LOGE(TAG, "Cannot open %s", path);
+        return 1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *data = malloc(size > 0 ? size : 1);
+    size_t len    = data != NULL ? fread(data, 1, size, file) : 0;
+    fclose(file);
+
+    if (data == NULL) {
+        return 1;
+    }
+
+    if (hex) {
+        len = hex_log_decode(data, len);
+    }
+
+    if (len < sizeof(trace->hdr)) {
+        ESP_LOGE(TAG, "Trace shorter than its header (%zu bytes)", len);
+        free(data);
+        return 1;
+    }
+
+    memcpy(&trace->hdr, data, sizeof(trace->hdr));
+
+    if (trace->hdr.magic != NEIL_BLE_GATTS_TRACE_MAGIC ||
+        trace->hdr.version != NEIL_BLE_GATTS_TRACE_VERSION ||
+        trace->hdr.record_size != sizeof(neil_ble_gatts_trace_rec_t)) {
+        ESP_LOGE(TAG, "Not a version %d trace (magic 0x%08" PRIx32 ", version %d)",
+                 NEIL_BLE_GATTS_TRACE_VERSION, trace->hdr.magic, trace->hdr.version);
+        free(data);
+        return 1;
+    }
+
+    const size_t present = (len - sizeof(trace->hdr)) / sizeof(*trace->recs);
+    trace->count = present < trace->hdr.count ? present : trace->hdr.count;
+
+    if (trace->count < trace->hdr.count) {
+        ESP_LOGW(TAG, "Trace cut short: %u of %u records", trace->count,
+                 trace->hdr.count);
+    }
+
+    trace->recs = malloc((trace->count > 0 ? trace->count : 1) * sizeof(*trace->recs));
+    if (trace->recs == NULL) {
+        free(data);
+        return 1;
+    }
+    memcpy(trace->recs, data + sizeof(trace->hdr), trace->count * sizeof(*trace->recs));
+
+    free(data);
+    return 0;
+}
+
+// -------------------------------------------------------------
+// Statistics
+// -------------------------------------------------------------
+
+typedef struct {
+    int64_t *ns; ///< Callback time of each delivery.
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t device_us; ///< Recorded handler time, summed.
+    uint32_t device_max_us;
+} event_stats_t;
+
+static void stats_add(event_stats_t *stats, int64_t ns, uint16_t device_us) {
+    if (stats->count == stats->capacity) {
+        const uint32_t capacity = stats->capacity > 0 ? stats->capacity * 2 : 64;
+        int64_t *grown          = realloc(stats->ns, capacity * sizeof(int64_t));
+        if (grown == NULL) {
+            return;
+        }
+        stats->ns       = grown;
+        stats->capacity = capacity;
+    }
+
+    stats->ns[stats->count++] = ns;
+    stats->device_us += device_us;
+    if (device_us > stats->device_max_us) {
+        stats->device_max_us = device_us;
+    }
+}
+
+static int ns_compare(const void *a, const void *b) {
+    const int64_t x = *(const int64_t *)a;
+    const int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// -------------------------------------------------------------
+// Replay State
+// -------------------------------------------------------------
+
+typedef struct {
+    bool open;
+    uint16_t conn_id;
+    uint16_t mtu;
+
+    // --- Last read response, to follow long reads
+    uint16_t read_handle;
+    uint16_t read_offset;
+    uint16_t read_len;
+    bool read_answered;
+
+    uint16_t prep_offset; ///< Next offset of a prepared write.
+} replay_conn_t;
+
+static struct {
+    replay_conn_t conns[CONN_MAX];
+    uint32_t trans_id;
+    uint32_t responses;
+} replay;
+
+static replay_conn_t *conn_get(uint16_t conn_id) {
+    replay_conn_t *free_slot = NULL;
+
+    for (size_t i = 0; i < CONN_MAX; i++) {
+        if (replay.conns[i].open && replay.conns[i].conn_id == conn_id) {
+            return replay.conns + i;
+        }
+        if (!replay.conns[i].open && free_slot == NULL) {
+            free_slot = replay.conns + i;
+        }
+    }
+
+    return free_slot;
+}
+
+/**
+ * @brief       Follow read responses, to continue long reads as a client.
+ *
+ *              Called on the BTC task while the replaying task waits.
+ */
+static void on_tx(const neil_ble_gatts_host_tx_t *tx, void *arg) {
+    if (tx->kind != NEIL_BLE_GATTS_HOST_TX_RESPONSE) {
+        return;
+    }
+
+    replay.responses++;
+
+    replay_conn_t *conn = conn_get(tx->conn_id);
+    if (conn != NULL && conn->open && tx->value != NULL &&
+        tx->handle == conn->read_handle) {
+        conn->read_len      = tx->len;
+        conn->read_answered = true;
+    }
+}
+
+static void bda_of(uint16_t conn_id, esp_bd_addr_t bda) {
+    const esp_bd_addr_t base = {0x02, 0x00, 0x00, 0x00, conn_id >> 8, conn_id & 0xFF};
+    memcpy(bda, base, ESP_BD_ADDR_LEN);
+}
+
+/**
+ * @brief       Interface owning a handle, first registered one otherwise.
+ */
+static esp_gatt_if_t if_of(uint16_t handle) {
+    neil_ble_gatts_host_attr_t attr;
+
+    if (handle != 0 && neil_ble_gatts_host_attr_get(handle, &attr)) {
+        return attr.gatts_if;
+    }
+
+    for (uint16_t app_id = 0; app_id < CONFIG_BT_GATT_MAX_SR_PROFILES; app_id++) {
+        const esp_gatt_if_t gatts_if = neil_ble_gatts_host_gatts_if(app_id);
+        if (gatts_if != ESP_GATT_IF_NONE) {
+            return gatts_if;
+        }
+    }
+
+    return ESP_GATT_IF_NONE;
+}
+
+/**
+ * @brief       Interface of the `nth` registered profile.
+ */
+static esp_gatt_if_t if_nth(uint16_t nth) {
+    for (uint16_t app_id = 0; app_id < CONFIG_BT_GATT_MAX_SR_PROFILES; app_id++) {
+        const esp_gatt_if_t gatts_if = neil_ble_gatts_host_gatts_if(app_id);
+        if (gatts_if != ESP_GATT_IF_NONE && nth-- == 0) {
+            return gatts_if;
+        }
+    }
+    return ESP_GATT_IF_NONE;
+}
+
+/**
+ * @brief       Whether a characteristic value only takes writes without
+ *              response (from the properties of its declaration).
+ */
+static bool write_no_rsp(uint16_t handle) {
+    neil_ble_gatts_host_attr_t decl;
+
+    if (handle == 0 || !neil_ble_gatts_host_attr_get(handle - 1, &decl) ||
+        decl.uuid.len != ESP_UUID_LEN_16 ||
+        decl.uuid.uuid.uuid16 != ESP_GATT_UUID_CHAR_DECLARE || decl.len < 1) {
+        return false;
+    }
+
+    const uint8_t props = decl.value[0];
+    return (props & ESP_GATT_CHAR_PROP_BIT_WRITE_NR) &&
+           !(props & ESP_GATT_CHAR_PROP_BIT_WRITE);
+}
+
+static bool is_cccd(uint16_t handle) {
+    neil_ble_gatts_host_attr_t attr;
+
+    return neil_ble_gatts_host_attr_get(handle, &attr) &&
+           attr.uuid.len == ESP_UUID_LEN_16 &&
+           attr.uuid.uuid.uuid16 == ESP_GATT_UUID_CHAR_CLIENT_CONFIG;
+}
+
+/**
+ * @brief       Whether a write record is part of a prepared (long) write: the
+ *              next event of its connection, past further parts, executes.
+ */
+static bool write_is_prep(const trace_t *trace, uint16_t idx) {
+    const neil_ble_gatts_trace_rec_t *write = trace->recs + idx;
+
+    for (uint16_t next = idx + 1; next < trace->count; next++) {
+        const neil_ble_gatts_trace_rec_t *rec = trace->recs + next;
+
+        if (rec->src != NEIL_BLE_GATTS_TRACE_SRC_GATTS ||
+            rec->conn_id != write->conn_id) {
+            continue;
+        }
+        if (rec->event == ESP_GATTS_WRITE_EVT && rec->handle == write->handle) {
+            continue;
+        }
+        return rec->event == ESP_GATTS_EXEC_WRITE_EVT;
+    }
+
+    return false;
+}
+
+// -------------------------------------------------------------
+// Replay
+// -------------------------------------------------------------
+
+typedef struct {
+    event_stats_t events[EVENT_SLOTS];
+    uint32_t skipped[EVENT_SLOTS];
+    uint32_t skipped_gap;
+    uint32_t synthesized; ///< Connections opened for records without one.
+    uint32_t failed;      ///< Records Bluedroid would not deliver.
+} replay_report_t;
+
+static int64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void sleep_us(uint32_t us) {
+    const struct timespec delay = {
+        .tv_sec  = us / 1000000,
+        .tv_nsec = (us % 1000000) * 1000L,
+    };
+    nanosleep(&delay, NULL);
+}
+
+/**
+ * @brief       Deliver the event of one record.
+ *
+ * @return      Callback time, -1 if skipped.
+ */
+static int64_t replay_record(const trace_t *trace, uint16_t idx, uint16_t *repeat_nth,
+                             replay_report_t *report) {
+    const neil_ble_gatts_trace_rec_t *rec  = trace->recs + idx;
+    const neil_ble_gatts_trace_rec_t *prev = idx > 0 ? rec - 1 : NULL;
+
+    // --- Events delivered to every profile are recorded once per profile
+    const bool repeated = prev != NULL && prev->src == rec->src &&
+                          prev->event == rec->event && prev->conn_id == rec->conn_id &&
+                          prev->handle == rec->handle && prev->len == rec->len;
+    *repeat_nth = repeated ? *repeat_nth + 1 : 0;
+
+    esp_ble_gatts_cb_param_t param = {0};
+    esp_gatt_if_t gatts_if         = if_nth(*repeat_nth);
+    replay_conn_t *conn            = NULL;
+
+    static uint8_t value[ESP_GATT_MAX_ATTR_LEN];
+
+    // --- Anything on a connection the trace did not see open opens it
+    if (rec->conn_id != NEIL_BLE_GATTS_TRACE_NO_CONN &&
+        rec->event != ESP_GATTS_CONNECT_EVT) {
+        conn = conn_get(rec->conn_id);
+
+        if (conn != NULL && !conn->open) {
+            esp_bd_addr_t bda;
+            bda_of(rec->conn_id, bda);
+
+            if (neil_ble_gatts_host_connect(rec->conn_id, bda) == ESP_OK) {
+                *conn = (replay_conn_t){
+                    .open    = true,
+                    .conn_id = rec->conn_id,
+                    .mtu     = ESP_GATT_DEF_BLE_MTU_SIZE,
+                };
+                report->synthesized++;
+            }
+        }
+    }
+
+    switch (rec->event) {
+    case ESP_GATTS_CONNECT_EVT:
+        conn = conn_get(rec->conn_id);
+        if (conn != NULL && !conn->open) {
+            *conn = (replay_conn_t){
+                .open    = true,
+                .conn_id = rec->conn_id,
+                .mtu     = ESP_GATT_DEF_BLE_MTU_SIZE,
+            };
+        }
+        param.connect.conn_id     = rec->conn_id;
+        param.connect.link_role   = 1;
+        param.connect.conn_params = (esp_gatt_conn_params_t){24, 0, 400};
+        bda_of(rec->conn_id, param.connect.remote_bda);
+        break;
+
+    case ESP_GATTS_DISCONNECT_EVT:
+        if (conn != NULL && !repeated) {
+            conn->open = false;
+        }
+        param.disconnect.conn_id = rec->conn_id;
+        param.disconnect.reason  = rec->len;
+        bda_of(rec->conn_id, param.disconnect.remote_bda);
+        break;
+
+    case ESP_GATTS_MTU_EVT:
+        if (conn != NULL) {
+            conn->mtu = rec->len;
+        }
+        param.mtu.conn_id = rec->conn_id;
+        param.mtu.mtu     = rec->len;
+        break;
+
+    case ESP_GATTS_CONGEST_EVT:
+        param.congest.conn_id   = rec->conn_id;
+        param.congest.congested = rec->len != 0;
+        break;
+
+    case ESP_GATTS_CONF_EVT:
+        gatts_if           = if_of(rec->handle);
+        param.conf.status  = ESP_GATT_OK;
+        param.conf.conn_id = rec->conn_id;
+        param.conf.handle  = rec->handle;
+        param.conf.len     = rec->len;
+        break;
+
+    case ESP_GATTS_READ_EVT: {
+        gatts_if = if_of(rec->handle);
+
+        // --- A full response asks for more (Read Blob) at the next offset
+        uint16_t offset = 0;
+        if (conn != NULL && conn->read_answered && conn->read_handle == rec->handle &&
+            conn->read_len >= conn->mtu - 1) {
+            offset = conn->read_offset + conn->mtu - 1;
+        }
+        if (conn != NULL) {
+            conn->read_handle   = rec->handle;
+            conn->read_offset   = offset;
+            conn->read_answered = false;
+        }
+
+        param.read.conn_id  = rec->conn_id;
+        param.read.trans_id = ++replay.trans_id;
+        param.read.handle   = rec->handle;
+        param.read.offset   = offset;
+        param.read.is_long  = offset > 0;
+        param.read.need_rsp = true;
+        bda_of(rec->conn_id, param.read.bda);
+        break;
+    }
+
+    case ESP_GATTS_WRITE_EVT: {
+        gatts_if = if_of(rec->handle);
+
+        const uint16_t len = rec->len <= sizeof(value) ? rec->len : sizeof(value);
+        memset(value, 0, len);
+        if (is_cccd(rec->handle) && len == sizeof(uint16_t)) {
+            value[0] = 0x01;
+        }
+
+        const bool prep = write_is_prep(trace, idx);
+
+        param.write.conn_id  = rec->conn_id;
+        param.write.trans_id = ++replay.trans_id;
+        param.write.handle   = rec->handle;
+        param.write.offset   = prep && conn != NULL ? conn->prep_offset : 0;
+        param.write.need_rsp = prep || !write_no_rsp(rec->handle);
+        param.write.is_prep  = prep;
+        param.write.len      = len;
+        param.write.value    = value;
+        bda_of(rec->conn_id, param.write.bda);
+
+        if (prep && conn != NULL) {
+            conn->prep_offset += len;
+        }
+        break;
+    }
+
+    case ESP_GATTS_EXEC_WRITE_EVT:
+        if (conn != NULL) {
+            conn->prep_offset = 0;
+        }
+        param.exec_write.conn_id         = rec->conn_id;
+        param.exec_write.trans_id        = ++replay.trans_id;
+        param.exec_write.exec_write_flag = ESP_GATT_PREP_WRITE_EXEC;
+        bda_of(rec->conn_id, param.exec_write.bda);
+        break;
+
+    default:
+        if (rec->event < EVENT_SLOTS) {
+            report->skipped[rec->event]++;
+        }
+        return -1;
+    }
+
+    if (gatts_if == ESP_GATT_IF_NONE) {
+        report->failed++;
+        return -1;
+    }
+
+    const int64_t ns = neil_ble_gatts_host_gatts_event(rec->event, gatts_if, &param);
+    if (ns < 0) {
+        report->failed++;
+    }
+
+    return ns;
+}
+
+/**
+ * @brief       Close connections left open, so that passes start alike.
+ */
+static void replay_close_all(void) {
+    for (size_t i = 0; i < CONN_MAX; i++) {
+        if (replay.conns[i].open) {
+            neil_ble_gatts_host_disconnect(replay.conns[i].conn_id,
+                                           ESP_GATT_CONN_TERMINATE_PEER_USER);
+            replay.conns[i].open = false;
+        }
+    }
+}
+
+static void replay_pass(const trace_t *trace, bool realtime, replay_report_t *report) {
+    const int64_t start_ns = now_ns();
+    uint16_t repeat_nth    = 0;
+
+    for (uint16_t idx = 0; idx < trace->count; idx++) {
+        const neil_ble_gatts_trace_rec_t *rec = trace->recs + idx;
+
+        if (realtime) {
+            // --- Time of the record after the first (wraps with esp_timer)
+            const uint32_t at_us = rec->time_us - trace->recs[0].time_us;
+            const int64_t now_us = (now_ns() - start_ns) / 1000;
+            if (at_us > now_us) {
+                sleep_us(at_us - now_us);
+            }
+        }
+
+        if (rec->src != NEIL_BLE_GATTS_TRACE_SRC_GATTS) {
+            report->skipped_gap++;
+            continue;
+        }
+
+        const int64_t ns = replay_record(trace, idx, &repeat_nth, report);
+        if (ns >= 0) {
+            stats_add(report->events + rec->event, ns, rec->duration_us);
+        }
+    }
+
+    neil_ble_gatts_host_settle(portMAX_DELAY);
+    replay_close_all();
+    neil_ble_gatts_host_settle(portMAX_DELAY);
+}
+
+// -------------------------------------------------------------
+// Report
+// -------------------------------------------------------------
+
+static void report_write(FILE *out, const char *path, const trace_t *trace,
+                         uint16_t passes, replay_report_t *report) {
+    uint64_t total_ns = 0;
+    uint32_t replayed = 0;
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"trace\": \"%s\",\n", path);
+    fprintf(out, "  \"records\": %u,\n", trace->count);
+    fprintf(out, "  \"dropped\": %" PRIu32 ",\n", trace->hdr.dropped);
+    fprintf(out, "  \"passes\": %u,\n", passes);
+    fprintf(out, "  \"events\": {");
+
+    bool first = true;
+    for (size_t event = 0; event < EVENT_SLOTS; event++) {
+        event_stats_t *stats = report->events + event;
+        if (stats->count == 0) {
+            continue;
+        }
+
+        qsort(stats->ns, stats->count, sizeof(int64_t), ns_compare);
+
+        int64_t sum = 0;
+        for (uint32_t i = 0; i < stats->count; i++) {
+            sum += stats->ns[i];
+        }
+        total_ns += sum;
+        replayed += stats->count;
+
+        fprintf(out, "%s\n    \"gatts.%s\": {", first ? "" : ",",
+                event_names[event] != NULL ? event_names[event] : "?");
+        fprintf(out, "\"count\": %" PRIu32 ", ", stats->count);
+        fprintf(out, "\"min_ns\": %" PRId64 ", ", stats->ns[0]);
+        fprintf(out, "\"avg_ns\": %" PRId64 ", ", sum / stats->count);
+        fprintf(out, "\"p50_ns\": %" PRId64 ", ", stats->ns[stats->count / 2]);
+        fprintf(out, "\"p99_ns\": %" PRId64 ", ",
+                stats->ns[(uint64_t)stats->count * 99 / 100]);
+        fprintf(out, "\"max_ns\": %" PRId64 ", ", stats->ns[stats->count - 1]);
+        fprintf(out, "\"device_avg_us\": %.1f, ",
+                (double)stats->device_us / stats->count);
+        fprintf(out, "\"device_max_us\": %" PRIu32 "}", stats->device_max_us);
+        first = false;
+    }
+
+    fprintf(out, "\n  },\n");
+    fprintf(out, "  \"skipped\": {");
+
+    first = true;
+    for (size_t event = 0; event < EVENT_SLOTS; event++) {
+        if (report->skipped[event] == 0) {
+            continue;
+        }
+        fprintf(out, "%s\"gatts.%s\": %" PRIu32, first ? "" : ", ",
+                event_names[event] != NULL ? event_names[event] : "?",
+                report->skipped[event]);
+        first = false;
+    }
+    fprintf(out, "%s\"gap\": %" PRIu32 "},\n", first ? "" : ", ", report->skipped_gap);
+
+    fprintf(out, "  \"synthesized_connections\": %" PRIu32 ",\n", report->synthesized);
+    fprintf(out, "  \"failed\": %" PRIu32 ",\n", report->failed);
+    fprintf(out, "  \"replayed\": %" PRIu32 ",\n", replayed);
+    fprintf(out, "  \"total_ns\": %" PRIu64 "\n", total_ns);
+    fprintf(out, "}\n");
+}
+
+int neil_ble_gatts_host_replay(const neil_ble_gatts_host_replay_opts_t *opts) {
+    trace_t trace = {0};
+
+    if (trace_load(opts->trace_path, opts->hex, &trace) != 0) {
+        return 1;
+    }
+
+    const uint16_t passes = opts->repeat > 0 ? opts->repeat : 1;
+
+    ESP_LOGI(TAG, "Replaying %u records, %u pass(es)", trace.count, passes);
+
+    // --- Completions come from the trace, not from the stack
+    neil_ble_gatts_host_set_auto_conf(false);
+    neil_ble_gatts_host_set_tx_cb(on_tx, NULL);
+
+    replay_report_t report = {0};
+    for (uint16_t pass = 0; pass < passes; pass++) {
+        replay_pass(&trace, opts->realtime, &report);
+    }
+
+    neil_ble_gatts_host_set_tx_cb(NULL, NULL);
+    neil_ble_gatts_host_set_auto_conf(true);
+
+    report_write(stdout, opts->trace_path, &trace, passes, &report);
+
+    int ret = 0;
+    if (opts->report_path != NULL) {
+        FILE *out = fopen(opts->report_path, "w");
+        if (out == NULL) {
+            ESP_LOGE(TAG, "Cannot write %s", opts->report_path);
+            ret = 1;
+        } else {
+            report_write(out, opts->trace_path, &trace, passes, &report);
+            fclose(out);
+        }
+    }
+
+    for (size_t event = 0; event < EVENT_SLOTS; event++) {
+        free(report.events[event].ns);
+    }
+    free(trace.recs);
+
+    return ret != 0 || report.failed > 0;
+}
@@ -0,0 +1,74 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// esp_bt_defs.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Bluedroid common definitions, host build (see ../README.md).
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define ESP_BT_OCTET16_LEN 16
+
+typedef uint8_t esp_bt_octet16_t[ESP_BT_OCTET16_LEN];
+
+typedef enum {
+    ESP_BT_STATUS_SUCCESS = 0,
+    ESP_BT_STATUS_FAIL,
+    ESP_BT_STATUS_NOT_READY,
+    ESP_BT_STATUS_NOMEM,
+    ESP_BT_STATUS_BUSY,
+    ESP_BT_STATUS_DONE,
+    ESP_BT_STATUS_UNSUPPORTED,
+    ESP_BT_STATUS_PARM_INVALID,
+    ESP_BT_STATUS_UNHANDLED,
+    ESP_BT_STATUS_AUTH_FAILURE,
+    ESP_BT_STATUS_RMT_DEV_DOWN,
+    ESP_BT_STATUS_AUTH_REJECTED,
+    ESP_BT_STATUS_INVALID_STATIC_RAND_ADDR,
+    ESP_BT_STATUS_PENDING,
+    ESP_BT_STATUS_UNACCEPT_CONN_INTERVAL,
+    ESP_BT_STATUS_PARAM_OUT_OF_RANGE,
+    ESP_BT_STATUS_TIMEOUT,
+} esp_bt_status_t;
+
+#define ESP_UUID_LEN_16  2
+#define ESP_UUID_LEN_32  4
+#define ESP_UUID_LEN_128 16
+
+/**
+ * @brief       UUID of an attribute.
+ */
+typedef struct {
+    uint16_t len;
+    union {
+        uint16_t uuid16;
+        uint32_t uuid32;
+        uint8_t uuid128[ESP_UUID_LEN_128];
+    } uuid;
+} __attribute__((packed)) esp_bt_uuid_t;
+
+#define ESP_BD_ADDR_LEN 6
+
+typedef uint8_t esp_bd_addr_t[ESP_BD_ADDR_LEN];
+
+typedef enum {
+    BLE_ADDR_TYPE_PUBLIC     = 0x00,
+    BLE_ADDR_TYPE_RANDOM     = 0x01,
+    BLE_ADDR_TYPE_RPA_PUBLIC = 0x02,
+    BLE_ADDR_TYPE_RPA_RANDOM = 0x03,
+} esp_ble_addr_type_t;
+
+#define ESP_BLE_ENC_KEY_MASK  (1 << 0)
+#define ESP_BLE_ID_KEY_MASK   (1 << 1)
+#define ESP_BLE_CSR_KEY_MASK  (1 << 2)
+#define ESP_BLE_LINK_KEY_MASK (1 << 3)
+
+typedef uint8_t esp_ble_key_mask_t;
@@ -0,0 +1,25 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// esp_bt_main.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Bluedroid lifecycle, host build (see ../README.md).
+
+#pragma once
+
+#include "esp_err.h"
+
+typedef enum {
+    ESP_BLUEDROID_STATUS_UNINITIALIZED = 0,
+    ESP_BLUEDROID_STATUS_INITIALIZED,
+    ESP_BLUEDROID_STATUS_ENABLED,
+} esp_bluedroid_status_t;
+
+esp_bluedroid_status_t esp_bluedroid_get_status(void);
+esp_err_t esp_bluedroid_enable(void);
+esp_err_t esp_bluedroid_disable(void);
+esp_err_t esp_bluedroid_init(void);
+esp_err_t esp_bluedroid_deinit(void);
@@ -0,0 +1,345 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// esp_gap_ble_api.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Bluedroid BLE GAP, host build (see ../README.md).
+///
+///             Events are numbered as in a BLE 4.2 build of ESP-IDF.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_bt_defs.h"
+#include "esp_err.h"
+
+// -------------------------------------------------------------
+// Security
+// -------------------------------------------------------------
+
+#define ESP_LE_AUTH_NO_BOND          0x00
+#define ESP_LE_AUTH_BOND             0x01
+#define ESP_LE_AUTH_REQ_MITM         (1 << 2)
+#define ESP_LE_AUTH_REQ_BOND_MITM    (ESP_LE_AUTH_BOND | ESP_LE_AUTH_REQ_MITM)
+#define ESP_LE_AUTH_REQ_SC_ONLY      (1 << 3)
+#define ESP_LE_AUTH_REQ_SC_BOND      (ESP_LE_AUTH_BOND | ESP_LE_AUTH_REQ_SC_ONLY)
+#define ESP_LE_AUTH_REQ_SC_MITM      (ESP_LE_AUTH_REQ_MITM | ESP_LE_AUTH_REQ_SC_ONLY)
+#define ESP_LE_AUTH_REQ_SC_MITM_BOND                                                   \
+    (ESP_LE_AUTH_REQ_MITM | ESP_LE_AUTH_REQ_SC_ONLY | ESP_LE_AUTH_BOND)
+
+typedef uint8_t esp_ble_auth_req_t;
+
+#define ESP_IO_CAP_OUT    0
+#define ESP_IO_CAP_IO     1
+#define ESP_IO_CAP_IN     2
+#define ESP_IO_CAP_NONE   3
+#define ESP_IO_CAP_KBDISP 4
+
+typedef uint8_t esp_ble_io_cap_t;
+
+#define ESP_BLE_ONLY_ACCEPT_SPECIFIED_AUTH_DISABLE 0
+#define ESP_BLE_ONLY_ACCEPT_SPECIFIED_AUTH_ENABLE  1
+
+#define ESP_BLE_OOB_DISABLE 0
+#define ESP_BLE_OOB_ENABLE  1
+
+typedef enum {
+    ESP_BLE_SM_PASSKEY = 0,
+    ESP_BLE_SM_AUTHEN_REQ_MODE,
+    ESP_BLE_SM_IOCAP_MODE,
+    ESP_BLE_SM_SET_INIT_KEY,
+    ESP_BLE_SM_SET_RSP_KEY,
+    ESP_BLE_SM_MAX_KEY_SIZE,
+    ESP_BLE_SM_MIN_KEY_SIZE,
+    ESP_BLE_SM_SET_STATIC_PASSKEY,
+    ESP_BLE_SM_CLEAR_STATIC_PASSKEY,
+    ESP_BLE_SM_ONLY_ACCEPT_SPECIFIED_SEC_AUTH,
+    ESP_BLE_SM_OOB_SUPPORT,
+    ESP_BLE_APP_ENC_KEY_SIZE,
+    ESP_BLE_SM_MAX_PARAM,
+} esp_ble_sm_param_t;
+
+typedef enum {
+    ESP_BLE_SEC_ENCRYPT = 1,
+    ESP_BLE_SEC_ENCRYPT_NO_MITM,
+    ESP_BLE_SEC_ENCRYPT_MITM,
+} esp_ble_sec_act_t;
+
+typedef enum {
+    ESP_LE_KEY_NONE  = 0,
+    ESP_LE_KEY_PENC  = (1 << 0),
+    ESP_LE_KEY_PID   = (1 << 1),
+    ESP_LE_KEY_PCSRK = (1 << 2),
+    ESP_LE_KEY_PLK   = (1 << 3),
+    ESP_LE_KEY_LLK   = (ESP_LE_KEY_PLK << 4),
+    ESP_LE_KEY_LENC  = (ESP_LE_KEY_PENC << 4),
+    ESP_LE_KEY_LID   = (ESP_LE_KEY_PID << 4),
+    ESP_LE_KEY_LCSRK = (ESP_LE_KEY_PCSRK << 4),
+} esp_ble_key_type_t;
+
+// -------------------------------------------------------------
+// Advertising
+// -------------------------------------------------------------
+
+#define ESP_BLE_ADV_DATA_LEN_MAX      31
+#define ESP_BLE_SCAN_RSP_DATA_LEN_MAX 31
+
+#define ESP_BLE_ADV_FLAG_LIMIT_DISC    (0x01 << 0)
+#define ESP_BLE_ADV_FLAG_GEN_DISC      (0x01 << 1)
+#define ESP_BLE_ADV_FLAG_BREDR_NOT_SPT (0x01 << 2)
+
+typedef enum {
+    ADV_TYPE_IND             = 0x00,
+    ADV_TYPE_DIRECT_IND_HIGH = 0x01,
+    ADV_TYPE_SCAN_IND        = 0x02,
+    ADV_TYPE_NONCONN_IND     = 0x03,
+    ADV_TYPE_DIRECT_IND_LOW  = 0x04,
+} esp_ble_adv_type_t;
+
+typedef enum {
+    ADV_CHNL_37  = 0x01,
+    ADV_CHNL_38  = 0x02,
+    ADV_CHNL_39  = 0x04,
+    ADV_CHNL_ALL = 0x07,
+} esp_ble_adv_channel_t;
+
+typedef enum {
+    ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY = 0x00,
+    ADV_FILTER_ALLOW_SCAN_WLST_CON_ANY,
+    ADV_FILTER_ALLOW_SCAN_ANY_CON_WLST,
+    ADV_FILTER_ALLOW_SCAN_WLST_CON_WLST,
+} esp_ble_adv_filter_t;
+
+/**
+ * @brief       Advertising (or scan response) data.
+ */
+typedef struct {
+    bool set_scan_rsp;
+    bool include_name;
+    bool include_txpower;
+    int min_interval;
+    int max_interval;
+    int appearance;
+    uint16_t manufacturer_len;
+    uint8_t *p_manufacturer_data;
+    uint16_t service_data_len;
+    uint8_t *p_service_data;
+    uint16_t service_uuid_len;
+    uint8_t *p_service_uuid;
+    uint8_t flag;
+} esp_ble_adv_data_t;
+
+/**
+ * @brief       Advertising parameters.
+ */
+typedef struct {
+    uint16_t adv_int_min;
+    uint16_t adv_int_max;
+    esp_ble_adv_type_t adv_type;
+    esp_ble_addr_type_t own_addr_type;
+    esp_bd_addr_t peer_addr;
+    esp_ble_addr_type_t peer_addr_type;
+    esp_ble_adv_channel_t channel_map;
+    esp_ble_adv_filter_t adv_filter_policy;
+} esp_ble_adv_params_t;
+
+/**
+ * @brief       Connection parameter update request.
+ */
+typedef struct {
+    esp_bd_addr_t bda;
+    uint16_t min_int;
+    uint16_t max_int;
+    uint16_t latency;
+    uint16_t timeout;
+} esp_ble_conn_update_params_t;
+
+// -------------------------------------------------------------
+// PHY
+// -------------------------------------------------------------
+
+#define ESP_BLE_GAP_PHY_1M    1
+#define ESP_BLE_GAP_PHY_2M    2
+#define ESP_BLE_GAP_PHY_CODED 3
+
+typedef uint8_t esp_ble_gap_phy_t;
+
+#define ESP_BLE_GAP_PHY_1M_PREF_MASK    (1 << 0)
+#define ESP_BLE_GAP_PHY_2M_PREF_MASK    (1 << 1)
+#define ESP_BLE_GAP_PHY_CODED_PREF_MASK (1 << 2)
+
+typedef uint8_t esp_ble_gap_phy_mask_t;
+typedef uint8_t esp_ble_gap_all_phys_t;
+
+#define ESP_BLE_GAP_PHY_OPTIONS_NO_PREF        0
+#define ESP_BLE_GAP_PHY_OPTIONS_PREF_S2_CODING 1
+#define ESP_BLE_GAP_PHY_OPTIONS_PREF_S8_CODING 2
+
+typedef uint16_t esp_ble_gap_prefer_phy_options_t;
+
+// -------------------------------------------------------------
+// Events
+// -------------------------------------------------------------
+
+typedef enum {
+    ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT = 0,
+    ESP_GAP_BLE_SCAN_RSP_DATA_SET_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_RESULT_EVT,
+    ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_RSP_DATA_RAW_SET_COMPLETE_EVT,
+    ESP_GAP_BLE_ADV_START_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_START_COMPLETE_EVT,
+    ESP_GAP_BLE_AUTH_CMPL_EVT,
+    ESP_GAP_BLE_KEY_EVT,
+    ESP_GAP_BLE_SEC_REQ_EVT,
+    ESP_GAP_BLE_PASSKEY_NOTIF_EVT,
+    ESP_GAP_BLE_PASSKEY_REQ_EVT,
+    ESP_GAP_BLE_OOB_REQ_EVT,
+    ESP_GAP_BLE_LOCAL_IR_EVT,
+    ESP_GAP_BLE_LOCAL_ER_EVT,
+    ESP_GAP_BLE_NC_REQ_EVT,
+    ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT,
+    ESP_GAP_BLE_SET_STATIC_RAND_ADDR_EVT,
+    ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT,
+    ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT,
+    ESP_GAP_BLE_SET_LOCAL_PRIVACY_COMPLETE_EVT,
+    ESP_GAP_BLE_REMOVE_BOND_DEV_COMPLETE_EVT,
+    ESP_GAP_BLE_CLEAR_BOND_DEV_COMPLETE_EVT,
+    ESP_GAP_BLE_GET_BOND_DEV_COMPLETE_EVT,
+    ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT,
+    ESP_GAP_BLE_UPDATE_WHITELIST_COMPLETE_EVT,
+    ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT,
+    ESP_GAP_BLE_EVT_MAX,
+} esp_gap_ble_cb_event_t;
+
+typedef struct {
+    esp_bd_addr_t bd_addr;
+    uint32_t passkey;
+} esp_ble_sec_key_notif_t;
+
+typedef struct {
+    esp_bd_addr_t bd_addr;
+} esp_ble_sec_req_t;
+
+typedef struct {
+    esp_bd_addr_t bd_addr;
+    esp_ble_key_type_t key_type;
+} esp_ble_key_t;
+
+typedef struct {
+    esp_bd_addr_t bd_addr;
+    bool key_present;
+    esp_bt_octet16_t key;
+    uint8_t key_type;
+    bool success;
+    uint8_t fail_reason;
+    esp_ble_addr_type_t addr_type;
+    uint8_t dev_type;
+    esp_ble_auth_req_t auth_mode;
+} esp_ble_auth_cmpl_t;
+
+typedef union {
+    esp_ble_sec_key_notif_t key_notif;
+    esp_ble_sec_req_t ble_req;
+    esp_ble_key_t ble_key;
+    esp_ble_auth_cmpl_t auth_cmpl;
+} esp_ble_sec_t;
+
+/**
+ * @brief       Bonded peer.
+ */
+typedef struct {
+    esp_bd_addr_t bd_addr;
+    struct {
+        esp_ble_key_mask_t key_mask;
+    } bond_key;
+} esp_ble_bond_dev_t;
+
+/**
+ * @brief       GAP event parameters, the member named after the event.
+ */
+typedef union {
+    struct ble_adv_data_cmpl_evt_param {
+        esp_bt_status_t status;
+    } adv_data_cmpl;
+    struct ble_scan_rsp_data_cmpl_evt_param {
+        esp_bt_status_t status;
+    } scan_rsp_data_cmpl;
+    struct ble_adv_start_cmpl_evt_param {
+        esp_bt_status_t status;
+    } adv_start_cmpl;
+    esp_ble_sec_t ble_security;
+    struct ble_adv_stop_cmpl_evt_param {
+        esp_bt_status_t status;
+    } adv_stop_cmpl;
+    struct ble_update_conn_params_evt_param {
+        esp_bt_status_t status;
+        esp_bd_addr_t bda;
+        uint16_t min_int;
+        uint16_t max_int;
+        uint16_t latency;
+        uint16_t conn_int;
+        uint16_t timeout;
+    } update_conn_params;
+    struct ble_local_privacy_cmpl_evt_param {
+        esp_bt_status_t status;
+    } local_privacy_cmpl;
+    struct ble_remove_bond_dev_cmpl_evt_param {
+        esp_bt_status_t status;
+        esp_bd_addr_t bd_addr;
+    } remove_bond_dev_cmpl;
+    struct ble_read_rssi_cmpl_evt_param {
+        esp_bt_status_t status;
+        int8_t rssi;
+        esp_bd_addr_t remote_addr;
+    } read_rssi_cmpl;
+    struct ble_phy_update_cmpl_evt_param {
+        esp_bt_status_t status;
+        esp_bd_addr_t bda;
+        esp_ble_gap_phy_t tx_phy;
+        esp_ble_gap_phy_t rx_phy;
+    } phy_update;
+} esp_ble_gap_cb_param_t;
+
+typedef void (*esp_gap_ble_cb_t)(esp_gap_ble_cb_event_t event,
+                                 esp_ble_gap_cb_param_t *param);
+
+// -------------------------------------------------------------
+// API
+// -------------------------------------------------------------
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback);
+
+esp_err_t esp_ble_gap_config_adv_data(esp_ble_adv_data_t *adv_data);
+esp_err_t esp_ble_gap_start_advertising(esp_ble_adv_params_t *adv_params);
+esp_err_t esp_ble_gap_stop_advertising(void);
+esp_err_t esp_ble_gap_set_device_name(const char *name);
+esp_err_t esp_ble_gap_config_local_privacy(bool privacy_enable);
+
+esp_err_t esp_ble_gap_update_conn_params(esp_ble_conn_update_params_t *params);
+esp_err_t esp_ble_gap_read_rssi(esp_bd_addr_t remote_addr);
+esp_err_t esp_ble_gap_disconnect(esp_bd_addr_t remote_device);
+esp_err_t esp_ble_gap_set_preferred_phy(esp_bd_addr_t bd_addr,
+                                        esp_ble_gap_all_phys_t all_phys_mask,
+                                        esp_ble_gap_phy_mask_t tx_phy_mask,
+                                        esp_ble_gap_phy_mask_t rx_phy_mask,
+                                        esp_ble_gap_prefer_phy_options_t phy_options);
+
+esp_err_t esp_ble_gap_set_security_param(esp_ble_sm_param_t param_type, void *value,
+                                         uint8_t len);
+esp_err_t esp_ble_gap_security_rsp(esp_bd_addr_t bd_addr, bool accept);
+esp_err_t esp_ble_set_encryption(esp_bd_addr_t bd_addr, esp_ble_sec_act_t sec_act);
+esp_err_t esp_ble_passkey_reply(esp_bd_addr_t bd_addr, bool accept, uint32_t passkey);
+esp_err_t esp_ble_confirm_reply(esp_bd_addr_t bd_addr, bool accept);
+esp_err_t esp_ble_oob_req_reply(esp_bd_addr_t bd_addr, uint8_t *TK, uint8_t len);
+
+int esp_ble_get_bond_device_num(void);
+esp_err_t esp_ble_get_bond_device_list(int *dev_num, esp_ble_bond_dev_t *dev_list);
+esp_err_t esp_ble_remove_bond_device(esp_bd_addr_t bd_addr);
@@ -0,0 +1,167 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// esp_gatts_api.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Bluedroid GATT server, host build (see ../README.md).
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_bt_defs.h"
+#include "esp_err.h"
+#include "esp_gap_ble_api.h"
+#include "esp_gatt_defs.h"
+
+typedef enum {
+    ESP_GATTS_REG_EVT                 = 0,
+    ESP_GATTS_READ_EVT                = 1,
+    ESP_GATTS_WRITE_EVT               = 2,
+    ESP_GATTS_EXEC_WRITE_EVT          = 3,
+    ESP_GATTS_MTU_EVT                 = 4,
+    ESP_GATTS_CONF_EVT                = 5,
+    ESP_GATTS_UNREG_EVT               = 6,
+    ESP_GATTS_CREATE_EVT              = 7,
+    ESP_GATTS_ADD_INCL_SRVC_EVT       = 8,
+    ESP_GATTS_ADD_CHAR_EVT            = 9,
+    ESP_GATTS_ADD_CHAR_DESCR_EVT      = 10,
+    ESP_GATTS_DELETE_EVT              = 11,
+    ESP_GATTS_START_EVT               = 12,
+    ESP_GATTS_STOP_EVT                = 13,
+    ESP_GATTS_CONNECT_EVT             = 14,
+    ESP_GATTS_DISCONNECT_EVT          = 15,
+    ESP_GATTS_OPEN_EVT                = 16,
+    ESP_GATTS_CANCEL_OPEN_EVT         = 17,
+    ESP_GATTS_CLOSE_EVT               = 18,
+    ESP_GATTS_LISTEN_EVT              = 19,
+    ESP_GATTS_CONGEST_EVT             = 20,
+    ESP_GATTS_RESPONSE_EVT            = 21,
+    ESP_GATTS_CREAT_ATTR_TAB_EVT      = 22,
+    ESP_GATTS_SET_ATTR_VAL_EVT        = 23,
+    ESP_GATTS_SEND_SERVICE_CHANGE_EVT = 24,
+} esp_gatts_cb_event_t;
+
+/**
+ * @brief       Connection parameters reported on connection.
+ */
+typedef struct {
+    uint16_t interval;
+    uint16_t latency;
+    uint16_t timeout;
+} esp_gatt_conn_params_t;
+
+/**
+ * @brief       GATTS event parameters, the member named after the event.
+ */
+typedef union {
+    struct gatts_reg_evt_param {
+        esp_gatt_status_t status;
+        uint16_t app_id;
+    } reg;
+
+    struct gatts_read_evt_param {
+        uint16_t conn_id;
+        uint32_t trans_id;
+        esp_bd_addr_t bda;
+        uint16_t handle;
+        uint16_t offset;
+        bool is_long;
+        bool need_rsp;
+    } read;
+
+    struct gatts_write_evt_param {
+        uint16_t conn_id;
+        uint32_t trans_id;
+        esp_bd_addr_t bda;
+        uint16_t handle;
+        uint16_t offset;
+        bool need_rsp;
+        bool is_prep;
+        uint16_t len;
+        uint8_t *value;
+    } write;
+
+    struct gatts_exec_write_evt_param {
+        uint16_t conn_id;
+        uint32_t trans_id;
+        esp_bd_addr_t bda;
+        uint8_t exec_write_flag;
+    } exec_write;
+
+    struct gatts_mtu_evt_param {
+        uint16_t conn_id;
+        uint16_t mtu;
+    } mtu;
+
+    struct gatts_conf_evt_param {
+        esp_gatt_status_t status;
+        uint16_t conn_id;
+        uint16_t handle;
+        uint16_t len;
+        uint8_t *value;
+    } conf;
+
+    struct gatts_start_evt_param {
+        esp_gatt_status_t status;
+        uint16_t service_handle;
+    } start;
+
+    struct gatts_stop_evt_param {
+        esp_gatt_status_t status;
+        uint16_t service_handle;
+    } stop;
+
+    struct gatts_connect_evt_param {
+        uint16_t conn_id;
+        uint8_t link_role;
+        esp_bd_addr_t remote_bda;
+        esp_gatt_conn_params_t conn_params;
+    } connect;
+
+    struct gatts_disconnect_evt_param {
+        uint16_t conn_id;
+        esp_bd_addr_t remote_bda;
+        esp_gatt_conn_reason_t reason;
+    } disconnect;
+
+    struct gatts_congest_evt_param {
+        uint16_t conn_id;
+        bool congested;
+    } congest;
+
+    struct gatts_rsp_evt_param {
+        esp_gatt_status_t status;
+        uint16_t handle;
+    } rsp;
+
+    struct gatts_add_attr_tab_evt_param {
+        esp_gatt_status_t status;
+        esp_bt_uuid_t svc_uuid;
+        uint8_t svc_inst_id;
+        uint16_t num_handle;
+        uint16_t *handles;
+    } add_attr_tab;
+} esp_ble_gatts_cb_param_t;
+
+typedef void (*esp_gatts_cb_t)(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
+                               esp_ble_gatts_cb_param_t *param);
+
+esp_err_t esp_ble_gatts_register_callback(esp_gatts_cb_t callback);
+esp_err_t esp_ble_gatts_app_register(uint16_t app_id);
+esp_err_t esp_ble_gatts_app_unregister(esp_gatt_if_t gatts_if);
+esp_err_t esp_ble_gatts_create_attr_tab(const esp_gatts_attr_db_t *gatts_attr_db,
+                                        esp_gatt_if_t gatts_if, uint16_t max_nb_attr,
+                                        uint8_t srvc_inst_id);
+esp_err_t esp_ble_gatts_start_service(uint16_t service_handle);
+esp_err_t esp_ble_gatts_stop_service(uint16_t service_handle);
+esp_err_t esp_ble_gatts_send_indicate(esp_gatt_if_t gatts_if, uint16_t conn_id,
+                                      uint16_t attr_handle, uint16_t value_len,
+                                      uint8_t *value, bool need_confirm);
+esp_err_t esp_ble_gatts_send_response(esp_gatt_if_t gatts_if, uint16_t conn_id,
+                                      uint32_t trans_id, esp_gatt_status_t status,
+                                      esp_gatt_rsp_t *rsp);
@@ -0,0 +1,111 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// esp_log.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      ESP-IDF logging, host build (see ../README.md).
+///
+///             Records go to stdout in the ESP-IDF format, without colors,
+///             filtered at run time by `esp_log_level_set`.
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+#endif
+
+/**
+ * @brief       Set the level of a tag, "*" for every tag without its own.
+ */
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+
+/**
+ * @brief       Level currently applied to a tag.
+ */
+esp_log_level_t esp_log_level_get(const char *tag);
+
+/**
+ * @brief       Milliseconds since start, for the record prefix.
+ */
+uint32_t esp_log_timestamp(void);
+
+/**
+ * @brief       Write a formatted record if `tag` logs at `level`.
+ */
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/**
+ * @brief       Log a buffer as lines of 16 hex bytes.
+ */
+void esp_log_buffer_hex_internal(const char *tag, const void *buffer, uint16_t buff_len,
+                                 esp_log_level_t level);
+
+#define LOG_FORMAT(letter, format) #letter " (%" PRIu32 ") %s: " format "\n"
+
+#define ESP_LOG_LEVEL(level, tag, format, ...)                                         \
+    do {                                                                               \
+        if ((level) == ESP_LOG_ERROR) {                                                \
+            esp_log_write(ESP_LOG_ERROR, tag, LOG_FORMAT(E, format),                   \
+                          esp_log_timestamp(), tag, ##__VA_ARGS__);                    \
+        } else if ((level) == ESP_LOG_WARN) {                                          \
+            esp_log_write(ESP_LOG_WARN, tag, LOG_FORMAT(W, format),                    \
+                          esp_log_timestamp(), tag, ##__VA_ARGS__);                    \
+        } else if ((level) == ESP_LOG_DEBUG) {                                         \
+            esp_log_write(ESP_LOG_DEBUG, tag, LOG_FORMAT(D, format),                   \
+                          esp_log_timestamp(), tag, ##__VA_ARGS__);                    \
+        } else if ((level) == ESP_LOG_VERBOSE) {                                       \
+            esp_log_write(ESP_LOG_VERBOSE, tag, LOG_FORMAT(V, format),                 \
+                          esp_log_timestamp(), tag, ##__VA_ARGS__);                    \
+        } else {                                                                       \
+            esp_log_write(ESP_LOG_INFO, tag, LOG_FORMAT(I, format),                    \
+                          esp_log_timestamp(), tag, ##__VA_ARGS__);                    \
+        }                                                                              \
+    } while (0)
+
+#define ESP_LOG_LEVEL_LOCAL(level, tag, format, ...)                                   \
+    do {                                                                               \
+        if (LOG_LOCAL_LEVEL >= (level)) {                                              \
+            ESP_LOG_LEVEL(level, tag, format, ##__VA_ARGS__);                          \
+        }                                                                              \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...)                                                     \
+    ESP_LOG_LEVEL_LOCAL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)                                                     \
+    ESP_LOG_LEVEL_LOCAL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)                                                     \
+    ESP_LOG_LEVEL_LOCAL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)                                                     \
+    ESP_LOG_LEVEL_LOCAL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...)                                                     \
+    ESP_LOG_LEVEL_LOCAL(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+#define ESP_LOG_BUFFER_HEX_LEVEL(tag, buffer, buff_len, level)                         \
+    do {                                                                               \
+        if (LOG_LOCAL_LEVEL >= (level)) {                                              \
+            esp_log_buffer_hex_internal(tag, buffer, buff_len, level);                 \
+        }                                                                              \
+    } while (0)
+
+#define ESP_LOG_BUFFER_HEX(tag, buffer, buff_len)                                      \
+    ESP_LOG_BUFFER_HEX_LEVEL(tag, buffer, buff_len, ESP_LOG_INFO)
+
+#define esp_log_buffer_hex ESP_LOG_BUFFER_HEX
@@ -0,0 +1,17 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// esp_random.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      ESP-IDF random numbers, host build (see ../README.md).
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t esp_random(void);
+void esp_fill_random(void *buf, size_t len);
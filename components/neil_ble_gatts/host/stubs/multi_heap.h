@@ -0,0 +1,24 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// multi_heap.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      ESP-IDF heap over a caller's buffer, host build (see
+///             ../README.md).
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct multi_heap_info *multi_heap_handle_t;
+
+multi_heap_handle_t multi_heap_register(void *start, size_t size);
+void multi_heap_set_lock(multi_heap_handle_t heap, void *lock);
+void *multi_heap_malloc(multi_heap_handle_t heap, size_t size);
+void multi_heap_free(multi_heap_handle_t heap, void *p);
+size_t multi_heap_free_size(multi_heap_handle_t heap);
+size_t multi_heap_minimum_free_size(multi_heap_handle_t heap);
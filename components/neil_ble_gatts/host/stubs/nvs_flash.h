@@ -0,0 +1,16 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// nvs_flash.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      ESP-IDF NVS partition, host build (see ../README.md).
+
+#pragma once
+
+#include "esp_err.h"
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
@@ -0,0 +1,164 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// sdkconfig.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Configuration of the host build (see ../README.md).
+///
+///             The component options take their Kconfig defaults, the stack
+///             those of a BLE-only Bluedroid build. Any of them can be
+///             overridden from the compiler command line (`-DCONFIG_...=`),
+///             booleans with 0 or 1.
+
+#pragma once
+
+// -------------------------------------------------------------
+// Platform
+// -------------------------------------------------------------
+
+// --- As ESP-IDF names its own host target
+#define CONFIG_IDF_TARGET       "linux"
+#define CONFIG_IDF_TARGET_LINUX 1
+
+#ifndef CONFIG_FREERTOS_HZ
+#define CONFIG_FREERTOS_HZ 100
+#endif
+
+#ifndef CONFIG_ESP_MAIN_TASK_STACK_SIZE
+#define CONFIG_ESP_MAIN_TASK_STACK_SIZE 3584
+#endif
+
+#ifndef CONFIG_LOG_DEFAULT_LEVEL
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+#endif
+
+// -------------------------------------------------------------
+// Bluetooth
+// -------------------------------------------------------------
+
+#define CONFIG_BT_ENABLED           1
+#define CONFIG_BT_BLUEDROID_ENABLED 1
+#define CONFIG_BT_BLE_ENABLED       1
+#define CONFIG_BT_GATTS_ENABLE      1
+
+#ifndef CONFIG_BT_ACL_CONNECTIONS
+#define CONFIG_BT_ACL_CONNECTIONS 4
+#endif
+
+#ifndef CONFIG_BT_GATT_MAX_SR_ATTRIBUTES
+#define CONFIG_BT_GATT_MAX_SR_ATTRIBUTES 100
+#endif
+
+#ifndef CONFIG_BT_GATT_MAX_SR_PROFILES
+#define CONFIG_BT_GATT_MAX_SR_PROFILES 8
+#endif
+
+// -------------------------------------------------------------
+// NEIL BLE GATT Server
+// -------------------------------------------------------------
+
+#ifndef CONFIG_NEIL_BLE_GATTS_CONN_MAX
+#define CONFIG_NEIL_BLE_GATTS_CONN_MAX 0
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_CTX_MAX
+#define CONFIG_NEIL_BLE_GATTS_CTX_MAX 2
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_NOTIFY_QUEUE_LEN
+#define CONFIG_NEIL_BLE_GATTS_NOTIFY_QUEUE_LEN 8
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_NOTIFY_SUBS_MAX
+#define CONFIG_NEIL_BLE_GATTS_NOTIFY_SUBS_MAX 8
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_NOTIFY_INFLIGHT_MAX
+#define CONFIG_NEIL_BLE_GATTS_NOTIFY_INFLIGHT_MAX 4
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_WRITE_PREP_MAX
+#define CONFIG_NEIL_BLE_GATTS_WRITE_PREP_MAX 512
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_PIPE_OPS_MAX
+#define CONFIG_NEIL_BLE_GATTS_PIPE_OPS_MAX 64
+#endif
+
+// --- Security (one of each choice)
+#if !defined(CONFIG_NEIL_BLE_GATTS_SEC_SC_BOND) &&                                     \
+    !defined(CONFIG_NEIL_BLE_GATTS_SEC_LEGACY_BOND) &&                                 \
+    !defined(CONFIG_NEIL_BLE_GATTS_SEC_NO_BOND)
+#define CONFIG_NEIL_BLE_GATTS_SEC_SC_MITM_BOND 1
+#endif
+
+#if !defined(CONFIG_NEIL_BLE_GATTS_IO_CAP_DISPLAY)
+#define CONFIG_NEIL_BLE_GATTS_IO_CAP_NONE 1
+#elif !defined(CONFIG_NEIL_BLE_GATTS_PASSKEY)
+#define CONFIG_NEIL_BLE_GATTS_PASSKEY 123456
+#endif
+
+// --- Logging
+#ifndef CONFIG_NEIL_BLE_GATTS_LOG_LEVEL_GATTS
+#define CONFIG_NEIL_BLE_GATTS_LOG_LEVEL_GATTS 3
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_LOG_LEVEL_GAP
+#define CONFIG_NEIL_BLE_GATTS_LOG_LEVEL_GAP 3
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_LOG_LEVEL_NOTIFY
+#define CONFIG_NEIL_BLE_GATTS_LOG_LEVEL_NOTIFY 2
+#endif
+
+// --- Features
+#ifndef CONFIG_NEIL_BLE_GATTS_TRACE
+#define CONFIG_NEIL_BLE_GATTS_TRACE 1
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_DEPTH
+#define CONFIG_NEIL_BLE_GATTS_DEPTH 1
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_PERSIST
+#define CONFIG_NEIL_BLE_GATTS_PERSIST 1
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_LINK
+#define CONFIG_NEIL_BLE_GATTS_LINK 1
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_ADMIT
+#define CONFIG_NEIL_BLE_GATTS_ADMIT 1
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_POLL
+#define CONFIG_NEIL_BLE_GATTS_POLL 1
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_DEMAND
+#define CONFIG_NEIL_BLE_GATTS_DEMAND 1
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_PIPE
+#define CONFIG_NEIL_BLE_GATTS_PIPE 1
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_JOURNAL
+#define CONFIG_NEIL_BLE_GATTS_JOURNAL 1
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_BATCH
+#define CONFIG_NEIL_BLE_GATTS_BATCH 1
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_HISTORY
+#define CONFIG_NEIL_BLE_GATTS_HISTORY 1
+#endif
+
+#ifndef CONFIG_NEIL_BLE_GATTS_BENCH_HOOKS
+#define CONFIG_NEIL_BLE_GATTS_BENCH_HOOKS 0
+#endif
@@ -10,11 +10,32 @@
 #include "esp_gatt_defs.h"
 #include "esp_gatts_api.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 
 #include "neil_ble_gatts.h"
+#include "neil_ble_gatts_admit.h"
 #include "neil_ble_gatts_attr_db.h"
+#include "neil_ble_gatts_bench.h"
 #include "neil_ble_gatts_cfg.h"
+#include "neil_ble_gatts_conn.h"
+#include "neil_ble_gatts_demand.h"
+#include "neil_ble_gatts_depth.h"
 #include "neil_ble_gatts_gap.h"
+#include "neil_ble_gatts_handle_map.h"
+#include "neil_ble_gatts_journal.h"
+#include "neil_ble_gatts_link.h"
+#include "neil_ble_gatts_log.h"
+#include "neil_ble_gatts_notify.h"
+#include "neil_ble_gatts_persist.h"
+#include "neil_ble_gatts_pipe.h"
+#include "neil_ble_gatts_poll.h"
+#include "neil_ble_gatts_read.h"
+#include "neil_ble_gatts_stack.h"
+#include "neil_ble_gatts_trace.h"
+#include "neil_ble_gatts_write.h"
 
 // -------------------------------------------------------------
 // Settings
@@ -22,19 +43,66 @@
 
 static const char *const TAG = "NEIL BLE GATTS";
 
-// Application Profile ID
+// Time allowed for peers to disconnect and the profile to unregister on stop.
+static const uint32_t STOP_TIMEOUT_MS = 1000;
+
+// Interval used when polling for peers to disconnect on stop.
+static const uint32_t STOP_POLL_MS = 10;
+
+// Interfaces routed to contexts.
 //
-// NOTE: This implementation supports only one application profile.
-static const uint8_t PROFILE_ID = 0;
+// NOTE: Bluedroid hands out interfaces from 1 up to its application limit,
+//       so a small table indexed by interface routes events.
+#define CTX_IF_SLOTS 16
 
 // -------------------------------------------------------------
-// Dependencies
+// Server State
 // -------------------------------------------------------------
 
-// Device Configuration
-//
-// NOTE: Must be set by dependency management procedures
-static const neil_ble_gatts_cfg_dev_t *device_config = NULL;
+/**
+ * @brief       Lifecycle of a GATT Server context.
+ */
+typedef enum {
+    SERVER_STOPPED = 0, ///< Profile is down, may be (re)started.
+    SERVER_RUNNING,     ///< Profile is up and serving.
+    SERVER_STOPPING,    ///< Teardown in progress, do not re-advertise.
+} server_state_t;
+
+/**
+ * @brief       GATT Server context, one application profile.
+ */
+struct neil_ble_gatts_ctx_s {
+    const neil_ble_gatts_cfg_dev_t *dev_cfg; ///< NULL while the slot is unused.
+    server_state_t state;
+
+    // --- Interface assigned to the application profile on registration.
+    esp_gatt_if_t gatts_if;
+
+    // --- Tables (kept across a warm stop so a restart can reuse them)
+    neil_ble_gatts_attr_db_t *attr_tab;
+    neil_ble_gatts_handle_map_t *handle_map;
+
+    // --- Advertising, unless the configuration is service-only.
+    neil_ble_gatts_gap_t gap;
+
+    // --- Signalled by the BTC task once the profile has been unregistered.
+    SemaphoreHandle_t unreg_done;
+};
+
+// --- Contexts, indexed by application profile ID.
+static neil_ble_gatts_ctx_t ctx_pool[NEIL_BLE_GATTS_CTX_MAX];
+
+// --- Registered contexts, indexed by interface.
+static neil_ble_gatts_ctx_t *ctx_by_if[CTX_IF_SLOTS];
+
+// --- Context of `neil_ble_gatts_start` and the procedures without a context.
+static neil_ble_gatts_ctx_t *ctx_default = NULL;
+
+// --- Classic BT memory can only be released once.
+static bool classic_mem_released = false;
+
+// --- Controller memory was released, no context can start until reboot.
+static bool bt_mem_released = false;
 
 // -------------------------------------------------------------
 // Prototypes
@@ -43,42 +111,158 @@ static const neil_ble_gatts_cfg_dev_t *device_config = NULL;
 // --- Events
 static void gatts_event_callback(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
                                  esp_ble_gatts_cb_param_t *param);
+static void gap_event_callback(esp_gap_ble_cb_event_t event,
+                               esp_ble_gap_cb_param_t *param);
 
 // -------------------------------------------------------------
-// Dependency Management
+// Context Management
 // -------------------------------------------------------------
 
 /**
- * @brief       Set device configuration structure used by the GATT Server.
+ * @brief       Application profile ID of a context.
+ */
+static uint8_t ctx_app_id(const neil_ble_gatts_ctx_t *ctx) { return ctx - ctx_pool; }
+
+/**
+ * @brief       Get the context registered on an interface.
+ *
+ * @return      NULL if no context is registered on `gatts_if`.
  */
-static void device_config_set(const neil_ble_gatts_cfg_dev_t *const dev_cfg) {
-    device_config = dev_cfg;
+static neil_ble_gatts_ctx_t *ctx_of_if(esp_gatt_if_t gatts_if) {
+    return gatts_if < CTX_IF_SLOTS ? ctx_by_if[gatts_if] : NULL;
 }
 
 /**
- * @brief       Clear device configuration structure used by the GATT Server.
+ * @brief       Number of contexts holding the stack up (running or stopping).
+ */
+static uint8_t ctx_live_count(void) {
+
+    uint8_t count = 0;
+
+    for (uint8_t idx = 0; idx < NEIL_BLE_GATTS_CTX_MAX; idx++) {
+        count += ctx_pool[idx].state != SERVER_STOPPED;
+    }
+
+    return count;
+}
+
+/**
+ * @brief       Whether a running context other than `ctx` advertises.
+ */
+static bool ctx_adv_taken(const neil_ble_gatts_ctx_t *ctx) {
+
+    for (uint8_t idx = 0; idx < NEIL_BLE_GATTS_CTX_MAX; idx++) {
+        const neil_ble_gatts_ctx_t *other = ctx_pool + idx;
+
+        if (other != ctx && other->state == SERVER_RUNNING &&
+            !other->dev_cfg->service_only) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief       Take a stopped context for a device configuration.
+ *
+ *              One holding the same configuration keeps its cached tables;
+ *              otherwise any holding no tables (unused or stopped cold) is
+ *              bound to `dev_cfg`.
  *
- *              Warning: If the GATT Server is still running when this is
- *                       called, it is considered undefined behavior.
+ * @return      NULL if every context is running or holds cached tables.
  */
-static void device_config_clear() { device_config = NULL; }
+static neil_ble_gatts_ctx_t *ctx_acquire(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    neil_ble_gatts_ctx_t *spare = NULL;
+
+    for (uint8_t idx = 0; idx < NEIL_BLE_GATTS_CTX_MAX; idx++) {
+        neil_ble_gatts_ctx_t *ctx = ctx_pool + idx;
+
+        if (ctx->state != SERVER_STOPPED) {
+            continue;
+        }
+
+        if (ctx->dev_cfg == dev_cfg) {
+            return ctx;
+        }
+
+        if (spare == NULL && ctx->attr_tab == NULL && ctx->handle_map == NULL) {
+            spare = ctx;
+        }
+    }
+
+    if (spare != NULL) {
+        spare->dev_cfg  = dev_cfg;
+        spare->gatts_if = ESP_GATT_IF_NONE;
+    }
+
+    return spare;
+}
+
+/**
+ * @brief       Find the service owning a characteristic configuration.
+ */
+static const neil_ble_gatts_cfg_svc_t *
+svc_config_of(const neil_ble_gatts_ctx_t *ctx,
+              const neil_ble_gatts_cfg_chr_t *chr_cfg) {
+
+    for (uint8_t svc_idx = 0; svc_idx < ctx->dev_cfg->svc_tab_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = ctx->dev_cfg->svc_tab + svc_idx;
+
+        if (chr_cfg >= svc_cfg->chr_tab &&
+            chr_cfg < svc_cfg->chr_tab + svc_cfg->chr_tab_len) {
+            return svc_cfg;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief       Release the attribute table and handle map of a context.
+ */
+static void tables_clear(neil_ble_gatts_ctx_t *ctx) {
+    neil_ble_gatts_handle_map_deinit(ctx->handle_map);
+    ctx->handle_map = NULL;
+    neil_ble_gatts_attr_db_deinit(ctx->attr_tab);
+    ctx->attr_tab = NULL;
+}
 
 // -------------------------------------------------------------
 // Initialization / Deinitialization
 // -------------------------------------------------------------
 
-// FIXME: Documentation
-void neil_ble_gatts_start(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+/**
+ * @brief       Bring up the controller and Bluedroid, shared by every
+ *              context.
+ */
+static esp_err_t stack_init() {
 
-    // --- Prepare Device Configuration
-    device_config_set(dev_cfg);
+    esp_err_t ret;
 
     // ---------------------------------
     // Memory Release
     // ---------------------------------
 
     // --- Release Heap Memory from unused bluetooth mode
-    ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
+    if (!classic_mem_released) {
+        ret = esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Classic BT memory release failed: %s", esp_err_to_name(ret));
+            return ret;
+        }
+        classic_mem_released = true;
+    }
+
+    // ---------------------------------
+    // Connection Table
+    // ---------------------------------
+
+    ret = neil_ble_gatts_conn_init();
+    if (ret != ESP_OK) {
+        return ret;
+    }
 
     // ---------------------------------
     // Bluetooth Controller
@@ -109,106 +293,546 @@ void neil_ble_gatts_start(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
 
     esp_ble_gatts_register_callback(gatts_event_callback);
 
-    esp_ble_gap_register_callback(neil_ble_gatts_gap_event_handler);
-
-    // ---------------------------------
-    // Application Profile Registration
-    // ---------------------------------
-
-    esp_ble_gatts_app_register(PROFILE_ID);
+    esp_ble_gap_register_callback(gap_event_callback);
 
     // ---------------------------------
     // Configure GAP Security Parameters
     // ---------------------------------
     neil_ble_gatts_gap_configure_security();
 
-    return;
+    return ESP_OK;
 }
 
-// -------------------------------------------------------------
-// Characteristic-Handle-to-Configuration Map
-// -------------------------------------------------------------
+/**
+ * @brief       Tear down Bluedroid and the controller.
+ *
+ * @return      The first error encountered, teardown continues regardless.
+ */
+static esp_err_t stack_deinit() {
+
+    esp_err_t first_err = ESP_OK;
+    esp_err_t ret;
+
+    if (esp_bluedroid_get_status() == ESP_BLUEDROID_STATUS_ENABLED) {
+        ret       = esp_bluedroid_disable();
+        first_err = first_err == ESP_OK ? ret : first_err;
+    }
+
+    if (esp_bluedroid_get_status() == ESP_BLUEDROID_STATUS_INITIALIZED) {
+        ret       = esp_bluedroid_deinit();
+        first_err = first_err == ESP_OK ? ret : first_err;
+    }
+
+    if (esp_bt_controller_get_status() == ESP_BT_CONTROLLER_STATUS_ENABLED) {
+        ret       = esp_bt_controller_disable();
+        first_err = first_err == ESP_OK ? ret : first_err;
+    }
+
+    if (esp_bt_controller_get_status() == ESP_BT_CONTROLLER_STATUS_INITED) {
+        ret       = esp_bt_controller_deinit();
+        first_err = first_err == ESP_OK ? ret : first_err;
+    }
+
+    if (first_err != ESP_OK) {
+        ESP_LOGE(TAG, "Stack teardown error: %s", esp_err_to_name(first_err));
+    }
+
+    return first_err;
+}
+
+/**
+ * @brief       Release what `ctx_attach` set up for a context.
+ */
+static void ctx_detach(neil_ble_gatts_ctx_t *ctx) {
+    if (!ctx->dev_cfg->service_only) {
+        neil_ble_gatts_admit_deinit();
+    }
+    neil_ble_gatts_demand_detach(ctx);
+    neil_ble_gatts_poll_detach(ctx);
+    neil_ble_gatts_persist_detach(ctx);
+}
+
+/**
+ * @brief       Set up the optional features a context's configuration uses:
+ *              persistent values (restored through `on_write`), polling,
+ *              demand signals and admission control, once command pipes and
+ *              the change journal are known to be built.
+ *
+ * @return      The first error, with nothing left attached. Features left out
+ *              in menuconfig report ESP_ERR_NOT_SUPPORTED when used.
+ */
+static esp_err_t ctx_attach(neil_ble_gatts_ctx_t *ctx) {
+
+    // --- Checks first, then stored values are the application's before a
+    //     client can connect
+    esp_err_t ret = neil_ble_gatts_pipe_check(ctx->dev_cfg);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Command pipes cannot run: %s", esp_err_to_name(ret));
+    } else if ((ret = neil_ble_gatts_journal_check(ctx->dev_cfg)) != ESP_OK) {
+        ESP_LOGE(TAG, "Change journal cannot be served: %s", esp_err_to_name(ret));
+    } else if ((ret = neil_ble_gatts_persist_attach(ctx, ctx->dev_cfg)) != ESP_OK) {
+        ESP_LOGE(TAG, "Persistent values cannot be kept: %s", esp_err_to_name(ret));
+    } else if ((ret = neil_ble_gatts_poll_attach(ctx, ctx->dev_cfg)) != ESP_OK) {
+        ESP_LOGE(TAG, "Polled characteristics cannot be sampled: %s",
+                 esp_err_to_name(ret));
+    } else if ((ret = neil_ble_gatts_demand_attach(ctx, ctx->dev_cfg)) != ESP_OK) {
+        ESP_LOGE(TAG, "Demand cannot be published: %s", esp_err_to_name(ret));
+    } else if (!ctx->dev_cfg->service_only &&
+               (ret = neil_ble_gatts_admit_init(ctx->dev_cfg->admit)) != ESP_OK) {
+        ESP_LOGE(TAG, "Admission control cannot start: %s", esp_err_to_name(ret));
+    }
+
+    if (ret != ESP_OK) {
+        ctx_detach(ctx);
+    }
+
+    return ret;
+}
 
 /**
- * @brief       Primitive handle-to-char_config mapping structure.
+ * @brief       Register the application profile of a context, bringing up the
+ *              stack first if no other context runs.
+ *
+ *              The remainder of the setup chain runs on the BTC task,
+ *              starting with `ESP_GATTS_REG_EVT`.
  *
- *              Used to relate handles on read/write requests to their
- *              appropriate configuration structure.
+ * @return      An error of `ctx_attach` or of the stack, the context then
+ *              stays stopped.
  */
-typedef struct {
-    size_t len;
-    uint16_t offset;
-    neil_ble_gatts_cfg_chr_t **data;
-} chr_handle_map_t;
+static esp_err_t ctx_start(neil_ble_gatts_ctx_t *ctx) {
+
+    if (!ctx->dev_cfg->service_only && ctx_adv_taken(ctx)) {
+        ESP_LOGE(TAG, "Another context advertises, configuration must be service-only");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (ctx->dev_cfg->l2cap != NULL) {
+        ESP_LOGW(TAG, "L2CAP channels need the NimBLE host, ignored");
+    }
+
+    esp_err_t ret = ctx_attach(ctx);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (ctx_live_count() == 0) {
+        ret = stack_init();
+        if (ret != ESP_OK) {
+            ctx_detach(ctx);
+            return ret;
+        }
+    }
+
+    // ---------------------------------
+    // Application Profile Registration
+    // ---------------------------------
+
+    ctx->state = SERVER_RUNNING;
+
+    esp_ble_gatts_app_register(ctx_app_id(ctx));
+
+    return ESP_OK;
+}
 
 /**
- * @brief       Allocate and configure a new handle-to-config map.
+ * @brief       Unregister the application profile of a context.
  */
-static chr_handle_map_t *chr_handle_map_init(const neil_ble_gatts_cfg_dev_t *dev_cfg,
-                                             uint16_t *handle_buffer,
-                                             uint16_t handle_buffer_len) {
+static void ctx_unregister(neil_ble_gatts_ctx_t *ctx) {
 
-    // --- Attributes per characteristic.
-    //
-    // NOTE: This information is implicit in the design structure of the GATT
-    //       table.
-    static const uint8_t attr_val_offset = 2;
+    if (ctx->gatts_if == ESP_GATT_IF_NONE) {
+        return;
+    }
+
+    if (ctx->unreg_done == NULL) {
+        ctx->unreg_done = xSemaphoreCreateBinary();
+    }
+
+    esp_ble_gatts_app_unregister(ctx->gatts_if);
+
+    if (ctx->unreg_done == NULL ||
+        xSemaphoreTake(ctx->unreg_done, pdMS_TO_TICKS(STOP_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGW(TAG, "Profile unregistration timed out");
+    }
+
+    if (ctx->gatts_if < CTX_IF_SLOTS) {
+        ctx_by_if[ctx->gatts_if] = NULL;
+    }
+
+    ctx->gatts_if = ESP_GATT_IF_NONE;
+}
+
+neil_ble_gatts_ctx_t *
+neil_ble_gatts_ctx_start(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    if (bt_mem_released) {
+        ESP_LOGE(TAG, "Memory released, cannot start");
+        return NULL;
+    }
 
-    // --- Services only require one attribute.
-    static const uint8_t svc_offset = 1;
+    neil_ble_gatts_ctx_t *ctx = ctx_acquire(dev_cfg);
 
-    const uint16_t handle_space_offset = handle_buffer[0];
+    if (ctx == NULL) {
+        ESP_LOGE(TAG, "No free context (%d in use)", NEIL_BLE_GATTS_CTX_MAX);
+        return NULL;
+    }
 
-    uint8_t attr_idx = -1;
+    return ctx_start(ctx) == ESP_OK ? ctx : NULL;
+}
 
-    chr_handle_map_t *map = malloc(sizeof(chr_handle_map_t));
+esp_err_t neil_ble_gatts_ctx_restart(neil_ble_gatts_ctx_t *ctx) {
 
-    map->len    = handle_buffer_len;
-    map->offset = handle_space_offset;
+    if (ctx == NULL || ctx->state != SERVER_STOPPED || ctx->dev_cfg == NULL ||
+        bt_mem_released) {
+        return ESP_ERR_INVALID_STATE;
+    }
 
-    // Initialize the internal mapping table with
-    // length * the size of a characteristic config pointer.
-    map->data = malloc(map->len * sizeof(neil_ble_gatts_cfg_chr_t *));
+    ESP_LOGI(TAG, "Restarting (%s tables)", ctx->attr_tab != NULL ? "cached" : "fresh");
 
-    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
-        attr_idx += svc_offset;
+    return ctx_start(ctx);
+}
 
-        // --- Acquire Service Config
-        neil_ble_gatts_cfg_svc_t *svc_cfg = (dev_cfg->svc_tab + svc_idx);
+esp_err_t neil_ble_gatts_ctx_stop(neil_ble_gatts_ctx_t *ctx,
+                                  neil_ble_gatts_stop_mode_t mode) {
 
-        for (uint8_t chr_idx = 0; chr_idx < (dev_cfg->svc_tab + svc_idx)->chr_tab_len;
-             chr_idx++) {
+    if (ctx == NULL || ctx->state != SERVER_RUNNING) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // --- The last context takes the stack and its links down
+    const bool last = ctx_live_count() == 1;
 
-            attr_idx += attr_val_offset;
+    if (!last && mode == NEIL_BLE_GATTS_STOP_RELEASE) {
+        ESP_LOGE(TAG, "Other contexts running, cannot release memory");
+        return ESP_ERR_INVALID_STATE;
+    }
 
-            neil_ble_gatts_cfg_chr_t *chr_cfg = (svc_cfg->chr_tab + chr_idx);
+    neil_ble_gatts_poll_detach(ctx);
 
-            *(map->data + attr_idx) = chr_cfg;
+    // --- Prevents the disconnect handler from re-advertising
+    ctx->state = SERVER_STOPPING;
+
+    // ---------------------------------
+    // Peers
+    // ---------------------------------
+
+    neil_ble_gatts_gap_deinit(&ctx->gap);
+
+    if (!ctx->dev_cfg->service_only) {
+        neil_ble_gatts_admit_deinit();
+    }
+
+    if (last) {
+        neil_ble_gatts_conn_disconnect_all();
+
+        for (uint32_t waited = 0;
+             neil_ble_gatts_conn_count() > 0 && waited < STOP_TIMEOUT_MS;
+             waited += STOP_POLL_MS) {
+            vTaskDelay(pdMS_TO_TICKS(STOP_POLL_MS));
+        }
+
+        if (neil_ble_gatts_conn_count() > 0) {
+            ESP_LOGW(TAG, "Peers still connected, forcing teardown");
+        }
+    }
+
+    // ---------------------------------
+    // Application Profile
+    // ---------------------------------
+
+    ctx_unregister(ctx);
+
+    // ---------------------------------
+    // Stack
+    // ---------------------------------
+
+    esp_err_t ret = ESP_OK;
+
+    if (last) {
+        ret = stack_deinit();
+
+        neil_ble_gatts_read_cancel_all();
+        neil_ble_gatts_notify_close_all();
+        neil_ble_gatts_link_close_all();
+        neil_ble_gatts_admit_close_all();
+        neil_ble_gatts_write_release_all();
+        neil_ble_gatts_conn_deinit();
+    }
+
+    // --- Publishes the last disconnections
+    neil_ble_gatts_demand_detach(ctx);
+
+    // --- No client writes anymore, the last values are stored
+    neil_ble_gatts_persist_detach(ctx);
+
+    if (mode != NEIL_BLE_GATTS_STOP_WARM) {
+        tables_clear(ctx);
+    }
+
+    ctx->state = SERVER_STOPPED;
+
+    if (mode == NEIL_BLE_GATTS_STOP_RELEASE) {
+        ctx->dev_cfg = NULL;
+
+        esp_err_t rel = esp_bt_mem_release(ESP_BT_MODE_BTDM);
+        if (rel != ESP_OK) {
+            ESP_LOGE(TAG, "BT memory release failed: %s", esp_err_to_name(rel));
+            ret = ret == ESP_OK ? rel : ret;
         }
+
+        bt_mem_released = true;
+    }
+
+    ESP_LOGI(TAG, "Stopped (profile %d)", ctx_app_id(ctx));
+
+    return ret;
+}
+
+// -------------------------------------------------------------
+// Default Context
+// -------------------------------------------------------------
+
+void neil_ble_gatts_start(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    if ((ctx_default != NULL && ctx_default->state != SERVER_STOPPED) ||
+        bt_mem_released) {
+        ESP_LOGE(TAG, "Server already started or memory released");
+        return;
+    }
+
+    // --- Tables cached by a warm stop only apply to the same configuration
+    if (ctx_default != NULL && ctx_default->dev_cfg != dev_cfg) {
+        tables_clear(ctx_default);
+    }
+
+    ctx_default = ctx_acquire(dev_cfg);
+
+    ESP_ERROR_CHECK(ctx_default != NULL ? ctx_start(ctx_default) : ESP_ERR_NOT_FOUND);
+}
+
+esp_err_t neil_ble_gatts_restart(void) {
+    return neil_ble_gatts_ctx_restart(ctx_default);
+}
+
+esp_err_t neil_ble_gatts_stop(neil_ble_gatts_stop_mode_t mode) {
+    return neil_ble_gatts_ctx_stop(ctx_default, mode);
+}
+
+esp_err_t neil_ble_gatts_notify(uint8_t svc_idx, uint8_t chr_idx, const uint8_t *data,
+                                uint16_t len) {
+    return neil_ble_gatts_ctx_notify(ctx_default, svc_idx, chr_idx, data, len);
+}
+
+esp_err_t neil_ble_gatts_notify_conn(uint16_t conn_id, uint8_t svc_idx, uint8_t chr_idx,
+                                     const uint8_t *data, uint16_t len) {
+    return neil_ble_gatts_ctx_notify_conn(ctx_default, conn_id, svc_idx, chr_idx, data,
+                                          len);
+}
+
+// -------------------------------------------------------------
+// Notifications
+// -------------------------------------------------------------
+
+esp_err_t neil_ble_gatts_ctx_notify(neil_ble_gatts_ctx_t *ctx, uint8_t svc_idx,
+                                    uint8_t chr_idx, const uint8_t *data,
+                                    uint16_t len) {
+    return neil_ble_gatts_ctx_notify_conn(ctx, NEIL_BLE_GATTS_NOTIFY_CONN_ALL, svc_idx,
+                                          chr_idx, data, len);
+}
+
+esp_err_t neil_ble_gatts_ctx_notify_conn(neil_ble_gatts_ctx_t *ctx, uint16_t conn_id,
+                                         uint8_t svc_idx, uint8_t chr_idx,
+                                         const uint8_t *data, uint16_t len) {
+
+    if (ctx == NULL || ctx->state != SERVER_RUNNING || ctx->handle_map == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (svc_idx >= ctx->dev_cfg->svc_tab_len ||
+        chr_idx >= ctx->dev_cfg->svc_tab[svc_idx].chr_tab_len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    neil_ble_gatts_cfg_chr_t *chr_cfg =
+        ctx->dev_cfg->svc_tab[svc_idx].chr_tab + chr_idx;
+
+    if (!chr_cfg->notify) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    neil_ble_gatts_journal_bump(chr_cfg);
+
+    const uint16_t handle = neil_ble_gatts_handle_map_find(ctx->handle_map, chr_cfg);
+
+    return neil_ble_gatts_notify_enqueue(ctx->gatts_if, conn_id, handle, data, len);
+}
+
+bool neil_ble_gatts_ctx_subscribed(neil_ble_gatts_ctx_t *ctx, uint8_t svc_idx,
+                                   uint8_t chr_idx) {
+    return neil_ble_gatts_ctx_subscribers(ctx, svc_idx, chr_idx) > 0;
+}
+
+uint8_t neil_ble_gatts_ctx_subscribers(neil_ble_gatts_ctx_t *ctx, uint8_t svc_idx,
+                                       uint8_t chr_idx) {
+
+    if (ctx == NULL || ctx->state != SERVER_RUNNING || ctx->handle_map == NULL ||
+        svc_idx >= ctx->dev_cfg->svc_tab_len ||
+        chr_idx >= ctx->dev_cfg->svc_tab[svc_idx].chr_tab_len) {
+        return 0;
+    }
+
+    const uint16_t handle = neil_ble_gatts_handle_map_find(
+        ctx->handle_map, ctx->dev_cfg->svc_tab[svc_idx].chr_tab + chr_idx);
+
+    return neil_ble_gatts_notify_subscribers(handle);
+}
+
+// -------------------------------------------------------------
+// Event Dispatch
+// -------------------------------------------------------------
+
+uint16_t neil_ble_gatts_ctx_handle(neil_ble_gatts_ctx_t *ctx, uint8_t svc_idx,
+                                   uint8_t chr_idx) {
+
+    if (ctx == NULL || ctx->handle_map == NULL ||
+        svc_idx >= ctx->dev_cfg->svc_tab_len ||
+        chr_idx >= ctx->dev_cfg->svc_tab[svc_idx].chr_tab_len) {
+        return 0;
     }
 
-    return map;
+    return neil_ble_gatts_handle_map_find(ctx->handle_map,
+                                          ctx->dev_cfg->svc_tab[svc_idx].chr_tab +
+                                              chr_idx);
 }
 
+#if CONFIG_NEIL_BLE_GATTS_BENCH_HOOKS
+
+// --- Transaction IDs of dispatched requests, apart from the stack's
+static uint32_t dispatch_trans_id = 0;
+static portMUX_TYPE dispatch_lock = portMUX_INITIALIZER_UNLOCKED;
+
 /**
- * @brief       Get configuration by handle from a map.
+ * @brief       Whether requests may be dispatched to a context: nothing else
+ *              should reach its handlers meanwhile.
  */
-static neil_ble_gatts_cfg_chr_t *chr_handle_map_get(chr_handle_map_t *map,
-                                                    uint16_t handle) {
-    return *(map->data + (handle - map->offset));
+static bool dispatch_ready(neil_ble_gatts_ctx_t *ctx) {
+    return ctx != NULL && ctx->state == SERVER_RUNNING && ctx->handle_map != NULL &&
+           neil_ble_gatts_conn_count() == 0;
 }
 
-// HACK: Error Checking
-static void chr_handle_map_deinit(chr_handle_map_t *map) {
+static uint32_t dispatch_trans_id_next(void) {
+    portENTER_CRITICAL(&dispatch_lock);
+    const uint32_t trans_id = --dispatch_trans_id;
+    portEXIT_CRITICAL(&dispatch_lock);
+
+    return trans_id;
+}
 
-    // Set all values in data array to null.
-    size_t len = map->len;
-    for (uint8_t idx = 0; idx < len; ++idx) {
-        *(map->data + idx) = NULL;
+esp_err_t neil_ble_gatts_bench_dispatch_read(neil_ble_gatts_ctx_t *ctx,
+                                             uint16_t conn_id, uint16_t handle,
+                                             uint16_t offset) {
+
+    if (!dispatch_ready(ctx)) {
+        return ESP_ERR_INVALID_STATE;
     }
 
-    free(map->data);
-    free(map);
+    esp_ble_gatts_cb_param_t param = {
+        .read =
+            {
+                .conn_id  = conn_id,
+                .trans_id = dispatch_trans_id_next(),
+                .handle   = handle,
+                .offset   = offset,
+                .is_long  = offset > 0,
+                .need_rsp = true,
+            },
+    };
+
+    gatts_event_callback(ESP_GATTS_READ_EVT, ctx->gatts_if, &param);
+
+    return ESP_OK;
+}
+
+esp_err_t neil_ble_gatts_bench_dispatch_write(neil_ble_gatts_ctx_t *ctx,
+                                              uint16_t conn_id, uint16_t handle,
+                                              uint8_t *value, uint16_t len,
+                                              bool need_rsp) {
+
+    if (!dispatch_ready(ctx)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_ble_gatts_cb_param_t param = {
+        .write =
+            {
+                .conn_id  = conn_id,
+                .trans_id = dispatch_trans_id_next(),
+                .handle   = handle,
+                .need_rsp = need_rsp,
+                .len      = len,
+                .value    = value,
+            },
+    };
+
+    gatts_event_callback(ESP_GATTS_WRITE_EVT, ctx->gatts_if, &param);
+
+    return ESP_OK;
+}
+
+#endif
+
+// -------------------------------------------------------------
+// Stack Procedures
+// -------------------------------------------------------------
+
+esp_err_t neil_ble_gatts_stack_notify(uint8_t gatts_if, uint16_t conn_id,
+                                      uint16_t handle, const uint8_t *data,
+                                      uint16_t len) {
+    return esp_ble_gatts_send_indicate(gatts_if, conn_id, handle, len, (uint8_t *)data,
+                                       false);
+}
+
+void neil_ble_gatts_stack_disconnect(uint16_t conn_id, const esp_bd_addr_t bda) {
+    esp_ble_gap_disconnect((uint8_t *)bda);
+}
+
+void neil_ble_gatts_stack_secure(uint16_t conn_id, const esp_bd_addr_t bda, bool mitm) {
+    const esp_ble_sec_act_t sec_act =
+        mitm ? ESP_BLE_SEC_ENCRYPT_MITM : ESP_BLE_SEC_ENCRYPT_NO_MITM;
+
+    esp_ble_set_encryption((uint8_t *)bda, sec_act);
+}
+
+esp_err_t neil_ble_gatts_stack_read_rssi(uint16_t conn_id, const esp_bd_addr_t bda) {
+    return esp_ble_gap_read_rssi((uint8_t *)bda);
+}
+
+esp_err_t neil_ble_gatts_stack_update_params(uint16_t conn_id, const esp_bd_addr_t bda,
+                                             uint16_t interval_min,
+                                             uint16_t interval_max, uint16_t latency,
+                                             uint16_t timeout) {
+
+    esp_ble_conn_update_params_t params = {
+        .min_int = interval_min,
+        .max_int = interval_max,
+        .latency = latency,
+        .timeout = timeout,
+    };
+    memcpy(params.bda, bda, sizeof(esp_bd_addr_t));
+
+    return esp_ble_gap_update_conn_params(&params);
+}
+
+esp_err_t neil_ble_gatts_stack_set_phy(uint16_t conn_id, const esp_bd_addr_t bda,
+                                       uint8_t phy) {
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    const esp_ble_gap_phy_mask_t mask = 1 << (phy - 1);
+
+    return esp_ble_gap_set_preferred_phy((uint8_t *)bda, 0, mask, mask,
+                                         ESP_BLE_GAP_PHY_OPTIONS_NO_PREF);
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
 }
 
 // -------------------------------------------------------------
@@ -218,13 +842,201 @@ static void chr_handle_map_deinit(chr_handle_map_t *map) {
 //    attribute_table_init();
 //    neil_ble_gatts_gap_init();
 
+/**
+ * @brief       Entry-point for GAP events, records them when tracing or
+ *              measuring stack depth.
+ */
+static void gap_event_callback(esp_gap_ble_cb_event_t event,
+                               esp_ble_gap_cb_param_t *param) {
+
+    const bool traced      = neil_ble_gatts_trace_active();
+    const int64_t start_us = traced ? esp_timer_get_time() : 0;
+
+    const bool measured      = neil_ble_gatts_depth_active();
+    const uint32_t free_size = measured ? neil_ble_gatts_depth_free() : 0;
+
+    neil_ble_gatts_gap_event_handler(event, param);
+
+    if (traced) {
+        neil_ble_gatts_trace_gap(event, start_us);
+    }
+
+    if (measured) {
+        neil_ble_gatts_depth_record(NEIL_BLE_GATTS_DEPTH_SRC_GAP, event, free_size);
+    }
+}
+
 // FIXME: Documentation
+static void gatts_event_dispatch(neil_ble_gatts_ctx_t *ctx, esp_gatts_cb_event_t event,
+                                 esp_gatt_if_t gatts_if,
+                                 esp_ble_gatts_cb_param_t *param);
+
+/**
+ * @brief       Check the link security an attribute requires, value or client
+ *              configuration alike.
+ */
+static esp_gatt_status_t access_check(neil_ble_gatts_ctx_t *ctx, uint16_t conn_id,
+                                      uint16_t handle) {
+
+    neil_ble_gatts_cfg_chr_t *chr_cfg =
+        neil_ble_gatts_handle_map_get(ctx->handle_map, handle);
+
+    if (chr_cfg == NULL) {
+        chr_cfg = neil_ble_gatts_handle_map_get_cccd(ctx->handle_map, handle);
+    }
+
+    return chr_cfg != NULL ? neil_ble_gatts_conn_sec_check(conn_id, chr_cfg->security)
+                           : ESP_GATT_OK;
+}
+
+/**
+ * @brief       Apply a complete write (single or executed prepared write).
+ */
+static esp_gatt_status_t write_apply(neil_ble_gatts_ctx_t *ctx, uint16_t conn_id,
+                                     uint16_t handle, uint8_t *value, uint16_t len) {
+
+    const esp_gatt_status_t sec_status = access_check(ctx, conn_id, handle);
+
+    if (sec_status != ESP_GATT_OK) {
+        return sec_status;
+    }
+
+    neil_ble_gatts_cfg_chr_t *chr_cfg =
+        neil_ble_gatts_handle_map_get(ctx->handle_map, handle);
+
+    // --- Change journal: remember what the client has seen
+    if (chr_cfg != NULL && chr_cfg->journal) {
+        return neil_ble_gatts_journal_request(conn_id, value, len);
+    }
+
+    // --- Command pipe: dispatch the batch, then notify the writer its status
+    if (chr_cfg != NULL && chr_cfg->pipe) {
+        uint8_t status[NEIL_BLE_GATTS_PIPE_STATUS_MAX];
+
+        const uint16_t status_len =
+            neil_ble_gatts_pipe_run(ctx->dev_cfg, conn_id, value, len, status);
+
+        if (chr_cfg->notify) {
+            neil_ble_gatts_notify_enqueue(ctx->gatts_if, conn_id, handle, status,
+                                          status_len);
+        }
+        return ESP_GATT_OK;
+    }
+
+    if (chr_cfg != NULL && chr_cfg->on_write != NULL) {
+        chr_cfg->on_write(value, len);
+        neil_ble_gatts_journal_bump(chr_cfg);
+        neil_ble_gatts_persist_store(chr_cfg, value, len);
+        return ESP_GATT_OK;
+    }
+
+    // --- Client configuration of the preceding value attribute
+    if (neil_ble_gatts_handle_map_get_cccd(ctx->handle_map, handle) != NULL) {
+        if (len != sizeof(uint16_t)) {
+            return ESP_GATT_INVALID_ATTR_LEN;
+        }
+
+        const uint16_t cccd = value[0] | value[1] << 8;
+        const esp_gatt_status_t status =
+            neil_ble_gatts_notify_subscribe(conn_id, handle - 1, cccd);
+
+        neil_ble_gatts_demand_refresh();
+
+        return status;
+    }
+
+    ESP_LOGW(TAG, "Write to unmapped handle %x", handle);
+
+    return chr_cfg != NULL ? ESP_GATT_WRITE_NOT_PERMIT : ESP_GATT_INVALID_HANDLE;
+}
+
+/**
+ * @brief       Apply a complete write, telling `on_write` callbacks the
+ *              writer (`neil_ble_gatts_conn_writer`).
+ */
+static esp_gatt_status_t write_dispatch(neil_ble_gatts_ctx_t *ctx, uint16_t conn_id,
+                                        uint16_t handle, uint8_t *value,
+                                        uint16_t len) {
+
+    neil_ble_gatts_conn_set_writer(conn_id);
+    const esp_gatt_status_t status = write_apply(ctx, conn_id, handle, value, len);
+    neil_ble_gatts_conn_set_writer(NEIL_BLE_GATTS_CONN_NONE);
+
+    return status;
+}
+
+/**
+ * @brief       Route a GATTS event to the context registered on its interface.
+ */
+static void gatts_event_route(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
+                              esp_ble_gatts_cb_param_t *param) {
+
+    // --- Registration binds a context (by profile ID) to its interface
+    if (event == ESP_GATTS_REG_EVT) {
+        neil_ble_gatts_ctx_t *ctx =
+            param->reg.app_id < NEIL_BLE_GATTS_CTX_MAX ? ctx_pool + param->reg.app_id
+                                                       : NULL;
+
+        if (ctx == NULL || param->reg.status != ESP_GATT_OK ||
+            gatts_if >= CTX_IF_SLOTS) {
+            ESP_LOGE(TAG, "Profile %d registration failed: %x (interface %d)",
+                     param->reg.app_id, param->reg.status, gatts_if);
+            return;
+        }
+
+        ctx->gatts_if       = gatts_if;
+        ctx_by_if[gatts_if] = ctx;
+
+        gatts_event_dispatch(ctx, event, gatts_if, param);
+        return;
+    }
+
+    // --- Not addressed to one profile, every registered context handles it
+    if (gatts_if == ESP_GATT_IF_NONE) {
+        for (uint8_t idx = 0; idx < CTX_IF_SLOTS; idx++) {
+            if (ctx_by_if[idx] != NULL) {
+                gatts_event_dispatch(ctx_by_if[idx], event, idx, param);
+            }
+        }
+        return;
+    }
+
+    neil_ble_gatts_ctx_t *ctx = ctx_of_if(gatts_if);
+
+    if (ctx != NULL) {
+        gatts_event_dispatch(ctx, event, gatts_if, param);
+    }
+}
+
+/**
+ * @brief       Entry-point for GATTS events, records them when tracing or
+ *              measuring stack depth.
+ */
 static void gatts_event_callback(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
                                  esp_ble_gatts_cb_param_t *param) {
 
+    const bool traced      = neil_ble_gatts_trace_active();
+    const int64_t start_us = traced ? esp_timer_get_time() : 0;
+
+    const bool measured      = neil_ble_gatts_depth_active();
+    const uint32_t free_size = measured ? neil_ble_gatts_depth_free() : 0;
+
+    gatts_event_route(event, gatts_if, param);
+
+    if (traced) {
+        neil_ble_gatts_trace_gatts(event, param, start_us);
+    }
+
+    if (measured) {
+        neil_ble_gatts_depth_record(NEIL_BLE_GATTS_DEPTH_SRC_GATTS, event, free_size);
+    }
+}
+
+static void gatts_event_dispatch(neil_ble_gatts_ctx_t *ctx, esp_gatts_cb_event_t event,
+                                 esp_gatt_if_t gatts_if,
+                                 esp_ble_gatts_cb_param_t *param) {
+
     static const uint8_t INSTANCE_ID = 0;
-    static neil_ble_gatts_attr_db_t *attr_tab;
-    static chr_handle_map_t *handle_map;
 
     switch (event) {
 
@@ -237,21 +1049,30 @@ static void gatts_event_callback(esp_gatts_cb_event_t event, esp_gatt_if_t gatts
     //
     case ESP_GATTS_REG_EVT:
 
-        // --- Prepare GAP
-        neil_ble_gatts_gap_init(device_config);
+        // --- Prepare GAP (service-only contexts do not advertise)
+        if (!ctx->dev_cfg->service_only &&
+            neil_ble_gatts_gap_init(&ctx->gap, ctx->dev_cfg) == ESP_OK) {
 
-        // --- Configure Privacy Settings
-        //
-        // NOTE: This will trigger the remaining GAP setup chain
-        esp_ble_gap_config_local_privacy(true);
+            // --- Configure Privacy Settings
+            //
+            // NOTE: This will trigger the remaining GAP setup chain
+            esp_ble_gap_config_local_privacy(true);
+        }
 
         ESP_LOGI(TAG, "Initializing GATT Table");
 
-        // --- Prepate Attribute Table
-        attr_tab = neil_ble_gatts_attr_db_init(device_config);
+        // --- Prepate Attribute Table (reused after a warm stop)
+        if (ctx->attr_tab == NULL) {
+            ctx->attr_tab = neil_ble_gatts_attr_db_init(ctx->dev_cfg);
+        }
+
+        if (ctx->attr_tab == NULL) {
+            ESP_LOGE(TAG, "Unable to allocate GATT Table");
+            break;
+        }
 
         // FIXME: Wrap table creation;
-        esp_ble_gatts_create_attr_tab(attr_tab->data, gatts_if, attr_tab->len,
+        esp_ble_gatts_create_attr_tab(ctx->attr_tab->data, gatts_if, ctx->attr_tab->len,
                                       INSTANCE_ID);
         break;
 
@@ -260,33 +1081,48 @@ static void gatts_event_callback(esp_gatts_cb_event_t event, esp_gatt_if_t gatts
     //
     case ESP_GATTS_CREAT_ATTR_TAB_EVT: {
 
-        // FIXME: Move out into global knowledge header,
-        //        maybe from the gatt table authority
-        static uint8_t attr_svc_offset = 1;
-        static uint8_t attr_chr_offset = 2;
+        if (param->add_attr_tab.status != ESP_GATT_OK) {
+            ESP_LOGE(TAG, "Attribute Table creation failed: %x",
+                     param->add_attr_tab.status);
+            break;
+        }
 
         ESP_LOGI(TAG, "Attribute Table Created");
 
-        handle_map = chr_handle_map_init(device_config, param->add_attr_tab.handles,
-                                         param->add_attr_tab.num_handle);
+        neil_ble_gatts_handle_map_t *handle_map = ctx->handle_map;
+
+        // --- Reuse the map of a warm stop, only the handle space may move
+        if (handle_map != NULL && handle_map->len == param->add_attr_tab.num_handle) {
+            neil_ble_gatts_handle_map_rebase(handle_map, param->add_attr_tab.handles);
+        } else {
+            neil_ble_gatts_handle_map_deinit(handle_map);
+            handle_map = neil_ble_gatts_handle_map_init(ctx->dev_cfg,
+                                                        param->add_attr_tab.handles,
+                                                        param->add_attr_tab.num_handle);
+        }
+
+        ctx->handle_map = handle_map;
+
+        if (handle_map == NULL) {
+            ESP_LOGE(TAG, "Unable to allocate Handle Mapping");
+            break;
+        }
 
         ESP_LOGI(TAG, "Handle Mapping Created");
 
-        uint8_t attr_idx = -1;
+        uint16_t attr_idx = 0;
 
         // --- Start Services
         //     FIXME: Factor out into abstraction-level appropriate call
-        for (uint8_t svc_idx = 0; svc_idx < device_config->svc_tab_len; svc_idx++) {
-            attr_idx += attr_svc_offset;
-
-            neil_ble_gatts_cfg_svc_t *svc_cfg = device_config->svc_tab + svc_idx;
+        for (uint8_t svc_idx = 0; svc_idx < ctx->dev_cfg->svc_tab_len; svc_idx++) {
+            neil_ble_gatts_cfg_svc_t *svc_cfg = ctx->dev_cfg->svc_tab + svc_idx;
 
             uint16_t svc_handle = attr_idx + handle_map->offset;
 
             ESP_LOGI(TAG, "Starting Service Handle: %x", svc_handle);
             esp_ble_gatts_start_service(svc_handle);
 
-            attr_idx += svc_cfg->chr_tab_len * attr_chr_offset;
+            attr_idx += neil_ble_gatts_attr_db_svc_len(svc_cfg);
         }
 
         ESP_LOGI(TAG, "FINISHED STARTING SERVICSE");
@@ -303,24 +1139,132 @@ static void gatts_event_callback(esp_gatts_cb_event_t event, esp_gatt_if_t gatts
         //
     case ESP_GATTS_READ_EVT: {
 
+        neil_ble_gatts_admit_touch(param->read.conn_id);
+
+        // --- Protected attribute on a link below its level
+        const esp_gatt_status_t sec_status =
+            access_check(ctx, param->read.conn_id, param->read.handle);
+
+        if (sec_status != ESP_GATT_OK) {
+            esp_ble_gatts_send_response(gatts_if, param->read.conn_id,
+                                        param->read.trans_id, sec_status, NULL);
+            break;
+        }
+
         // Acquire characteristic config object
         neil_ble_gatts_cfg_chr_t *chr_cfg =
-            chr_handle_map_get(handle_map, param->read.handle);
+            neil_ble_gatts_handle_map_get(ctx->handle_map, param->read.handle);
+
+        // --- Client configuration, held per connection
+        if (chr_cfg == NULL &&
+            neil_ble_gatts_handle_map_get_cccd(ctx->handle_map, param->read.handle) !=
+                NULL) {
+            const uint16_t cccd =
+                neil_ble_gatts_notify_cccd(param->read.conn_id, param->read.handle - 1);
+
+            esp_gatt_rsp_t *rsp = neil_ble_gatts_read_rsp(param->read.conn_id);
+
+            esp_gatt_status_t status = neil_ble_gatts_read_fill(
+                rsp, param->read.handle, param->read.offset,
+                (const uint8_t[]){cccd & 0xFF, cccd >> 8}, sizeof(cccd));
+
+            esp_ble_gatts_send_response(gatts_if, param->read.conn_id,
+                                        param->read.trans_id, status,
+                                        status == ESP_GATT_OK ? rsp : NULL);
+            break;
+        }
+
+        if (chr_cfg == NULL) {
+            esp_ble_gatts_send_response(gatts_if, param->read.conn_id,
+                                        param->read.trans_id, ESP_GATT_INVALID_HANDLE,
+                                        NULL);
+            break;
+        }
 
-        // Prepare response object
-        esp_gatt_rsp_t rsp;
+        // --- Change journal: versions newer than the client last wrote
+        if (chr_cfg->journal) {
+            esp_gatt_rsp_t *rsp = neil_ble_gatts_read_rsp(param->read.conn_id);
 
-        memset(&rsp, 0, sizeof(esp_gatt_rsp_t));
+            const uint16_t len = neil_ble_gatts_journal_read(
+                ctx->dev_cfg, param->read.conn_id, rsp->attr_value.value,
+                ESP_GATT_MAX_ATTR_LEN);
 
-        rsp.attr_value.handle = param->read.handle;
-        rsp.attr_value.len    = chr_cfg->size;
+            esp_gatt_status_t status =
+                neil_ble_gatts_read_fill(rsp, param->read.handle, param->read.offset,
+                                         rsp->attr_value.value, len);
+
+            esp_ble_gatts_send_response(gatts_if, param->read.conn_id,
+                                        param->read.trans_id, status,
+                                        status == ESP_GATT_OK ? rsp : NULL);
+            break;
+        }
+
+        // --- Deferred: the application responds later from its own task
+        if (chr_cfg->on_read_async != NULL) {
+            neil_ble_gatts_read_token_t token = neil_ble_gatts_read_defer(
+                gatts_if, param->read.conn_id, param->read.trans_id, param->read.handle,
+                param->read.offset);
+
+            if (token == 0) {
+                esp_ble_gatts_send_response(gatts_if, param->read.conn_id,
+                                            param->read.trans_id, ESP_GATT_BUSY, NULL);
+                break;
+            }
+
+            chr_cfg->on_read_async(token);
+            break;
+        }
+
+        // --- Batch: one response carrying several sibling values
+        if (chr_cfg->batch_len > 0) {
+            neil_ble_gatts_conn_t *conn = neil_ble_gatts_conn_get(param->read.conn_id);
+
+            // Fit one ATT Read Response (1-byte opcode)
+            const uint16_t mtu = conn != NULL ? conn->mtu : ESP_GATT_DEF_BLE_MTU_SIZE;
+
+            esp_gatt_rsp_t *rsp = neil_ble_gatts_read_rsp(param->read.conn_id);
+
+            uint16_t len;
+            esp_gatt_status_t status = neil_ble_gatts_read_batch(
+                svc_config_of(ctx, chr_cfg), chr_cfg, param->read.conn_id,
+                rsp->attr_value.value, mtu - 1, &len);
+
+            if (status == ESP_GATT_OK) {
+                status = neil_ble_gatts_read_fill(rsp, param->read.handle,
+                                                  param->read.offset,
+                                                  rsp->attr_value.value, len);
+            }
+
+            esp_ble_gatts_send_response(gatts_if, param->read.conn_id,
+                                        param->read.trans_id, status,
+                                        status == ESP_GATT_OK ? rsp : NULL);
+            break;
+        }
+
+        if (chr_cfg->on_read == NULL) {
+            esp_ble_gatts_send_response(gatts_if, param->read.conn_id,
+                                        param->read.trans_id, ESP_GATT_READ_NOT_PERMIT,
+                                        NULL);
+            break;
+        }
+
+        // Prepare response object, off the BTC task stack
+        esp_gatt_rsp_t *rsp = neil_ble_gatts_read_rsp(param->read.conn_id);
+
+        // --- Only the value is cleared, in case `on_read` fills less of it
+        memset(rsp->attr_value.value, 0, chr_cfg->size);
 
         // Read data into response object
-        chr_cfg->on_read(rsp.attr_value.value);
+        chr_cfg->on_read(rsp->attr_value.value);
+
+        // Apply the offset of long reads in place
+        esp_gatt_status_t status =
+            neil_ble_gatts_read_fill(rsp, param->read.handle, param->read.offset,
+                                     rsp->attr_value.value, chr_cfg->size);
 
         // Send response
         esp_ble_gatts_send_response(gatts_if, param->read.conn_id, param->read.trans_id,
-                                    ESP_GATT_OK, &rsp);
+                                    status, status == ESP_GATT_OK ? rsp : NULL);
         break;
     }
 
@@ -332,18 +1276,87 @@ static void gatts_event_callback(esp_gatts_cb_event_t event, esp_gatt_if_t gatts
     // --- On Write Operation Request
     //
     case ESP_GATTS_WRITE_EVT: {
-        esp_log_buffer_hex(TAG, param->write.value, param->write.len);
-        chr_handle_map_get(handle_map, param->write.handle)
-            ->on_write(param->write.value, param->write.len);
+        neil_ble_gatts_admit_touch(param->write.conn_id);
+
+        // --- Prepared write: queue the part and echo it back
+        if (param->write.is_prep) {
+            NEIL_BLE_GATTS_LOG(GATTS_PREP_WRITE, param->write.conn_id,
+                               param->write.handle, param->write.offset);
+
+            esp_gatt_status_t status =
+                access_check(ctx, param->write.conn_id, param->write.handle);
+
+            if (status == ESP_GATT_OK) {
+                status = neil_ble_gatts_write_prepare(
+                    param->write.conn_id, param->write.handle, param->write.offset,
+                    param->write.value, param->write.len);
+            }
+
+            esp_gatt_rsp_t *rsp = neil_ble_gatts_read_rsp(param->write.conn_id);
+
+            rsp->attr_value.handle   = param->write.handle;
+            rsp->attr_value.offset   = param->write.offset;
+            rsp->attr_value.len      = param->write.len;
+            rsp->attr_value.auth_req = ESP_GATT_AUTH_REQ_NONE;
+            memcpy(rsp->attr_value.value, param->write.value, param->write.len);
+
+            esp_ble_gatts_send_response(gatts_if, param->write.conn_id,
+                                        param->write.trans_id, status,
+                                        status == ESP_GATT_OK ? rsp : NULL);
+            break;
+        }
+
+        NEIL_BLE_GATTS_LOG(GATTS_WRITE, param->write.conn_id, param->write.handle,
+                           param->write.len);
+
+        esp_gatt_status_t status =
+            write_dispatch(ctx, param->write.conn_id, param->write.handle,
+                           param->write.value, param->write.len);
+
+        if (param->write.need_rsp) {
+            esp_ble_gatts_send_response(gatts_if, param->write.conn_id,
+                                        param->write.trans_id, status, NULL);
+        }
+        break;
+    }
+
+    //
+    // --- On Execute (or Cancel) of Prepared Writes
+    //
+    case ESP_GATTS_EXEC_WRITE_EVT: {
+        neil_ble_gatts_admit_touch(param->exec_write.conn_id);
+
+        esp_gatt_status_t status = ESP_GATT_OK;
+
+        uint16_t handle;
+        uint16_t len;
+        uint8_t *value =
+            neil_ble_gatts_write_take(param->exec_write.conn_id, &handle, &len);
+
+        if (value != NULL &&
+            param->exec_write.exec_write_flag == ESP_GATT_PREP_WRITE_EXEC) {
+            status = write_dispatch(ctx, param->exec_write.conn_id, handle, value, len);
+        }
+
+        neil_ble_gatts_write_release(param->exec_write.conn_id);
+
+        NEIL_BLE_GATTS_LOG(GATTS_EXEC_WRITE, param->exec_write.conn_id,
+                           param->exec_write.exec_write_flag, status);
+
+        esp_ble_gatts_send_response(gatts_if, param->exec_write.conn_id,
+                                    param->exec_write.trans_id, status, NULL);
         break;
     }
 
     //
     // --- On Application (Profile) ID Un-registration
     //
+    // NOTE: Tables are released by `neil_ble_gatts_stop` according to the
+    //       requested stop mode.
     case ESP_GATTS_UNREG_EVT:
-        chr_handle_map_deinit(handle_map);
-        neil_ble_gatts_attr_db_deinit(attr_tab);
+        if (ctx->unreg_done != NULL) {
+            xSemaphoreGive(ctx->unreg_done);
+        }
         break;
 
     // ---------------------------------
@@ -351,13 +1364,67 @@ static void gatts_event_callback(esp_gatts_cb_event_t event, esp_gatt_if_t gatts
     // ---------------------------------
 
     // --- On Client Connection
+    //
+    // NOTE: Every profile is told of a link, the first sets it up.
     case ESP_GATTS_CONNECT_EVT:
-        esp_ble_set_encryption(param->connect.remote_bda, ESP_BLE_SEC_ENCRYPT_MITM);
+        if (neil_ble_gatts_conn_get(param->connect.conn_id) == NULL) {
+            const uint16_t conn_id = param->connect.conn_id;
+
+            NEIL_BLE_GATTS_LOG(GATTS_CONNECT, conn_id, 0, 0);
+            neil_ble_gatts_conn_add(conn_id, param->connect.remote_bda);
+            neil_ble_gatts_notify_open(conn_id);
+            neil_ble_gatts_link_open(conn_id, param->connect.remote_bda);
+            neil_ble_gatts_admit_open(conn_id, param->connect.remote_bda);
+            neil_ble_gatts_demand_refresh();
+        }
+        // --- Advertising stops on connection, resumed while slots remain
+        if (ctx->state == SERVER_RUNNING && neil_ble_gatts_admit_advertise()) {
+            neil_ble_gatts_gap_advertise(&ctx->gap);
+        }
         break;
 
+    // --- On MTU Exchange
+    case ESP_GATTS_MTU_EVT: {
+        NEIL_BLE_GATTS_LOG(GATTS_MTU, param->mtu.conn_id, param->mtu.mtu, 0);
+        neil_ble_gatts_admit_touch(param->mtu.conn_id);
+        neil_ble_gatts_conn_t *conn = neil_ble_gatts_conn_get(param->mtu.conn_id);
+        if (conn != NULL) {
+            conn->mtu = param->mtu.mtu;
+        }
+        break;
+    }
+
     // --- On Client Disconnection
     case ESP_GATTS_DISCONNECT_EVT:
-        neil_ble_gatts_gap_advertise();
+        if (neil_ble_gatts_conn_get(param->disconnect.conn_id) != NULL) {
+            NEIL_BLE_GATTS_LOG(GATTS_DISCONNECT, param->disconnect.conn_id,
+                               param->disconnect.reason, 0);
+            neil_ble_gatts_read_cancel(param->disconnect.conn_id);
+            neil_ble_gatts_notify_close(param->disconnect.conn_id);
+            neil_ble_gatts_link_close(param->disconnect.conn_id);
+            neil_ble_gatts_admit_close(param->disconnect.conn_id);
+            neil_ble_gatts_write_release(param->disconnect.conn_id);
+            neil_ble_gatts_conn_remove(param->disconnect.conn_id);
+            neil_ble_gatts_demand_refresh();
+        }
+        if (ctx->state == SERVER_RUNNING && neil_ble_gatts_admit_advertise()) {
+            neil_ble_gatts_gap_advertise(&ctx->gap);
+        }
+        break;
+
+    // ---------------------------------
+    // Notification Events
+    // ---------------------------------
+
+    // --- On Congestion Change (pauses or resumes the connection's queue)
+    case ESP_GATTS_CONGEST_EVT:
+        neil_ble_gatts_notify_on_congest(param->congest.conn_id,
+                                         param->congest.congested);
+        break;
+
+    // --- On Notification Sent
+    case ESP_GATTS_CONF_EVT:
+        neil_ble_gatts_notify_on_sent(param->conf.conn_id, param->conf.status);
         break;
 
     default:
@@ -4,15 +4,222 @@
 
 #pragma once
 
+#include "esp_err.h"
+
 #include "neil_ble_gatts_cfg.h"
+#include "neil_ble_gatts_history.h"
+#include "neil_ble_gatts_log.h"
+#include "neil_ble_gatts_mem.h"
+#include "neil_ble_gatts_notify.h"
+#include "neil_ble_gatts_read.h"
+#include "neil_ble_gatts_stack.h"
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+#include "neil_ble_gatts_trace.h"
+#endif
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Contexts that may run side by side. NimBLE registers every service before
+/// its host starts, so it serves one.
+#if NEIL_BLE_GATTS_STACK_NIMBLE
+#define NEIL_BLE_GATTS_CTX_MAX 1
+#elif defined(CONFIG_NEIL_BLE_GATTS_CTX_MAX)
+#define NEIL_BLE_GATTS_CTX_MAX CONFIG_NEIL_BLE_GATTS_CTX_MAX
+#else
+#define NEIL_BLE_GATTS_CTX_MAX 2
+#endif
+
+// -------------------------------------------------------------
+// Types
+// -------------------------------------------------------------
+
+/**
+ * @brief       GATT Server context.
+ *
+ *              Serves one device configuration as its own GATT application
+ *              profile (Bluedroid `gatts_if`), with its own attribute table,
+ *              handle map and advertising state. Contexts share the stack and
+ *              its links: every connected peer can reach every running
+ *              context's services.
+ *
+ *              Legacy advertising offers one advertising set, so at most one
+ *              running context advertises; the others are `service_only`.
+ */
+typedef struct neil_ble_gatts_ctx_s neil_ble_gatts_ctx_t;
+
+/**
+ * @brief       How much state `neil_ble_gatts_stop` releases.
+ */
+typedef enum {
+    /// Tear down the stack but keep the attribute table and handle map,
+    /// so `neil_ble_gatts_restart` can skip rebuilding them.
+    NEIL_BLE_GATTS_STOP_WARM = 0,
+
+    /// Tear down the stack and free every component allocation.
+    NEIL_BLE_GATTS_STOP_COLD,
+
+    /// As cold, then permanently return controller and host memory to the
+    /// heap. The server cannot be started again until reboot.
+    NEIL_BLE_GATTS_STOP_RELEASE,
+} neil_ble_gatts_stop_mode_t;
 
 // -------------------------------------------------------------
 // Prototypes
 // -------------------------------------------------------------
 
+// --- Contexts
+
+/**
+ * @brief       Start a GATT Server context.
+ *
+ *              The first context brings up the stack; the others register
+ *              their profile on it. A context stopped while holding the same
+ *              configuration is reused, with the tables a warm stop retained.
+ *
+ *              Runs on the host stack selected in menuconfig, Bluedroid or
+ *              NimBLE, with the same configuration.
+ *
+ * @return      NULL if every context is in use, another running context
+ *              advertises and `dev_cfg` is not `service_only`, memory was
+ *              released, the stack failed to start, or `dev_cfg` uses a
+ *              feature that cannot be set up (left out in menuconfig, invalid
+ *              or out of memory), in which case nothing of it is kept.
+ */
+neil_ble_gatts_ctx_t *neil_ble_gatts_ctx_start(const neil_ble_gatts_cfg_dev_t *dev_cfg);
+
+/**
+ * @brief       Stop a GATT Server context.
+ *
+ *              While other contexts run, only its profile is unregistered
+ *              (and its advertising stopped); peers stay connected. Stopping
+ *              the last context stops advertising, disconnects all peers,
+ *              unregisters the profile (Bluedroid), then disables and
+ *              deinitializes the host stack and the controller. Blocks the
+ *              calling task for up to about two seconds; must not be called
+ *              from a Bluetooth callback.
+ *
+ * @return      ESP_ERR_INVALID_STATE if the context is not running, or if
+ *              `NEIL_BLE_GATTS_STOP_RELEASE` is requested while other contexts
+ *              run.
+ */
+esp_err_t neil_ble_gatts_ctx_stop(neil_ble_gatts_ctx_t *ctx,
+                                  neil_ble_gatts_stop_mode_t mode);
+
+/**
+ * @brief       Start a stopped context again with its configuration.
+ *
+ *              Tables retained by a warm stop are reused.
+ *
+ * @return      ESP_ERR_INVALID_STATE if the context is running, another
+ *              running context advertises, or memory was released; otherwise
+ *              as `neil_ble_gatts_ctx_start`, the error of a feature or of
+ *              the stack.
+ */
+esp_err_t neil_ble_gatts_ctx_restart(neil_ble_gatts_ctx_t *ctx);
+
+/**
+ * @brief       Notify subscribers of a characteristic value of a context.
+ *
+ *              The characteristic (by service and characteristic index) must
+ *              set `notify`. The value is queued for every subscribed
+ *              connection and sent as the scheduler allows; payloads longer
+ *              than a connection's MTU are truncated. May be called from any
+ *              task.
+ *
+ * @return      ESP_ERR_INVALID_STATE if the context is not running,
+ *              ESP_ERR_NOT_SUPPORTED if the characteristic does not notify.
+ */
+esp_err_t neil_ble_gatts_ctx_notify(neil_ble_gatts_ctx_t *ctx, uint8_t svc_idx,
+                                    uint8_t chr_idx, const uint8_t *data,
+                                    uint16_t len);
+
+/**
+ * @brief       Notify a characteristic value of a context to the connection
+ *              `conn_id` alone (see `neil_ble_gatts_ctx_notify`).
+ *
+ *              Nothing is queued if the connection is not subscribed.
+ */
+esp_err_t neil_ble_gatts_ctx_notify_conn(neil_ble_gatts_ctx_t *ctx, uint16_t conn_id,
+                                         uint8_t svc_idx, uint8_t chr_idx,
+                                         const uint8_t *data, uint16_t len);
+
+/**
+ * @brief       Whether any connection subscribed to notifications of a
+ *              characteristic of a context.
+ *
+ *              Lets producers skip work nobody would receive. May be called
+ *              from any task.
+ */
+bool neil_ble_gatts_ctx_subscribed(neil_ble_gatts_ctx_t *ctx, uint8_t svc_idx,
+                                   uint8_t chr_idx);
+
+/**
+ * @brief       Number of connections subscribed to notifications of a
+ *              characteristic of a context.
+ *
+ *              0 if the context is not running. May be called from any task.
+ */
+uint8_t neil_ble_gatts_ctx_subscribers(neil_ble_gatts_ctx_t *ctx, uint8_t svc_idx,
+                                       uint8_t chr_idx);
+
+// --- Event dispatch (benchmarks)
+//
+// Requests handed to the GATTS event entry-point as the stack delivers them,
+// to time the read and write paths without a client. Responses go to
+// `conn_id` as usual; with no such link the stack refuses them. Call from one
+// task while no client is connected. NimBLE hands requests to its access
+// callback instead, and returns ESP_ERR_NOT_SUPPORTED.
+
+/**
+ * @brief       Value handle of a characteristic of a context.
+ *
+ *              0 until the context's attribute table is created.
+ */
+uint16_t neil_ble_gatts_ctx_handle(neil_ble_gatts_ctx_t *ctx, uint8_t svc_idx,
+                                   uint8_t chr_idx);
+
+// --- Default context (single-profile applications)
+
 /**
  * @brief       Start a new Bluetooth Low-Energy GATT Server.
  *
- *              (Do not start more than one server)
+ *              Starts the default context, which the procedures below act
+ *              on. Aborts if the stack fails to start or the configuration
+ *              is rejected (see `neil_ble_gatts_ctx_start`).
  */
 void neil_ble_gatts_start(const neil_ble_gatts_cfg_dev_t *dev_cfg);
+
+/**
+ * @brief       Stop the default context (see `neil_ble_gatts_ctx_stop`).
+ *
+ * @return      ESP_ERR_INVALID_STATE if the server is not running.
+ */
+esp_err_t neil_ble_gatts_stop(neil_ble_gatts_stop_mode_t mode);
+
+/**
+ * @brief       Start the default context again with the configuration of the
+ *              last `neil_ble_gatts_start`.
+ *
+ *              Tables retained by a warm stop are reused.
+ *
+ * @return      ESP_ERR_INVALID_STATE if the server is running, was never
+ *              started, or its memory was released.
+ */
+esp_err_t neil_ble_gatts_restart(void);
+
+/**
+ * @brief       Notify subscribers of a characteristic value of the default
+ *              context (see `neil_ble_gatts_ctx_notify`).
+ */
+esp_err_t neil_ble_gatts_notify(uint8_t svc_idx, uint8_t chr_idx, const uint8_t *data,
+                                uint16_t len);
+
+/**
+ * @brief       Notify one connection of a characteristic value of the default
+ *              context (see `neil_ble_gatts_ctx_notify_conn`).
+ */
+esp_err_t neil_ble_gatts_notify_conn(uint16_t conn_id, uint8_t svc_idx, uint8_t chr_idx,
+                                     const uint8_t *data, uint16_t len);
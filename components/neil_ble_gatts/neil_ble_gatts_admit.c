@@ -0,0 +1,373 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_admit.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Connection Admission Control implementation.
+///
+///             Connections are tracked from their connect event to their
+///             disconnect event. One being disconnected by this module
+///             (`leaving`) still holds its host slot, but no longer counts
+///             against the limit nor is picked again.
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#include "neil_ble_gatts_admit.h"
+#include "neil_ble_gatts_conn.h"
+#include "neil_ble_gatts_stack.h"
+
+static const char *const TAG = "neil_ble_gatts_admit";
+
+#if CONFIG_NEIL_BLE_GATTS_ADMIT
+
+// -------------------------------------------------------------
+// State
+// -------------------------------------------------------------
+
+typedef struct {
+    bool active;
+    uint16_t conn_id;
+    esp_bd_addr_t bda;
+    bool priority;     ///< Peer is listed.
+    bool leaving;      ///< Disconnect requested.
+    int64_t active_us; ///< Time of the last client request.
+} admit_conn_t;
+
+static admit_conn_t conns[NEIL_BLE_GATTS_CONN_MAX];
+
+// --- Configuration of the advertising context, NULL admits every connection
+static const neil_ble_gatts_cfg_admit_t *admit_cfg = NULL;
+
+// --- Limit in effect, derived from the configuration
+static uint8_t max_conns = NEIL_BLE_GATTS_CONN_MAX;
+
+static neil_ble_gatts_admit_stats_t stats;
+
+static esp_timer_handle_t idle_timer = NULL;
+
+// --- Connections come and go on the Bluetooth task, idle out on the timer task.
+static portMUX_TYPE admit_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// -------------------------------------------------------------
+// Helpers (call with the lock held)
+// -------------------------------------------------------------
+
+static admit_conn_t *conn_find(uint16_t conn_id) {
+    for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        if (conns[idx].active && conns[idx].conn_id == conn_id) {
+            return conns + idx;
+        }
+    }
+    return NULL;
+}
+
+static bool peer_listed(const esp_bd_addr_t bda) {
+    for (uint8_t idx = 0; admit_cfg != NULL && idx < admit_cfg->priority_len; idx++) {
+        if (memcmp(admit_cfg->priority[idx], bda, sizeof(esp_bd_addr_t)) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief       Count tracked connections, all of them or only those staying.
+ */
+static uint8_t conn_count(bool staying) {
+
+    uint8_t count = 0;
+
+    for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        count += conns[idx].active && !(staying && conns[idx].leaving);
+    }
+
+    return count;
+}
+
+/**
+ * @brief       Least recently active unlisted connection still staying.
+ */
+static admit_conn_t *conn_victim(void) {
+
+    admit_conn_t *victim = NULL;
+
+    for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        admit_conn_t *conn = conns + idx;
+
+        if (!conn->active || conn->leaving || conn->priority) {
+            continue;
+        }
+        if (victim == NULL || conn->active_us < victim->active_us) {
+            victim = conn;
+        }
+    }
+
+    return victim;
+}
+
+// -------------------------------------------------------------
+// Idle Check
+// -------------------------------------------------------------
+
+static void idle_check(void *arg) {
+
+    admit_conn_t idle[NEIL_BLE_GATTS_CONN_MAX];
+    uint8_t count = 0;
+
+    const int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&admit_lock);
+    for (int idx = 0; admit_cfg != NULL && idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        admit_conn_t *conn = conns + idx;
+
+        if (!conn->active || conn->leaving || conn->priority ||
+            now_us - conn->active_us < admit_cfg->idle_timeout_s * 1000000LL) {
+            continue;
+        }
+
+        conn->leaving = true;
+        stats.idle++;
+        idle[count++] = *conn;
+    }
+    portEXIT_CRITICAL(&admit_lock);
+
+    // --- GAP calls must not run inside the critical section
+    for (uint8_t idx = 0; idx < count; idx++) {
+        ESP_LOGI(TAG, "conn_id %d idle, disconnecting", idle[idx].conn_id);
+        neil_ble_gatts_stack_disconnect(idle[idx].conn_id, idle[idx].bda);
+    }
+}
+
+// -------------------------------------------------------------
+// Control
+// -------------------------------------------------------------
+
+esp_err_t neil_ble_gatts_admit_init(const neil_ble_gatts_cfg_admit_t *cfg) {
+
+    uint8_t limit = NEIL_BLE_GATTS_CONN_MAX;
+
+    if (cfg != NULL && cfg->max_conns > 0 && cfg->max_conns < limit) {
+        limit = cfg->max_conns;
+    }
+
+    // --- Listed peers need a slot of their own to get in when full
+    if (cfg != NULL && cfg->priority_len > 0 && limit == NEIL_BLE_GATTS_CONN_MAX) {
+        ESP_LOGW(TAG, "Keeping one of %d connections for priority peers",
+                 NEIL_BLE_GATTS_CONN_MAX);
+        limit--;
+    }
+
+    if (cfg != NULL && cfg->idle_timeout_s > 0 && idle_timer == NULL) {
+        const esp_timer_create_args_t args = {
+            .callback = idle_check,
+            .name     = "neil_admit",
+        };
+        const uint64_t period_us = NEIL_BLE_GATTS_ADMIT_CHECK_MS * 1000ULL;
+
+        if (esp_timer_create(&args, &idle_timer) != ESP_OK ||
+            esp_timer_start_periodic(idle_timer, period_us) != ESP_OK) {
+            ESP_LOGE(TAG, "Unable to start idle check");
+            neil_ble_gatts_admit_deinit();
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    portENTER_CRITICAL(&admit_lock);
+    admit_cfg = cfg;
+    max_conns = limit;
+    for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        conns[idx].priority = conns[idx].active && peer_listed(conns[idx].bda);
+    }
+    portEXIT_CRITICAL(&admit_lock);
+
+    return ESP_OK;
+}
+
+void neil_ble_gatts_admit_deinit(void) {
+
+    if (idle_timer != NULL) {
+        esp_timer_stop(idle_timer);
+        esp_timer_delete(idle_timer);
+        idle_timer = NULL;
+    }
+
+    portENTER_CRITICAL(&admit_lock);
+    admit_cfg = NULL;
+    max_conns = NEIL_BLE_GATTS_CONN_MAX;
+    portEXIT_CRITICAL(&admit_lock);
+}
+
+void neil_ble_gatts_admit_get_stats(neil_ble_gatts_admit_stats_t *out) {
+
+    if (out == NULL) {
+        return;
+    }
+
+    portENTER_CRITICAL(&admit_lock);
+    *out             = stats;
+    out->connections = conn_count(true);
+    out->max_conns   = max_conns;
+    portEXIT_CRITICAL(&admit_lock);
+}
+
+// -------------------------------------------------------------
+// Connections
+// -------------------------------------------------------------
+
+bool neil_ble_gatts_admit_open(uint16_t conn_id, const esp_bd_addr_t bda) {
+
+    admit_conn_t *slot  = NULL;
+    admit_conn_t leaver = {0};
+    bool admitted       = true;
+
+    portENTER_CRITICAL(&admit_lock);
+    // --- Every profile is told of the same link
+    const admit_conn_t *known = conn_find(conn_id);
+    if (known != NULL) {
+        admitted = !known->leaving;
+        portEXIT_CRITICAL(&admit_lock);
+        return admitted;
+    }
+    for (int idx = 0; slot == NULL && idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        if (!conns[idx].active) {
+            slot = conns + idx;
+        }
+    }
+    if (slot != NULL) {
+        const bool full = admit_cfg != NULL && conn_count(true) >= max_conns;
+
+        *slot = (admit_conn_t){
+            .active    = true,
+            .conn_id   = conn_id,
+            .priority  = peer_listed(bda),
+            .active_us = esp_timer_get_time(),
+        };
+        memcpy(slot->bda, bda, sizeof(esp_bd_addr_t));
+
+        // --- Full: a listed peer takes the place of another, others leave
+        admit_conn_t *victim = full && slot->priority ? conn_victim() : NULL;
+
+        if (full && !slot->priority) {
+            slot->leaving = true;
+            leaver        = *slot;
+            admitted      = false;
+            stats.rejected++;
+        } else if (victim != NULL) {
+            victim->leaving = true;
+            leaver          = *victim;
+            stats.preempted++;
+        }
+
+        if (admitted) {
+            stats.admitted++;
+        }
+    }
+    portEXIT_CRITICAL(&admit_lock);
+
+    // --- GAP calls must not run inside the critical section
+    if (leaver.active) {
+        ESP_LOGI(TAG, "conn_id %d %s", leaver.conn_id,
+                 leaver.conn_id == conn_id ? "refused, full" : "preempted");
+        neil_ble_gatts_stack_disconnect(leaver.conn_id, leaver.bda);
+    }
+
+    return admitted;
+}
+
+void neil_ble_gatts_admit_close(uint16_t conn_id) {
+    portENTER_CRITICAL(&admit_lock);
+    admit_conn_t *conn = conn_find(conn_id);
+    if (conn != NULL) {
+        conn->active = false;
+    }
+    portEXIT_CRITICAL(&admit_lock);
+}
+
+void neil_ble_gatts_admit_close_all(void) {
+    portENTER_CRITICAL(&admit_lock);
+    for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        conns[idx].active = false;
+    }
+    portEXIT_CRITICAL(&admit_lock);
+}
+
+void neil_ble_gatts_admit_touch(uint16_t conn_id) {
+    portENTER_CRITICAL(&admit_lock);
+    admit_conn_t *conn = conn_find(conn_id);
+    if (conn != NULL) {
+        conn->active_us = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL(&admit_lock);
+}
+
+bool neil_ble_gatts_admit_advertise(void) {
+
+    portENTER_CRITICAL(&admit_lock);
+    const uint8_t present = conn_count(false);
+    const uint8_t staying = conn_count(true);
+
+    bool advertise = present < NEIL_BLE_GATTS_CONN_MAX &&
+                     (staying < max_conns ||
+                      (admit_cfg != NULL && admit_cfg->priority_len > 0));
+
+    // --- Without a configuration, only once every connection is gone
+    if (admit_cfg == NULL) {
+        advertise = present == 0;
+    }
+    portEXIT_CRITICAL(&admit_lock);
+
+    return advertise;
+}
+
+#else
+
+// NOTE: Disabled in menuconfig (CONFIG_NEIL_BLE_GATTS_ADMIT), every
+//       connection is admitted as without an `admit` configuration.
+
+void neil_ble_gatts_admit_get_stats(neil_ble_gatts_admit_stats_t *out) {
+
+    if (out == NULL) {
+        return;
+    }
+
+    *out = (neil_ble_gatts_admit_stats_t){
+        .connections = neil_ble_gatts_conn_count(),
+        .max_conns   = NEIL_BLE_GATTS_CONN_MAX,
+    };
+}
+
+esp_err_t neil_ble_gatts_admit_init(const neil_ble_gatts_cfg_admit_t *cfg) {
+
+    if (cfg != NULL) {
+        ESP_LOGE(TAG, "`admit` set, but disabled in menuconfig");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return ESP_OK;
+}
+
+void neil_ble_gatts_admit_deinit(void) {}
+
+bool neil_ble_gatts_admit_open(uint16_t conn_id, const esp_bd_addr_t bda) {
+    return true;
+}
+
+void neil_ble_gatts_admit_close(uint16_t conn_id) {}
+
+void neil_ble_gatts_admit_close_all(void) {}
+
+void neil_ble_gatts_admit_touch(uint16_t conn_id) {}
+
+bool neil_ble_gatts_admit_advertise(void) {
+    return neil_ble_gatts_conn_count() == 0;
+}
+
+#endif
@@ -0,0 +1,116 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_admit.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Connection Admission Control API.
+///
+///             Keeps forgotten connections from holding every slot of the
+///             host (`neil_ble_gatts_cfg_admit_t`):
+///
+///                 limit       connections past `max_conns` are disconnected
+///                             as they come, advertising stops when full
+///                 idle        a connection without client requests (reads,
+///                             writes, MTU exchange) for `idle_timeout_s` is
+///                             disconnected; notifications do not count
+///                 priority    a listed peer is admitted past the limit into
+///                             the slot kept for it, and the least recently
+///                             active unlisted connection is disconnected
+///
+///             An unlisted peer may still connect while advertising runs for
+///             priority peers; it is disconnected at once and counted in
+///             `rejected`.
+
+#ifndef neil_ble_gatts_ADMIT_H_
+#define neil_ble_gatts_ADMIT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "neil_ble_gatts_cfg.h"
+#include "neil_ble_gatts_stack.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Period of the idle check (ms).
+#define NEIL_BLE_GATTS_ADMIT_CHECK_MS 1000
+
+// -------------------------------------------------------------
+// Domain Structures
+// -------------------------------------------------------------
+
+/**
+ * @brief       Admission counters.
+ */
+typedef struct {
+    uint8_t connections; ///< Admitted connections now.
+    uint8_t max_conns;   ///< Limit in effect.
+
+    uint32_t admitted;  ///< Connections admitted.
+    uint32_t rejected;  ///< Disconnected on arrival, limit reached.
+    uint32_t preempted; ///< Disconnected to make room for a priority peer.
+    uint32_t idle;      ///< Disconnected for lack of client requests.
+} neil_ble_gatts_admit_stats_t;
+
+// -------------------------------------------------------------
+// Procedures (public)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Get the admission counters.
+ */
+void neil_ble_gatts_admit_get_stats(neil_ble_gatts_admit_stats_t *stats);
+
+// -------------------------------------------------------------
+// Procedures (component-internal)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Apply the configuration of the advertising context (NULL to
+ *              admit every connection), and start the idle check it needs.
+ */
+esp_err_t neil_ble_gatts_admit_init(const neil_ble_gatts_cfg_admit_t *cfg);
+
+/**
+ * @brief       Stop the idle check and admit every connection, when the
+ *              advertising context stops. Tracked connections are kept.
+ */
+void neil_ble_gatts_admit_deinit(void);
+
+/**
+ * @brief       Decide on a new connection, disconnecting it or another one
+ *              as the configuration requires.
+ *
+ * @return      false if the connection is being disconnected.
+ */
+bool neil_ble_gatts_admit_open(uint16_t conn_id, const esp_bd_addr_t bda);
+
+/**
+ * @brief       Forget a connection.
+ */
+void neil_ble_gatts_admit_close(uint16_t conn_id);
+
+/**
+ * @brief       Forget every connection (on stop).
+ */
+void neil_ble_gatts_admit_close_all(void);
+
+/**
+ * @brief       Record a client request on a connection.
+ */
+void neil_ble_gatts_admit_touch(uint16_t conn_id);
+
+/**
+ * @brief       Whether advertising should run: a connection could be admitted
+ *              and the host has a slot for it.
+ */
+bool neil_ble_gatts_admit_advertise(void);
+
+#endif // neil_ble_gatts_ADMIT_H_
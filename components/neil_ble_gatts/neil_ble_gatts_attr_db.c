@@ -17,6 +17,9 @@
 #include "esp_log.h"
 #include "neil_ble_gatts_cfg.h"
 #include "neil_ble_gatts_attr_db.h"
+#include "neil_ble_gatts_mem.h"
+#include "neil_ble_gatts_read.h"
+#include "neil_ble_gatts_util.h"
 
 static const char *TAG = "neil_ble_gatts_attr_db";
 
@@ -32,20 +35,30 @@ static const char *TAG = "neil_ble_gatts_attr_db";
  *              and can be used to determine how many 2-byte memory cells are
  *              needed to create a handle-to-configuration-entry map.
  */
-static uint8_t handle_buffer_range(const neil_ble_gatts_cfg_dev_t *const dev_cfg) {
+static uint16_t handle_buffer_range(const neil_ble_gatts_cfg_dev_t *const dev_cfg) {
 
-    // --- 2-byte wide handles (uint16_t)
-    static const uint8_t handle_size = 2;
-
-    // One handle per service.
-    uint8_t length = dev_cfg->svc_tab_len;
+    uint16_t length = 0;
 
     for (uint8_t index = 0; index < dev_cfg->svc_tab_len; index++) {
-        // Two additional handles per characteristic.
-        // HACK: This will expand to 3 in the future to support
-        //       client characteristic configuration parameters
-        //       (requiring an additional handle)
-        length += handle_size * (*(dev_cfg->svc_tab + index)).chr_tab_len;
+        length += neil_ble_gatts_attr_db_svc_len(dev_cfg->svc_tab + index);
+    }
+
+    return length;
+}
+
+uint8_t neil_ble_gatts_attr_db_chr_len(const neil_ble_gatts_cfg_chr_t *chr_cfg) {
+    // Declaration and value, plus the client configuration descriptor of
+    // notifying characteristics.
+    return 2 + (chr_cfg->notify ? 1 : 0);
+}
+
+uint16_t neil_ble_gatts_attr_db_svc_len(const neil_ble_gatts_cfg_svc_t *svc_cfg) {
+
+    // One handle for the service declaration.
+    uint16_t length = 1;
+
+    for (uint8_t index = 0; index < svc_cfg->chr_tab_len; index++) {
+        length += neil_ble_gatts_attr_db_chr_len(svc_cfg->chr_tab + index);
     }
 
     return length;
@@ -58,6 +71,58 @@ static uint16_t handle_buffer_offset(uint16_t *handle_buffer) {
     return handle_buffer[0];
 }
 
+/**
+ * @brief       Count 32-bit UUIDs, which ATT declarations cannot carry and
+ *              must be expanded to 128-bit.
+ */
+static uint16_t uuid32_count(const neil_ble_gatts_cfg_dev_t *const dev_cfg) {
+
+    uint16_t count = 0;
+
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+
+        count += svc_cfg->uuid_len == ESP_UUID_LEN_32;
+
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+            count += svc_cfg->chr_tab[chr_idx].uuid_len == ESP_UUID_LEN_32;
+        }
+    }
+
+    return count;
+}
+
+uint16_t neil_ble_gatts_attr_db_len(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+    return handle_buffer_range(dev_cfg);
+}
+
+size_t neil_ble_gatts_attr_db_footprint(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+    return sizeof(neil_ble_gatts_attr_db_t) +
+           handle_buffer_range(dev_cfg) * sizeof(esp_gatts_attr_db_t) +
+           uuid32_count(dev_cfg) * ESP_UUID_LEN_128;
+}
+
+/**
+ * @brief       Resolve the on-air form of a configured UUID.
+ *
+ *              16 and 128-bit UUIDs are used in place; 32-bit UUIDs are
+ *              expanded into the next slot of `uuid_buf`.
+ */
+static const uint8_t *uuid_resolve(const uint8_t *uuid, uint8_t uuid_len,
+                                   uint8_t **uuid_buf, uint16_t *out_len) {
+
+    if (uuid_len == ESP_UUID_LEN_32) {
+        uint8_t *uuid128 = *uuid_buf;
+        neil_ble_gatts_util_uuid_expand(uuid, uuid_len, uuid128);
+        *uuid_buf += ESP_UUID_LEN_128;
+        *out_len = ESP_UUID_LEN_128;
+        return uuid128;
+    }
+
+    *out_len = uuid_len ? uuid_len : ESP_UUID_LEN_128;
+    return uuid;
+}
+
 // -------------------------------------------------------------
 // Attribute Table Management
 // -------------------------------------------------------------
@@ -87,10 +152,11 @@ static uint8_t SVC_TYPE_UUID[2] = {0x00, 0x28};
 /// GATT DB Table.
 static uint8_t CHR_TYPE_UUID[2] = {0x03, 0x28};
 
-/* --- Unused Type UUID Constants (left here for documentation)
-static const uint16_t __attribute__((unused))
-CHARACTERISTIC_CLIENT_CONFIGURATION_TYPE_UUID = 0x2902;
+/// Client Characteristic Configuration Descriptor Type UUID.
+/// Lets each client enable notifications of the preceding characteristic.
+static uint8_t CCCD_TYPE_UUID[2] = {0x02, 0x29};
 
+/* --- Unused Type UUID Constants (left here for documentation)
 static const uint16_t __attribute__((unused))
 SECONDARY_SERVICE_TYPE_UUID = 0x2801;
 
@@ -105,9 +171,19 @@ INCLUDE_SERVICE_TYPE_UUID = 0x2802;
 // The size of a characteristics declaration data is one byte
 static uint8_t CHR_DECL_SIZE = sizeof(uint8_t);
 
-// Read/Write Property Flag
-static uint8_t CHR_PROP_FLAGS =
-    ESP_GATT_CHAR_PROP_BIT_WRITE_NR | ESP_GATT_CHAR_PROP_BIT_READ;
+// Read/Write Property Flag (writes with and without response)
+static uint8_t CHR_PROP_FLAGS = ESP_GATT_CHAR_PROP_BIT_WRITE |
+                                ESP_GATT_CHAR_PROP_BIT_WRITE_NR |
+                                ESP_GATT_CHAR_PROP_BIT_READ;
+
+// Read/Write/Notify Property Flag
+static uint8_t CHR_PROP_FLAGS_NOTIFY =
+    ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_WRITE_NR |
+    ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+
+// Client configuration values are two bytes, held per connection by
+// neil_ble_gatts_notify (this is only the declared initial value).
+static uint8_t CCCD_DEFAULT[2] = {0x00, 0x00};
 
 // ---------------------------------
 // Initialization
@@ -122,17 +198,36 @@ neil_ble_gatts_attr_db_init(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
 
     ESP_LOGI(TAG, "Initializing Table");
 
-    neil_ble_gatts_attr_db_t *attr_tab = malloc(sizeof(neil_ble_gatts_attr_db_t));
+    neil_ble_gatts_attr_db_t *attr_tab = neil_ble_gatts_mem_alloc(
+        NEIL_BLE_GATTS_MEM_ATTR_DB, sizeof(neil_ble_gatts_attr_db_t));
+
+    if (attr_tab == NULL) {
+        ESP_LOGE(TAG, "Out of memory allocating table");
+        return NULL;
+    }
 
     // Attribute Table Index (moved by the loop control)
-    uint8_t attr_idx = 0;
+    uint16_t attr_idx = 0;
 
     // Capture the length of the table
     attr_tab->len = handle_buffer_range(dev_cfg);
 
     // Generic Attributes Table
-    // TODO: Error Check
-    attr_tab->data = malloc(attr_tab->len * sizeof(esp_gatts_attr_db_t));
+    attr_tab->data = neil_ble_gatts_mem_alloc(
+        NEIL_BLE_GATTS_MEM_ATTR_DB, attr_tab->len * sizeof(esp_gatts_attr_db_t));
+
+    // 32-bit UUID Expansions
+    attr_tab->uuid_buf = neil_ble_gatts_mem_alloc(
+        NEIL_BLE_GATTS_MEM_ATTR_DB, uuid32_count(dev_cfg) * ESP_UUID_LEN_128);
+
+    if (attr_tab->data == NULL || attr_tab->uuid_buf == NULL) {
+        ESP_LOGE(TAG, "Out of memory allocating %u attributes", attr_tab->len);
+        neil_ble_gatts_attr_db_deinit(attr_tab);
+        return NULL;
+    }
+
+    // Next free 32-bit expansion slot
+    uint8_t *uuid_buf = attr_tab->uuid_buf;
 
     // Service Table
     const neil_ble_gatts_cfg_svc_t *svc_tab = dev_cfg->svc_tab;
@@ -158,8 +253,17 @@ neil_ble_gatts_attr_db_init(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
         // Number of Characteristic Table Elements
         const uint8_t chr_len = svc_cfg->chr_tab_len;
 
+        if (!neil_ble_gatts_util_uuid_len_valid(svc_cfg->uuid_len)) {
+            ESP_LOGE(TAG, "Service (%d) has invalid UUID length %d", svc_idx,
+                     svc_cfg->uuid_len);
+            neil_ble_gatts_attr_db_deinit(attr_tab);
+            return NULL;
+        }
+
         // Service ID
-        const uint8_t *svc_id = svc_cfg->uuid;
+        uint16_t svc_id_len;
+        const uint8_t *svc_id =
+            uuid_resolve(svc_cfg->uuid, svc_cfg->uuid_len, &uuid_buf, &svc_id_len);
 
         // ---------------------------------
         // Construct the Service Attribute
@@ -181,8 +285,8 @@ neil_ble_gatts_attr_db_init(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
                 .perm = ESP_GATT_PERM_READ,
 
                 // The value field contains the actual service UUID.
-                .max_length = ESP_UUID_LEN_128,
-                .length     = ESP_UUID_LEN_128,
+                .max_length = svc_id_len,
+                .length     = svc_id_len,
                 .value      = (uint8_t *)svc_id,
             },
         };
@@ -194,7 +298,24 @@ neil_ble_gatts_attr_db_init(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
 
             const neil_ble_gatts_cfg_chr_t *chr_cfg = (chr_tab + chr_idx);
 
-            const uint8_t *chr_id = chr_cfg->uuid;
+            if (!neil_ble_gatts_util_uuid_len_valid(chr_cfg->uuid_len)) {
+                ESP_LOGE(TAG, "Characteristic (%d/%d) has invalid UUID length %d",
+                         svc_idx, chr_idx, chr_cfg->uuid_len);
+                neil_ble_gatts_attr_db_deinit(attr_tab);
+                return NULL;
+            }
+
+            if (chr_cfg->batch_len > 0 &&
+                !neil_ble_gatts_read_batch_valid(svc_cfg, chr_cfg)) {
+                ESP_LOGE(TAG, "Characteristic (%d/%d) has an invalid batch", svc_idx,
+                         chr_idx);
+                neil_ble_gatts_attr_db_deinit(attr_tab);
+                return NULL;
+            }
+
+            uint16_t chr_id_len;
+            const uint8_t *chr_id =
+                uuid_resolve(chr_cfg->uuid, chr_cfg->uuid_len, &uuid_buf, &chr_id_len);
 
             ESP_LOGI(TAG, "Preparing Characteristic Attribute (%d/%d)", svc_idx,
                      chr_idx);
@@ -218,7 +339,7 @@ neil_ble_gatts_attr_db_init(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
                     .max_length = CHR_DECL_SIZE,
                     .length     = CHR_DECL_SIZE,
                     // FIXME: Support parameterized config
-                    .value = &CHR_PROP_FLAGS,
+                    .value = chr_cfg->notify ? &CHR_PROP_FLAGS_NOTIFY : &CHR_PROP_FLAGS,
                 },
             };
 
@@ -233,7 +354,7 @@ neil_ble_gatts_attr_db_init(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
                 {
                     // The UUID fields directly relate to the real UUID of the
                     // attribute.
-                    .uuid_length = ESP_UUID_LEN_128,
+                    .uuid_length = chr_id_len,
                     .uuid_p      = (uint8_t *)chr_id,
                     // Permissions should match declaration properties.
                     // FIXME: Support parameterized config
@@ -244,6 +365,29 @@ neil_ble_gatts_attr_db_init(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
                     .value      = NULL,
                 },
             };
+
+            if (!chr_cfg->notify) {
+                continue;
+            }
+
+            // ---------------------------------
+            // Construct Client Configuration Attribute
+            // ---------------------------------
+
+            *(attr_tab->data + attr_idx++) = (esp_gatts_attr_db_t){
+                .attr_control = {.auto_rsp = 0},
+                .att_desc =
+                    // For Client Characteristic Configuration Descriptors:
+                {
+                    .uuid_length = ESP_UUID_LEN_16,
+                    .uuid_p      = CCCD_TYPE_UUID,
+                    // Clients read and write their own configuration.
+                    .perm       = ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
+                    .max_length = sizeof(CCCD_DEFAULT),
+                    .length     = sizeof(CCCD_DEFAULT),
+                    .value      = CCCD_DEFAULT,
+                },
+            };
         }
     }
 
@@ -255,7 +399,11 @@ neil_ble_gatts_attr_db_init(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
 // ---------------------------------
 
 void neil_ble_gatts_attr_db_deinit(neil_ble_gatts_attr_db_t *attr_tab) {
-    free(attr_tab->data);
+    if (attr_tab == NULL) {
+        return;
+    }
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_ATTR_DB, attr_tab->data);
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_ATTR_DB, attr_tab->uuid_buf);
     attr_tab->len = 0;
-    free(attr_tab);
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_ATTR_DB, attr_tab);
 }
@@ -11,6 +11,7 @@
 #ifndef neil_ble_gatts_attr_db_H_
 #define neil_ble_gatts_attr_db_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "esp_gatt_defs.h"
@@ -27,14 +28,41 @@
 typedef struct neil_ble_gatts_attr_db_s {
     uint16_t len;
     esp_gatts_attr_db_t *data;
+    uint8_t *uuid_buf; ///< 128-bit expansions of 32-bit UUIDs.
 } neil_ble_gatts_attr_db_t;
 
+/// Number of heap allocations made by `neil_ble_gatts_attr_db_init`.
+#define NEIL_BLE_GATTS_ATTR_DB_ALLOC_COUNT 3
+
 // -------------------------------------------------------------
 // Procedures
 // -------------------------------------------------------------
 
+/**
+ * @brief       Number of attributes of a characteristic: declaration, value
+ *              and, when it notifies, client configuration (value + 1).
+ */
+uint8_t neil_ble_gatts_attr_db_chr_len(const neil_ble_gatts_cfg_chr_t *chr_cfg);
+
+/**
+ * @brief       Number of attributes of a service, its declaration included.
+ */
+uint16_t neil_ble_gatts_attr_db_svc_len(const neil_ble_gatts_cfg_svc_t *svc_cfg);
+
+/**
+ * @brief       Number of attributes (and handles) a device configuration needs.
+ */
+uint16_t neil_ble_gatts_attr_db_len(const neil_ble_gatts_cfg_dev_t *dev_cfg);
+
+/**
+ * @brief       Heap bytes an attribute table for `dev_cfg` will hold.
+ */
+size_t neil_ble_gatts_attr_db_footprint(const neil_ble_gatts_cfg_dev_t *dev_cfg);
+
 /**
  * @brief       Create a new GATT attribute table.
+ *
+ * @return      NULL on allocation failure.
  */
 neil_ble_gatts_attr_db_t *neil_ble_gatts_attr_db_init(const neil_ble_gatts_cfg_dev_t *dev_cfg);
 
@@ -0,0 +1,57 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_bench.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Benchmark Hooks (Bluedroid, CONFIG_NEIL_BLE_GATTS_BENCH_HOOKS).
+///
+///             Hand synthetic requests to the GATTS event entry-point of a
+///             running context, for the micro-benchmarks to time the event
+///             handlers without a peer.
+///
+///             Every module expects its events from the BTC task alone, and
+///             the hooks run the handlers on the caller's task instead: they
+///             refuse to run while a client is connected, and the caller must
+///             not start, stop or otherwise drive the server meanwhile. Not
+///             for application builds.
+
+#ifndef neil_ble_gatts_BENCH_H_
+#define neil_ble_gatts_BENCH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "neil_ble_gatts.h"
+
+#if CONFIG_NEIL_BLE_GATTS_BENCH_HOOKS && !NEIL_BLE_GATTS_STACK_NIMBLE
+
+/**
+ * @brief       Dispatch a read request (`ESP_GATTS_READ_EVT`) to a context.
+ *
+ * @return      ESP_ERR_INVALID_STATE if the context has no attribute table
+ *              or a client is connected.
+ */
+esp_err_t neil_ble_gatts_bench_dispatch_read(neil_ble_gatts_ctx_t *ctx,
+                                             uint16_t conn_id, uint16_t handle,
+                                             uint16_t offset);
+
+/**
+ * @brief       Dispatch a write request (`ESP_GATTS_WRITE_EVT`) to a context,
+ *              a write command unless `need_rsp`.
+ *
+ * @return      ESP_ERR_INVALID_STATE if the context has no attribute table
+ *              or a client is connected.
+ */
+esp_err_t neil_ble_gatts_bench_dispatch_write(neil_ble_gatts_ctx_t *ctx,
+                                              uint16_t conn_id, uint16_t handle,
+                                              uint8_t *value, uint16_t len,
+                                              bool need_rsp);
+
+#endif
+
+#endif // neil_ble_gatts_BENCH_H_
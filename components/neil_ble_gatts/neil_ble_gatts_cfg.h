@@ -11,7 +11,9 @@
 #ifndef neil_ble_gatts_CFG_H_
 #define neil_ble_gatts_CFG_H_
 
-#include "esp_bt_defs.h"
+#include <stdbool.h>
+
+#include "neil_ble_gatts_stack.h"
 
 // -------------------------------------------------------------
 // Generic UUID System
@@ -58,20 +60,128 @@
 /// Get characteristic index (by-convention) from UUID.
 #define neil_ble_gatts_UUID_128_GET_CHR_INDEX(uuid128) uuid128[10]
 
+// -------------------------------------------------------------
+// Short UUIDs
+// -------------------------------------------------------------
+//
+// SIG-assigned UUIDs (e.g. Battery Service 0x180F) may be declared in their
+// 16-bit or 32-bit form, which shortens discovery responses and leaves room
+// in the 31-byte advertisement. Set the matching `uuid_len` alongside.
+//
+// Usage:
+//     .uuid     = neil_ble_gatts_UUID_16(0x180F),
+//     .uuid_len = ESP_UUID_LEN_16,
+
+/// 16-bit UUID (little-endian), use with `uuid_len = ESP_UUID_LEN_16`.
+#define neil_ble_gatts_UUID_16(uuid16) {(uuid16) & 0xFF, ((uuid16) >> 8) & 0xFF}
+
+/// 32-bit UUID (little-endian), use with `uuid_len = ESP_UUID_LEN_32`.
+#define neil_ble_gatts_UUID_32(uuid32)                                                \
+    {                                                                                  \
+        (uuid32) & 0xFF, ((uuid32) >> 8) & 0xFF, ((uuid32) >> 16) & 0xFF,              \
+            ((uuid32) >> 24) & 0xFF                                                    \
+    }
+
+/// Effective UUID length of a service or characteristic configuration.
+///
+/// A `uuid_len` of `0` (the default of designated initializers) means 128-bit.
+#define neil_ble_gatts_UUID_LEN(cfg)                                                   \
+    ((cfg)->uuid_len ? (cfg)->uuid_len : ESP_UUID_LEN_128)
+
 // -------------------------------------------------------------
 // Device Configuration Structures
 // -------------------------------------------------------------
 
+/**
+ * @brief       Handle to a read request whose response has been deferred.
+ *
+ *              Pass to `neil_ble_gatts_read_complete` or
+ *              `neil_ble_gatts_read_error` from any task.
+ */
+typedef uint32_t neil_ble_gatts_read_token_t;
+
+/**
+ * @brief       Link security a characteristic requires.
+ *
+ *              Links start unencrypted. Accessing a characteristic above the
+ *              link's level is refused with Insufficient Authentication, and
+ *              the server requests encryption so the client can retry.
+ */
+typedef enum {
+    NEIL_BLE_GATTS_SEC_NONE = 0, ///< Open, served on any link.
+    NEIL_BLE_GATTS_SEC_ENCRYPT,  ///< Encrypted link (Just Works pairing suffices).
+    NEIL_BLE_GATTS_SEC_MITM,     ///< Encrypted and authenticated link.
+} neil_ble_gatts_sec_t;
+
+/**
+ * @brief       How successive samples of a polled characteristic compare.
+ */
+typedef enum {
+    NEIL_BLE_GATTS_POLL_BYTES = 0, ///< Changed if any byte differs.
+    NEIL_BLE_GATTS_POLL_INT,       ///< Signed little-endian of `size` (1, 2, 4) bytes.
+    NEIL_BLE_GATTS_POLL_UINT,      ///< Unsigned little-endian of `size` bytes.
+    NEIL_BLE_GATTS_POLL_FLOAT,     ///< `float` (`size` 4).
+} neil_ble_gatts_poll_cmp_t;
+
+/**
+ * @brief       Sampling of a characteristic by the server (see
+ *              neil_ble_gatts_poll.h).
+ */
+typedef struct {
+    uint32_t period_ms;            ///< Sampling period, rounded up to the poll tick.
+    neil_ble_gatts_poll_cmp_t cmp; ///< How samples are compared.
+    float deadband;                ///< Smallest numeric change notified (0: any).
+} neil_ble_gatts_cfg_poll_t;
+
 /**
  * @brief       Characteristic configuration structure with control-callbacks.
+ *
+ * Note:
+ *     Set either `on_read` or `on_read_async`. The asynchronous variant
+ *     returns immediately and completes the request later (within the 30 s
+ *     ATT transaction timeout), keeping slow data sources off the Bluetooth
+ *     task. NimBLE cannot defer a response: `on_read_async` is Bluedroid-only.
+ *
+ *     A batch characteristic sets `batch` instead: reading it invokes the
+ *     `on_read` of each listed sibling (indexes into the service's
+ *     `chr_tab`) once and returns their values in one response, as
+ *     `[len u16 LE][value]` records in list order, stopping at the first
+ *     value that does not fit the connection MTU. Clients able to issue ATT
+ *     Read Multiple may read the members directly instead.
+ *
+ *     `security` covers value reads and writes and subscriptions. A batch or
+ *     command pipe is checked at its own level and each member at its own: a
+ *     batch read fails if any member is protected beyond the link, a pipe
+ *     operation on such a member fails alone.
  */
 typedef struct {
     void (*on_read)(uint8_t *data);               ///< Read callback
     void (*on_write)(uint8_t *val, uint16_t len); ///< Write callback
 
+    /// Deferred read callback
+    void (*on_read_async)(neil_ble_gatts_read_token_t token);
+
     uint16_t size; ///< Data size for read/write operations.
 
-    uint8_t uuid[ESP_UUID_LEN_128]; ///< 128-bit Characteristic ID.
+    bool notify;  ///< Allow clients to subscribe (see `neil_ble_gatts_notify`).
+    bool pipe;    ///< Command pipe to sibling writes (see neil_ble_gatts_pipe.h).
+    bool journal; ///< Change journal of the device (see neil_ble_gatts_journal.h).
+
+    neil_ble_gatts_sec_t security; ///< Link security required for any access.
+
+    const neil_ble_gatts_cfg_poll_t *poll; ///< Sample `on_read`, notify changes.
+
+    uint32_t demand; ///< Event bits set while subscribed (neil_ble_gatts_demand.h).
+
+    bool persistent; ///< Keep written values in NVS (see neil_ble_gatts_persist.h).
+
+    uint8_t uuid[ESP_UUID_LEN_128]; ///< Characteristic ID (little-endian).
+    uint8_t uuid_len;               ///< 2, 4 or 16 bytes (0 means 16).
+
+    const uint8_t *batch; ///< Sibling characteristic indexes read together.
+    uint8_t batch_len;    ///< Number of batch members (0 if not a batch).
+
+    uint32_t version; ///< Last change, maintained by the server (leave 0).
 
 } neil_ble_gatts_cfg_chr_t;
 
@@ -83,16 +193,76 @@ typedef struct {
     neil_ble_gatts_cfg_chr_t
         *chr_tab; ///< Array of characteristic control-callback containers.
 
-    uint8_t uuid[ESP_UUID_LEN_128]; ///< 128-bit Service ID.
+    uint8_t uuid[ESP_UUID_LEN_128]; ///< Service ID (little-endian).
+    uint8_t uuid_len;               ///< 2, 4 or 16 bytes (0 means 16).
 
 } neil_ble_gatts_cfg_svc_t;
 
+/// L2CAP channel buffer, a NimBLE mbuf chain (see neil_ble_gatts_l2cap.h).
+typedef struct os_mbuf neil_ble_gatts_l2cap_buf_t;
+
+/**
+ * @brief       L2CAP connection-oriented channel server (NimBLE only).
+ *
+ *              Clients connect an LE credit-based channel to `psm` next to
+ *              their GATT link, one channel per connection.
+ */
+typedef struct {
+    uint16_t psm; ///< Protocol/service multiplexer, 0x0080-0x00FF (dynamic).
+    uint16_t mtu; ///< Largest SDU accepted from a client.
+
+    /// Received SDU, owned by the callback (`neil_ble_gatts_l2cap_buf_free`).
+    void (*on_recv)(uint16_t conn_id, neil_ble_gatts_l2cap_buf_t *sdu);
+
+    /// Channel of a connection opened or closed (optional).
+    void (*on_state)(uint16_t conn_id, bool connected);
+} neil_ble_gatts_cfg_l2cap_t;
+
+/// `svc_idx` and `chr_idx` of a demand event about connections.
+#define NEIL_BLE_GATTS_DEMAND_LINK 0xFF
+
+/**
+ * @brief       Demand change of a context (see neil_ble_gatts_demand.h).
+ *
+ *              Reported when the number of connections changes, with both
+ *              indexes NEIL_BLE_GATTS_DEMAND_LINK, and when the number of
+ *              subscribers of a notifying characteristic changes.
+ */
+typedef struct {
+    uint8_t svc_idx;
+    uint8_t chr_idx;
+    uint8_t connections; ///< Connected clients, each able to read.
+    uint8_t subscribers; ///< Subscribers of the characteristic.
+} neil_ble_gatts_demand_evt_t;
+
+/**
+ * @brief       Connection admission control.
+ *
+ *              Connections beyond `max_conns` are refused, unless the peer is
+ *              listed in `priority`: it then takes the place of the least
+ *              recently active unlisted connection. While peers are listed,
+ *              one connection slot of the host stays free for them.
+ *
+ *              Advertising runs while a connection can be admitted.
+ */
+typedef struct {
+    uint8_t max_conns;       ///< Connections served, 0 for the host limit.
+    uint16_t idle_timeout_s; ///< Disconnect without client requests (0: never).
+
+    const esp_bd_addr_t *priority; ///< Priority peers (identity addresses), never idle.
+    uint8_t priority_len;
+} neil_ble_gatts_cfg_admit_t;
+
 /**
  * @brief       Device configuration structure.
  *
  * Note:
  *     This and other structures are intended to be defined manually and passed
  *     to top-level domain procedures.
+ *
+ *     One configuration is served by one context (`neil_ble_gatts_ctx_start`).
+ *     A `service_only` context does not advertise: its services are reached
+ *     over the links another context accepts.
  */
 typedef struct {
     char *name;       ///< Device name, this is what is advertised to central
@@ -105,6 +275,17 @@ typedef struct {
         *svc_tab; ///< Service table, array of service configuration containers.
     uint8_t svc_tab_len;
 
+    bool service_only; ///< Do not advertise (name and manufacturer unused).
+
+    const neil_ble_gatts_cfg_l2cap_t *l2cap; ///< L2CAP channel server (optional).
+
+    /// Admission control (optional, advertising configurations only). Without
+    /// it, advertising resumes once every connection is gone.
+    const neil_ble_gatts_cfg_admit_t *admit;
+
+    /// Demand changes (optional), on the Bluetooth task: do not block.
+    void (*on_demand)(const neil_ble_gatts_demand_evt_t *evt);
+
 } neil_ble_gatts_cfg_dev_t;
 
 #endif // neil_ble_gatts_CFG_H_
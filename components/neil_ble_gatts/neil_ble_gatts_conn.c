@@ -0,0 +1,305 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_conn.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Connection Table implementation.
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#include "neil_ble_gatts_conn.h"
+#include "neil_ble_gatts_mem.h"
+#include "neil_ble_gatts_stack.h"
+
+static const char *const TAG = "neil_ble_gatts_conn";
+
+// -------------------------------------------------------------
+// State
+// -------------------------------------------------------------
+
+// --- Connection slots (allocated while the server is running)
+static neil_ble_gatts_conn_t *conn_tab = NULL;
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+// --- One response buffer per slot, handed to each new connection
+static esp_gatt_rsp_t *rsp_tab = NULL;
+#endif
+
+// --- Slots are written on the BTC task and read from application tasks.
+static portMUX_TYPE conn_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// --- Set and read on the BTC task alone, around `on_write` callbacks.
+static uint16_t conn_writer = NEIL_BLE_GATTS_CONN_NONE;
+
+// -------------------------------------------------------------
+// Initialization / Deinitialization
+// -------------------------------------------------------------
+
+esp_err_t neil_ble_gatts_conn_init(void) {
+
+    if (conn_tab != NULL) {
+        return ESP_OK;
+    }
+
+    conn_tab = neil_ble_gatts_mem_calloc(NEIL_BLE_GATTS_MEM_CONN,
+                                         NEIL_BLE_GATTS_CONN_MAX,
+                                         sizeof(neil_ble_gatts_conn_t));
+
+    if (conn_tab == NULL) {
+        ESP_LOGE(TAG, "Out of memory allocating connection table");
+        return ESP_ERR_NO_MEM;
+    }
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+    // NOTE: Cleared once, then every response sets the fields it sends.
+    rsp_tab = neil_ble_gatts_mem_calloc(NEIL_BLE_GATTS_MEM_CONN,
+                                        NEIL_BLE_GATTS_CONN_MAX,
+                                        sizeof(esp_gatt_rsp_t));
+
+    if (rsp_tab == NULL) {
+        ESP_LOGE(TAG, "Out of memory allocating response buffers");
+        neil_ble_gatts_conn_deinit();
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+
+    return ESP_OK;
+}
+
+void neil_ble_gatts_conn_deinit(void) {
+    portENTER_CRITICAL(&conn_lock);
+    neil_ble_gatts_conn_t *tab = conn_tab;
+    conn_tab                   = NULL;
+    portEXIT_CRITICAL(&conn_lock);
+
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_CONN, tab);
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_CONN, rsp_tab);
+    rsp_tab = NULL;
+#endif
+}
+
+// -------------------------------------------------------------
+// Tracking
+// -------------------------------------------------------------
+
+neil_ble_gatts_conn_t *neil_ble_gatts_conn_add(uint16_t conn_id,
+                                               const esp_bd_addr_t bda) {
+
+    neil_ble_gatts_conn_t *conn = NULL;
+
+    portENTER_CRITICAL(&conn_lock);
+    for (uint8_t idx = 0; conn_tab != NULL && idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        // --- Every profile is told of the same link
+        if (conn_tab[idx].in_use && conn_tab[idx].conn_id == conn_id) {
+            portEXIT_CRITICAL(&conn_lock);
+            return conn_tab + idx;
+        }
+    }
+    for (uint8_t idx = 0; conn_tab != NULL && idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        if (!conn_tab[idx].in_use) {
+            conn = &conn_tab[idx];
+
+            memset(conn, 0, sizeof(*conn));
+            conn->in_use  = true;
+            conn->conn_id = conn_id;
+            conn->mtu     = ESP_GATT_DEF_BLE_MTU_SIZE;
+            memcpy(conn->bda, bda, sizeof(esp_bd_addr_t));
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+            conn->rsp = rsp_tab + idx;
+#endif
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&conn_lock);
+
+    if (conn == NULL) {
+        ESP_LOGW(TAG, "Connection table full, conn_id %d untracked", conn_id);
+    }
+
+    return conn;
+}
+
+neil_ble_gatts_conn_t *neil_ble_gatts_conn_get(uint16_t conn_id) {
+
+    neil_ble_gatts_conn_t *conn = NULL;
+
+    portENTER_CRITICAL(&conn_lock);
+    for (uint8_t idx = 0; conn_tab != NULL && idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        if (conn_tab[idx].in_use && conn_tab[idx].conn_id == conn_id) {
+            conn = &conn_tab[idx];
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&conn_lock);
+
+    return conn;
+}
+
+neil_ble_gatts_conn_t *neil_ble_gatts_conn_find(const esp_bd_addr_t bda) {
+
+    neil_ble_gatts_conn_t *conn = NULL;
+
+    portENTER_CRITICAL(&conn_lock);
+    for (uint8_t idx = 0; conn_tab != NULL && idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        if (conn_tab[idx].in_use &&
+            memcmp(conn_tab[idx].bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+            conn = &conn_tab[idx];
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&conn_lock);
+
+    return conn;
+}
+
+void neil_ble_gatts_conn_remove(uint16_t conn_id) {
+    portENTER_CRITICAL(&conn_lock);
+    for (uint8_t idx = 0; conn_tab != NULL && idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        if (conn_tab[idx].in_use && conn_tab[idx].conn_id == conn_id) {
+            conn_tab[idx].in_use = false;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&conn_lock);
+}
+
+uint8_t neil_ble_gatts_conn_count(void) {
+
+    uint8_t count = 0;
+
+    portENTER_CRITICAL(&conn_lock);
+    for (uint8_t idx = 0; conn_tab != NULL && idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        count += conn_tab[idx].in_use;
+    }
+    portEXIT_CRITICAL(&conn_lock);
+
+    return count;
+}
+
+uint16_t neil_ble_gatts_conn_mtu(uint16_t conn_id) {
+
+    uint16_t mtu = 0;
+
+    portENTER_CRITICAL(&conn_lock);
+    for (uint8_t idx = 0; conn_tab != NULL && idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        if (conn_tab[idx].in_use && conn_tab[idx].conn_id == conn_id) {
+            mtu = conn_tab[idx].mtu;
+        }
+    }
+    portEXIT_CRITICAL(&conn_lock);
+
+    return mtu;
+}
+
+// -------------------------------------------------------------
+// Link Security
+// -------------------------------------------------------------
+
+esp_gatt_status_t neil_ble_gatts_conn_sec_check(uint16_t conn_id,
+                                                neil_ble_gatts_sec_t level) {
+
+    if (level == NEIL_BLE_GATTS_SEC_NONE) {
+        return ESP_GATT_OK;
+    }
+
+    esp_gatt_status_t status = ESP_GATT_INSUF_AUTHENTICATION;
+    bool request             = false;
+    const int64_t now_us     = esp_timer_get_time();
+    esp_bd_addr_t bda;
+
+    portENTER_CRITICAL(&conn_lock);
+    for (uint8_t idx = 0; conn_tab != NULL && idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        neil_ble_gatts_conn_t *conn = conn_tab + idx;
+
+        if (!conn->in_use || conn->conn_id != conn_id) {
+            continue;
+        }
+
+        if (conn->sec_level >= level) {
+            status = ESP_GATT_OK;
+        } else if (!conn->sec_pending || now_us - conn->sec_requested_us >=
+                                             NEIL_BLE_GATTS_CONN_SEC_RETRY_US) {
+            // --- First request, or the peer ignored the previous one
+            conn->sec_pending      = true;
+            conn->sec_requested_us = now_us;
+            request                = true;
+            memcpy(bda, conn->bda, sizeof(esp_bd_addr_t));
+        }
+        break;
+    }
+    portEXIT_CRITICAL(&conn_lock);
+
+    // --- GAP calls must not run inside the critical section
+    if (request) {
+        ESP_LOGD(TAG, "conn_id %d below security level %d, requesting encryption",
+                 conn_id, level);
+        neil_ble_gatts_stack_secure(conn_id, bda, level == NEIL_BLE_GATTS_SEC_MITM);
+    }
+
+    return status;
+}
+
+void neil_ble_gatts_conn_sec_update(uint16_t conn_id, neil_ble_gatts_sec_t level) {
+    portENTER_CRITICAL(&conn_lock);
+    for (uint8_t idx = 0; conn_tab != NULL && idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        if (conn_tab[idx].in_use && conn_tab[idx].conn_id == conn_id) {
+            conn_tab[idx].sec_level   = level;
+            conn_tab[idx].sec_pending = false;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&conn_lock);
+}
+
+// -------------------------------------------------------------
+// Writes
+// -------------------------------------------------------------
+
+void neil_ble_gatts_conn_set_writer(uint16_t conn_id) { conn_writer = conn_id; }
+
+uint16_t neil_ble_gatts_conn_writer(void) { return conn_writer; }
+
+// -------------------------------------------------------------
+// Disconnection
+// -------------------------------------------------------------
+
+void neil_ble_gatts_conn_disconnect_all(void) {
+
+    neil_ble_gatts_conn_t peers[NEIL_BLE_GATTS_CONN_MAX];
+    uint8_t count = 0;
+
+    // --- Copy peers out, GAP calls must not run inside the critical section
+    portENTER_CRITICAL(&conn_lock);
+    for (uint8_t idx = 0; conn_tab != NULL && idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        if (conn_tab[idx].in_use) {
+            peers[count++] = conn_tab[idx];
+        }
+    }
+    portEXIT_CRITICAL(&conn_lock);
+
+    for (uint8_t idx = 0; idx < count; idx++) {
+        neil_ble_gatts_stack_disconnect(peers[idx].conn_id, peers[idx].bda);
+    }
+}
+
+// -------------------------------------------------------------
+// Footprint
+// -------------------------------------------------------------
+
+size_t neil_ble_gatts_conn_footprint(void) {
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+    return NEIL_BLE_GATTS_CONN_MAX *
+           (sizeof(neil_ble_gatts_conn_t) + sizeof(esp_gatt_rsp_t));
+#else
+    return NEIL_BLE_GATTS_CONN_MAX * sizeof(neil_ble_gatts_conn_t);
+#endif
+}
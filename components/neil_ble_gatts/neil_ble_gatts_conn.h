@@ -0,0 +1,184 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_conn.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Connection Table API.
+
+#ifndef neil_ble_gatts_CONN_H_
+#define neil_ble_gatts_CONN_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "neil_ble_gatts_cfg.h"
+#include "neil_ble_gatts_stack.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Maximum number of simultaneously tracked connections.
+///
+/// Set in menuconfig, or follows the connection limit of the host stack.
+#if CONFIG_NEIL_BLE_GATTS_CONN_MAX > 0
+#define NEIL_BLE_GATTS_CONN_MAX CONFIG_NEIL_BLE_GATTS_CONN_MAX
+#elif defined(CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
+#define NEIL_BLE_GATTS_CONN_MAX CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#elif defined(CONFIG_BT_ACL_CONNECTIONS)
+#define NEIL_BLE_GATTS_CONN_MAX CONFIG_BT_ACL_CONNECTIONS
+#else
+#define NEIL_BLE_GATTS_CONN_MAX 4
+#endif
+
+/// Encryption requested this long ago without an outcome is requested again
+/// (the SMP transaction timeout), in case the peer ignored it.
+#define NEIL_BLE_GATTS_CONN_SEC_RETRY_US (30 * 1000 * 1000)
+
+/// No connection, see `neil_ble_gatts_conn_writer`.
+#define NEIL_BLE_GATTS_CONN_NONE 0xFFFF
+
+// -------------------------------------------------------------
+// Domain Structures
+// -------------------------------------------------------------
+
+/**
+ * @brief       Per-connection state.
+ */
+typedef struct {
+    bool in_use;       ///< Slot is occupied by a live connection.
+    uint16_t conn_id;  ///< Connection ID (Bluedroid) or handle (NimBLE).
+    esp_bd_addr_t bda; ///< Remote device address.
+    uint16_t mtu;      ///< Negotiated ATT MTU.
+
+    neil_ble_gatts_sec_t sec_level; ///< Current link security.
+    bool sec_pending;               ///< Encryption requested, outcome not in yet.
+    int64_t sec_requested_us;       ///< When encryption was last requested.
+
+    uint32_t journal_since; ///< Version last written to the change journal.
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+    esp_gatt_rsp_t *rsp; ///< Response buffer of the connection's requests.
+#endif
+} neil_ble_gatts_conn_t;
+
+/// Number of heap allocations made by `neil_ble_gatts_conn_init`.
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+#define NEIL_BLE_GATTS_CONN_ALLOC_COUNT 2
+#else
+#define NEIL_BLE_GATTS_CONN_ALLOC_COUNT 1
+#endif
+
+// -------------------------------------------------------------
+// Procedures
+// -------------------------------------------------------------
+
+/**
+ * @brief       Allocate the connection table, and on Bluedroid the response
+ *              buffers that keep `esp_gatt_rsp_t` off the BTC task stack.
+ */
+esp_err_t neil_ble_gatts_conn_init(void);
+
+/**
+ * @brief       Release the connection table.
+ *
+ *              Any tracked connection is forgotten.
+ */
+void neil_ble_gatts_conn_deinit(void);
+
+/**
+ * @brief       Track a new connection.
+ *
+ *              A connection already tracked is returned as is.
+ *
+ * @return      NULL if the table is full or not initialized.
+ */
+neil_ble_gatts_conn_t *neil_ble_gatts_conn_add(uint16_t conn_id,
+                                               const esp_bd_addr_t bda);
+
+/**
+ * @brief       Get a tracked connection by ID.
+ *
+ * @return      NULL if the connection is not tracked.
+ */
+neil_ble_gatts_conn_t *neil_ble_gatts_conn_get(uint16_t conn_id);
+
+/**
+ * @brief       Get a tracked connection by remote address.
+ *
+ * @return      NULL if no connection to `bda` is tracked.
+ */
+neil_ble_gatts_conn_t *neil_ble_gatts_conn_find(const esp_bd_addr_t bda);
+
+/**
+ * @brief       Stop tracking a connection.
+ */
+void neil_ble_gatts_conn_remove(uint16_t conn_id);
+
+/**
+ * @brief       Number of tracked connections.
+ */
+uint8_t neil_ble_gatts_conn_count(void);
+
+/**
+ * @brief       Negotiated MTU of a connection, safe from any task.
+ *
+ * @return      0 if the connection is not tracked.
+ */
+uint16_t neil_ble_gatts_conn_mtu(uint16_t conn_id);
+
+/**
+ * @brief       Check the link security of a connection against the level an
+ *              attribute requires.
+ *
+ *              A link below the level is asked to encrypt, once until the
+ *              outcome is reported through `neil_ble_gatts_conn_sec_update`
+ *              or NEIL_BLE_GATTS_CONN_SEC_RETRY_US passes without one.
+ *
+ * @return      ESP_GATT_OK, or ESP_GATT_INSUF_AUTHENTICATION to answer the
+ *              client with, so it may also pair on its own.
+ */
+esp_gatt_status_t neil_ble_gatts_conn_sec_check(uint16_t conn_id,
+                                                neil_ble_gatts_sec_t level);
+
+/**
+ * @brief       Record the link security of a connection after a security
+ *              procedure (NEIL_BLE_GATTS_SEC_NONE if it failed).
+ */
+void neil_ble_gatts_conn_sec_update(uint16_t conn_id, neil_ble_gatts_sec_t level);
+
+/**
+ * @brief       Record the connection whose write the backend dispatches, or
+ *              NEIL_BLE_GATTS_CONN_NONE once dispatched.
+ */
+void neil_ble_gatts_conn_set_writer(uint16_t conn_id);
+
+/**
+ * @brief       Connection whose write is being dispatched, for `on_write`
+ *              callbacks answering the writer alone. Call from the callback.
+ *
+ * @return      NEIL_BLE_GATTS_CONN_NONE outside a client write (e.g. values
+ *              restored by persistence).
+ */
+uint16_t neil_ble_gatts_conn_writer(void);
+
+/**
+ * @brief       Request disconnection of every tracked connection.
+ *
+ *              Disconnection completes asynchronously; entries are removed
+ *              as disconnect events arrive.
+ */
+void neil_ble_gatts_conn_disconnect_all(void);
+
+/**
+ * @brief       Heap bytes the connection table holds.
+ */
+size_t neil_ble_gatts_conn_footprint(void);
+
+#endif // neil_ble_gatts_CONN_H_
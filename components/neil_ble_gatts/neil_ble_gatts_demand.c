@@ -0,0 +1,376 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_demand.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Demand Signals implementation.
+///
+///             Nothing is counted here: on each refresh the connection table
+///             and the subscriptions of the notification scheduler are read
+///             back and compared with the counts last published. Refreshes
+///             follow connection and client configuration events, so they
+///             are rare and run on the Bluetooth task.
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "neil_ble_gatts_conn.h"
+#include "neil_ble_gatts_demand.h"
+#include "neil_ble_gatts_mem.h"
+
+static const char *const TAG = "neil_ble_gatts_demand";
+
+#if CONFIG_NEIL_BLE_GATTS_DEMAND
+
+// -------------------------------------------------------------
+// State
+// -------------------------------------------------------------
+
+typedef struct {
+    uint8_t svc_idx;
+    uint8_t chr_idx;
+    uint8_t subscribers; ///< Count last published.
+    EventBits_t bits;
+} demand_chr_t;
+
+typedef struct {
+    neil_ble_gatts_ctx_t *ctx; ///< NULL if the slot is free.
+    const neil_ble_gatts_cfg_dev_t *dev_cfg;
+    demand_chr_t *chrs;
+    uint16_t chr_count;
+} demand_ctx_t;
+
+static demand_ctx_t ctxs[NEIL_BLE_GATTS_CTX_MAX];
+
+// --- Connections last published
+static uint8_t connections = 0;
+
+static EventGroupHandle_t demand_group = NULL;
+
+// --- Guards the watch lists, taken by attach/detach and each refresh
+static SemaphoreHandle_t demand_mutex = NULL;
+
+// --- Guards the lazy creation of the event group, asked for from any task
+static portMUX_TYPE demand_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// -------------------------------------------------------------
+// Publication (call with the mutex held)
+// -------------------------------------------------------------
+
+static void demand_report(const demand_ctx_t *slot, uint8_t svc_idx, uint8_t chr_idx,
+                          uint8_t subscribers) {
+
+    if (slot->dev_cfg->on_demand == NULL) {
+        return;
+    }
+
+    const neil_ble_gatts_demand_evt_t evt = {
+        .svc_idx     = svc_idx,
+        .chr_idx     = chr_idx,
+        .connections = connections,
+        .subscribers = subscribers,
+    };
+
+    slot->dev_cfg->on_demand(&evt);
+}
+
+/**
+ * @brief       Publish the counts that changed.
+ *
+ * @param       stale   Bits no longer watched, cleared unless still wanted.
+ */
+static void demand_publish(EventBits_t stale) {
+
+    const uint8_t now_connections = neil_ble_gatts_conn_count();
+    const bool link_changed       = now_connections != connections;
+    connections                   = now_connections;
+
+    EventBits_t watched = NEIL_BLE_GATTS_DEMAND_CONNECTED | stale;
+    EventBits_t wanted  = connections > 0 ? NEIL_BLE_GATTS_DEMAND_CONNECTED : 0;
+
+    for (uint8_t idx = 0; idx < NEIL_BLE_GATTS_CTX_MAX; idx++) {
+        demand_ctx_t *slot = ctxs + idx;
+
+        if (slot->ctx == NULL) {
+            continue;
+        }
+
+        if (link_changed) {
+            demand_report(slot, NEIL_BLE_GATTS_DEMAND_LINK, NEIL_BLE_GATTS_DEMAND_LINK,
+                          0);
+        }
+
+        for (uint16_t chr = 0; chr < slot->chr_count; chr++) {
+            demand_chr_t *entry = slot->chrs + chr;
+
+            const uint8_t subscribers = neil_ble_gatts_ctx_subscribers(
+                slot->ctx, entry->svc_idx, entry->chr_idx);
+
+            watched |= entry->bits;
+            if (subscribers > 0) {
+                wanted |= entry->bits;
+            }
+
+            if (subscribers != entry->subscribers) {
+                entry->subscribers = subscribers;
+                demand_report(slot, entry->svc_idx, entry->chr_idx, subscribers);
+            }
+        }
+    }
+
+    if (demand_group != NULL) {
+        xEventGroupSetBits(demand_group, wanted);
+        xEventGroupClearBits(demand_group, watched & ~wanted);
+    }
+}
+
+// -------------------------------------------------------------
+// Event Group
+// -------------------------------------------------------------
+
+EventGroupHandle_t neil_ble_gatts_demand_group(void) {
+
+    if (demand_group != NULL) {
+        return demand_group;
+    }
+
+    EventGroupHandle_t group = xEventGroupCreate();
+
+    portENTER_CRITICAL(&demand_lock);
+    if (demand_group == NULL) {
+        demand_group = group;
+        group        = NULL;
+    }
+    portEXIT_CRITICAL(&demand_lock);
+
+    // --- Another task created it meanwhile
+    if (group != NULL) {
+        vEventGroupDelete(group);
+    }
+
+    if (demand_group == NULL) {
+        ESP_LOGE(TAG, "Unable to create event group");
+    }
+
+    return demand_group;
+}
+
+// -------------------------------------------------------------
+// Watch Lists
+// -------------------------------------------------------------
+
+static bool chr_watched(const neil_ble_gatts_cfg_dev_t *dev_cfg,
+                        const neil_ble_gatts_cfg_chr_t *chr_cfg) {
+    return chr_cfg->notify && (chr_cfg->demand != 0 || dev_cfg->on_demand != NULL);
+}
+
+/**
+ * @brief       Free the watch list of a slot (mutex held).
+ *
+ * @return      Bits the slot watched.
+ */
+static EventBits_t slot_clear(demand_ctx_t *slot) {
+
+    EventBits_t bits = 0;
+
+    for (uint16_t chr = 0; chr < slot->chr_count; chr++) {
+        bits |= slot->chrs[chr].bits;
+    }
+
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_DEMAND, slot->chrs);
+    *slot = (demand_ctx_t){0};
+
+    return bits;
+}
+
+esp_err_t neil_ble_gatts_demand_attach(neil_ble_gatts_ctx_t *ctx,
+                                       const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    if (ctx == NULL || dev_cfg == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint16_t count = 0;
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+            const neil_ble_gatts_cfg_chr_t *chr_cfg = svc_cfg->chr_tab + chr_idx;
+
+            // --- FreeRTOS reserves the top byte, bit 23 is ours
+            const uint32_t reserved = chr_cfg->demand & ~NEIL_BLE_GATTS_DEMAND_CHR_BITS;
+            if (reserved != 0) {
+                ESP_LOGE(TAG, "Demand bits 0x%08" PRIx32 " of %d.%d are reserved",
+                         reserved, svc_idx, chr_idx);
+                return ESP_ERR_INVALID_ARG;
+            }
+
+            count += chr_watched(dev_cfg, chr_cfg);
+        }
+    }
+
+    // --- No mutex nor event group for configurations that watch nothing
+    if (count == 0 && dev_cfg->on_demand == NULL) {
+        neil_ble_gatts_demand_detach(ctx);
+        return ESP_OK;
+    }
+
+    if (demand_mutex == NULL) {
+        demand_mutex = xSemaphoreCreateMutex();
+    }
+
+    if (demand_mutex == NULL || neil_ble_gatts_demand_group() == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    demand_chr_t *chrs = NULL;
+
+    if (count > 0) {
+        chrs = neil_ble_gatts_mem_calloc(NEIL_BLE_GATTS_MEM_DEMAND, count,
+                                         sizeof(demand_chr_t));
+        if (chrs == NULL) {
+            ESP_LOGE(TAG, "Out of memory watching %d characteristics", count);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    uint16_t added = 0;
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+            const neil_ble_gatts_cfg_chr_t *chr_cfg = svc_cfg->chr_tab + chr_idx;
+
+            if (chr_watched(dev_cfg, chr_cfg)) {
+                chrs[added++] = (demand_chr_t){
+                    .svc_idx = svc_idx,
+                    .chr_idx = chr_idx,
+                    .bits    = chr_cfg->demand,
+                };
+            }
+        }
+    }
+
+    xSemaphoreTake(demand_mutex, portMAX_DELAY);
+
+    demand_ctx_t *slot = NULL;
+    EventBits_t stale  = 0;
+
+    for (uint8_t idx = 0; idx < NEIL_BLE_GATTS_CTX_MAX; idx++) {
+        if (ctxs[idx].ctx == ctx) {
+            stale = slot_clear(ctxs + idx);
+        }
+        if (ctxs[idx].ctx == NULL && slot == NULL) {
+            slot = ctxs + idx;
+        }
+    }
+
+    // NOTE: There is one slot per context, one is always free.
+    *slot = (demand_ctx_t){
+        .ctx       = ctx,
+        .dev_cfg   = dev_cfg,
+        .chrs      = chrs,
+        .chr_count = count,
+    };
+
+    demand_publish(stale);
+
+    xSemaphoreGive(demand_mutex);
+
+    return ESP_OK;
+}
+
+void neil_ble_gatts_demand_detach(neil_ble_gatts_ctx_t *ctx) {
+
+    if (demand_mutex == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(demand_mutex, portMAX_DELAY);
+
+    EventBits_t stale = 0;
+    for (uint8_t idx = 0; idx < NEIL_BLE_GATTS_CTX_MAX; idx++) {
+        if (ctxs[idx].ctx == ctx) {
+            stale = slot_clear(ctxs + idx);
+        }
+    }
+
+    demand_publish(stale);
+
+    xSemaphoreGive(demand_mutex);
+}
+
+void neil_ble_gatts_demand_refresh(void) {
+
+    if (demand_mutex == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(demand_mutex, portMAX_DELAY);
+    demand_publish(0);
+    xSemaphoreGive(demand_mutex);
+}
+
+size_t neil_ble_gatts_demand_footprint(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    uint16_t count = 0;
+
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+            count += chr_watched(dev_cfg, svc_cfg->chr_tab + chr_idx);
+        }
+    }
+
+    return count * sizeof(demand_chr_t);
+}
+
+#else
+
+// NOTE: Disabled in menuconfig (CONFIG_NEIL_BLE_GATTS_DEMAND), configurations
+//       asking for demand signals are rejected.
+
+EventGroupHandle_t neil_ble_gatts_demand_group(void) {
+    ESP_LOGW(TAG, "Disabled in menuconfig");
+    return NULL;
+}
+
+esp_err_t neil_ble_gatts_demand_attach(neil_ble_gatts_ctx_t *ctx,
+                                       const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    if (ctx == NULL || dev_cfg == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    bool wanted = dev_cfg->on_demand != NULL;
+
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+            wanted = wanted || svc_cfg->chr_tab[chr_idx].demand != 0;
+        }
+    }
+
+    if (wanted) {
+        ESP_LOGE(TAG, "`demand` or `on_demand` set, but disabled in menuconfig");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return ESP_OK;
+}
+
+void neil_ble_gatts_demand_detach(neil_ble_gatts_ctx_t *ctx) {}
+
+void neil_ble_gatts_demand_refresh(void) {}
+
+size_t neil_ble_gatts_demand_footprint(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,101 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_demand.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Demand Signals.
+///
+///             Producers of characteristic values should only run while
+///             someone can receive them. The server publishes who can:
+///
+///                 event group     `neil_ble_gatts_demand_group`, with
+///                                 NEIL_BLE_GATTS_DEMAND_CONNECTED set while a
+///                                 client is connected, and the `demand` bits of
+///                                 a notifying characteristic set while it has
+///                                 subscribers (bits shared by characteristics
+///                                 are set while any of them has)
+///                 callback        `on_demand` of the device configuration,
+///                                 told of every change in the number of
+///                                 connections or of subscribers
+///
+///             A sampling task blocks until its data is wanted:
+///
+///                 xEventGroupWaitBits(neil_ble_gatts_demand_group(), BIT_ACCEL,
+///                                     pdFALSE, pdFALSE, portMAX_DELAY);
+///
+///             Characteristic bits must leave NEIL_BLE_GATTS_DEMAND_CONNECTED
+///             and the bits FreeRTOS reserves (above bit 23) alone.
+
+#ifndef neil_ble_gatts_DEMAND_H_
+#define neil_ble_gatts_DEMAND_H_
+
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
+#include "neil_ble_gatts.h"
+#include "neil_ble_gatts_cfg.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Event bit set while at least one client is connected.
+#define NEIL_BLE_GATTS_DEMAND_CONNECTED (1UL << 23)
+
+/// Event bits a characteristic may use as `demand` (bits 0 to 22).
+#define NEIL_BLE_GATTS_DEMAND_CHR_BITS (NEIL_BLE_GATTS_DEMAND_CONNECTED - 1)
+
+/// Number of heap allocations made by `neil_ble_gatts_demand_attach`.
+#define NEIL_BLE_GATTS_DEMAND_ALLOC_COUNT 1
+
+// -------------------------------------------------------------
+// Procedures (public)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Event group of the demand bits, created on first use.
+ *
+ * @return      NULL if it could not be created.
+ */
+EventGroupHandle_t neil_ble_gatts_demand_group(void);
+
+// -------------------------------------------------------------
+// Procedures (component-internal)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Watch the notifying characteristics of a context that have
+ *              `demand` bits, or all of them if it has `on_demand`.
+ *
+ *              Replaces the entries of an earlier attach.
+ *
+ * @return      ESP_ERR_INVALID_ARG if a `demand` has bits outside
+ *              NEIL_BLE_GATTS_DEMAND_CHR_BITS.
+ */
+esp_err_t neil_ble_gatts_demand_attach(neil_ble_gatts_ctx_t *ctx,
+                                       const neil_ble_gatts_cfg_dev_t *dev_cfg);
+
+/**
+ * @brief       Stop watching a context, clearing its bits.
+ */
+void neil_ble_gatts_demand_detach(neil_ble_gatts_ctx_t *ctx);
+
+/**
+ * @brief       Compare connections and subscribers with what was published,
+ *              and publish the changes. Call after a connection opened or
+ *              closed, or a client configuration was written.
+ */
+void neil_ble_gatts_demand_refresh(void);
+
+/**
+ * @brief       Heap bytes the watch list of `dev_cfg` will hold.
+ */
+size_t neil_ble_gatts_demand_footprint(const neil_ble_gatts_cfg_dev_t *dev_cfg);
+
+#endif // neil_ble_gatts_DEMAND_H_
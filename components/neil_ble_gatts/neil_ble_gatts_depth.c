@@ -0,0 +1,204 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_depth.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Callback Stack Depth implementation.
+///
+///             A callback that lowers the high-water reached it itself, so
+///             the new mark, from the start of the stack, tells how deep it
+///             went below the frame recording it.
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "neil_ble_gatts_depth.h"
+#include "neil_ble_gatts_mem.h"
+
+static const char *const TAG = "neil_ble_gatts_depth";
+
+#if CONFIG_NEIL_BLE_GATTS_DEPTH
+
+// -------------------------------------------------------------
+// State
+// -------------------------------------------------------------
+
+typedef neil_ble_gatts_depth_evt_t depth_evts_t[NEIL_BLE_GATTS_DEPTH_EVENTS];
+
+// --- Event tables of every source (allocated while measuring)
+static depth_evts_t *evts = NULL;
+
+static neil_ble_gatts_depth_stats_t stats;
+
+// --- Records are written on the host task, control comes from any task.
+static portMUX_TYPE depth_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// -------------------------------------------------------------
+// Control
+// -------------------------------------------------------------
+
+esp_err_t neil_ble_gatts_depth_start(void) {
+
+    depth_evts_t *tabs = neil_ble_gatts_mem_calloc(
+        NEIL_BLE_GATTS_MEM_DEPTH, NEIL_BLE_GATTS_DEPTH_SRC_MAX, sizeof(depth_evts_t));
+
+    if (tabs == NULL) {
+        ESP_LOGE(TAG, "Out of memory allocating event tables");
+        return ESP_ERR_NO_MEM;
+    }
+
+    portENTER_CRITICAL(&depth_lock);
+    depth_evts_t *old = evts;
+    evts              = tabs;
+    stats             = (neil_ble_gatts_depth_stats_t){.free_min = UINT32_MAX};
+    portEXIT_CRITICAL(&depth_lock);
+
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_DEPTH, old);
+
+    return ESP_OK;
+}
+
+void neil_ble_gatts_depth_stop(void) {
+    portENTER_CRITICAL(&depth_lock);
+    depth_evts_t *old = evts;
+    evts              = NULL;
+    portEXIT_CRITICAL(&depth_lock);
+
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_DEPTH, old);
+}
+
+esp_err_t neil_ble_gatts_depth_get_stats(neil_ble_gatts_depth_stats_t *out) {
+
+    if (out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = ESP_OK;
+
+    portENTER_CRITICAL(&depth_lock);
+    if (evts != NULL) {
+        *out = stats;
+    } else {
+        ret = ESP_ERR_INVALID_STATE;
+    }
+    portEXIT_CRITICAL(&depth_lock);
+
+    return ret;
+}
+
+esp_err_t neil_ble_gatts_depth_get_event(neil_ble_gatts_depth_src_t src,
+                                         uint8_t event,
+                                         neil_ble_gatts_depth_evt_t *evt) {
+
+    if (src >= NEIL_BLE_GATTS_DEPTH_SRC_MAX || evt == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (event >= NEIL_BLE_GATTS_DEPTH_EVENTS) {
+        event = NEIL_BLE_GATTS_DEPTH_EVENTS - 1;
+    }
+
+    esp_err_t ret = ESP_OK;
+
+    portENTER_CRITICAL(&depth_lock);
+    if (evts != NULL) {
+        *evt = evts[src][event];
+    } else {
+        ret = ESP_ERR_INVALID_STATE;
+    }
+    portEXIT_CRITICAL(&depth_lock);
+
+    return ret;
+}
+
+// -------------------------------------------------------------
+// Hooks
+// -------------------------------------------------------------
+
+bool neil_ble_gatts_depth_active(void) {
+    return evts != NULL;
+}
+
+uint32_t neil_ble_gatts_depth_free(void) {
+    return uxTaskGetStackHighWaterMark(NULL);
+}
+
+void neil_ble_gatts_depth_record(neil_ble_gatts_depth_src_t src, uint8_t event,
+                                 uint32_t free_before) {
+
+    const uint32_t free_after = uxTaskGetStackHighWaterMark(NULL);
+
+    // --- Lowered by this callback: the mark lies below this frame
+    uint16_t depth = 0;
+
+    if (free_after < free_before) {
+        const uint8_t *frame = __builtin_frame_address(0);
+        const uint8_t *mark  = pxTaskGetStackStart(NULL) + free_after;
+
+        depth = frame > mark ? frame - mark : 0;
+    }
+
+    if (event >= NEIL_BLE_GATTS_DEPTH_EVENTS) {
+        event = NEIL_BLE_GATTS_DEPTH_EVENTS - 1;
+    }
+
+    portENTER_CRITICAL(&depth_lock);
+    if (evts != NULL) {
+        neil_ble_gatts_depth_evt_t *evt = evts[src] + event;
+
+        evt->count++;
+        if (depth > evt->depth_max) {
+            evt->depth_max = depth;
+        }
+
+        stats.count++;
+        if (free_after < stats.free_min) {
+            stats.free_min = free_after;
+        }
+        if (depth > stats.depth_max) {
+            stats.depth_max   = depth;
+            stats.deepest_src = src;
+            stats.deepest_evt = event;
+        }
+    }
+    portEXIT_CRITICAL(&depth_lock);
+}
+
+#else
+
+// NOTE: Disabled in menuconfig (CONFIG_NEIL_BLE_GATTS_DEPTH), callbacks are
+//       never sampled.
+
+esp_err_t neil_ble_gatts_depth_start(void) {
+    ESP_LOGW(TAG, "Disabled in menuconfig");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void neil_ble_gatts_depth_stop(void) {}
+
+esp_err_t neil_ble_gatts_depth_get_stats(neil_ble_gatts_depth_stats_t *out) {
+    return ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t neil_ble_gatts_depth_get_event(neil_ble_gatts_depth_src_t src,
+                                         uint8_t event,
+                                         neil_ble_gatts_depth_evt_t *evt) {
+    return ESP_ERR_INVALID_STATE;
+}
+
+bool neil_ble_gatts_depth_active(void) {
+    return false;
+}
+
+uint32_t neil_ble_gatts_depth_free(void) {
+    return 0;
+}
+
+void neil_ble_gatts_depth_record(neil_ble_gatts_depth_src_t src, uint8_t event,
+                                 uint32_t free_before) {}
+
+#endif
@@ -0,0 +1,123 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_depth.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Callback Stack Depth API.
+///
+///             GATT and GAP callbacks run on the task of the host stack (the
+///             BTC task on Bluedroid, the host task on NimBLE), together with
+///             the application callbacks they invoke. While measuring, the
+///             stack high-water of that task is sampled around each callback:
+///
+///                 high-water  least free stack the task ever had
+///                 depth       stack used below the entry point of the
+///                             component by the callback that set the
+///                             high-water, kept per event as its maximum
+///
+///             An event that stays above the high-water set by another leaves
+///             no depth: the deepest events show, which size the stack.
+///             Sampling scans the free stack twice per callback, so leave it
+///             off outside of sizing sessions.
+
+#ifndef neil_ble_gatts_DEPTH_H_
+#define neil_ble_gatts_DEPTH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Events kept per source, higher event numbers share the last entry.
+#define NEIL_BLE_GATTS_DEPTH_EVENTS 96
+
+// -------------------------------------------------------------
+// Domain Structures
+// -------------------------------------------------------------
+
+/// Event source of a callback.
+typedef enum {
+    NEIL_BLE_GATTS_DEPTH_SRC_GATTS = 0, ///< GATTS event (NimBLE: access operation).
+    NEIL_BLE_GATTS_DEPTH_SRC_GAP,       ///< GAP event.
+    NEIL_BLE_GATTS_DEPTH_SRC_MAX,
+} neil_ble_gatts_depth_src_t;
+
+/**
+ * @brief       Measurements of one event.
+ */
+typedef struct {
+    uint32_t count;     ///< Callbacks measured.
+    uint16_t depth_max; ///< Deepest stack use (bytes), 0 if never the deepest.
+} neil_ble_gatts_depth_evt_t;
+
+/**
+ * @brief       Measurements of the callback task.
+ */
+typedef struct {
+    uint32_t count;      ///< Callbacks measured.
+    uint32_t free_min;   ///< High-water: least free stack (bytes).
+    uint16_t depth_max;  ///< Deepest stack use of a callback (bytes).
+    uint8_t deepest_src; ///< neil_ble_gatts_depth_src_t of the deepest callback.
+    uint8_t deepest_evt; ///< Event of the deepest callback.
+} neil_ble_gatts_depth_stats_t;
+
+// -------------------------------------------------------------
+// Control
+// -------------------------------------------------------------
+
+/**
+ * @brief       Start measuring callbacks, discarding earlier measurements.
+ */
+esp_err_t neil_ble_gatts_depth_start(void);
+
+/**
+ * @brief       Stop measuring and release the event table.
+ */
+void neil_ble_gatts_depth_stop(void);
+
+/**
+ * @brief       Get the measurements of the callback task.
+ *
+ * @return      ESP_ERR_INVALID_STATE if not measuring.
+ */
+esp_err_t neil_ble_gatts_depth_get_stats(neil_ble_gatts_depth_stats_t *stats);
+
+/**
+ * @brief       Get the measurements of one event.
+ *
+ * @return      ESP_ERR_INVALID_STATE if not measuring.
+ */
+esp_err_t neil_ble_gatts_depth_get_event(neil_ble_gatts_depth_src_t src,
+                                         uint8_t event,
+                                         neil_ble_gatts_depth_evt_t *evt);
+
+// -------------------------------------------------------------
+// Hooks (component-internal)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Whether measuring is active (lets callers skip sampling).
+ */
+bool neil_ble_gatts_depth_active(void);
+
+/**
+ * @brief       Free stack of the calling task (bytes), before a callback.
+ */
+uint32_t neil_ble_gatts_depth_free(void);
+
+/**
+ * @brief       Record a callback after it has been handled.
+ *
+ * @param       free_before     `neil_ble_gatts_depth_free` before the callback.
+ */
+void neil_ble_gatts_depth_record(neil_ble_gatts_depth_src_t src, uint8_t event,
+                                 uint32_t free_before);
+
+#endif // neil_ble_gatts_DEPTH_H_
@@ -9,23 +9,33 @@
 #include "esp_log.h"
 
 #include "neil_ble_gatts_cfg.h"
+#include "neil_ble_gatts_conn.h"
 #include "neil_ble_gatts_gap.h"
+#include "neil_ble_gatts_link.h"
+#include "neil_ble_gatts_log.h"
 #include "neil_ble_gatts_util.h"
 
 static const char *const TAG = "neil_ble_gatts_GAP";
 
-static struct gap_config_s {
-    esp_ble_adv_data_t adv_data;
-    esp_ble_adv_data_t adv_ext_data;
-    esp_ble_adv_params_t adv_params;
-} gap_config;
+// --- Owner of the (single, legacy) advertising set, NULL if unclaimed.
+static neil_ble_gatts_gap_t *adv_owner = NULL;
 
 // -------------------------------------------------------------
 // Prototypes
 // -------------------------------------------------------------
 
 // --- Advertising
-static void adv_svc_uuid_merge(const neil_ble_gatts_cfg_dev_t *dev_cfg, uint8_t *uuid);
+static uint16_t adv_svc_uuid_merge(const neil_ble_gatts_cfg_dev_t *dev_cfg,
+                                   uint8_t *uuid);
+
+// -------------------------------------------------------------
+// Logging
+// -------------------------------------------------------------
+
+// --- A device address as two log arguments, printed "%08x%04x"
+#define BDA_HI(bda)                                                                    \
+    ((uint32_t)(bda)[0] << 24 | (bda)[1] << 16 | (bda)[2] << 8 | (bda)[3])
+#define BDA_LO(bda) ((uint32_t)(bda)[4] << 8 | (bda)[5])
 
 // -------------------------------------------------------------
 // Advertising State Control Flags
@@ -34,68 +44,106 @@ static void adv_svc_uuid_merge(const neil_ble_gatts_cfg_dev_t *dev_cfg, uint8_t
 static const uint8_t ADV_CONFIG_COMPLETED_FLAG = 0b01;
 // --- Informs Scan Response system is configured
 static const uint8_t SCAN_RSP_CONFIG_COMPLETED_FLAG = 0b10;
-// --- Condition byte used to track status flags
-static uint8_t is_adv_config_done = 0;
 
-void neil_ble_gatts_gap_init(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+// -------------------------------------------------------------
+// Advertising Payload Budget
+// -------------------------------------------------------------
 
-    // FIXME: Increase size to maximum length
-    static uint8_t adv_svc_uuid[16];
+/// Legacy advertising payload bytes left for service UUID lists, after
+/// flags (3), TX power (3) and slave connection interval (6).
+#define ADV_SVC_UUID_BUDGET (ESP_BLE_ADV_DATA_LEN_MAX - 3 - 3 - 6)
 
-    // Initialize the advertising ID with appropriate size
-    adv_svc_uuid_merge(dev_cfg, adv_svc_uuid);
+// -------------------------------------------------------------
+// Security Settings (menuconfig)
+// -------------------------------------------------------------
 
-    // For each service in the device config
-    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
-        uint16_t offset = ESP_UUID_LEN_128 * svc_idx;
-        // Create a UUID to relate to the service
-        memcpy(&adv_svc_uuid[offset], (uint8_t[])neil_ble_gatts_UUID_128(svc_idx, 0),
-               ESP_UUID_LEN_128);
+#if CONFIG_NEIL_BLE_GATTS_SEC_NO_BOND
+#define SEC_AUTH_REQ ESP_LE_AUTH_NO_BOND
+#elif CONFIG_NEIL_BLE_GATTS_SEC_LEGACY_BOND
+#define SEC_AUTH_REQ ESP_LE_AUTH_BOND
+#elif CONFIG_NEIL_BLE_GATTS_SEC_SC_BOND
+#define SEC_AUTH_REQ ESP_LE_AUTH_REQ_SC_BOND
+#else
+#define SEC_AUTH_REQ ESP_LE_AUTH_REQ_SC_MITM_BOND
+#endif
+
+#if CONFIG_NEIL_BLE_GATTS_IO_CAP_DISPLAY
+#define SEC_IO_CAP  ESP_IO_CAP_OUT
+#define SEC_PASSKEY CONFIG_NEIL_BLE_GATTS_PASSKEY
+#else
+#define SEC_IO_CAP  ESP_IO_CAP_NONE
+#define SEC_PASSKEY 123456
+#endif
+
+esp_err_t neil_ble_gatts_gap_init(neil_ble_gatts_gap_t *gap,
+                                  const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    if (adv_owner != NULL && adv_owner != gap) {
+        ESP_LOGE(TAG, "Advertising set already in use");
+        return ESP_ERR_INVALID_STATE;
     }
 
-    gap_config = (struct gap_config_s){
-        .adv_data =
-            {
-                .set_scan_rsp    = false,
-                .include_txpower = true,
-                .min_interval    = 0x0006, // slave connection min interval, Time =
-                                           // min_interval * 1.25 msec
-                .max_interval = 0x0010,    // slave connection max interval, Time =
-                                           // max_interval * 1.25 msec
-                .appearance          = 0x00,
-                .manufacturer_len    = 0,
-                .p_manufacturer_data = NULL,
-                .service_data_len    = 0,
-                .p_service_data      = NULL,
-                .service_uuid_len    = sizeof(adv_svc_uuid),
-                .p_service_uuid      = adv_svc_uuid,
-                .flag = (ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT),
-            },
-
-        .adv_ext_data =
-            {
-                .set_scan_rsp        = true,
-                .include_name        = true,
-                .manufacturer_len    = dev_cfg->mfr_len,
-                .p_manufacturer_data = (uint8_t *)dev_cfg->mfr,
-            },
-
-        .adv_params =
-            {
-                .adv_int_min       = 0x100,
-                .adv_int_max       = 0x100,
-                .adv_type          = ADV_TYPE_IND,
-                .own_addr_type     = BLE_ADDR_TYPE_RPA_PUBLIC,
-                .channel_map       = ADV_CHNL_ALL,
-                .adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
-            },
+    adv_owner = gap;
+
+    const uint16_t adv_svc_uuid_len = adv_svc_uuid_merge(dev_cfg, gap->adv_svc_uuid);
+
+    gap->adv_data = (esp_ble_adv_data_t){
+        .set_scan_rsp    = false,
+        .include_txpower = true,
+        .min_interval    = 0x0006, // slave connection min interval, Time =
+                                   // min_interval * 1.25 msec
+        .max_interval = 0x0010,    // slave connection max interval, Time =
+                                   // max_interval * 1.25 msec
+        .appearance          = 0x00,
+        .manufacturer_len    = 0,
+        .p_manufacturer_data = NULL,
+        .service_data_len    = 0,
+        .p_service_data      = NULL,
+        .service_uuid_len    = adv_svc_uuid_len,
+        .p_service_uuid      = adv_svc_uuid_len ? gap->adv_svc_uuid : NULL,
+        .flag = (ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT),
+    };
+
+    gap->adv_ext_data = (esp_ble_adv_data_t){
+        .set_scan_rsp        = true,
+        .include_name        = true,
+        .manufacturer_len    = dev_cfg->mfr_len,
+        .p_manufacturer_data = (uint8_t *)dev_cfg->mfr,
+    };
+
+    gap->adv_params = (esp_ble_adv_params_t){
+        .adv_int_min       = 0x100,
+        .adv_int_max       = 0x100,
+        .adv_type          = ADV_TYPE_IND,
+        .own_addr_type     = BLE_ADDR_TYPE_RPA_PUBLIC,
+        .channel_map       = ADV_CHNL_ALL,
+        .adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
     };
 
+    gap->adv_config_done = 0;
+
     esp_ble_gap_set_device_name(dev_cfg->name);
+
+    return ESP_OK;
 }
 
-void neil_ble_gatts_gap_advertise() {
-    esp_ble_gap_start_advertising(&gap_config.adv_params);
+/**
+ * @brief       Stop advertising and give up the advertising set, so GAP can be
+ *              re-initialized after the stack has been torn down.
+ */
+void neil_ble_gatts_gap_deinit(neil_ble_gatts_gap_t *gap) {
+    if (adv_owner != gap) {
+        return;
+    }
+    esp_ble_gap_stop_advertising();
+    gap->adv_config_done = 0;
+    adv_owner            = NULL;
+}
+
+void neil_ble_gatts_gap_advertise(neil_ble_gatts_gap_t *gap) {
+    if (adv_owner == gap) {
+        esp_ble_gap_start_advertising(&gap->adv_params);
+    }
 }
 
 /**
@@ -107,23 +155,32 @@ void neil_ble_gatts_gap_advertise() {
 void neil_ble_gatts_gap_event_handler(esp_gap_ble_cb_event_t event,
                                       esp_ble_gap_cb_param_t *param) {
 
-    ESP_LOGV(TAG, "GAP_EVT, event %d\n", event);
+    NEIL_BLE_GATTS_LOG(GAP_EVENT, event, 0, 0);
+
+    // --- Advertising events apply to the owner of the advertising set
+    neil_ble_gatts_gap_t *gap = adv_owner;
 
     switch (event) {
 
     // --- On Advertisement Config Done
     case ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT:
-        is_adv_config_done &= (~ADV_CONFIG_COMPLETED_FLAG);
-        if (is_adv_config_done == 0) {
-            neil_ble_gatts_gap_advertise();
+        if (gap == NULL) {
+            break;
+        }
+        gap->adv_config_done &= (~ADV_CONFIG_COMPLETED_FLAG);
+        if (gap->adv_config_done == 0) {
+            neil_ble_gatts_gap_advertise(gap);
         }
         break;
 
     // --- On Response Config Done
     case ESP_GAP_BLE_SCAN_RSP_DATA_SET_COMPLETE_EVT:
-        is_adv_config_done &= (~SCAN_RSP_CONFIG_COMPLETED_FLAG);
-        if (is_adv_config_done == 0) {
-            neil_ble_gatts_gap_advertise();
+        if (gap == NULL) {
+            break;
+        }
+        gap->adv_config_done &= (~SCAN_RSP_CONFIG_COMPLETED_FLAG);
+        if (gap->adv_config_done == 0) {
+            neil_ble_gatts_gap_advertise(gap);
         }
         break;
 
@@ -136,7 +193,7 @@ void neil_ble_gatts_gap_event_handler(esp_gap_ble_cb_event_t event,
                      param->adv_start_cmpl.status);
             break;
         }
-        ESP_LOGI(TAG, "advertising start success");
+        NEIL_BLE_GATTS_LOG(GAP_ADV_START, param->adv_start_cmpl.status, 0, 0);
         break;
 
     // --- On Passkey Request (ingored)
@@ -144,7 +201,7 @@ void neil_ble_gatts_gap_event_handler(esp_gap_ble_cb_event_t event,
     // NOTE: The target device does not have DisplayYesNo capabilities.
     //       For this reason, the passkey reply system is unused.
     case ESP_GAP_BLE_PASSKEY_REQ_EVT: /* passkey request event */
-        ESP_LOGI(TAG, "ESP_GAP_BLE_PASSKEY_REQ_EVT");
+        NEIL_BLE_GATTS_LOG(GAP_PASSKEY_REQ, 0, 0, 0);
         // esp_ble_passkey_reply(&profile_table[PROFILE_neil_ID].remote_bda,
         // true,
         //                       0x00);
@@ -152,7 +209,7 @@ void neil_ble_gatts_gap_event_handler(esp_gap_ble_cb_event_t event,
 
     // --- On Out-of-band Pairing Request
     case ESP_GAP_BLE_OOB_REQ_EVT: {
-        ESP_LOGI(TAG, "ESP_GAP_BLE_OOB_REQ_EVT");
+        NEIL_BLE_GATTS_LOG(GAP_OOB_REQ, 0, 0, 0);
         uint8_t tk[16] = {
             1}; // If you paired with OOB, both devices need to use the same tk
         esp_ble_oob_req_reply(param->ble_security.ble_req.bd_addr, tk, sizeof(tk));
@@ -161,12 +218,10 @@ void neil_ble_gatts_gap_event_handler(esp_gap_ble_cb_event_t event,
 
     // --- On Local Identity-Root (ignored)
     case ESP_GAP_BLE_LOCAL_IR_EVT: /* BLE local IR event */
-        ESP_LOGI(TAG, "ESP_GAP_BLE_LOCAL_IR_EVT");
         break;
 
     // --- On Local Encryption-Root (ignored)
     case ESP_GAP_BLE_LOCAL_ER_EVT: /* BLE local ER event */
-        ESP_LOGI(TAG, "ESP_GAP_BLE_LOCAL_ER_EVT");
         break;
 
     // On Numeric Comparison Request (Compare pass-key on pairing)
@@ -176,8 +231,7 @@ void neil_ble_gatts_gap_event_handler(esp_gap_ble_cb_event_t event,
         passkey number to the user to confirm it with the number displayed by
         peer device. */
         esp_ble_confirm_reply(param->ble_security.ble_req.bd_addr, true);
-        ESP_LOGI(TAG, "ESP_GAP_BLE_NC_REQ_EVT, the passkey Notify number:%" PRIu32,
-                 param->ble_security.key_notif.passkey);
+        NEIL_BLE_GATTS_LOG(GAP_NC_REQ, param->ble_security.key_notif.passkey, 0, 0);
         break;
 
     // --- On BLE Security Request
@@ -195,50 +249,57 @@ void neil_ble_gatts_gap_event_handler(esp_gap_ble_cb_event_t event,
                                         /// capability.
 
         /// show the passkey number to the user to input it in the peer device.
-        ESP_LOGI(TAG, "The passkey Notify number:%06" PRIu32,
-                 param->ble_security.key_notif.passkey);
+        NEIL_BLE_GATTS_LOG(GAP_PASSKEY_NOTIF, param->ble_security.key_notif.passkey, 0,
+                           0);
         break;
 
     // --- On BLE Key Event for Peer Device Keys
     case ESP_GAP_BLE_KEY_EVT:
         // shows the ble key info share with peer device to the user.
-        ESP_LOGI(
-            TAG, "key type = %s",
-            neil_ble_gatts_util_esp_key_to_str(param->ble_security.ble_key.key_type));
+        NEIL_BLE_GATTS_LOG(GAP_KEY, param->ble_security.ble_key.key_type, 0, 0);
         break;
 
     // --- On Authentication Done
     case ESP_GAP_BLE_AUTH_CMPL_EVT: {
-        esp_bd_addr_t bd_addr;
-        memcpy(bd_addr, param->ble_security.auth_cmpl.bd_addr, sizeof(esp_bd_addr_t));
-        ESP_LOGI(TAG, "remote BD_ADDR: %08x%04x",
-                 (bd_addr[0] << 24) + (bd_addr[1] << 16) + (bd_addr[2] << 8) +
-                     bd_addr[3],
-                 (bd_addr[4] << 8) + bd_addr[5]);
-        ESP_LOGI(TAG, "address type = %d", param->ble_security.auth_cmpl.addr_type);
-        ESP_LOGI(TAG, "pair status = %s",
-                 param->ble_security.auth_cmpl.success ? "success" : "fail");
-        if (!param->ble_security.auth_cmpl.success) {
-            ESP_LOGI(TAG, "fail reason = 0x%x",
-                     param->ble_security.auth_cmpl.fail_reason);
+        const uint8_t *bd_addr = param->ble_security.auth_cmpl.bd_addr;
+
+        // --- Record the level reached, checked on protected accesses
+        //
+        // NOTE: Without IO, pairing is Just Works whatever `auth_mode` echoes
+        //       of the MITM bit requested; as on NimBLE, it is not MITM.
+        neil_ble_gatts_sec_t level = NEIL_BLE_GATTS_SEC_NONE;
+        if (param->ble_security.auth_cmpl.success) {
+            const bool mitm = SEC_IO_CAP != ESP_IO_CAP_NONE &&
+                              param->ble_security.auth_cmpl.auth_mode &
+                                  ESP_LE_AUTH_REQ_MITM;
+
+            level = mitm ? NEIL_BLE_GATTS_SEC_MITM : NEIL_BLE_GATTS_SEC_ENCRYPT;
+        }
+
+        neil_ble_gatts_conn_t *conn = neil_ble_gatts_conn_find(bd_addr);
+        if (conn != NULL) {
+            neil_ble_gatts_conn_sec_update(conn->conn_id, level);
+        }
+
+        if (param->ble_security.auth_cmpl.success) {
+            NEIL_BLE_GATTS_LOG(GAP_AUTH_OK, BDA_HI(bd_addr), BDA_LO(bd_addr),
+                               param->ble_security.auth_cmpl.auth_mode);
         } else {
-            ESP_LOGI(TAG, "auth mode = %s",
-                     neil_ble_gatts_util_esp_auth_req_to_str(
-                         param->ble_security.auth_cmpl.auth_mode));
+            NEIL_BLE_GATTS_LOG(GAP_AUTH_FAIL, BDA_HI(bd_addr), BDA_LO(bd_addr),
+                               param->ble_security.auth_cmpl.fail_reason);
         }
+#if NEIL_BLE_GATTS_LOG_LEVEL_GAP >= NEIL_BLE_GATTS_LOG_DEBUG
+        // NOTE: Allocates and formats the whole bond list, debug builds only.
         neil_ble_gatts_util_show_bonded_devices(TAG);
+#endif
         break;
     }
 
     // --- On Bonded Device Removal
     case ESP_GAP_BLE_REMOVE_BOND_DEV_COMPLETE_EVT: {
-        ESP_LOGD(TAG, "ESP_GAP_BLE_REMOVE_BOND_DEV_COMPLETE_EVT status = %d",
-                 param->remove_bond_dev_cmpl.status);
-        ESP_LOGI(TAG, "ESP_GAP_BLE_REMOVE_BOND_DEV");
-        ESP_LOGI(TAG, "-----ESP_GAP_BLE_REMOVE_BOND_DEV----");
-        esp_log_buffer_hex(TAG, (void *)param->remove_bond_dev_cmpl.bd_addr,
-                           sizeof(esp_bd_addr_t));
-        ESP_LOGI(TAG, "------------------------------------");
+        const uint8_t *bd_addr = param->remove_bond_dev_cmpl.bd_addr;
+        NEIL_BLE_GATTS_LOG(GAP_BOND_REMOVED, BDA_HI(bd_addr), BDA_LO(bd_addr),
+                           param->remove_bond_dev_cmpl.status);
         break;
     }
 
@@ -250,56 +311,86 @@ void neil_ble_gatts_gap_event_handler(esp_gap_ble_cb_event_t event,
             break;
         }
 
-        esp_err_t ret = esp_ble_gap_config_adv_data(&gap_config.adv_data);
+        if (gap == NULL) {
+            break;
+        }
+
+        esp_err_t ret = esp_ble_gap_config_adv_data(&gap->adv_data);
         if (ret) {
             ESP_LOGE(TAG, "config adv data failed, error code = %x", ret);
         } else {
-            is_adv_config_done |= ADV_CONFIG_COMPLETED_FLAG;
+            gap->adv_config_done |= ADV_CONFIG_COMPLETED_FLAG;
         }
 
-        ret = esp_ble_gap_config_adv_data(&gap_config.adv_ext_data);
+        ret = esp_ble_gap_config_adv_data(&gap->adv_ext_data);
         if (ret) {
             ESP_LOGE(TAG, "config adv ext data failed, error code = %x", ret);
         } else {
-            is_adv_config_done |= SCAN_RSP_CONFIG_COMPLETED_FLAG;
+            gap->adv_config_done |= SCAN_RSP_CONFIG_COMPLETED_FLAG;
         }
 
         break;
 
+    // ---------------------------------
+    // Link Events
+    // ---------------------------------
+
+    // --- On RSSI Sample
+    case ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT: {
+        const neil_ble_gatts_conn_t *conn =
+            neil_ble_gatts_conn_find(param->read_rssi_cmpl.remote_addr);
+        if (conn != NULL && param->read_rssi_cmpl.status == ESP_BT_STATUS_SUCCESS) {
+            neil_ble_gatts_link_on_rssi(conn->conn_id, param->read_rssi_cmpl.rssi);
+        }
+        break;
+    }
+
+    // --- On Connection Parameter Update
+    case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT: {
+        const neil_ble_gatts_conn_t *conn =
+            neil_ble_gatts_conn_find(param->update_conn_params.bda);
+        if (conn != NULL) {
+            neil_ble_gatts_link_on_params(
+                conn->conn_id,
+                param->update_conn_params.status == ESP_BT_STATUS_SUCCESS,
+                param->update_conn_params.conn_int, param->update_conn_params.latency);
+        }
+        break;
+    }
+
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    // --- On PHY Update
+    case ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT: {
+        const neil_ble_gatts_conn_t *conn =
+            neil_ble_gatts_conn_find(param->phy_update.bda);
+        if (conn != NULL) {
+            neil_ble_gatts_link_on_phy(
+                conn->conn_id, param->phy_update.status == ESP_BT_STATUS_SUCCESS,
+                param->phy_update.tx_phy);
+        }
+        break;
+    }
+#endif
+
     // --- Unrecognized Event
     default:
         break;
     }
 }
 
-// HACK: Refactor into parameterized configuration boilerplate
-//
-// In it's current state, it is 1:1 with the GATT security example
-//
+/**
+ * @brief       Hand the pairing parameters selected in menuconfig to the stack.
+ */
 void neil_ble_gatts_gap_configure_security() {
-    /* set the security iocap & auth_req & key size & init key response key
-     * parameters to the stack*/
-
-    // HACK: Move out into parameter
-    esp_ble_auth_req_t auth_req =
-        ESP_LE_AUTH_REQ_SC_MITM_BOND; // bonding with peer device after
-                                      // authentication
 
-    // HACK: Move out into parameter
-    esp_ble_io_cap_t iocap =
-        ESP_IO_CAP_NONE; // set the IO capability to No output No input
+    esp_ble_auth_req_t auth_req = SEC_AUTH_REQ;
+    esp_ble_io_cap_t iocap      = SEC_IO_CAP;
+    uint32_t passkey            = SEC_PASSKEY;
 
-    // HACK: Move out into parameter
     uint8_t key_size = 16; // the key size should be 7~16 bytes
     uint8_t init_key = ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK;
     uint8_t rsp_key  = ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK;
 
-    // Passkey (Randomly Typed)
-    //
-    // HACK: Move out into parameter
-    //
-    uint32_t passkey = 0xFF09E48D;
-
     uint8_t auth_option = ESP_BLE_ONLY_ACCEPT_SPECIFIED_AUTH_DISABLE;
     uint8_t oob_support = ESP_BLE_OOB_DISABLE;
 
@@ -323,17 +414,51 @@ void neil_ble_gatts_gap_configure_security() {
     esp_ble_gap_set_security_param(ESP_BLE_SM_SET_RSP_KEY, &rsp_key, sizeof(uint8_t));
 }
 
-static void adv_svc_uuid_merge(const neil_ble_gatts_cfg_dev_t *dev_cfg, uint8_t *uuid) {
+/**
+ * @brief       Collect service UUIDs for advertising, in 128-bit form.
+ *
+ *              Services are taken in configuration order while their encoded
+ *              list (2 header bytes per UUID size, plus the short form of each
+ *              UUID) fits the legacy advertising payload; the rest are left to
+ *              discovery.
+ *
+ * @return      Bytes written to `uuid`.
+ */
+static uint16_t adv_svc_uuid_merge(const neil_ble_gatts_cfg_dev_t *dev_cfg,
+                                   uint8_t *uuid) {
 
     ESP_LOGI(TAG, "Merging Service UUIDs for advertising");
 
+    // Encoded bytes used by each list, indexed by UUID length
+    uint8_t list_len[ESP_UUID_LEN_128 + 1] = {0};
+    uint8_t payload                        = 0;
+    uint16_t count                         = 0;
+
     // For each service in the device config
     for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
-        uint16_t offset = ESP_UUID_LEN_128 * svc_idx;
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+        const uint8_t svc_id_len                = neil_ble_gatts_UUID_LEN(svc_cfg);
+
+        if (!neil_ble_gatts_util_uuid_len_valid(svc_id_len)) {
+            continue;
+        }
 
-        uint8_t *svc_id = (dev_cfg->svc_tab + svc_idx)->uuid;
+        // A new list costs its length and type bytes
+        const uint8_t cost = svc_id_len + (list_len[svc_id_len] ? 0 : 2);
 
-        // Create a UUID to relate to the service
-        memcpy(uuid + offset, svc_id, ESP_UUID_LEN_128);
+        if (count == NEIL_BLE_GATTS_GAP_ADV_SVC_UUID_MAX ||
+            payload + cost > ADV_SVC_UUID_BUDGET) {
+            ESP_LOGW(TAG, "Service (%d) UUID does not fit advertising data", svc_idx);
+            continue;
+        }
+
+        list_len[svc_id_len] += cost;
+        payload += cost;
+
+        neil_ble_gatts_util_uuid_expand(svc_cfg->uuid, svc_id_len,
+                                        uuid + count * ESP_UUID_LEN_128);
+        count++;
     }
+
+    return count * ESP_UUID_LEN_128;
 }
@@ -5,12 +5,44 @@
 #ifndef neil_ble_gatts_GAP_H_
 #define neil_ble_gatts_GAP_H_
 
+#include <stdint.h>
+
+#include "esp_err.h"
 #include "esp_gap_ble_api.h"
 
 #include "neil_ble_gatts_cfg.h"
 
-void neil_ble_gatts_gap_init(const neil_ble_gatts_cfg_dev_t *dev_cfg);
-void neil_ble_gatts_gap_advertise();
+/// Most service UUIDs considered for advertising.
+#define NEIL_BLE_GATTS_GAP_ADV_SVC_UUID_MAX 8
+
+/**
+ * @brief       Advertising state of one context.
+ *
+ *              Legacy advertising has a single set: one initialized state
+ *              owns it, and advertising events are applied to the owner.
+ */
+typedef struct {
+    esp_ble_adv_data_t adv_data;
+    esp_ble_adv_data_t adv_ext_data;
+    esp_ble_adv_params_t adv_params;
+
+    // --- Bluedroid takes 128-bit entries and folds base-UUID ones into the
+    //     16/32-bit service lists itself.
+    uint8_t adv_svc_uuid[NEIL_BLE_GATTS_GAP_ADV_SVC_UUID_MAX * ESP_UUID_LEN_128];
+
+    uint8_t adv_config_done; ///< Pending advertising configuration flags.
+} neil_ble_gatts_gap_t;
+
+/**
+ * @brief       Prepare advertising of a device configuration and take the
+ *              advertising set.
+ *
+ * @return      ESP_ERR_INVALID_STATE if another state owns the advertising set.
+ */
+esp_err_t neil_ble_gatts_gap_init(neil_ble_gatts_gap_t *gap,
+                                  const neil_ble_gatts_cfg_dev_t *dev_cfg);
+void neil_ble_gatts_gap_deinit(neil_ble_gatts_gap_t *gap);
+void neil_ble_gatts_gap_advertise(neil_ble_gatts_gap_t *gap);
 void neil_ble_gatts_gap_event_handler(esp_gap_ble_cb_event_t event,
                                esp_ble_gap_cb_param_t *param);
 void neil_ble_gatts_gap_configure_security();
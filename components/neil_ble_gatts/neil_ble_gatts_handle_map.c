@@ -0,0 +1,149 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_handle_map.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Characteristic-Handle-to-Configuration Map implementation.
+
+#include <stdint.h>
+
+#include "esp_log.h"
+
+#include "neil_ble_gatts_attr_db.h"
+#include "neil_ble_gatts_cfg.h"
+#include "neil_ble_gatts_handle_map.h"
+#include "neil_ble_gatts_mem.h"
+
+static const char *const TAG = "neil_ble_gatts_handle_map";
+
+// -------------------------------------------------------------
+// Initialization
+// -------------------------------------------------------------
+
+neil_ble_gatts_handle_map_t *
+neil_ble_gatts_handle_map_init(const neil_ble_gatts_cfg_dev_t *dev_cfg,
+                               uint16_t *handle_buffer, uint16_t handle_buffer_len) {
+
+    // --- The value follows the characteristic declaration.
+    static const uint8_t attr_val_offset = 1;
+
+    const uint16_t handle_space_offset = handle_buffer[0];
+
+    uint16_t attr_idx = 0;
+
+    neil_ble_gatts_handle_map_t *map =
+        neil_ble_gatts_mem_alloc(NEIL_BLE_GATTS_MEM_HANDLE_MAP, sizeof(*map));
+
+    if (map == NULL) {
+        ESP_LOGE(TAG, "Out of memory allocating handle map");
+        return NULL;
+    }
+
+    map->len    = handle_buffer_len;
+    map->offset = handle_space_offset;
+
+    // Initialize the internal mapping table with
+    // length * the size of a characteristic config pointer.
+    //
+    // NOTE: Zeroed so that non-value handles map to NULL.
+    map->data = neil_ble_gatts_mem_calloc(NEIL_BLE_GATTS_MEM_HANDLE_MAP, map->len,
+                                          sizeof(neil_ble_gatts_cfg_chr_t *));
+
+    if (map->data == NULL) {
+        ESP_LOGE(TAG, "Out of memory allocating handle map entries");
+        neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_HANDLE_MAP, map);
+        return NULL;
+    }
+
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
+        // --- Service declaration
+        attr_idx++;
+
+        // --- Acquire Service Config
+        neil_ble_gatts_cfg_svc_t *svc_cfg = (dev_cfg->svc_tab + svc_idx);
+
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+
+            neil_ble_gatts_cfg_chr_t *chr_cfg = (svc_cfg->chr_tab + chr_idx);
+
+            *(map->data + attr_idx + attr_val_offset) = chr_cfg;
+
+            attr_idx += neil_ble_gatts_attr_db_chr_len(chr_cfg);
+        }
+    }
+
+    return map;
+}
+
+void neil_ble_gatts_handle_map_rebase(neil_ble_gatts_handle_map_t *map,
+                                      uint16_t *handle_buffer) {
+    map->offset = handle_buffer[0];
+}
+
+// -------------------------------------------------------------
+// Lookup
+// -------------------------------------------------------------
+
+neil_ble_gatts_cfg_chr_t *
+neil_ble_gatts_handle_map_get(neil_ble_gatts_handle_map_t *map, uint16_t handle) {
+
+    if (map == NULL || handle < map->offset ||
+        (size_t)(handle - map->offset) >= map->len) {
+        return NULL;
+    }
+
+    return *(map->data + (handle - map->offset));
+}
+
+neil_ble_gatts_cfg_chr_t *
+neil_ble_gatts_handle_map_get_cccd(neil_ble_gatts_handle_map_t *map, uint16_t handle) {
+
+    // --- Client configuration directly follows the value attribute
+    neil_ble_gatts_cfg_chr_t *chr_cfg = neil_ble_gatts_handle_map_get(map, handle - 1);
+
+    return chr_cfg != NULL && chr_cfg->notify ? chr_cfg : NULL;
+}
+
+uint16_t neil_ble_gatts_handle_map_find(neil_ble_gatts_handle_map_t *map,
+                                        const neil_ble_gatts_cfg_chr_t *chr_cfg) {
+
+    if (map == NULL) {
+        return 0;
+    }
+
+    for (size_t idx = 0; idx < map->len; idx++) {
+        if (map->data[idx] == chr_cfg) {
+            return map->offset + idx;
+        }
+    }
+
+    return 0;
+}
+
+// -------------------------------------------------------------
+// Termination
+// -------------------------------------------------------------
+
+void neil_ble_gatts_handle_map_deinit(neil_ble_gatts_handle_map_t *map) {
+
+    if (map == NULL) {
+        return;
+    }
+
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_HANDLE_MAP, map->data);
+    map->data = NULL;
+    map->len  = 0;
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_HANDLE_MAP, map);
+}
+
+// -------------------------------------------------------------
+// Footprint
+// -------------------------------------------------------------
+
+size_t neil_ble_gatts_handle_map_footprint(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+    return sizeof(neil_ble_gatts_handle_map_t) +
+           neil_ble_gatts_attr_db_len(dev_cfg) * sizeof(neil_ble_gatts_cfg_chr_t *);
+}
@@ -0,0 +1,98 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_handle_map.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Characteristic-Handle-to-Configuration Map API.
+
+#ifndef neil_ble_gatts_HANDLE_MAP_H_
+#define neil_ble_gatts_HANDLE_MAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "neil_ble_gatts_cfg.h"
+
+// -------------------------------------------------------------
+// Domain Structures
+// -------------------------------------------------------------
+
+/**
+ * @brief       Primitive handle-to-char_config mapping structure.
+ *
+ *              Used to relate handles on read/write requests to their
+ *              appropriate configuration structure.
+ */
+typedef struct {
+    size_t len;
+    uint16_t offset;
+    neil_ble_gatts_cfg_chr_t **data;
+} neil_ble_gatts_handle_map_t;
+
+/// Number of heap allocations made by `neil_ble_gatts_handle_map_init`.
+#define NEIL_BLE_GATTS_HANDLE_MAP_ALLOC_COUNT 2
+
+// -------------------------------------------------------------
+// Procedures
+// -------------------------------------------------------------
+
+/**
+ * @brief       Allocate and configure a new handle-to-config map.
+ *
+ * @return      NULL on allocation failure.
+ */
+neil_ble_gatts_handle_map_t *
+neil_ble_gatts_handle_map_init(const neil_ble_gatts_cfg_dev_t *dev_cfg,
+                               uint16_t *handle_buffer, uint16_t handle_buffer_len);
+
+/**
+ * @brief       Move an existing map onto a new handle space.
+ *
+ *              Entries are stored relative to the first handle, so a table
+ *              re-created from the same configuration only needs its offset
+ *              updated.
+ */
+void neil_ble_gatts_handle_map_rebase(neil_ble_gatts_handle_map_t *map,
+                                      uint16_t *handle_buffer);
+
+/**
+ * @brief       Get configuration by handle from a map.
+ *
+ * @return      NULL if the handle does not belong to a characteristic value.
+ */
+neil_ble_gatts_cfg_chr_t *
+neil_ble_gatts_handle_map_get(neil_ble_gatts_handle_map_t *map, uint16_t handle);
+
+/**
+ * @brief       Get the notifying characteristic whose client configuration
+ *              descriptor is at `handle`.
+ *
+ * @return      NULL if the handle is not a client configuration descriptor.
+ */
+neil_ble_gatts_cfg_chr_t *
+neil_ble_gatts_handle_map_get_cccd(neil_ble_gatts_handle_map_t *map, uint16_t handle);
+
+/**
+ * @brief       Get the value handle of a characteristic configuration.
+ *
+ * @return      0 if the characteristic is not part of the map.
+ */
+uint16_t neil_ble_gatts_handle_map_find(neil_ble_gatts_handle_map_t *map,
+                                        const neil_ble_gatts_cfg_chr_t *chr_cfg);
+
+/**
+ * @brief       Tear down a handle-to-config map.
+ *
+ *              NULL is accepted and ignored.
+ */
+void neil_ble_gatts_handle_map_deinit(neil_ble_gatts_handle_map_t *map);
+
+/**
+ * @brief       Heap bytes a map for `dev_cfg` will hold.
+ */
+size_t neil_ble_gatts_handle_map_footprint(const neil_ble_gatts_cfg_dev_t *dev_cfg);
+
+#endif // neil_ble_gatts_HANDLE_MAP_H_
@@ -0,0 +1,500 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_history.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Time-Series History implementation.
+///
+///             Requests arrive on the BTC task; ranges are encoded and queued
+///             by a dedicated task so streaming can wait on the notification
+///             queue without blocking Bluetooth events.
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "neil_ble_gatts.h"
+#include "neil_ble_gatts_conn.h"
+#include "neil_ble_gatts_history.h"
+#include "neil_ble_gatts_mem.h"
+#include "neil_ble_gatts_notify.h"
+#include "neil_ble_gatts_stack.h"
+
+static const char *const TAG = "neil_ble_gatts_history";
+
+#if CONFIG_NEIL_BLE_GATTS_HISTORY
+
+/// Largest frame, one notification at the largest MTU.
+#define FRAME_MAX (ESP_GATT_MAX_MTU_SIZE - 3)
+
+/// Frame header: series, count, seq, time.
+#define FRAME_HDR 10
+
+/// Largest encoding of one sample (two 5-byte varints).
+#define SAMPLE_MAX 10
+
+/// Samples copied out of a ring per hold of the lock.
+#define COPY_CHUNK 16
+
+/// Poll interval while the notification queue is full.
+#define STREAM_POLL_TICKS 1
+
+// -------------------------------------------------------------
+// State
+// -------------------------------------------------------------
+
+typedef struct {
+    uint32_t time_ms;
+    int32_t value;
+} sample_t;
+
+/**
+ * @brief       Samples of one series, oldest overwritten first.
+ */
+typedef struct {
+    sample_t *samples;
+    uint16_t head;     ///< Next slot to write.
+    uint16_t count;    ///< Valid samples.
+    uint32_t next_seq; ///< Sequence number of the next sample.
+} ring_t;
+
+static struct {
+    sample_t *pool; ///< Backing store of every ring.
+    ring_t rings[NEIL_BLE_GATTS_HISTORY_SERIES_MAX];
+    uint8_t series_count;
+    uint16_t capacity;
+    uint8_t svc_idx;
+    uint8_t chr_idx;
+} hist;
+
+/**
+ * @brief       Latest range request, consumed by the stream task.
+ */
+static struct {
+    uint32_t gen;     ///< Bumped per request, aborts the range being streamed.
+    uint16_t conn_id; ///< Requester, the only connection the range is sent to.
+    uint8_t series;
+    uint8_t mode;
+    uint32_t from;
+    uint32_t to;
+} req;
+
+static TaskHandle_t stream_task_handle = NULL;
+
+// --- Samples are appended from application tasks and read by the stream task.
+static portMUX_TYPE hist_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// -------------------------------------------------------------
+// Encoding
+// -------------------------------------------------------------
+
+static uint8_t varint_put(uint8_t *out, uint32_t value) {
+    uint8_t len = 0;
+    while (value >= 0x80) {
+        out[len++] = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    out[len++] = (uint8_t)value;
+    return len;
+}
+
+static uint32_t zigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static void u32_put(uint8_t *out, uint32_t value) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = value >> 24;
+}
+
+// -------------------------------------------------------------
+// Ring Access (call with the lock held)
+// -------------------------------------------------------------
+
+static uint32_t ring_oldest(const ring_t *ring) { return ring->next_seq - ring->count; }
+
+static const sample_t *ring_at(const ring_t *ring, uint32_t seq) {
+    const uint32_t age = ring->next_seq - seq; // 1 for the newest sample
+    return ring->samples + (ring->head + hist.capacity - age) % hist.capacity;
+}
+
+/**
+ * @brief       First sequence number whose sample time is at least `time_ms`
+ *              (`next_seq` if none).
+ *
+ *              Sample times never decrease, so the ring is searched by
+ *              bisection.
+ */
+static uint32_t ring_seq_at(const ring_t *ring, uint32_t time_ms) {
+    uint32_t low  = ring_oldest(ring);
+    uint32_t high = ring->next_seq;
+
+    while (low < high) {
+        const uint32_t mid = low + (high - low) / 2;
+        if (ring_at(ring, mid)->time_ms < time_ms) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+// -------------------------------------------------------------
+// Ring Copies
+// -------------------------------------------------------------
+
+/**
+ * @brief       Copy up to `max` consecutive samples from `seq` up to `last`.
+ *
+ * @return      Samples copied, 0 if none is left, the ring is gone or `seq`
+ *              was overwritten.
+ */
+static uint8_t ring_copy(uint8_t series, uint32_t seq, uint32_t last, sample_t *out,
+                         uint8_t max) {
+
+    uint8_t count = 0;
+
+    portENTER_CRITICAL(&hist_lock);
+
+    const ring_t *ring = hist.rings + series;
+
+    if (hist.pool != NULL && ring->count > 0 &&
+        (int32_t)(seq - ring_oldest(ring)) >= 0) {
+        const uint32_t newest = ring->next_seq - 1;
+        const uint32_t end    = last < newest ? last : newest;
+
+        while (count < max && seq + count <= end) {
+            out[count] = *ring_at(ring, seq + count);
+            count++;
+        }
+    }
+
+    portEXIT_CRITICAL(&hist_lock);
+
+    return count;
+}
+
+// -------------------------------------------------------------
+// Frames
+// -------------------------------------------------------------
+
+/**
+ * @brief       Encode samples from `*seq` up to `last` into one frame.
+ *
+ *              Samples are copied out a chunk at a time, so the lock (which
+ *              masks interrupts) is never held while encoding.
+ *
+ * @return      Frame length, 0 if no sample is left (or the ring is gone).
+ */
+static uint16_t frame_encode(uint8_t series, uint32_t *seq, uint32_t last,
+                             uint8_t *frame, uint16_t cap) {
+
+    // --- Overwritten samples are skipped
+    portENTER_CRITICAL(&hist_lock);
+    const ring_t *ring = hist.rings + series;
+    if (hist.pool != NULL && (int32_t)(*seq - ring_oldest(ring)) < 0) {
+        *seq = ring_oldest(ring);
+    }
+    portEXIT_CRITICAL(&hist_lock);
+
+    sample_t chunk[COPY_CHUNK];
+    sample_t prev = {0};
+    uint8_t count = 0;
+    uint16_t len  = FRAME_HDR;
+    bool full     = false;
+
+    while (!full && count < UINT8_MAX) {
+        const uint8_t max =
+            UINT8_MAX - count < COPY_CHUNK ? UINT8_MAX - count : COPY_CHUNK;
+
+        // --- Ends the frame once caught up, or if overwritten meanwhile
+        const uint8_t copied = ring_copy(series, *seq, last, chunk, max);
+
+        if (copied == 0) {
+            break;
+        }
+
+        for (uint8_t idx = 0; idx < copied; idx++) {
+            const sample_t *sample = chunk + idx;
+
+            if (len + SAMPLE_MAX > cap) {
+                full = true;
+                break;
+            }
+
+            if (count == 0) {
+                u32_put(frame + 2, *seq);
+                u32_put(frame + 6, sample->time_ms);
+                len += varint_put(frame + len, zigzag(sample->value));
+            } else {
+                const uint32_t delta = (uint32_t)sample->value - (uint32_t)prev.value;
+
+                len += varint_put(frame + len, sample->time_ms - prev.time_ms);
+                len += varint_put(frame + len, zigzag((int32_t)delta));
+            }
+
+            prev = *sample;
+            (*seq)++;
+            count++;
+        }
+    }
+
+    frame[0] = series;
+    frame[1] = count;
+
+    return count ? len : 0;
+}
+
+// -------------------------------------------------------------
+// Streaming
+// -------------------------------------------------------------
+
+/**
+ * @brief       Wait for room in the notification queue of the requester.
+ *
+ * @return      false if the request was replaced or the requester left
+ *              meanwhile.
+ */
+static bool stream_wait(uint32_t gen, uint16_t conn_id) {
+    neil_ble_gatts_notify_stats_t stats;
+
+    for (;;) {
+        if (gen != req.gen ||
+            neil_ble_gatts_notify_get_stats(conn_id, &stats) != ESP_OK) {
+            return false;
+        }
+        if (stats.depth < NEIL_BLE_GATTS_NOTIFY_QUEUE_LEN - 1) {
+            return true;
+        }
+        vTaskDelay(STREAM_POLL_TICKS);
+    }
+}
+
+static void stream_range(uint32_t gen, uint16_t conn_id, uint8_t series, uint8_t mode,
+                         uint32_t from, uint32_t to) {
+
+    uint8_t frame[FRAME_MAX];
+    bool empty = false;
+
+    // --- Resolve the range to sequence numbers
+    portENTER_CRITICAL(&hist_lock);
+    if (hist.pool != NULL && mode == NEIL_BLE_GATTS_HISTORY_BY_TIME) {
+        const ring_t *ring = hist.rings + series;
+        from               = ring_seq_at(ring, from);
+
+        if (to != NEIL_BLE_GATTS_HISTORY_LATEST) {
+            const uint32_t after = ring_seq_at(ring, to + 1);
+
+            // --- Ends before the oldest sample: `after - 1` could wrap to
+            //     NEIL_BLE_GATTS_HISTORY_LATEST and stream the whole ring
+            empty = after == ring_oldest(ring);
+            to    = after - 1;
+        }
+    }
+    portEXIT_CRITICAL(&hist_lock);
+
+    uint32_t seq = from;
+
+    while (stream_wait(gen, conn_id)) {
+        const uint16_t mtu = neil_ble_gatts_conn_mtu(conn_id);
+
+        if (mtu == 0) {
+            return;
+        }
+
+        // Frames fit the requester's MTU (1-byte opcode, 2-byte handle)
+        const uint16_t cap = mtu - 3 < FRAME_MAX ? mtu - 3 : FRAME_MAX;
+
+        uint16_t len = empty ? 0 : frame_encode(series, &seq, to, frame, cap);
+
+        if (len == 0) {
+            // --- End frame
+            frame[0] = series;
+            frame[1] = 0;
+            u32_put(frame + 2, seq);
+            neil_ble_gatts_notify_conn(conn_id, hist.svc_idx, hist.chr_idx, frame, 6);
+            return;
+        }
+
+        const esp_err_t ret =
+            neil_ble_gatts_notify_conn(conn_id, hist.svc_idx, hist.chr_idx, frame, len);
+
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "Range of series %d abandoned at seq %u", series,
+                     (unsigned)seq);
+            return;
+        }
+    }
+}
+
+static void stream_task(void *arg) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        portENTER_CRITICAL(&hist_lock);
+        const uint32_t gen     = req.gen;
+        const uint16_t conn_id = req.conn_id;
+        const uint8_t series   = req.series;
+        const uint8_t mode     = req.mode;
+        const uint32_t from    = req.from;
+        const uint32_t to      = req.to;
+        portEXIT_CRITICAL(&hist_lock);
+
+        stream_range(gen, conn_id, series, mode, from, to);
+    }
+}
+
+// -------------------------------------------------------------
+// Control
+// -------------------------------------------------------------
+
+esp_err_t neil_ble_gatts_history_start(uint8_t svc_idx, uint8_t chr_idx,
+                                       uint8_t series_count, uint16_t capacity) {
+
+    if (series_count == 0 || series_count > NEIL_BLE_GATTS_HISTORY_SERIES_MAX ||
+        capacity == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (hist.pool != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    sample_t *pool = neil_ble_gatts_mem_calloc(NEIL_BLE_GATTS_MEM_HISTORY,
+                                               (size_t)series_count * capacity,
+                                               sizeof(sample_t));
+
+    if (pool == NULL) {
+        ESP_LOGE(TAG, "Out of memory allocating %u samples", series_count * capacity);
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (stream_task_handle == NULL &&
+        xTaskCreate(stream_task, "neil_history", NEIL_BLE_GATTS_HISTORY_TASK_STACK,
+                    NULL, NEIL_BLE_GATTS_HISTORY_TASK_PRIO,
+                    &stream_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Unable to create stream task");
+        neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_HISTORY, pool);
+        return ESP_ERR_NO_MEM;
+    }
+
+    portENTER_CRITICAL(&hist_lock);
+    memset(hist.rings, 0, sizeof(hist.rings));
+    for (uint8_t series = 0; series < series_count; series++) {
+        hist.rings[series].samples = pool + series * capacity;
+    }
+    hist.series_count = series_count;
+    hist.capacity     = capacity;
+    hist.svc_idx      = svc_idx;
+    hist.chr_idx      = chr_idx;
+    hist.pool         = pool;
+    portEXIT_CRITICAL(&hist_lock);
+
+    return ESP_OK;
+}
+
+void neil_ble_gatts_history_stop(void) {
+    portENTER_CRITICAL(&hist_lock);
+    sample_t *pool    = hist.pool;
+    hist.pool         = NULL;
+    hist.series_count = 0;
+    req.gen++;
+    portEXIT_CRITICAL(&hist_lock);
+
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_HISTORY, pool);
+}
+
+esp_err_t neil_ble_gatts_history_append(uint8_t series, int32_t value) {
+
+    const uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+
+    esp_err_t ret = ESP_OK;
+
+    portENTER_CRITICAL(&hist_lock);
+
+    if (hist.pool == NULL) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else if (series >= hist.series_count) {
+        ret = ESP_ERR_INVALID_ARG;
+    } else {
+        ring_t *ring = hist.rings + series;
+
+        ring->samples[ring->head] = (sample_t){.time_ms = now_ms, .value = value};
+        ring->head                = (ring->head + 1) % hist.capacity;
+        ring->next_seq++;
+
+        if (ring->count < hist.capacity) {
+            ring->count++;
+        }
+    }
+
+    portEXIT_CRITICAL(&hist_lock);
+
+    return ret;
+}
+
+void neil_ble_gatts_history_request(uint8_t *data, uint16_t len) {
+
+    if (len < 10) {
+        ESP_LOGW(TAG, "Malformed history request (%d bytes)", len);
+        return;
+    }
+
+    const uint8_t series = data[0];
+    const uint8_t mode   = data[1];
+
+    if (series >= hist.series_count || mode > NEIL_BLE_GATTS_HISTORY_BY_TIME) {
+        ESP_LOGW(TAG, "Invalid history request (series %d, mode %d)", series, mode);
+        return;
+    }
+
+    const uint16_t conn_id = neil_ble_gatts_conn_writer();
+
+    if (conn_id == NEIL_BLE_GATTS_CONN_NONE) {
+        ESP_LOGW(TAG, "History request outside a client write ignored");
+        return;
+    }
+
+    portENTER_CRITICAL(&hist_lock);
+    req.gen++;
+    req.conn_id = conn_id;
+    req.series  = series;
+    req.mode    = mode;
+    req.from    = data[2] | data[3] << 8 | data[4] << 16 | (uint32_t)data[5] << 24;
+    req.to      = data[6] | data[7] << 8 | data[8] << 16 | (uint32_t)data[9] << 24;
+    portEXIT_CRITICAL(&hist_lock);
+
+    xTaskNotifyGive(stream_task_handle);
+}
+
+#else
+
+// NOTE: Disabled in menuconfig (CONFIG_NEIL_BLE_GATTS_HISTORY), the rings
+//       cannot be started.
+
+esp_err_t neil_ble_gatts_history_start(uint8_t svc_idx, uint8_t chr_idx,
+                                       uint8_t series_count, uint16_t capacity) {
+    ESP_LOGE(TAG, "History started, but disabled in menuconfig");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void neil_ble_gatts_history_stop(void) {}
+
+esp_err_t neil_ble_gatts_history_append(uint8_t series, int32_t value) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void neil_ble_gatts_history_request(uint8_t *data, uint16_t len) {}
+
+#endif
@@ -0,0 +1,119 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_history.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Time-Series History API.
+///
+///             The application appends samples of one or more series to RAM
+///             rings. A client that was away requests a sequence or time range
+///             and receives it as delta-compressed notifications, instead of
+///             reconstructing it from current values.
+///
+///             The history is served through two characteristics declared by
+///             the application:
+///
+///                 request   write,  `on_write = neil_ble_gatts_history_request`
+///                 data      notify, passed to `neil_ble_gatts_history_start`
+///
+///             Frames are notified to the client that wrote the request alone,
+///             once subscribed to the data characteristic.
+
+#ifndef neil_ble_gatts_HISTORY_H_
+#define neil_ble_gatts_HISTORY_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Maximum number of series.
+#define NEIL_BLE_GATTS_HISTORY_SERIES_MAX 8
+
+/// Stack size of the task encoding requested ranges.
+#define NEIL_BLE_GATTS_HISTORY_TASK_STACK 3072
+
+/// Priority of the task encoding requested ranges.
+#define NEIL_BLE_GATTS_HISTORY_TASK_PRIO 5
+
+// -------------------------------------------------------------
+// Wire Format
+// -------------------------------------------------------------
+//
+// Request (write, little-endian):
+//
+//     [series u8][mode u8][from u32][to u32]
+//
+//     mode: NEIL_BLE_GATTS_HISTORY_BY_SEQ  - from/to are sequence numbers
+//           NEIL_BLE_GATTS_HISTORY_BY_TIME - from/to are sample times (ms)
+//     to:   inclusive, 0xFFFFFFFF for the newest sample
+//
+// Data frame (notification):
+//
+//     [series u8][count u8][seq u32][time u32][value zigzag varint]
+//     then count - 1 times:
+//     [time delta varint][value delta zigzag varint]
+//
+//     Samples of a frame have consecutive sequence numbers starting at `seq`.
+//     A requested range older than the ring starts at the oldest sample kept.
+//
+// End frame (notification), after the last data frame:
+//
+//     [series u8][0][next seq u32]
+
+/// Request mode: range of sequence numbers.
+#define NEIL_BLE_GATTS_HISTORY_BY_SEQ 0
+
+/// Request mode: range of sample times.
+#define NEIL_BLE_GATTS_HISTORY_BY_TIME 1
+
+/// Open end of a requested range.
+#define NEIL_BLE_GATTS_HISTORY_LATEST 0xFFFFFFFFu
+
+// -------------------------------------------------------------
+// Procedures
+// -------------------------------------------------------------
+
+/**
+ * @brief       Allocate `series_count` rings of `capacity` samples and serve
+ *              them through the notifying characteristic `chr_idx` of
+ *              service `svc_idx`.
+ *
+ *              May be called before `neil_ble_gatts_start`, so samples are
+ *              kept while the server is down.
+ *
+ * @return      ESP_ERR_NOT_SUPPORTED if the history is disabled in
+ *              menuconfig.
+ */
+esp_err_t neil_ble_gatts_history_start(uint8_t svc_idx, uint8_t chr_idx,
+                                       uint8_t series_count, uint16_t capacity);
+
+/**
+ * @brief       Release the rings, abandoning a range being streamed.
+ */
+void neil_ble_gatts_history_stop(void);
+
+/**
+ * @brief       Append a sample, timestamped now, overwriting the oldest once
+ *              full.
+ *
+ *              May be called from any task.
+ */
+esp_err_t neil_ble_gatts_history_append(uint8_t series, int32_t value);
+
+/**
+ * @brief       Write callback of the request characteristic.
+ *
+ *              A new request replaces one still being streamed, whichever
+ *              client wrote it. Writes that do not come from a client (e.g.
+ *              restored by persistence) are ignored.
+ */
+void neil_ble_gatts_history_request(uint8_t *data, uint16_t len);
+
+#endif // neil_ble_gatts_HISTORY_H_
@@ -0,0 +1,203 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_journal.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Change Journal implementation.
+///
+///             Versions live in the characteristic configurations, so the
+///             journal holds no memory of its own: a read walks the device
+///             configuration and reports every version newer than requested.
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+
+#include "neil_ble_gatts_conn.h"
+#include "neil_ble_gatts_journal.h"
+
+static const char *const TAG = "neil_ble_gatts_journal";
+
+#if CONFIG_NEIL_BLE_GATTS_JOURNAL
+
+// -------------------------------------------------------------
+// State
+// -------------------------------------------------------------
+
+// --- Global version, 0 until the first change.
+static uint32_t journal_version = 0;
+
+// --- Boot identifier (never 0, drawn on first use).
+static uint32_t journal_epoch = 0;
+
+// --- Bumped from application tasks and the BTC task alike.
+static portMUX_TYPE journal_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// -------------------------------------------------------------
+// Encoding
+// -------------------------------------------------------------
+
+static void u32_put(uint8_t *out, uint32_t value) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = value >> 24;
+}
+
+// -------------------------------------------------------------
+// Versions
+// -------------------------------------------------------------
+
+void neil_ble_gatts_journal_bump(neil_ble_gatts_cfg_chr_t *chr_cfg) {
+    portENTER_CRITICAL(&journal_lock);
+    chr_cfg->version = ++journal_version;
+    portEXIT_CRITICAL(&journal_lock);
+}
+
+uint32_t neil_ble_gatts_journal_version(void) {
+    portENTER_CRITICAL(&journal_lock);
+    const uint32_t version = journal_version;
+    portEXIT_CRITICAL(&journal_lock);
+    return version;
+}
+
+static uint32_t epoch_get(void) {
+
+    // --- Drawn outside the lock, the first caller wins
+    const uint32_t drawn = esp_random() | 1;
+
+    portENTER_CRITICAL(&journal_lock);
+    if (journal_epoch == 0) {
+        journal_epoch = drawn;
+    }
+    const uint32_t epoch = journal_epoch;
+    portEXIT_CRITICAL(&journal_lock);
+
+    return epoch;
+}
+
+// -------------------------------------------------------------
+// Requests
+// -------------------------------------------------------------
+
+esp_err_t neil_ble_gatts_journal_check(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+    return ESP_OK;
+}
+
+esp_gatt_status_t neil_ble_gatts_journal_request(uint16_t conn_id, const uint8_t *data,
+                                                 uint16_t len) {
+
+    if (len != sizeof(uint32_t)) {
+        ESP_LOGW(TAG, "Request of %d bytes ignored", len);
+        return ESP_GATT_INVALID_ATTR_LEN;
+    }
+
+    neil_ble_gatts_conn_t *conn = neil_ble_gatts_conn_get(conn_id);
+
+    if (conn == NULL) {
+        return ESP_GATT_ERROR;
+    }
+
+    conn->journal_since =
+        data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+
+    return ESP_GATT_OK;
+}
+
+uint16_t neil_ble_gatts_journal_read(const neil_ble_gatts_cfg_dev_t *dev_cfg,
+                                     uint16_t conn_id, uint8_t *buf, uint16_t size) {
+
+    if (size < NEIL_BLE_GATTS_JOURNAL_HDR_LEN) {
+        ESP_LOGE(TAG, "Response buffer of %d bytes too small", size);
+        return 0;
+    }
+
+    const neil_ble_gatts_conn_t *conn = neil_ble_gatts_conn_get(conn_id);
+    const uint32_t since              = conn != NULL ? conn->journal_since : 0;
+
+    u32_put(buf, epoch_get());
+    u32_put(buf + 4, neil_ble_gatts_journal_version());
+
+    uint8_t count = 0;
+    uint16_t pos  = NEIL_BLE_GATTS_JOURNAL_HDR_LEN;
+    bool overflow = false;
+
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len && !overflow; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+            const neil_ble_gatts_cfg_chr_t *chr_cfg = svc_cfg->chr_tab + chr_idx;
+
+            // --- Aligned word, read without the lock
+            const uint32_t version = chr_cfg->version;
+
+            if (chr_cfg->journal || version <= since) {
+                continue;
+            }
+
+            if (pos + NEIL_BLE_GATTS_JOURNAL_REC_LEN > size ||
+                count == NEIL_BLE_GATTS_JOURNAL_OVERFLOW - 1) {
+                overflow = true;
+                break;
+            }
+
+            buf[pos]     = svc_idx;
+            buf[pos + 1] = chr_idx;
+            u32_put(buf + pos + 2, version);
+
+            pos += NEIL_BLE_GATTS_JOURNAL_REC_LEN;
+            count++;
+        }
+    }
+
+    if (overflow) {
+        buf[8] = NEIL_BLE_GATTS_JOURNAL_OVERFLOW;
+        return NEIL_BLE_GATTS_JOURNAL_HDR_LEN;
+    }
+
+    buf[8] = count;
+
+    return pos;
+}
+
+#else
+
+// NOTE: Disabled in menuconfig (CONFIG_NEIL_BLE_GATTS_JOURNAL), configurations
+//       with a journal characteristic are rejected. Versions are not kept.
+
+void neil_ble_gatts_journal_bump(neil_ble_gatts_cfg_chr_t *chr_cfg) {}
+
+uint32_t neil_ble_gatts_journal_version(void) { return 0; }
+
+esp_err_t neil_ble_gatts_journal_check(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+            if (svc_cfg->chr_tab[chr_idx].journal) {
+                ESP_LOGE(TAG, "`journal` set, but disabled in menuconfig");
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+        }
+    }
+
+    return ESP_OK;
+}
+
+esp_gatt_status_t neil_ble_gatts_journal_request(uint16_t conn_id, const uint8_t *data,
+                                                 uint16_t len) {
+    return ESP_GATT_REQ_NOT_SUPPORTED;
+}
+
+uint16_t neil_ble_gatts_journal_read(const neil_ble_gatts_cfg_dev_t *dev_cfg,
+                                     uint16_t conn_id, uint8_t *buf, uint16_t size) {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,102 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_journal.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Change Journal API.
+///
+///             Every characteristic carries a version, taken from one global
+///             counter each time it is written by a client, written through a
+///             command pipe, notified, or reported updated by the application
+///             (`neil_ble_gatts_journal_bump`).
+///
+///             A characteristic with `journal` set lets a reconnecting client
+///             find what changed while it was away: it writes the global
+///             version it last saw, then reads the characteristics changed
+///             since, and re-reads only those.
+
+#ifndef neil_ble_gatts_JOURNAL_H_
+#define neil_ble_gatts_JOURNAL_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "neil_ble_gatts_cfg.h"
+#include "neil_ble_gatts_stack.h"
+
+// -------------------------------------------------------------
+// Wire Format
+// -------------------------------------------------------------
+//
+// Request (write, little-endian):
+//
+//     [since u32]                  global version last seen by the client
+//
+// Response (read, little-endian):
+//
+//     [epoch u32][version u32][count u8]
+//     [svc_idx u8][chr_idx u8][version u32]       x count
+//
+// The epoch changes on every boot, when versions restart: a client holding
+// another epoch re-reads everything. `count` is
+// NEIL_BLE_GATTS_JOURNAL_OVERFLOW, with no records, if the changes do not fit
+// one value. Read the response right after the request; versions are kept per
+// connection.
+
+/// Response header length.
+#define NEIL_BLE_GATTS_JOURNAL_HDR_LEN 9
+
+/// Response record length.
+#define NEIL_BLE_GATTS_JOURNAL_REC_LEN 6
+
+/// Record count meaning "too many changes, re-read everything".
+#define NEIL_BLE_GATTS_JOURNAL_OVERFLOW 0xFF
+
+// -------------------------------------------------------------
+// Procedures (public)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Record an application-side update of a characteristic.
+ *
+ *              Characteristics notified through `neil_ble_gatts_notify` are
+ *              recorded already. May be called from any task.
+ */
+void neil_ble_gatts_journal_bump(neil_ble_gatts_cfg_chr_t *chr_cfg);
+
+/**
+ * @brief       Current global version.
+ */
+uint32_t neil_ble_gatts_journal_version(void);
+
+// -------------------------------------------------------------
+// Procedures (component-internal)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Check that the journals of a device configuration can be served.
+ *
+ * @return      ESP_ERR_NOT_SUPPORTED if a characteristic sets `journal` while
+ *              the journal is disabled in menuconfig.
+ */
+esp_err_t neil_ble_gatts_journal_check(const neil_ble_gatts_cfg_dev_t *dev_cfg);
+
+/**
+ * @brief       Apply a request written to the journal by a connection.
+ */
+esp_gatt_status_t neil_ble_gatts_journal_request(uint16_t conn_id, const uint8_t *data,
+                                                 uint16_t len);
+
+/**
+ * @brief       Build the response of the journal for a connection.
+ *
+ * @return      Bytes written to `buf`, at most `size`.
+ */
+uint16_t neil_ble_gatts_journal_read(const neil_ble_gatts_cfg_dev_t *dev_cfg,
+                                     uint16_t conn_id, uint8_t *buf, uint16_t size);
+
+#endif // neil_ble_gatts_JOURNAL_H_
@@ -0,0 +1,472 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_l2cap.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      L2CAP Connection-Oriented Channel implementation (NimBLE).
+///
+///             Channel events run on the NimBLE host task, sends on
+///             application tasks. A mutex guards the channel table and is held
+///             across `ble_l2cap_send`, so a channel is never used after its
+///             disconnect event returned. Each channel has one SDU in flight:
+///             a send held for credits keeps the channel's semaphore until the
+///             host reports it unstalled.
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "host/ble_hs.h"
+
+#include "neil_ble_gatts_l2cap.h"
+
+static const char *const TAG = "neil_ble_gatts_l2cap";
+
+// -------------------------------------------------------------
+// State
+// -------------------------------------------------------------
+
+typedef struct {
+    struct ble_l2cap_chan *chan; ///< NULL if the slot is free.
+    uint16_t conn_id;
+    bool open; ///< Connected, accepted channels are not yet.
+
+    // --- Given while no SDU of the channel waits for credits
+    SemaphoreHandle_t tx_ready;
+
+    neil_ble_gatts_l2cap_stats_t stats;
+} chan_slot_t;
+
+// --- One slot kept with channels disabled, for a valid table
+#if NEIL_BLE_GATTS_L2CAP_CHAN_MAX > 0
+#define SLOT_COUNT NEIL_BLE_GATTS_L2CAP_CHAN_MAX
+#else
+#define SLOT_COUNT 1
+#endif
+
+static chan_slot_t slots[SLOT_COUNT];
+
+static SemaphoreHandle_t chan_mutex = NULL;
+
+static const neil_ble_gatts_cfg_l2cap_t *l2cap_cfg = NULL;
+
+// -------------------------------------------------------------
+// Channel Table (call with the mutex held)
+// -------------------------------------------------------------
+
+static chan_slot_t *slot_by_chan(const struct ble_l2cap_chan *chan) {
+    for (uint8_t idx = 0; idx < SLOT_COUNT; idx++) {
+        if (slots[idx].chan == chan) {
+            return slots + idx;
+        }
+    }
+    return NULL;
+}
+
+static chan_slot_t *slot_by_conn(uint16_t conn_id) {
+    for (uint8_t idx = 0; idx < SLOT_COUNT; idx++) {
+        if (slots[idx].chan != NULL && slots[idx].open &&
+            slots[idx].conn_id == conn_id) {
+            return slots + idx;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief       Free a slot and wake a sender blocked on it.
+ */
+static void slot_release(chan_slot_t *slot) {
+    slot->chan = NULL;
+    slot->open = false;
+    xSemaphoreGive(slot->tx_ready);
+}
+
+/**
+ * @brief       Lend the host a buffer for the next SDU, which also grants the
+ *              peer credits.
+ */
+static void slot_recv_ready(chan_slot_t *slot) {
+    struct os_mbuf *rx = os_msys_get_pkt(0, 0);
+
+    if (rx == NULL || ble_l2cap_recv_ready(slot->chan, rx) != 0) {
+        if (rx != NULL) {
+            os_mbuf_free_chain(rx);
+        }
+        slot->stats.rx_starve++;
+        ESP_LOGE(TAG, "No receive buffer, connection %d stalls", slot->conn_id);
+    }
+}
+
+// -------------------------------------------------------------
+// Channel Events (NimBLE host task)
+// -------------------------------------------------------------
+
+static int on_accept(struct ble_l2cap_event *event) {
+    chan_slot_t *slot = slot_by_chan(NULL);
+
+    if (slot == NULL) {
+        ESP_LOGW(TAG, "Channel of connection %d refused, %d open",
+                 event->accept.conn_handle, NEIL_BLE_GATTS_L2CAP_CHAN_MAX);
+        return BLE_HS_ENOMEM;
+    }
+
+    memset(&slot->stats, 0, sizeof(slot->stats));
+    slot->chan    = event->accept.chan;
+    slot->conn_id = event->accept.conn_handle;
+    slot->open    = false;
+
+    slot_recv_ready(slot);
+
+    return 0;
+}
+
+static bool on_connect(struct ble_l2cap_event *event) {
+    chan_slot_t *slot = slot_by_chan(event->connect.chan);
+
+    if (slot == NULL) {
+        return false;
+    }
+
+    if (event->connect.status != 0) {
+        ESP_LOGW(TAG, "Channel of connection %d failed: %d",
+                 event->connect.conn_handle, event->connect.status);
+        slot_release(slot);
+        return false;
+    }
+
+    struct ble_l2cap_chan_info info;
+    if (ble_l2cap_get_chan_info(slot->chan, &info) == 0) {
+        slot->stats.tx_mtu = info.peer_coc_mtu;
+        slot->stats.rx_mtu = info.our_coc_mtu;
+    }
+
+    // --- Stale from an earlier channel of the slot
+    xSemaphoreTake(slot->tx_ready, 0);
+    xSemaphoreGive(slot->tx_ready);
+
+    slot->open = true;
+
+    ESP_LOGI(TAG, "Channel of connection %d open, SDU %d/%d bytes", slot->conn_id,
+             slot->stats.tx_mtu, slot->stats.rx_mtu);
+
+    return true;
+}
+
+static int l2cap_event(struct ble_l2cap_event *event, void *arg) {
+    int rc              = 0;
+    uint16_t conn_id    = 0;
+    bool state_changed  = false;
+    bool connected      = false;
+    struct os_mbuf *sdu = NULL;
+    chan_slot_t *slot   = NULL;
+
+    xSemaphoreTake(chan_mutex, portMAX_DELAY);
+
+    switch (event->type) {
+    case BLE_L2CAP_EVENT_COC_ACCEPT:
+        rc = on_accept(event);
+        break;
+
+    case BLE_L2CAP_EVENT_COC_CONNECTED:
+        conn_id       = event->connect.conn_handle;
+        connected     = on_connect(event);
+        state_changed = connected;
+        break;
+
+    case BLE_L2CAP_EVENT_COC_DISCONNECTED:
+        slot = slot_by_chan(event->disconnect.chan);
+        if (slot != NULL) {
+            conn_id       = slot->conn_id;
+            state_changed = slot->open;
+            slot_release(slot);
+        }
+        break;
+
+    case BLE_L2CAP_EVENT_COC_DATA_RECEIVED:
+        sdu  = event->receive.sdu_rx;
+        slot = slot_by_chan(event->receive.chan);
+        if (slot != NULL) {
+            conn_id = slot->conn_id;
+            slot->stats.rx_sdus++;
+            slot->stats.rx_bytes += OS_MBUF_PKTLEN(sdu);
+            slot_recv_ready(slot);
+        }
+        break;
+
+    case BLE_L2CAP_EVENT_COC_TX_UNSTALLED:
+        slot = slot_by_chan(event->tx_unstalled.chan);
+        if (slot != NULL) {
+            xSemaphoreGive(slot->tx_ready);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    xSemaphoreGive(chan_mutex);
+
+    // ---------------------------------
+    // Application Callbacks
+    // ---------------------------------
+
+    if (sdu != NULL) {
+        if (slot != NULL && l2cap_cfg->on_recv != NULL) {
+            l2cap_cfg->on_recv(conn_id, sdu);
+        } else {
+            os_mbuf_free_chain(sdu);
+        }
+    }
+
+    if (state_changed && l2cap_cfg->on_state != NULL) {
+        l2cap_cfg->on_state(conn_id, connected);
+    }
+
+    return rc;
+}
+
+// -------------------------------------------------------------
+// Buffers
+// -------------------------------------------------------------
+
+neil_ble_gatts_l2cap_buf_t *neil_ble_gatts_l2cap_buf_alloc(void) {
+    return os_msys_get_pkt(0, 0);
+}
+
+uint8_t *neil_ble_gatts_l2cap_buf_reserve(neil_ble_gatts_l2cap_buf_t *buf,
+                                          uint16_t len) {
+    return buf != NULL ? os_mbuf_extend(buf, len) : NULL;
+}
+
+esp_err_t neil_ble_gatts_l2cap_buf_append(neil_ble_gatts_l2cap_buf_t *buf,
+                                          const void *data, uint16_t len) {
+    if (buf == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return os_mbuf_append(buf, data, len) == 0 ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+uint16_t neil_ble_gatts_l2cap_buf_len(const neil_ble_gatts_l2cap_buf_t *buf) {
+    return buf != NULL ? OS_MBUF_PKTLEN(buf) : 0;
+}
+
+uint16_t neil_ble_gatts_l2cap_buf_copy(const neil_ble_gatts_l2cap_buf_t *buf,
+                                       uint16_t offset, void *dst, uint16_t len) {
+    const uint16_t total = neil_ble_gatts_l2cap_buf_len(buf);
+
+    if (offset >= total) {
+        return 0;
+    }
+
+    if (len > total - offset) {
+        len = total - offset;
+    }
+
+    return os_mbuf_copydata(buf, offset, len, dst) == 0 ? len : 0;
+}
+
+void neil_ble_gatts_l2cap_buf_free(neil_ble_gatts_l2cap_buf_t *buf) {
+    if (buf != NULL) {
+        os_mbuf_free_chain(buf);
+    }
+}
+
+// -------------------------------------------------------------
+// Channels
+// -------------------------------------------------------------
+
+esp_err_t neil_ble_gatts_l2cap_send(uint16_t conn_id, neil_ble_gatts_l2cap_buf_t *buf,
+                                    TickType_t timeout) {
+
+    if (buf == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (chan_mutex == NULL) {
+        os_mbuf_free_chain(buf);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // ---------------------------------
+    // Credits
+    // ---------------------------------
+
+    xSemaphoreTake(chan_mutex, portMAX_DELAY);
+    chan_slot_t *slot = slot_by_conn(conn_id);
+    xSemaphoreGive(chan_mutex);
+
+    if (slot == NULL) {
+        os_mbuf_free_chain(buf);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // --- Outside the mutex, the unstall event needs it
+    if (xSemaphoreTake(slot->tx_ready, timeout) != pdTRUE) {
+        os_mbuf_free_chain(buf);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    // ---------------------------------
+    // Send
+    // ---------------------------------
+
+    xSemaphoreTake(chan_mutex, portMAX_DELAY);
+
+    // --- Closed, or closed and reopened, while waiting
+    if (slot_by_conn(conn_id) != slot) {
+        xSemaphoreGive(chan_mutex);
+        os_mbuf_free_chain(buf);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const uint16_t len = OS_MBUF_PKTLEN(buf);
+
+    if (len > slot->stats.tx_mtu) {
+        xSemaphoreGive(slot->tx_ready);
+        xSemaphoreGive(chan_mutex);
+        os_mbuf_free_chain(buf);
+        ESP_LOGE(TAG, "SDU of %d bytes beyond peer MTU %d", len, slot->stats.tx_mtu);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp_err_t ret = ESP_OK;
+    const int rc  = ble_l2cap_send(slot->chan, buf);
+
+    if (rc == 0 || rc == BLE_HS_ESTALLED) {
+        slot->stats.tx_sdus++;
+        slot->stats.tx_bytes += len;
+    }
+
+    if (rc == BLE_HS_ESTALLED) {
+        // --- Accepted, the semaphore comes back with the peer's credits
+        slot->stats.stalls++;
+    } else {
+        if (rc != 0) {
+            ESP_LOGE(TAG, "Send on connection %d failed: %d", conn_id, rc);
+            ret = ESP_FAIL;
+        }
+
+        // --- Refused before the host took the buffer
+        if (rc == BLE_HS_EBUSY) {
+            os_mbuf_free_chain(buf);
+        }
+
+        xSemaphoreGive(slot->tx_ready);
+    }
+
+    xSemaphoreGive(chan_mutex);
+
+    return ret;
+}
+
+esp_err_t neil_ble_gatts_l2cap_close(uint16_t conn_id) {
+
+    if (chan_mutex == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(chan_mutex, portMAX_DELAY);
+    chan_slot_t *slot = slot_by_conn(conn_id);
+    const int rc      = slot != NULL ? ble_l2cap_disconnect(slot->chan) : 0;
+    xSemaphoreGive(chan_mutex);
+
+    if (slot == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    return rc == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t neil_ble_gatts_l2cap_get_stats(uint16_t conn_id,
+                                         neil_ble_gatts_l2cap_stats_t *out) {
+
+    if (out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (chan_mutex == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(chan_mutex, portMAX_DELAY);
+    const chan_slot_t *slot = slot_by_conn(conn_id);
+    if (slot != NULL) {
+        *out = slot->stats;
+    }
+    xSemaphoreGive(chan_mutex);
+
+    return slot != NULL ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+void neil_ble_gatts_l2cap_psm_read(uint8_t *data) {
+    const uint16_t psm = l2cap_cfg != NULL ? l2cap_cfg->psm : 0;
+
+    data[0] = psm & 0xFF;
+    data[1] = psm >> 8;
+}
+
+// -------------------------------------------------------------
+// Initialization / Deinitialization
+// -------------------------------------------------------------
+
+esp_err_t neil_ble_gatts_l2cap_init(const neil_ble_gatts_cfg_l2cap_t *cfg) {
+
+    if (NEIL_BLE_GATTS_L2CAP_CHAN_MAX == 0) {
+        ESP_LOGE(TAG, "Channels disabled, set CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    if (cfg->psm < 0x0080 || cfg->psm > 0x00FF || cfg->mtu == 0) {
+        ESP_LOGE(TAG, "Invalid PSM %x or MTU %d", cfg->psm, cfg->mtu);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (chan_mutex == NULL) {
+        chan_mutex = xSemaphoreCreateMutex();
+        if (chan_mutex == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    for (uint8_t idx = 0; idx < SLOT_COUNT; idx++) {
+        if (slots[idx].tx_ready == NULL) {
+            slots[idx].tx_ready = xSemaphoreCreateBinary();
+        }
+        if (slots[idx].tx_ready == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    l2cap_cfg = cfg;
+
+    const int rc = ble_l2cap_create_server(cfg->psm, cfg->mtu, l2cap_event, NULL);
+    if (rc != 0) {
+        ESP_LOGE(TAG, "Server on PSM %x failed: %d", cfg->psm, rc);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Server on PSM %x, SDU %d bytes", cfg->psm, cfg->mtu);
+
+    return ESP_OK;
+}
+
+void neil_ble_gatts_l2cap_deinit(void) {
+
+    if (chan_mutex == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(chan_mutex, portMAX_DELAY);
+    for (uint8_t idx = 0; idx < SLOT_COUNT; idx++) {
+        if (slots[idx].chan != NULL) {
+            slot_release(slots + idx);
+        }
+    }
+    xSemaphoreGive(chan_mutex);
+}
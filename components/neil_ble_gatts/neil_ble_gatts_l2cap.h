@@ -0,0 +1,164 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_l2cap.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      L2CAP Connection-Oriented Channel API (NimBLE only).
+///
+///             Bulk transfers (logs, waveforms) move faster over an LE
+///             credit-based channel than as notifications: SDUs up to the
+///             channel MTU are segmented by the host, and the peer paces the
+///             sender with credits instead of dropping.
+///
+///             A device configuration with `l2cap` set opens a channel server
+///             on its PSM alongside the GATT server. Clients discover the PSM
+///             through a characteristic declared by the application:
+///
+///                 psm   read, `size = 2`, `on_read = neil_ble_gatts_l2cap_psm_read`
+///
+///             Buffers are handed over, not copied: the application fills a
+///             buffer and gives it to `neil_ble_gatts_l2cap_send`, and takes
+///             each received SDU from `on_recv`.
+///
+///             Bluedroid offers no LE channel API; there the `l2cap`
+///             configuration is ignored with a warning and this module is not
+///             built.
+
+#ifndef neil_ble_gatts_L2CAP_H_
+#define neil_ble_gatts_L2CAP_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#include "neil_ble_gatts_cfg.h"
+#include "neil_ble_gatts_stack.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Channels open at once, follows the NimBLE configuration.
+#ifdef CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM
+#define NEIL_BLE_GATTS_L2CAP_CHAN_MAX CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM
+#else
+#define NEIL_BLE_GATTS_L2CAP_CHAN_MAX 0
+#endif
+
+// -------------------------------------------------------------
+// Types
+// -------------------------------------------------------------
+
+/**
+ * @brief       Channel counters.
+ *
+ *              Credits are accounted by the host: a send the peer has no
+ *              credits for is held until the peer grants more, counted in
+ *              `stalls`.
+ */
+typedef struct {
+    uint16_t tx_mtu; ///< Largest SDU the peer accepts.
+    uint16_t rx_mtu; ///< Largest SDU accepted from the peer.
+
+    uint32_t tx_sdus;
+    uint32_t tx_bytes;
+    uint32_t rx_sdus;
+    uint32_t rx_bytes;
+
+    uint32_t stalls;    ///< Sends held for credits.
+    uint32_t rx_starve; ///< Receive buffers unavailable, peer left without credits.
+} neil_ble_gatts_l2cap_stats_t;
+
+// -------------------------------------------------------------
+// Procedures (public)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Get an empty buffer from the host pool.
+ *
+ * @return      NULL if the pool is exhausted.
+ */
+neil_ble_gatts_l2cap_buf_t *neil_ble_gatts_l2cap_buf_alloc(void);
+
+/**
+ * @brief       Grow a buffer by `len` contiguous bytes, to be written in place.
+ *
+ * @return      Start of the new bytes, NULL if `len` exceeds one pool block or
+ *              the pool is exhausted.
+ */
+uint8_t *neil_ble_gatts_l2cap_buf_reserve(neil_ble_gatts_l2cap_buf_t *buf,
+                                          uint16_t len);
+
+/**
+ * @brief       Copy bytes to the end of a buffer.
+ */
+esp_err_t neil_ble_gatts_l2cap_buf_append(neil_ble_gatts_l2cap_buf_t *buf,
+                                          const void *data, uint16_t len);
+
+/**
+ * @brief       Bytes held by a buffer.
+ */
+uint16_t neil_ble_gatts_l2cap_buf_len(const neil_ble_gatts_l2cap_buf_t *buf);
+
+/**
+ * @brief       Copy bytes out of a buffer.
+ *
+ * @return      Bytes copied, less than `len` past the end of the buffer.
+ */
+uint16_t neil_ble_gatts_l2cap_buf_copy(const neil_ble_gatts_l2cap_buf_t *buf,
+                                       uint16_t offset, void *dst, uint16_t len);
+
+/**
+ * @brief       Return a buffer to the host pool.
+ */
+void neil_ble_gatts_l2cap_buf_free(neil_ble_gatts_l2cap_buf_t *buf);
+
+/**
+ * @brief       Send one SDU over the channel of a connection.
+ *
+ *              Takes ownership of `buf` in every case. Waits up to `timeout`
+ *              while the previous SDU is held for credits. May be called from
+ *              any task but the NimBLE host task.
+ *
+ * @return      ESP_ERR_NOT_FOUND without a channel, ESP_ERR_INVALID_SIZE
+ *              beyond the peer MTU, ESP_ERR_TIMEOUT if credits did not come.
+ */
+esp_err_t neil_ble_gatts_l2cap_send(uint16_t conn_id, neil_ble_gatts_l2cap_buf_t *buf,
+                                    TickType_t timeout);
+
+/**
+ * @brief       Close the channel of a connection, the link stays up.
+ */
+esp_err_t neil_ble_gatts_l2cap_close(uint16_t conn_id);
+
+/**
+ * @brief       Counters of the channel of a connection.
+ */
+esp_err_t neil_ble_gatts_l2cap_get_stats(uint16_t conn_id,
+                                         neil_ble_gatts_l2cap_stats_t *out);
+
+/**
+ * @brief       `on_read` of the PSM characteristic: PSM, u16 little-endian.
+ */
+void neil_ble_gatts_l2cap_psm_read(uint8_t *data);
+
+// -------------------------------------------------------------
+// Procedures (component-internal)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Register the channel server, after the host is initialized.
+ */
+esp_err_t neil_ble_gatts_l2cap_init(const neil_ble_gatts_cfg_l2cap_t *cfg);
+
+/**
+ * @brief       Forget every channel and wake blocked senders, after the host
+ *              stopped.
+ */
+void neil_ble_gatts_l2cap_deinit(void);
+
+#endif // neil_ble_gatts_L2CAP_H_
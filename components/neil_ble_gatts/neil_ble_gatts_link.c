@@ -0,0 +1,486 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_link.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Adaptive Link Manager implementation.
+///
+///             A task samples every link once per period and decides at most
+///             one procedure per link: a parameter update or a PHY change.
+///             The decision is made under the lock, the procedure is started
+///             outside it since a stack may report the outcome before
+///             returning. A link waits for the outcome of its procedure, or
+///             for the hold to expire, before anything else is requested.
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "neil_ble_gatts_conn.h"
+#include "neil_ble_gatts_link.h"
+#include "neil_ble_gatts_notify.h"
+#include "neil_ble_gatts_stack.h"
+
+static const char *const TAG = "neil_ble_gatts_link";
+
+#if CONFIG_NEIL_BLE_GATTS_LINK
+
+/// Smoothing of RSSI samples, each moves the average by 1/RSSI_WEIGHT.
+#define RSSI_WEIGHT 4
+
+// -------------------------------------------------------------
+// Profiles
+// -------------------------------------------------------------
+
+typedef struct {
+    uint16_t interval_min; ///< 1.25 ms
+    uint16_t interval_max; ///< 1.25 ms
+    uint16_t latency;      ///< Intervals the peripheral may skip.
+    uint16_t timeout;      ///< 10 ms
+} profile_params_t;
+
+static const profile_params_t profile_params[NEIL_BLE_GATTS_LINK_PROFILE_MAX] = {
+    // --- 300-330 ms, answering every fifth event at worst, 6 s timeout
+    [NEIL_BLE_GATTS_LINK_IDLE] = {240, 264, 4, 600},
+    // --- 30-50 ms, 4 s timeout
+    [NEIL_BLE_GATTS_LINK_BALANCED] = {24, 40, 0, 400},
+    // --- 15-30 ms, 4 s timeout
+    [NEIL_BLE_GATTS_LINK_BURST] = {12, 24, 0, 400},
+};
+
+// -------------------------------------------------------------
+// State
+// -------------------------------------------------------------
+
+typedef enum {
+    ACTION_NONE = 0,
+    ACTION_PARAMS,
+    ACTION_PHY,
+} action_t;
+
+typedef struct {
+    bool active;
+    uint16_t conn_id;
+    esp_bd_addr_t bda;
+
+    bool rssi_valid;      ///< `stats.rssi` holds at least one sample.
+    bool phy_unsupported; ///< PHY selection refused, not tried again.
+
+    action_t pending;     ///< Procedure awaiting its outcome.
+    uint8_t pending_left; ///< Periods before an unreported outcome is a failure.
+    uint8_t hold;         ///< Periods before the next change.
+    uint16_t quiet;       ///< Consecutive periods without outbound traffic.
+
+    neil_ble_gatts_link_profile_t want_profile; ///< Profile of the pending request.
+    neil_ble_gatts_link_phy_t want_phy;         ///< PHY of the pending request.
+
+    uint32_t handed_last;   ///< Notification bytes handed, at the last sample.
+    uint32_t pressure_last; ///< Notification congestions and drops, likewise.
+
+    neil_ble_gatts_link_stats_t stats;
+} link_t;
+
+static link_t links[NEIL_BLE_GATTS_CONN_MAX];
+
+static bool link_enabled             = false;
+static TaskHandle_t link_task_handle = NULL;
+
+// --- Links are opened and reported on the Bluetooth task, sampled on ours.
+static portMUX_TYPE link_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// -------------------------------------------------------------
+// Helpers (call with the lock held)
+// -------------------------------------------------------------
+
+static link_t *link_find(uint16_t conn_id) {
+    for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        if (links[idx].active && links[idx].conn_id == conn_id) {
+            return links + idx;
+        }
+    }
+    return NULL;
+}
+
+static void pending_failed(link_t *link) {
+    if (link->pending == ACTION_PARAMS) {
+        link->stats.param_failures++;
+    } else if (link->pending == ACTION_PHY) {
+        link->stats.phy_failures++;
+    }
+    link->pending = ACTION_NONE;
+}
+
+static neil_ble_gatts_link_profile_t
+profile_choose(const link_t *link, bool busy, bool calm) {
+
+    switch (link->stats.profile) {
+    case NEIL_BLE_GATTS_LINK_IDLE:
+        if (busy) {
+            return NEIL_BLE_GATTS_LINK_BURST;
+        }
+        if (link->quiet == 0) {
+            return NEIL_BLE_GATTS_LINK_BALANCED;
+        }
+        return NEIL_BLE_GATTS_LINK_IDLE;
+
+    case NEIL_BLE_GATTS_LINK_BALANCED:
+        if (busy) {
+            return NEIL_BLE_GATTS_LINK_BURST;
+        }
+        if (link->quiet >= NEIL_BLE_GATTS_LINK_IDLE_PERIODS) {
+            return NEIL_BLE_GATTS_LINK_IDLE;
+        }
+        return NEIL_BLE_GATTS_LINK_BALANCED;
+
+    default:
+        return calm ? NEIL_BLE_GATTS_LINK_BALANCED : NEIL_BLE_GATTS_LINK_BURST;
+    }
+}
+
+static neil_ble_gatts_link_phy_t phy_choose(const link_t *link) {
+    const int8_t rssi = link->stats.rssi;
+    const bool burst  = link->stats.profile == NEIL_BLE_GATTS_LINK_BURST;
+
+    if (rssi < NEIL_BLE_GATTS_LINK_FAR_RSSI) {
+        return NEIL_BLE_GATTS_LINK_PHY_CODED;
+    }
+
+    // --- Between the thresholds the coded PHY is kept, 2M only under burst
+    if (rssi > NEIL_BLE_GATTS_LINK_NEAR_RSSI ||
+        link->stats.phy == NEIL_BLE_GATTS_LINK_PHY_2M) {
+        return burst ? NEIL_BLE_GATTS_LINK_PHY_2M : NEIL_BLE_GATTS_LINK_PHY_1M;
+    }
+
+    return link->stats.phy;
+}
+
+/**
+ * @brief       Account one period of a link and decide its next procedure.
+ */
+static action_t link_decide(link_t *link, uint32_t queued, uint32_t handed,
+                            uint32_t pressure) {
+
+    neil_ble_gatts_link_stats_t *stats = &link->stats;
+
+    const uint32_t bytes = handed - link->handed_last;
+    const bool congested = pressure != link->pressure_last;
+    link->handed_last    = handed;
+    link->pressure_last  = pressure;
+
+    stats->load_bps = bytes * 1000 / NEIL_BLE_GATTS_LINK_PERIOD_MS;
+    stats->profile_bytes[stats->profile] += bytes;
+    stats->profile_periods[stats->profile]++;
+    stats->phy_bytes[stats->phy - 1] += bytes;
+    stats->phy_periods[stats->phy - 1]++;
+
+    if (bytes > 0 || queued > 0) {
+        link->quiet = 0;
+    } else if (link->quiet < UINT16_MAX) {
+        link->quiet++;
+    }
+
+    if (link->hold > 0) {
+        link->hold--;
+    }
+
+    if (link->pending != ACTION_NONE) {
+        if (--link->pending_left == 0) {
+            pending_failed(link);
+        }
+        return ACTION_NONE;
+    }
+
+    const bool busy = stats->load_bps >= NEIL_BLE_GATTS_LINK_BUSY_BPS ||
+                      queued >= NEIL_BLE_GATTS_LINK_BUSY_QUEUE || congested;
+    const bool calm = stats->load_bps < NEIL_BLE_GATTS_LINK_CALM_BPS && queued == 0 &&
+                      !congested;
+
+    const neil_ble_gatts_link_profile_t profile = profile_choose(link, busy, calm);
+
+    // --- Traffic on an idle link is served at once, the rest waits out the hold
+    const bool urgent = stats->profile == NEIL_BLE_GATTS_LINK_IDLE &&
+                        profile != NEIL_BLE_GATTS_LINK_IDLE;
+
+    if (profile != stats->profile && (link->hold == 0 || urgent)) {
+        link->want_profile = profile;
+        link->pending      = ACTION_PARAMS;
+        stats->param_requests++;
+    } else if (link->hold == 0 && link->rssi_valid && !link->phy_unsupported &&
+               phy_choose(link) != stats->phy) {
+        link->want_phy = phy_choose(link);
+        link->pending  = ACTION_PHY;
+        stats->phy_requests++;
+    } else {
+        return ACTION_NONE;
+    }
+
+    link->pending_left = NEIL_BLE_GATTS_LINK_HOLD_PERIODS;
+    link->hold         = NEIL_BLE_GATTS_LINK_HOLD_PERIODS;
+
+    return link->pending;
+}
+
+// -------------------------------------------------------------
+// Sampling
+// -------------------------------------------------------------
+
+static void link_service(int idx) {
+
+    portENTER_CRITICAL(&link_lock);
+    const bool active      = links[idx].active;
+    const uint16_t conn_id = links[idx].conn_id;
+    esp_bd_addr_t bda;
+    memcpy(bda, links[idx].bda, sizeof(esp_bd_addr_t));
+    portEXIT_CRITICAL(&link_lock);
+
+    if (!active) {
+        return;
+    }
+
+    // --- Reported later, or before returning; used from the next period on
+    neil_ble_gatts_stack_read_rssi(conn_id, bda);
+
+    uint32_t queued = 0;
+    uint32_t handed = 0;
+    neil_ble_gatts_notify_stats_t notify_stats;
+
+    if (neil_ble_gatts_notify_load(conn_id, &queued, &handed) != ESP_OK ||
+        neil_ble_gatts_notify_get_stats(conn_id, &notify_stats) != ESP_OK) {
+        return;
+    }
+
+    action_t action               = ACTION_NONE;
+    profile_params_t params       = {0};
+    neil_ble_gatts_link_phy_t phy = NEIL_BLE_GATTS_LINK_PHY_1M;
+
+    portENTER_CRITICAL(&link_lock);
+    link_t *link = link_find(conn_id);
+    if (link != NULL) {
+        action = link_decide(link, queued, handed,
+                             notify_stats.congestions + notify_stats.dropped);
+        params = profile_params[link->want_profile];
+        phy    = link->want_phy;
+    }
+    portEXIT_CRITICAL(&link_lock);
+
+    esp_err_t ret = ESP_OK;
+
+    if (action == ACTION_PARAMS) {
+        ret = neil_ble_gatts_stack_update_params(conn_id, bda, params.interval_min,
+                                                 params.interval_max, params.latency,
+                                                 params.timeout);
+    } else if (action == ACTION_PHY) {
+        ret = neil_ble_gatts_stack_set_phy(conn_id, bda, phy);
+    }
+
+    if (ret == ESP_OK) {
+        return;
+    }
+
+    ESP_LOGW(TAG, "Link update of conn_id %d refused: %s", conn_id,
+             esp_err_to_name(ret));
+
+    portENTER_CRITICAL(&link_lock);
+    link = link_find(conn_id);
+    if (link != NULL && link->pending == action) {
+        link->phy_unsupported |= ret == ESP_ERR_NOT_SUPPORTED && action == ACTION_PHY;
+        pending_failed(link);
+    }
+    portEXIT_CRITICAL(&link_lock);
+}
+
+static void link_task(void *arg) {
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(NEIL_BLE_GATTS_LINK_PERIOD_MS));
+
+        if (!link_enabled) {
+            continue;
+        }
+
+        for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+            link_service(idx);
+        }
+    }
+}
+
+// -------------------------------------------------------------
+// Control
+// -------------------------------------------------------------
+
+esp_err_t neil_ble_gatts_link_start(void) {
+
+    if (link_task_handle == NULL &&
+        xTaskCreate(link_task, "neil_link", NEIL_BLE_GATTS_LINK_TASK_STACK, NULL,
+                    NEIL_BLE_GATTS_LINK_TASK_PRIO, &link_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Unable to create link task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    link_enabled = true;
+
+    return ESP_OK;
+}
+
+void neil_ble_gatts_link_stop(void) {
+    link_enabled = false;
+}
+
+esp_err_t neil_ble_gatts_link_get_stats(uint16_t conn_id,
+                                        neil_ble_gatts_link_stats_t *stats) {
+
+    if (stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    portENTER_CRITICAL(&link_lock);
+    const link_t *link = link_find(conn_id);
+    if (link != NULL) {
+        *stats = link->stats;
+        ret    = ESP_OK;
+    }
+    portEXIT_CRITICAL(&link_lock);
+
+    return ret;
+}
+
+// -------------------------------------------------------------
+// Connections
+// -------------------------------------------------------------
+
+void neil_ble_gatts_link_open(uint16_t conn_id, const esp_bd_addr_t bda) {
+
+    bool ok = false;
+
+    portENTER_CRITICAL(&link_lock);
+    // --- Every profile is told of the same link
+    ok = link_find(conn_id) != NULL;
+    for (int idx = 0; !ok && idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        if (!links[idx].active) {
+            links[idx] = (link_t){
+                .active  = true,
+                .conn_id = conn_id,
+                .stats   = {
+                      .profile = NEIL_BLE_GATTS_LINK_BALANCED,
+                      .phy     = NEIL_BLE_GATTS_LINK_PHY_1M,
+                },
+            };
+            memcpy(links[idx].bda, bda, sizeof(esp_bd_addr_t));
+            ok = true;
+        }
+    }
+    portEXIT_CRITICAL(&link_lock);
+
+    if (!ok) {
+        ESP_LOGE(TAG, "No link slot for conn_id %d", conn_id);
+    }
+}
+
+void neil_ble_gatts_link_close(uint16_t conn_id) {
+    portENTER_CRITICAL(&link_lock);
+    link_t *link = link_find(conn_id);
+    if (link != NULL) {
+        link->active = false;
+    }
+    portEXIT_CRITICAL(&link_lock);
+}
+
+void neil_ble_gatts_link_close_all(void) {
+    portENTER_CRITICAL(&link_lock);
+    for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        links[idx].active = false;
+    }
+    portEXIT_CRITICAL(&link_lock);
+}
+
+// -------------------------------------------------------------
+// Stack Reports
+// -------------------------------------------------------------
+
+void neil_ble_gatts_link_on_rssi(uint16_t conn_id, int8_t rssi) {
+    portENTER_CRITICAL(&link_lock);
+    link_t *link = link_find(conn_id);
+    if (link != NULL && link->rssi_valid) {
+        link->stats.rssi += (rssi - link->stats.rssi) / RSSI_WEIGHT;
+    } else if (link != NULL) {
+        link->stats.rssi = rssi;
+        link->rssi_valid = true;
+    }
+    portEXIT_CRITICAL(&link_lock);
+}
+
+void neil_ble_gatts_link_on_params(uint16_t conn_id, bool ok, uint16_t interval,
+                                   uint16_t latency) {
+    portENTER_CRITICAL(&link_lock);
+    link_t *link = link_find(conn_id);
+    if (link != NULL && ok) {
+        link->stats.interval = interval;
+        link->stats.latency  = latency;
+
+        // --- A central-initiated update leaves the profile as it was
+        if (link->pending == ACTION_PARAMS) {
+            link->stats.profile = link->want_profile;
+            link->stats.param_updates++;
+            link->pending = ACTION_NONE;
+        }
+    } else if (link != NULL && link->pending == ACTION_PARAMS) {
+        pending_failed(link);
+    }
+    portEXIT_CRITICAL(&link_lock);
+}
+
+void neil_ble_gatts_link_on_phy(uint16_t conn_id, bool ok, uint8_t phy) {
+    portENTER_CRITICAL(&link_lock);
+    link_t *link = link_find(conn_id);
+    if (link != NULL && ok && phy >= NEIL_BLE_GATTS_LINK_PHY_1M &&
+        phy <= NEIL_BLE_GATTS_LINK_PHY_CODED) {
+        link->stats.phy = (neil_ble_gatts_link_phy_t)phy;
+
+        if (link->pending == ACTION_PHY) {
+            link->stats.phy_updates++;
+            link->pending = ACTION_NONE;
+        }
+    } else if (link != NULL && link->pending == ACTION_PHY) {
+        pending_failed(link);
+    }
+    portEXIT_CRITICAL(&link_lock);
+}
+
+#else
+
+// NOTE: Disabled in menuconfig (CONFIG_NEIL_BLE_GATTS_LINK), links keep the
+//       parameters the central chose.
+
+esp_err_t neil_ble_gatts_link_start(void) {
+    ESP_LOGW(TAG, "Disabled in menuconfig");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void neil_ble_gatts_link_stop(void) {}
+
+esp_err_t neil_ble_gatts_link_get_stats(uint16_t conn_id,
+                                        neil_ble_gatts_link_stats_t *stats) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void neil_ble_gatts_link_open(uint16_t conn_id, const esp_bd_addr_t bda) {}
+
+void neil_ble_gatts_link_close(uint16_t conn_id) {}
+
+void neil_ble_gatts_link_close_all(void) {}
+
+void neil_ble_gatts_link_on_rssi(uint16_t conn_id, int8_t rssi) {}
+
+void neil_ble_gatts_link_on_params(uint16_t conn_id, bool ok, uint16_t interval,
+                                   uint16_t latency) {}
+
+void neil_ble_gatts_link_on_phy(uint16_t conn_id, bool ok, uint8_t phy) {}
+
+#endif
@@ -0,0 +1,186 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_link.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Adaptive Link Manager API.
+///
+///             Once started, every link is sampled each period: signal
+///             strength (RSSI), and the outbound load and congestion seen by
+///             the notification scheduler. From these the manager picks a
+///             connection parameter profile and a PHY, and renegotiates them
+///             with hysteresis:
+///
+///                 idle        no traffic for a while, long interval with
+///                             peripheral latency to save power
+///                 balanced    occasional traffic
+///                 burst       sustained load, short interval
+///
+///                 coded PHY   weak signal, for range
+///                 2M PHY      strong signal under burst load
+///                 1M PHY      otherwise
+///
+///             Counters record the decisions, their outcome, and the bytes
+///             moved under each profile and PHY, to judge their effect on
+///             throughput.
+
+#ifndef neil_ble_gatts_LINK_H_
+#define neil_ble_gatts_LINK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "neil_ble_gatts_stack.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Sampling period (ms).
+#define NEIL_BLE_GATTS_LINK_PERIOD_MS 1000
+
+/// Periods a link keeps its parameters after a change before the next.
+#define NEIL_BLE_GATTS_LINK_HOLD_PERIODS 5
+
+/// Outbound load entering the burst profile (bytes per second).
+#define NEIL_BLE_GATTS_LINK_BUSY_BPS 2000
+
+/// Outbound load leaving the burst profile (bytes per second).
+#define NEIL_BLE_GATTS_LINK_CALM_BPS 400
+
+/// Queued outbound bytes entering the burst profile regardless of rate.
+#define NEIL_BLE_GATTS_LINK_BUSY_QUEUE 1024
+
+/// Periods without traffic before the idle profile.
+#define NEIL_BLE_GATTS_LINK_IDLE_PERIODS 30
+
+/// Smoothed RSSI (dBm) below which the coded PHY is requested.
+#define NEIL_BLE_GATTS_LINK_FAR_RSSI (-85)
+
+/// Smoothed RSSI (dBm) above which the coded PHY is left.
+#define NEIL_BLE_GATTS_LINK_NEAR_RSSI (-75)
+
+/// Stack size of the sampling task.
+#define NEIL_BLE_GATTS_LINK_TASK_STACK 2560
+
+/// Priority of the sampling task.
+#define NEIL_BLE_GATTS_LINK_TASK_PRIO 4
+
+// -------------------------------------------------------------
+// Domain Structures
+// -------------------------------------------------------------
+
+/**
+ * @brief       Connection parameter profiles.
+ */
+typedef enum {
+    NEIL_BLE_GATTS_LINK_IDLE = 0,
+    NEIL_BLE_GATTS_LINK_BALANCED,
+    NEIL_BLE_GATTS_LINK_BURST,
+    NEIL_BLE_GATTS_LINK_PROFILE_MAX,
+} neil_ble_gatts_link_profile_t;
+
+/**
+ * @brief       LE PHYs, numbered as in HCI.
+ */
+typedef enum {
+    NEIL_BLE_GATTS_LINK_PHY_1M    = 1,
+    NEIL_BLE_GATTS_LINK_PHY_2M    = 2,
+    NEIL_BLE_GATTS_LINK_PHY_CODED = 3,
+} neil_ble_gatts_link_phy_t;
+
+/// Number of PHYs, for per-PHY counters indexed by `phy - 1`.
+#define NEIL_BLE_GATTS_LINK_PHY_COUNT 3
+
+/**
+ * @brief       Manager state and counters of one link.
+ */
+typedef struct {
+    int8_t rssi;       ///< Smoothed RSSI (dBm), 0 before the first sample.
+    uint16_t interval; ///< Connection interval (1.25 ms), 0 if not reported.
+    uint16_t latency;  ///< Peripheral latency (intervals).
+    uint32_t load_bps; ///< Outbound load over the last period.
+
+    neil_ble_gatts_link_profile_t profile; ///< Profile in effect.
+    neil_ble_gatts_link_phy_t phy;         ///< PHY in effect (transmit).
+
+    uint32_t param_requests; ///< Parameter updates requested.
+    uint32_t param_updates;  ///< Parameter updates reported applied.
+    uint32_t param_failures; ///< Refused by the stack or the central.
+    uint32_t phy_requests;   ///< PHY changes requested.
+    uint32_t phy_updates;    ///< PHY changes reported applied.
+    uint32_t phy_failures;   ///< Refused, or PHY selection not supported.
+
+    uint32_t profile_bytes[NEIL_BLE_GATTS_LINK_PROFILE_MAX]; ///< Sent per profile.
+    uint32_t profile_periods[NEIL_BLE_GATTS_LINK_PROFILE_MAX];
+    uint32_t phy_bytes[NEIL_BLE_GATTS_LINK_PHY_COUNT]; ///< Sent per PHY.
+    uint32_t phy_periods[NEIL_BLE_GATTS_LINK_PHY_COUNT];
+} neil_ble_gatts_link_stats_t;
+
+// -------------------------------------------------------------
+// Procedures (public)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Start managing links, current and future.
+ */
+esp_err_t neil_ble_gatts_link_start(void);
+
+/**
+ * @brief       Stop managing links, parameters in effect are kept.
+ */
+void neil_ble_gatts_link_stop(void);
+
+/**
+ * @brief       Get the state and counters of a link.
+ *
+ * @return      ESP_ERR_NOT_FOUND if the connection is unknown.
+ */
+esp_err_t neil_ble_gatts_link_get_stats(uint16_t conn_id,
+                                        neil_ble_gatts_link_stats_t *stats);
+
+// -------------------------------------------------------------
+// Procedures (component-internal)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Track a new link, in the balanced profile on the 1M PHY.
+ */
+void neil_ble_gatts_link_open(uint16_t conn_id, const esp_bd_addr_t bda);
+
+/**
+ * @brief       Forget a link.
+ */
+void neil_ble_gatts_link_close(uint16_t conn_id);
+
+/**
+ * @brief       Forget every link (on stop).
+ */
+void neil_ble_gatts_link_close_all(void);
+
+/**
+ * @brief       Record an RSSI sample (`ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT`).
+ */
+void neil_ble_gatts_link_on_rssi(uint16_t conn_id, int8_t rssi);
+
+/**
+ * @brief       Record the outcome of a parameter update
+ *              (`ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT`, NimBLE
+ *              `BLE_GAP_EVENT_CONN_UPDATE`), also when the central started it.
+ */
+void neil_ble_gatts_link_on_params(uint16_t conn_id, bool ok, uint16_t interval,
+                                   uint16_t latency);
+
+/**
+ * @brief       Record the outcome of a PHY update
+ *              (`ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT`, NimBLE
+ *              `BLE_GAP_EVENT_PHY_UPDATE_COMPLETE`).
+ */
+void neil_ble_gatts_link_on_phy(uint16_t conn_id, bool ok, uint8_t phy);
+
+#endif // neil_ble_gatts_LINK_H_
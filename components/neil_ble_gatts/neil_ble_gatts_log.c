@@ -0,0 +1,286 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_log.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Deferred Binary Logging implementation.
+///
+///             Writers claim a slot with an atomic increment and publish it
+///             with a stamp (claim index + 1); the single reader, the drain
+///             task, accepts a slot only if its stamp matches before and after
+///             copying. A reader lapped by writers skips to the oldest slot
+///             still intact and reports the gap.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "neil_ble_gatts_log.h"
+#include "neil_ble_gatts_mem.h"
+
+static const char *const TAG = "neil_ble_gatts_log";
+
+// -------------------------------------------------------------
+// Message Table
+// -------------------------------------------------------------
+
+typedef struct {
+    uint8_t level;
+    const char *sub;
+    const char *fmt;
+} msg_info_t;
+
+#define MSG_INFO(id, sub, level, fmt)                                                  \
+    [NEIL_BLE_GATTS_LOG_MSG_##id] = {NEIL_BLE_GATTS_LOG_##level, #sub, fmt},
+
+static const msg_info_t MSG_INFO_TAB[NEIL_BLE_GATTS_LOG_MSG_COUNT] = {
+    NEIL_BLE_GATTS_LOG_MESSAGES(MSG_INFO)};
+
+// -------------------------------------------------------------
+// State
+// -------------------------------------------------------------
+
+/**
+ * @brief       Ring slot.
+ */
+typedef struct {
+    uint32_t stamp; ///< Claim index + 1 once published, 0 while being written.
+    neil_ble_gatts_log_rec_t rec;
+} slot_t;
+
+static struct {
+    slot_t *slots;
+    uint32_t mask;
+    uint32_t head;  ///< Next claim index (writers).
+    uint32_t tail;  ///< Next index to drain (drain task).
+    uint32_t users; ///< Writers and drains currently holding `slots`.
+    bool hdr_sent;
+    neil_ble_gatts_log_sink_t sink;
+    void *ctx;
+} ring;
+
+static TaskHandle_t drain_task_handle = NULL;
+
+// -------------------------------------------------------------
+// Ring Access
+// -------------------------------------------------------------
+
+/**
+ * @brief       Pin the ring so `neil_ble_gatts_log_stop` cannot free it.
+ *
+ * @return      NULL if logging is stopped.
+ */
+static slot_t *ring_acquire(void) {
+    __atomic_add_fetch(&ring.users, 1, __ATOMIC_ACQUIRE);
+
+    slot_t *slots = __atomic_load_n(&ring.slots, __ATOMIC_ACQUIRE);
+
+    if (slots == NULL) {
+        __atomic_sub_fetch(&ring.users, 1, __ATOMIC_RELEASE);
+    }
+    return slots;
+}
+
+static void ring_release(void) { __atomic_sub_fetch(&ring.users, 1, __ATOMIC_RELEASE); }
+
+// -------------------------------------------------------------
+// Recording
+// -------------------------------------------------------------
+
+void neil_ble_gatts_log_put(neil_ble_gatts_log_msg_t msg, uint32_t a0, uint32_t a1,
+                            uint32_t a2) {
+
+    slot_t *slots = ring_acquire();
+
+    if (slots == NULL) {
+        return;
+    }
+
+    const uint32_t idx = __atomic_fetch_add(&ring.head, 1, __ATOMIC_RELAXED);
+
+    slot_t *slot = slots + (idx & ring.mask);
+
+    __atomic_store_n(&slot->stamp, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->rec = (neil_ble_gatts_log_rec_t){
+        .time_us = (uint32_t)esp_timer_get_time(),
+        .msg     = msg,
+        .seq     = (uint16_t)idx,
+        .args    = {a0, a1, a2},
+    };
+
+    __atomic_store_n(&slot->stamp, idx + 1, __ATOMIC_RELEASE);
+
+    ring_release();
+}
+
+// -------------------------------------------------------------
+// Draining
+// -------------------------------------------------------------
+
+static void rec_print(const neil_ble_gatts_log_rec_t *rec) {
+
+    if (rec->msg >= NEIL_BLE_GATTS_LOG_MSG_COUNT) {
+        return;
+    }
+
+    const msg_info_t *info = MSG_INFO_TAB + rec->msg;
+
+    char line[96];
+
+    // NOTE: Excess arguments are ignored by snprintf.
+    snprintf(line, sizeof(line), info->fmt, (unsigned)rec->args[0],
+             (unsigned)rec->args[1], (unsigned)rec->args[2]);
+
+    ESP_LOG_LEVEL((esp_log_level_t)info->level, TAG, "[%10u] %s: %s",
+                  (unsigned)rec->time_us, info->sub, line);
+}
+
+/**
+ * @brief       Hand drained records to the sink, header first.
+ */
+static void recs_emit(const neil_ble_gatts_log_rec_t *recs, uint16_t count) {
+
+    if (ring.sink == NULL) {
+        for (uint16_t idx = 0; idx < count; idx++) {
+            rec_print(recs + idx);
+        }
+        return;
+    }
+
+    if (!ring.hdr_sent) {
+        const neil_ble_gatts_log_hdr_t hdr = {
+            .magic       = NEIL_BLE_GATTS_LOG_MAGIC,
+            .version     = NEIL_BLE_GATTS_LOG_VERSION,
+            .record_size = sizeof(neil_ble_gatts_log_rec_t),
+        };
+        ring.hdr_sent =
+            ring.sink((const uint8_t *)&hdr, sizeof(hdr), ring.ctx) == ESP_OK;
+    }
+
+    if (ring.hdr_sent && count > 0) {
+        ring.sink((const uint8_t *)recs, count * sizeof(neil_ble_gatts_log_rec_t),
+                  ring.ctx);
+    }
+}
+
+static void ring_drain(void) {
+
+    slot_t *slots = ring_acquire();
+
+    if (slots == NULL) {
+        return;
+    }
+
+    const uint32_t capacity = ring.mask + 1;
+
+    // --- Copy in chunks so the sink (possibly blocking) sees few calls
+    neil_ble_gatts_log_rec_t chunk[8];
+    uint16_t count = 0;
+
+    while (ring.tail != __atomic_load_n(&ring.head, __ATOMIC_RELAXED)) {
+
+        const uint32_t head = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+        slot_t *slot        = slots + (ring.tail & ring.mask);
+
+        const uint32_t stamp = __atomic_load_n(&slot->stamp, __ATOMIC_ACQUIRE);
+        chunk[count]         = slot->rec;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        const bool intact = stamp == ring.tail + 1 &&
+                            __atomic_load_n(&slot->stamp, __ATOMIC_RELAXED) == stamp;
+
+        if (intact) {
+            ring.tail++;
+        } else if (head - ring.tail > capacity) {
+            // --- Lapped: skip to the oldest slot writers have not reclaimed
+            chunk[count] = (neil_ble_gatts_log_rec_t){
+                .time_us = (uint32_t)esp_timer_get_time(),
+                .msg     = NEIL_BLE_GATTS_LOG_MSG_DROPPED,
+                .args    = {head - capacity - ring.tail},
+            };
+            ring.tail = head - capacity;
+        } else {
+            // --- Still being written, retry on the next drain
+            break;
+        }
+
+        if (++count == sizeof(chunk) / sizeof(chunk[0])) {
+            recs_emit(chunk, count);
+            count = 0;
+        }
+    }
+
+    recs_emit(chunk, count);
+
+    ring_release();
+}
+
+static void drain_task(void *arg) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(NEIL_BLE_GATTS_LOG_DRAIN_MS));
+        ring_drain();
+    }
+}
+
+// -------------------------------------------------------------
+// Control
+// -------------------------------------------------------------
+
+esp_err_t neil_ble_gatts_log_start(uint16_t capacity, neil_ble_gatts_log_sink_t sink,
+                                   void *ctx) {
+
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (ring.slots != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    slot_t *slots = neil_ble_gatts_mem_calloc(NEIL_BLE_GATTS_MEM_LOG, capacity,
+                                              sizeof(slot_t));
+
+    if (slots == NULL) {
+        ESP_LOGE(TAG, "Out of memory allocating %u records", capacity);
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (drain_task_handle == NULL &&
+        xTaskCreate(drain_task, "neil_log", NEIL_BLE_GATTS_LOG_TASK_STACK, NULL,
+                    NEIL_BLE_GATTS_LOG_TASK_PRIO, &drain_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Unable to create drain task");
+        neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_LOG, slots);
+        return ESP_ERR_NO_MEM;
+    }
+
+    ring.mask     = capacity - 1;
+    ring.head     = 0;
+    ring.tail     = 0;
+    ring.hdr_sent = false;
+    ring.sink     = sink;
+    ring.ctx      = ctx;
+    __atomic_store_n(&ring.slots, slots, __ATOMIC_RELEASE);
+
+    return ESP_OK;
+}
+
+void neil_ble_gatts_log_stop(void) {
+
+    slot_t *slots = __atomic_exchange_n(&ring.slots, NULL, __ATOMIC_ACQ_REL);
+
+    // --- Wait out writers and a drain still holding the ring
+    while (__atomic_load_n(&ring.users, __ATOMIC_ACQUIRE) != 0) {
+        vTaskDelay(1);
+    }
+
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_LOG, slots);
+}
@@ -0,0 +1,204 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_log.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Deferred Binary Logging API.
+///
+///             Hot paths (GATTS and GAP handlers, the notification scheduler)
+///             log a message ID, up to three integer arguments and a timestamp
+///             into a lock-free RAM ring instead of formatting on the spot.
+///             A low-priority task later formats the records to the console,
+///             or streams them to a sink for `tools/log_decode.py` on the host.
+///
+///             Each message belongs to a subsystem whose level is fixed at
+///             compile time; messages above it compile to nothing.
+
+#ifndef neil_ble_gatts_LOG_H_
+#define neil_ble_gatts_LOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "sdkconfig.h"
+
+// -------------------------------------------------------------
+// Levels
+// -------------------------------------------------------------
+
+#define NEIL_BLE_GATTS_LOG_NONE  0
+#define NEIL_BLE_GATTS_LOG_ERROR 1
+#define NEIL_BLE_GATTS_LOG_WARN  2
+#define NEIL_BLE_GATTS_LOG_INFO  3
+#define NEIL_BLE_GATTS_LOG_DEBUG 4
+
+// --- Per-subsystem levels, set in menuconfig or with compile definitions
+#ifndef NEIL_BLE_GATTS_LOG_LEVEL_GATTS
+#ifdef CONFIG_NEIL_BLE_GATTS_LOG_LEVEL_GATTS
+#define NEIL_BLE_GATTS_LOG_LEVEL_GATTS CONFIG_NEIL_BLE_GATTS_LOG_LEVEL_GATTS
+#else
+#define NEIL_BLE_GATTS_LOG_LEVEL_GATTS NEIL_BLE_GATTS_LOG_INFO
+#endif
+#endif
+
+#ifndef NEIL_BLE_GATTS_LOG_LEVEL_GAP
+#ifdef CONFIG_NEIL_BLE_GATTS_LOG_LEVEL_GAP
+#define NEIL_BLE_GATTS_LOG_LEVEL_GAP CONFIG_NEIL_BLE_GATTS_LOG_LEVEL_GAP
+#else
+#define NEIL_BLE_GATTS_LOG_LEVEL_GAP NEIL_BLE_GATTS_LOG_INFO
+#endif
+#endif
+
+#ifndef NEIL_BLE_GATTS_LOG_LEVEL_NOTIFY
+#ifdef CONFIG_NEIL_BLE_GATTS_LOG_LEVEL_NOTIFY
+#define NEIL_BLE_GATTS_LOG_LEVEL_NOTIFY CONFIG_NEIL_BLE_GATTS_LOG_LEVEL_NOTIFY
+#else
+#define NEIL_BLE_GATTS_LOG_LEVEL_NOTIFY NEIL_BLE_GATTS_LOG_WARN
+#endif
+#endif
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Interval at which the task drains the ring.
+#define NEIL_BLE_GATTS_LOG_DRAIN_MS 100
+
+/// Stack size of the draining task.
+#define NEIL_BLE_GATTS_LOG_TASK_STACK 3072
+
+/// Priority of the draining task (just above idle).
+#define NEIL_BLE_GATTS_LOG_TASK_PRIO 1
+
+// -------------------------------------------------------------
+// Messages
+// -------------------------------------------------------------
+//
+// X(id, subsystem, level, format)
+//
+// Formats take up to three unsigned arguments, using only conversions shared
+// by C and Python (%u, %x, with flags and width).
+// Append new messages at the end: IDs are recorded in streamed logs, and
+// `tools/log_decode.py` reads this table.
+
+#define NEIL_BLE_GATTS_LOG_MESSAGES(X)                                                 \
+    X(DROPPED, GATTS, WARN, "%u records dropped")                                      \
+    X(GATTS_CONNECT, GATTS, INFO, "conn_id %u connected")                              \
+    X(GATTS_DISCONNECT, GATTS, INFO, "conn_id %u disconnected, reason %x")             \
+    X(GATTS_MTU, GATTS, DEBUG, "conn_id %u mtu %u")                                    \
+    X(GATTS_WRITE, GATTS, DEBUG, "conn_id %u write handle %x len %u")                  \
+    X(GATTS_PREP_WRITE, GATTS, DEBUG, "conn_id %u prepare handle %x offset %u")        \
+    X(GATTS_EXEC_WRITE, GATTS, DEBUG, "conn_id %u execute %u, status %x")              \
+    X(GAP_EVENT, GAP, DEBUG, "event %u")                                               \
+    X(GAP_ADV_START, GAP, INFO, "advertising start, status %x")                        \
+    X(GAP_PASSKEY_REQ, GAP, INFO, "passkey request")                                   \
+    X(GAP_OOB_REQ, GAP, INFO, "out-of-band request")                                   \
+    X(GAP_NC_REQ, GAP, INFO, "numeric comparison, passkey %06u")                       \
+    X(GAP_PASSKEY_NOTIF, GAP, INFO, "passkey %06u")                                    \
+    X(GAP_KEY, GAP, DEBUG, "key type %u")                                              \
+    X(GAP_AUTH_OK, GAP, INFO, "paired %08x%04x, auth mode %x")                         \
+    X(GAP_AUTH_FAIL, GAP, WARN, "pairing %08x%04x failed, reason %x")                  \
+    X(GAP_BOND_REMOVED, GAP, INFO, "bond %08x%04x removed, status %x")                 \
+    X(NOTIFY_SUBSCRIBE, NOTIFY, DEBUG, "conn_id %u handle %x cccd %x")
+
+#define NEIL_BLE_GATTS_LOG_X_ID(id, sub, level, fmt) NEIL_BLE_GATTS_LOG_MSG_##id,
+#define NEIL_BLE_GATTS_LOG_X_ON(id, sub, level, fmt)                                   \
+    NEIL_BLE_GATTS_LOG_ON_##id =                                                       \
+        NEIL_BLE_GATTS_LOG_##level <= NEIL_BLE_GATTS_LOG_LEVEL_##sub,
+
+/// Message ID of a record.
+typedef enum {
+    NEIL_BLE_GATTS_LOG_MESSAGES(NEIL_BLE_GATTS_LOG_X_ID) NEIL_BLE_GATTS_LOG_MSG_COUNT
+} neil_ble_gatts_log_msg_t;
+
+// --- Whether each message is compiled in
+enum { NEIL_BLE_GATTS_LOG_MESSAGES(NEIL_BLE_GATTS_LOG_X_ON) };
+
+/**
+ * @brief       Log message `id` (without prefix) with three arguments.
+ *
+ *              Never blocks or formats; a no-op while logging is stopped.
+ */
+#define NEIL_BLE_GATTS_LOG(id, a0, a1, a2)                                             \
+    do {                                                                               \
+        if (NEIL_BLE_GATTS_LOG_ON_##id) {                                              \
+            neil_ble_gatts_log_put(NEIL_BLE_GATTS_LOG_MSG_##id, (a0), (a1), (a2));     \
+        }                                                                              \
+    } while (0)
+
+// -------------------------------------------------------------
+// Binary Format
+// -------------------------------------------------------------
+//
+// A streamed log is one header followed by records, all little-endian.
+
+/// Magic value of the stream header ("NBGL").
+#define NEIL_BLE_GATTS_LOG_MAGIC 0x4C47424Eu
+
+/// Version of the stream format.
+#define NEIL_BLE_GATTS_LOG_VERSION 1
+
+/**
+ * @brief       Stream header.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;      ///< NEIL_BLE_GATTS_LOG_MAGIC
+    uint8_t version;     ///< NEIL_BLE_GATTS_LOG_VERSION
+    uint8_t record_size; ///< sizeof(neil_ble_gatts_log_rec_t)
+} neil_ble_gatts_log_hdr_t;
+
+/**
+ * @brief       One logged message.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t time_us; ///< Low 32 bits of esp_timer.
+    uint16_t msg;     ///< neil_ble_gatts_log_msg_t
+    uint16_t seq;     ///< Running sequence number (gaps reveal drops).
+    uint32_t args[3];
+} neil_ble_gatts_log_rec_t;
+
+/**
+ * @brief       Sink receiving serialized log bytes (e.g. a UART writer).
+ */
+typedef esp_err_t (*neil_ble_gatts_log_sink_t)(const uint8_t *data, size_t len,
+                                               void *ctx);
+
+// -------------------------------------------------------------
+// Control
+// -------------------------------------------------------------
+
+/**
+ * @brief       Allocate a ring of `capacity` records (a power of two) and
+ *              start logging.
+ *
+ *              Records are formatted to the console, or streamed raw to
+ *              `sink` when it is not NULL. Once the ring is full, records not
+ *              yet drained are overwritten and reported as dropped.
+ */
+esp_err_t neil_ble_gatts_log_start(uint16_t capacity, neil_ble_gatts_log_sink_t sink,
+                                   void *ctx);
+
+/**
+ * @brief       Stop logging and release the ring, discarding undrained
+ *              records.
+ */
+void neil_ble_gatts_log_stop(void);
+
+// -------------------------------------------------------------
+// Recording
+// -------------------------------------------------------------
+
+/**
+ * @brief       Record a message, use NEIL_BLE_GATTS_LOG instead.
+ *
+ *              Lock-free, may be called from any task.
+ */
+void neil_ble_gatts_log_put(neil_ble_gatts_log_msg_t msg, uint32_t a0, uint32_t a1,
+                            uint32_t a2);
+
+#endif // neil_ble_gatts_LOG_H_
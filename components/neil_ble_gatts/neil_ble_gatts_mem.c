@@ -0,0 +1,356 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_mem.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Heap footprint accounting and placement implementation.
+
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "multi_heap.h"
+
+#include "neil_ble_gatts_conn.h"
+#include "neil_ble_gatts_demand.h"
+#include "neil_ble_gatts_mem.h"
+#include "neil_ble_gatts_persist.h"
+#include "neil_ble_gatts_poll.h"
+#include "neil_ble_gatts_stack.h"
+
+#if NEIL_BLE_GATTS_STACK_NIMBLE
+#include "neil_ble_gatts_nimble_db.h"
+#else
+#include "neil_ble_gatts_attr_db.h"
+#include "neil_ble_gatts_handle_map.h"
+#include "neil_ble_gatts_write.h"
+#endif
+
+static const char *const TAG = "neil_ble_gatts_mem";
+
+// -------------------------------------------------------------
+// Allocation Header
+// -------------------------------------------------------------
+
+/**
+ * @brief       Prefix stored in front of every block.
+ *
+ *              Records the requested size so `free` can be accounted without
+ *              relying on allocator internals. The union keeps the payload
+ *              8-byte aligned.
+ */
+typedef union {
+    size_t size;
+    long long align;
+} mem_hdr_t;
+
+// -------------------------------------------------------------
+// Counters
+// -------------------------------------------------------------
+
+static const char *const SUBSYS_NAMES[NEIL_BLE_GATTS_MEM_MAX] = {
+    [NEIL_BLE_GATTS_MEM_ATTR_DB]    = "attr_db",
+    [NEIL_BLE_GATTS_MEM_HANDLE_MAP] = "handle_map",
+    [NEIL_BLE_GATTS_MEM_UTIL]       = "util",
+    [NEIL_BLE_GATTS_MEM_CONN]       = "conn",
+    [NEIL_BLE_GATTS_MEM_TRACE]      = "trace",
+    [NEIL_BLE_GATTS_MEM_NOTIFY]     = "notify",
+    [NEIL_BLE_GATTS_MEM_HISTORY]    = "history",
+    [NEIL_BLE_GATTS_MEM_WRITE]      = "write",
+    [NEIL_BLE_GATTS_MEM_LOG]        = "log",
+    [NEIL_BLE_GATTS_MEM_POLL]       = "poll",
+    [NEIL_BLE_GATTS_MEM_DEMAND]     = "demand",
+    [NEIL_BLE_GATTS_MEM_PERSIST]    = "persist",
+    [NEIL_BLE_GATTS_MEM_DEPTH]      = "depth",
+};
+
+static neil_ble_gatts_mem_stats_t subsys_stats[NEIL_BLE_GATTS_MEM_MAX];
+
+// --- Whole-component usage (peak is tracked separately from the subsystems)
+static neil_ble_gatts_mem_stats_t total_stats;
+
+// --- Allocations happen on both the BTC task and application tasks.
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void stats_charge(neil_ble_gatts_mem_subsys_t subsys, size_t size) {
+    portENTER_CRITICAL(&stats_lock);
+
+    neil_ble_gatts_mem_stats_t *stats = &subsys_stats[subsys];
+
+    stats->used += size;
+    stats->allocs++;
+    if (stats->used > stats->peak) {
+        stats->peak = stats->used;
+    }
+
+    total_stats.used += size;
+    total_stats.allocs++;
+    if (total_stats.used > total_stats.peak) {
+        total_stats.peak = total_stats.used;
+    }
+
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+static void stats_credit(neil_ble_gatts_mem_subsys_t subsys, size_t size) {
+    portENTER_CRITICAL(&stats_lock);
+    subsys_stats[subsys].used -= size;
+    total_stats.used -= size;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+static void stats_fail(neil_ble_gatts_mem_subsys_t subsys) {
+    portENTER_CRITICAL(&stats_lock);
+    subsys_stats[subsys].failures++;
+    total_stats.failures++;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+// -------------------------------------------------------------
+// Placement
+// -------------------------------------------------------------
+
+static uint32_t subsys_caps[NEIL_BLE_GATTS_MEM_MAX] = {
+    [0 ... NEIL_BLE_GATTS_MEM_MAX - 1] = MALLOC_CAP_DEFAULT,
+};
+
+// --- Only attached or detached while no block is held, so every live block
+//     comes from the current source.
+static multi_heap_handle_t arena = NULL;
+
+// --- multi_heap takes the caller's lock for concurrent access
+static portMUX_TYPE arena_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void *block_alloc(neil_ble_gatts_mem_subsys_t subsys, size_t size) {
+    return arena != NULL ? multi_heap_malloc(arena, size)
+                         : heap_caps_malloc(size, subsys_caps[subsys]);
+}
+
+static void block_free(void *block) {
+    if (arena != NULL) {
+        multi_heap_free(arena, block);
+    } else {
+        heap_caps_free(block);
+    }
+}
+
+esp_err_t neil_ble_gatts_mem_set_caps(neil_ble_gatts_mem_subsys_t subsys,
+                                      uint32_t caps) {
+
+    if (subsys >= NEIL_BLE_GATTS_MEM_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    subsys_caps[subsys] = caps;
+
+    return ESP_OK;
+}
+
+esp_err_t neil_ble_gatts_mem_set_arena(void *buf, size_t len) {
+
+    if (buf != NULL && len <= NEIL_BLE_GATTS_MEM_ARENA_SLACK) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    portENTER_CRITICAL(&stats_lock);
+    const size_t used = total_stats.used;
+    portEXIT_CRITICAL(&stats_lock);
+
+    if (used != 0) {
+        ESP_LOGE(TAG, "Arena change with %u bytes held", (unsigned)used);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (buf == NULL) {
+        arena = NULL;
+        return ESP_OK;
+    }
+
+    multi_heap_handle_t heap = multi_heap_register(buf, len);
+
+    if (heap == NULL) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    multi_heap_set_lock(heap, &arena_lock);
+    arena = heap;
+
+    return ESP_OK;
+}
+
+esp_err_t neil_ble_gatts_mem_get_arena_free(size_t *free_now, size_t *free_min) {
+
+    if (arena == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (free_now != NULL) {
+        *free_now = multi_heap_free_size(arena);
+    }
+    if (free_min != NULL) {
+        *free_min = multi_heap_minimum_free_size(arena);
+    }
+
+    return ESP_OK;
+}
+
+// -------------------------------------------------------------
+// Allocation
+// -------------------------------------------------------------
+
+void *neil_ble_gatts_mem_alloc(neil_ble_gatts_mem_subsys_t subsys, size_t size) {
+
+    if (subsys >= NEIL_BLE_GATTS_MEM_MAX) {
+        return NULL;
+    }
+
+    const size_t block_size = sizeof(mem_hdr_t) + size;
+
+    mem_hdr_t *hdr = block_alloc(subsys, block_size);
+
+    if (hdr == NULL) {
+        stats_fail(subsys);
+        return NULL;
+    }
+
+    hdr->size = block_size;
+    stats_charge(subsys, block_size);
+
+    return hdr + 1;
+}
+
+void *neil_ble_gatts_mem_calloc(neil_ble_gatts_mem_subsys_t subsys, size_t count,
+                                size_t size) {
+
+    // --- Guard against multiplication overflow
+    if (size != 0 && count > SIZE_MAX / size) {
+        stats_fail(subsys);
+        return NULL;
+    }
+
+    void *ptr = neil_ble_gatts_mem_alloc(subsys, count * size);
+
+    if (ptr != NULL) {
+        memset(ptr, 0, count * size);
+    }
+
+    return ptr;
+}
+
+void neil_ble_gatts_mem_free(neil_ble_gatts_mem_subsys_t subsys, void *ptr) {
+
+    if (ptr == NULL || subsys >= NEIL_BLE_GATTS_MEM_MAX) {
+        return;
+    }
+
+    mem_hdr_t *hdr = (mem_hdr_t *)ptr - 1;
+
+    stats_credit(subsys, hdr->size);
+    block_free(hdr);
+}
+
+// -------------------------------------------------------------
+// Reporting
+// -------------------------------------------------------------
+
+esp_err_t neil_ble_gatts_mem_get_stats(neil_ble_gatts_mem_subsys_t subsys,
+                                       neil_ble_gatts_mem_stats_t *stats) {
+
+    if (subsys >= NEIL_BLE_GATTS_MEM_MAX || stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&stats_lock);
+    *stats = subsys_stats[subsys];
+    portEXIT_CRITICAL(&stats_lock);
+
+    return ESP_OK;
+}
+
+void neil_ble_gatts_mem_get_total(neil_ble_gatts_mem_stats_t *stats) {
+    portENTER_CRITICAL(&stats_lock);
+    *stats = total_stats;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void neil_ble_gatts_mem_reset_peak(void) {
+    portENTER_CRITICAL(&stats_lock);
+    for (uint8_t idx = 0; idx < NEIL_BLE_GATTS_MEM_MAX; idx++) {
+        subsys_stats[idx].peak = subsys_stats[idx].used;
+    }
+    total_stats.peak = total_stats.used;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void neil_ble_gatts_mem_dump(const char *const tag) {
+
+    neil_ble_gatts_mem_stats_t stats;
+
+    for (uint8_t idx = 0; idx < NEIL_BLE_GATTS_MEM_MAX; idx++) {
+        neil_ble_gatts_mem_get_stats(idx, &stats);
+        ESP_LOGI(tag, "%-10s used %6u peak %6u allocs %" PRIu32 " failures %" PRIu32,
+                 SUBSYS_NAMES[idx], (unsigned)stats.used, (unsigned)stats.peak,
+                 stats.allocs, stats.failures);
+    }
+
+    neil_ble_gatts_mem_get_total(&stats);
+    ESP_LOGI(tag, "%-10s used %6u peak %6u allocs %" PRIu32 " failures %" PRIu32,
+             "total", (unsigned)stats.used, (unsigned)stats.peak, stats.allocs,
+             stats.failures);
+}
+
+// -------------------------------------------------------------
+// Estimation
+// -------------------------------------------------------------
+
+/**
+ * @brief       Heap taken by a subsystem that allocates only when the
+ *              configuration uses it.
+ */
+static size_t optional_cost(size_t footprint, size_t alloc_count) {
+    return footprint > 0 ? footprint + alloc_count * sizeof(mem_hdr_t) : 0;
+}
+
+size_t neil_ble_gatts_mem_estimate(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    if (dev_cfg == NULL) {
+        return 0;
+    }
+
+    size_t total = 0;
+
+    // --- Each subsystem reports its payload and allocation count,
+    //     every allocation additionally carries one accounting header.
+#if NEIL_BLE_GATTS_STACK_NIMBLE
+    total += neil_ble_gatts_nimble_db_footprint(dev_cfg) +
+             NEIL_BLE_GATTS_NIMBLE_DB_ALLOC_COUNT * sizeof(mem_hdr_t);
+#else
+    total += neil_ble_gatts_attr_db_footprint(dev_cfg) +
+             NEIL_BLE_GATTS_ATTR_DB_ALLOC_COUNT * sizeof(mem_hdr_t);
+
+    total += neil_ble_gatts_handle_map_footprint(dev_cfg) +
+             NEIL_BLE_GATTS_HANDLE_MAP_ALLOC_COUNT * sizeof(mem_hdr_t);
+
+    // --- Any client may prepare a write, each connection holding one buffer
+    total += neil_ble_gatts_write_footprint() +
+             NEIL_BLE_GATTS_CONN_MAX * sizeof(mem_hdr_t);
+#endif
+
+    total += neil_ble_gatts_conn_footprint() +
+             NEIL_BLE_GATTS_CONN_ALLOC_COUNT * sizeof(mem_hdr_t);
+
+    total += optional_cost(neil_ble_gatts_persist_footprint(dev_cfg),
+                           NEIL_BLE_GATTS_PERSIST_ALLOC_COUNT);
+
+    total += optional_cost(neil_ble_gatts_poll_footprint(dev_cfg),
+                           NEIL_BLE_GATTS_POLL_ALLOC_COUNT);
+
+    total += optional_cost(neil_ble_gatts_demand_footprint(dev_cfg),
+                           NEIL_BLE_GATTS_DEMAND_ALLOC_COUNT);
+
+    return total;
+}
@@ -0,0 +1,172 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_mem.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Heap footprint accounting and placement API.
+///
+///             By default blocks come from the general heap. The application
+///             may instead place each subsystem with heap capabilities (e.g.
+///             hot queues in internal RAM, cold tables in PSRAM), or hand the
+///             component one arena that every block is carved from.
+
+#ifndef neil_ble_gatts_MEM_H_
+#define neil_ble_gatts_MEM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+
+#include "neil_ble_gatts_cfg.h"
+
+// -------------------------------------------------------------
+// Domain Structures
+// -------------------------------------------------------------
+
+/**
+ * @brief       Component subsystems that own heap memory.
+ *
+ *              Every allocation made by the component is charged to exactly
+ *              one subsystem.
+ */
+typedef enum {
+    NEIL_BLE_GATTS_MEM_ATTR_DB = 0, ///< GATT attribute table (service definitions).
+    NEIL_BLE_GATTS_MEM_HANDLE_MAP,  ///< Handle-to-configuration map.
+    NEIL_BLE_GATTS_MEM_UTIL,        ///< Transient diagnostics (bonded-device list).
+    NEIL_BLE_GATTS_MEM_CONN,        ///< Connection state table.
+    NEIL_BLE_GATTS_MEM_TRACE,       ///< Event trace ring (optional).
+    NEIL_BLE_GATTS_MEM_NOTIFY,      ///< Queued notification payloads.
+    NEIL_BLE_GATTS_MEM_HISTORY,     ///< Time-series history rings (optional).
+    NEIL_BLE_GATTS_MEM_WRITE,       ///< Prepared (long) write buffers.
+    NEIL_BLE_GATTS_MEM_LOG,         ///< Deferred log ring (optional).
+    NEIL_BLE_GATTS_MEM_POLL,        ///< Polled characteristic samples (optional).
+    NEIL_BLE_GATTS_MEM_DEMAND,      ///< Watched characteristics (optional).
+    NEIL_BLE_GATTS_MEM_PERSIST,     ///< Persistent characteristic values (optional).
+    NEIL_BLE_GATTS_MEM_DEPTH,       ///< Callback stack depth tables (optional).
+    NEIL_BLE_GATTS_MEM_MAX,
+} neil_ble_gatts_mem_subsys_t;
+
+/**
+ * @brief       Heap usage counters for one subsystem.
+ */
+typedef struct {
+    size_t used;       ///< Bytes currently held (including accounting overhead).
+    size_t peak;       ///< High-water mark of `used`.
+    uint32_t allocs;   ///< Number of successful allocations.
+    uint32_t failures; ///< Number of failed allocations.
+} neil_ble_gatts_mem_stats_t;
+
+/// Arena bytes taken by allocator bookkeeping rather than blocks; add it to
+/// the estimate when sizing an arena.
+#define NEIL_BLE_GATTS_MEM_ARENA_SLACK 2048
+
+// -------------------------------------------------------------
+// Placement
+// -------------------------------------------------------------
+
+/**
+ * @brief       Place future blocks of `subsys` with `heap_caps_malloc(caps)`.
+ *
+ *              Defaults to MALLOC_CAP_DEFAULT. Ignored while an arena is set.
+ */
+esp_err_t neil_ble_gatts_mem_set_caps(neil_ble_gatts_mem_subsys_t subsys,
+                                      uint32_t caps);
+
+/**
+ * @brief       Carve every component block from `len` bytes at `buf`.
+ *
+ *              Gives a fixed, unfragmented footprint: size the arena from
+ *              `neil_ble_gatts_mem_estimate`, the runtime buffers the
+ *              application enables and NEIL_BLE_GATTS_MEM_ARENA_SLACK.
+ *              Allocations beyond it fail rather than fall back to the heap.
+ *
+ *              The block stays the application's. Pass NULL to detach it once
+ *              the component holds nothing (e.g. after a memory-releasing
+ *              `neil_ble_gatts_stop`), then reuse or free it as a unit.
+ *
+ * @return      ESP_ERR_INVALID_STATE if the component currently holds memory.
+ */
+esp_err_t neil_ble_gatts_mem_set_arena(void *buf, size_t len);
+
+/**
+ * @brief       Get the free bytes of the arena, now and at the lowest point.
+ *
+ * @return      ESP_ERR_INVALID_STATE if no arena is set.
+ */
+esp_err_t neil_ble_gatts_mem_get_arena_free(size_t *free_now, size_t *free_min);
+
+// -------------------------------------------------------------
+// Allocation (component-internal)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Allocate `size` bytes charged to `subsys`.
+ *
+ * @return      NULL on failure.
+ */
+void *neil_ble_gatts_mem_alloc(neil_ble_gatts_mem_subsys_t subsys, size_t size);
+
+/**
+ * @brief       Allocate and zero `count * size` bytes charged to `subsys`.
+ *
+ * @return      NULL on failure.
+ */
+void *neil_ble_gatts_mem_calloc(neil_ble_gatts_mem_subsys_t subsys, size_t count,
+                                size_t size);
+
+/**
+ * @brief       Release memory obtained from `neil_ble_gatts_mem_alloc`.
+ *
+ *              NULL is accepted and ignored.
+ */
+void neil_ble_gatts_mem_free(neil_ble_gatts_mem_subsys_t subsys, void *ptr);
+
+// -------------------------------------------------------------
+// Reporting
+// -------------------------------------------------------------
+
+/**
+ * @brief       Get a snapshot of the counters for one subsystem.
+ */
+esp_err_t neil_ble_gatts_mem_get_stats(neil_ble_gatts_mem_subsys_t subsys,
+                                       neil_ble_gatts_mem_stats_t *stats);
+
+/**
+ * @brief       Get a snapshot of the counters summed over all subsystems.
+ *
+ *              The total `peak` is the high-water mark of the component as a
+ *              whole, not the sum of the per-subsystem peaks.
+ */
+void neil_ble_gatts_mem_get_total(neil_ble_gatts_mem_stats_t *stats);
+
+/**
+ * @brief       Reset the high-water marks to the current usage.
+ */
+void neil_ble_gatts_mem_reset_peak(void);
+
+/**
+ * @brief       Log the counters of every subsystem.
+ */
+void neil_ble_gatts_mem_dump(const char *const tag);
+
+/**
+ * @brief       Estimate the heap a device configuration will hold while the
+ *              server is running.
+ *
+ *              Computed from the configuration alone, so it can be called
+ *              before `neil_ble_gatts_start` to budget RAM per product variant.
+ *              Polled characteristics are counted whether or not they pass
+ *              validation, and on Bluedroid a prepared write on every
+ *              connection. Covers component allocations only; controller and
+ *              host stack memory is not included, nor are runtime buffers the
+ *              caller enables or sizes (the event trace ring, the depth event
+ *              tables, history rings, queued notifications).
+ */
+size_t neil_ble_gatts_mem_estimate(const neil_ble_gatts_cfg_dev_t *dev_cfg);
+
+#endif // neil_ble_gatts_MEM_H_
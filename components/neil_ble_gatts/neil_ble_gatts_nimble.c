@@ -0,0 +1,1278 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_nimble.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      NimBLE backend of the GATT Server.
+///
+///             Implements `neil_ble_gatts.h` on the NimBLE host, built instead
+///             of `neil_ble_gatts.c` when NimBLE is selected in menuconfig.
+///             Services are registered from the same device configuration
+///             (`neil_ble_gatts_nimble_db.h`), and every callback runs on the
+///             NimBLE host task.
+///
+///             Differences from Bluedroid:
+///               - Client configuration descriptors and prepared writes are
+///                 handled by NimBLE, the application sees complete values.
+///               - Reads are answered within the access callback, so deferred
+///                 reads (`on_read_async`) are rejected at start.
+///               - There is no congestion event; a notification the host has
+///                 no buffer for waits for the next completed send.
+///               - Event tracing (`neil_ble_gatts_trace.h`) is not available.
+///               - L2CAP channels (`neil_ble_gatts_l2cap.h`) are NimBLE-only.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_bt.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host/ble_hs.h"
+#include "host/util/util.h"
+#include "nimble/nimble_port.h"
+#include "nimble/nimble_port_freertos.h"
+#include "services/gap/ble_svc_gap.h"
+#include "services/gatt/ble_svc_gatt.h"
+
+#include "neil_ble_gatts.h"
+#include "neil_ble_gatts_admit.h"
+#include "neil_ble_gatts_cfg.h"
+#include "neil_ble_gatts_conn.h"
+#include "neil_ble_gatts_demand.h"
+#include "neil_ble_gatts_depth.h"
+#include "neil_ble_gatts_journal.h"
+#include "neil_ble_gatts_l2cap.h"
+#include "neil_ble_gatts_link.h"
+#include "neil_ble_gatts_log.h"
+#include "neil_ble_gatts_nimble_db.h"
+#include "neil_ble_gatts_notify.h"
+#include "neil_ble_gatts_persist.h"
+#include "neil_ble_gatts_pipe.h"
+#include "neil_ble_gatts_poll.h"
+#include "neil_ble_gatts_read.h"
+#include "neil_ble_gatts_stack.h"
+
+// NOTE: Not exported by the NimBLE headers.
+void ble_store_config_init(void);
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+static const char *const TAG = "NEIL BLE GATTS";
+
+// Time allowed for peers to disconnect on stop.
+static const uint32_t STOP_TIMEOUT_MS = 1000;
+
+// Interval used when polling for peers to disconnect on stop.
+static const uint32_t STOP_POLL_MS = 10;
+
+// Advertising interval (0.625 ms units), as on Bluedroid.
+static const uint16_t ADV_ITVL = 0x100;
+
+// Preferred slave connection interval range (1.25 ms units), as on Bluedroid.
+static const uint8_t ADV_SLAVE_ITVL[4] = {0x06, 0x00, 0x10, 0x00};
+
+/// Most service UUIDs of each size considered for advertising.
+#define ADV_SVC_UUID_MAX 8
+
+/// Legacy advertising payload bytes left for service UUID lists, after
+/// flags (3), TX power (3) and slave connection interval (6).
+#define ADV_SVC_UUID_BUDGET (BLE_HS_ADV_MAX_SZ - 3 - 3 - 6)
+
+// -------------------------------------------------------------
+// Security Settings (menuconfig)
+// -------------------------------------------------------------
+
+#if CONFIG_NEIL_BLE_GATTS_SEC_NO_BOND
+#define SEC_BONDING 0
+#define SEC_MITM    0
+#define SEC_SC      0
+#elif CONFIG_NEIL_BLE_GATTS_SEC_LEGACY_BOND
+#define SEC_BONDING 1
+#define SEC_MITM    0
+#define SEC_SC      0
+#elif CONFIG_NEIL_BLE_GATTS_SEC_SC_BOND
+#define SEC_BONDING 1
+#define SEC_MITM    0
+#define SEC_SC      1
+#else
+#define SEC_BONDING 1
+#define SEC_MITM    1
+#define SEC_SC      1
+#endif
+
+#if CONFIG_NEIL_BLE_GATTS_IO_CAP_DISPLAY
+#define SEC_IO_CAP BLE_SM_IO_CAP_DISP_ONLY
+#else
+#define SEC_IO_CAP BLE_SM_IO_CAP_NO_IO
+#endif
+
+// Passkey shown when pairing requires one.
+#ifdef CONFIG_NEIL_BLE_GATTS_PASSKEY
+static const uint32_t STATIC_PASSKEY = CONFIG_NEIL_BLE_GATTS_PASSKEY;
+#else
+static const uint32_t STATIC_PASSKEY = 123456;
+#endif
+
+// -------------------------------------------------------------
+// Server State
+// -------------------------------------------------------------
+
+/**
+ * @brief       Lifecycle of the GATT Server.
+ */
+typedef enum {
+    SERVER_STOPPED = 0, ///< Stack is down, may be (re)started.
+    SERVER_RUNNING,     ///< Stack is up and serving.
+    SERVER_STOPPING,    ///< Teardown in progress, do not re-advertise.
+    SERVER_RELEASED,    ///< Controller memory released, cannot restart.
+} server_state_t;
+
+/**
+ * @brief       GATT Server context.
+ */
+struct neil_ble_gatts_ctx_s {
+    const neil_ble_gatts_cfg_dev_t *dev_cfg; ///< Device configuration.
+    server_state_t state;
+
+    // --- Service definitions, kept across a warm stop for a restart to reuse
+    neil_ble_gatts_nimble_db_t *svc_db;
+};
+
+// --- The only context: NimBLE registers every service before its host starts.
+static neil_ble_gatts_ctx_t ctx_main;
+
+// --- Address type inferred once the host has synchronized.
+static uint8_t own_addr_type;
+
+// --- Classic BT memory can only be released once.
+static bool classic_mem_released = false;
+
+// --- Characteristic values are staged here; access callbacks only run on the
+//     host task, one at a time.
+static uint8_t value_buf[ESP_GATT_MAX_ATTR_LEN];
+
+// -------------------------------------------------------------
+// Prototypes
+// -------------------------------------------------------------
+
+static int gap_event_callback(struct ble_gap_event *event, void *arg);
+static int chr_access_callback(uint16_t conn_handle, uint16_t attr_handle,
+                               struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+// -------------------------------------------------------------
+// Dependency Management
+// -------------------------------------------------------------
+
+/**
+ * @brief       Find the service owning a characteristic configuration.
+ */
+static const neil_ble_gatts_cfg_svc_t *
+svc_config_of(const neil_ble_gatts_cfg_chr_t *chr_cfg) {
+
+    for (uint8_t svc_idx = 0; svc_idx < ctx_main.dev_cfg->svc_tab_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = ctx_main.dev_cfg->svc_tab + svc_idx;
+
+        if (chr_cfg >= svc_cfg->chr_tab &&
+            chr_cfg < svc_cfg->chr_tab + svc_cfg->chr_tab_len) {
+            return svc_cfg;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief       Release the service definitions.
+ */
+static void tables_clear() {
+    neil_ble_gatts_nimble_db_deinit(ctx_main.svc_db);
+    ctx_main.svc_db = NULL;
+}
+
+// -------------------------------------------------------------
+// Advertising
+// -------------------------------------------------------------
+
+/**
+ * @brief       Sort service UUIDs into the advertised 16/32/128-bit lists.
+ *
+ *              Services are taken in configuration order while the encoded
+ *              lists fit the legacy advertising payload; the rest are left to
+ *              discovery.
+ */
+static void adv_svc_uuid_merge(struct ble_hs_adv_fields *fields) {
+
+    static ble_uuid16_t uuids16[ADV_SVC_UUID_MAX];
+    static ble_uuid32_t uuids32[ADV_SVC_UUID_MAX];
+    static ble_uuid128_t uuids128[ADV_SVC_UUID_MAX];
+
+    uint8_t payload = 0;
+
+    for (uint8_t svc_idx = 0; svc_idx < ctx_main.dev_cfg->svc_tab_len; svc_idx++) {
+        const ble_uuid_t *uuid = ctx_main.svc_db->svc_tab[svc_idx].uuid;
+
+        // --- Entry cost, a new list also costs its length and type bytes
+        const uint8_t *count = uuid->type == BLE_UUID_TYPE_16   ? &fields->num_uuids16
+                               : uuid->type == BLE_UUID_TYPE_32 ? &fields->num_uuids32
+                                                                : &fields->num_uuids128;
+        const uint8_t cost   = uuid->type / 8 + (*count ? 0 : 2);
+
+        if (*count == ADV_SVC_UUID_MAX || payload + cost > ADV_SVC_UUID_BUDGET) {
+            ESP_LOGW(TAG, "Service (%d) UUID does not fit advertising data", svc_idx);
+            continue;
+        }
+
+        payload += cost;
+
+        switch (uuid->type) {
+        case BLE_UUID_TYPE_16:
+            uuids16[fields->num_uuids16++] = *BLE_UUID16(uuid);
+            break;
+        case BLE_UUID_TYPE_32:
+            uuids32[fields->num_uuids32++] = *BLE_UUID32(uuid);
+            break;
+        default:
+            uuids128[fields->num_uuids128++] = *BLE_UUID128(uuid);
+            break;
+        }
+    }
+
+    fields->uuids16              = uuids16;
+    fields->uuids16_is_complete  = fields->num_uuids16 > 0;
+    fields->uuids32              = uuids32;
+    fields->uuids32_is_complete  = fields->num_uuids32 > 0;
+    fields->uuids128             = uuids128;
+    fields->uuids128_is_complete = fields->num_uuids128 > 0;
+}
+
+/**
+ * @brief       Configure advertising and scan response data, then advertise.
+ *
+ *              Same content as on Bluedroid: flags, TX power, connection
+ *              interval and service UUIDs advertised, name and manufacturer
+ *              data in the scan response. Service-only configurations do not
+ *              advertise.
+ */
+static void advertise(void) {
+
+    if (ctx_main.dev_cfg->service_only) {
+        return;
+    }
+
+    struct ble_hs_adv_fields fields = {
+        .flags                 = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP,
+        .tx_pwr_lvl_is_present = 1,
+        .tx_pwr_lvl            = BLE_HS_ADV_TX_PWR_LVL_AUTO,
+        .slave_itvl_range      = ADV_SLAVE_ITVL,
+    };
+
+    adv_svc_uuid_merge(&fields);
+
+    int rc = ble_gap_adv_set_fields(&fields);
+    if (rc != 0) {
+        ESP_LOGE(TAG, "config adv data failed, error code = %x", rc);
+        return;
+    }
+
+    struct ble_hs_adv_fields rsp_fields = {
+        .name             = (const uint8_t *)ctx_main.dev_cfg->name,
+        .name_len         = strlen(ctx_main.dev_cfg->name),
+        .name_is_complete = 1,
+        .mfg_data         = (const uint8_t *)ctx_main.dev_cfg->mfr,
+        .mfg_data_len     = ctx_main.dev_cfg->mfr_len,
+    };
+
+    rc = ble_gap_adv_rsp_set_fields(&rsp_fields);
+    if (rc != 0) {
+        ESP_LOGE(TAG, "config scan rsp data failed, error code = %x", rc);
+        return;
+    }
+
+    const struct ble_gap_adv_params adv_params = {
+        .conn_mode = BLE_GAP_CONN_MODE_UND,
+        .disc_mode = BLE_GAP_DISC_MODE_GEN,
+        .itvl_min  = ADV_ITVL,
+        .itvl_max  = ADV_ITVL,
+    };
+
+    rc = ble_gap_adv_start(own_addr_type, NULL, BLE_HS_FOREVER, &adv_params,
+                           gap_event_callback, NULL);
+
+    NEIL_BLE_GATTS_LOG(GAP_ADV_START, rc, 0, 0);
+
+    if (rc != 0) {
+        ESP_LOGE(TAG, "advertising start failed, error status = %x", rc);
+    }
+}
+
+// -------------------------------------------------------------
+// Host Callbacks
+// -------------------------------------------------------------
+
+/**
+ * @brief       Host and controller are in sync, advertising may start.
+ */
+static void on_sync(void) {
+
+    ble_hs_util_ensure_addr(0);
+
+    if (ble_hs_id_infer_auto(0, &own_addr_type) != 0) {
+        ESP_LOGE(TAG, "Unable to determine address type");
+        return;
+    }
+
+    if (ctx_main.state == SERVER_RUNNING) {
+        advertise();
+    }
+}
+
+static void on_reset(int reason) { ESP_LOGW(TAG, "Host reset, reason %d", reason); }
+
+/**
+ * @brief       Body of the NimBLE host task, returns once the host stops.
+ */
+static void host_task(void *param) {
+    nimble_port_run();
+    nimble_port_freertos_deinit();
+}
+
+// -------------------------------------------------------------
+// Initialization / Deinitialization
+// -------------------------------------------------------------
+
+/**
+ * @brief       Configure GAP security from menuconfig, as the Bluedroid backend.
+ */
+static void security_configure(void) {
+    ble_hs_cfg.sm_io_cap         = SEC_IO_CAP;
+    ble_hs_cfg.sm_bonding        = SEC_BONDING;
+    ble_hs_cfg.sm_mitm           = SEC_MITM;
+    ble_hs_cfg.sm_sc             = SEC_SC;
+    ble_hs_cfg.sm_our_key_dist   = BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID;
+    ble_hs_cfg.sm_their_key_dist = BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID;
+}
+
+/**
+ * @brief       Bring up the controller and NimBLE, register the services
+ *              and start the host task.
+ *
+ *              Advertising starts from the host task once it has synchronized
+ *              with the controller.
+ */
+static esp_err_t stack_init() {
+
+    esp_err_t ret;
+
+    // ---------------------------------
+    // Memory Release
+    // ---------------------------------
+
+    // --- Release Heap Memory from unused bluetooth mode
+    if (!classic_mem_released) {
+        ret = esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Classic BT memory release failed: %s", esp_err_to_name(ret));
+            return ret;
+        }
+        classic_mem_released = true;
+    }
+
+    // ---------------------------------
+    // Connection Table
+    // ---------------------------------
+
+    ret = neil_ble_gatts_conn_init();
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    // ---------------------------------
+    // Service Definitions
+    // ---------------------------------
+
+    // --- Reused after a warm stop
+    if (ctx_main.svc_db == NULL) {
+        ctx_main.svc_db =
+            neil_ble_gatts_nimble_db_init(ctx_main.dev_cfg, chr_access_callback);
+    }
+
+    if (ctx_main.svc_db == NULL) {
+        ESP_LOGE(TAG, "Unable to build service definitions");
+        neil_ble_gatts_conn_deinit();
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // ---------------------------------
+    // Controller and Host
+    // ---------------------------------
+
+    ret = nimble_port_init();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "NimBLE initialization failed: %s", esp_err_to_name(ret));
+        neil_ble_gatts_conn_deinit();
+        return ret;
+    }
+
+    ble_hs_cfg.sync_cb         = on_sync;
+    ble_hs_cfg.reset_cb        = on_reset;
+    ble_hs_cfg.store_status_cb = ble_store_util_status_rr;
+
+    security_configure();
+
+    // ---------------------------------
+    // Services
+    // ---------------------------------
+
+    ble_svc_gap_init();
+    ble_svc_gatt_init();
+
+    int rc = ble_gatts_count_cfg(ctx_main.svc_db->svc_tab);
+    if (rc == 0) {
+        rc = ble_gatts_add_svcs(ctx_main.svc_db->svc_tab);
+    }
+
+    if (rc != 0) {
+        ESP_LOGE(TAG, "Service registration failed: %d", rc);
+        nimble_port_deinit();
+        neil_ble_gatts_conn_deinit();
+        return ESP_FAIL;
+    }
+
+    ble_svc_gap_device_name_set(ctx_main.dev_cfg->name);
+
+    ble_store_config_init();
+
+    // ---------------------------------
+    // L2CAP Channels
+    // ---------------------------------
+
+    if (ctx_main.dev_cfg->l2cap != NULL) {
+        ret = neil_ble_gatts_l2cap_init(ctx_main.dev_cfg->l2cap);
+        if (ret != ESP_OK) {
+            nimble_port_deinit();
+            neil_ble_gatts_conn_deinit();
+            return ret;
+        }
+    }
+
+    // ---------------------------------
+    // Host Task
+    // ---------------------------------
+
+    ctx_main.state = SERVER_RUNNING;
+
+    nimble_port_freertos_init(host_task);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief       Stop the host task, then tear down NimBLE and the controller.
+ */
+static esp_err_t stack_deinit() {
+
+    esp_err_t ret = ESP_OK;
+
+    if (nimble_port_stop() != 0) {
+        ret = ESP_FAIL;
+    }
+
+    esp_err_t deinit = nimble_port_deinit();
+    ret              = ret == ESP_OK ? deinit : ret;
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Stack teardown error: %s", esp_err_to_name(ret));
+    }
+
+    return ret;
+}
+
+/**
+ * @brief       Release what `ctx_attach` set up for the context.
+ */
+static void ctx_detach(neil_ble_gatts_ctx_t *ctx) {
+    if (!ctx->dev_cfg->service_only) {
+        neil_ble_gatts_admit_deinit();
+    }
+    neil_ble_gatts_demand_detach(ctx);
+    neil_ble_gatts_poll_detach(ctx);
+    neil_ble_gatts_persist_detach(ctx);
+}
+
+/**
+ * @brief       Set up the optional features the configuration uses:
+ *              persistent values (restored through `on_write`), polling,
+ *              demand signals and admission control, once command pipes and
+ *              the change journal are known to be built.
+ *
+ * @return      The first error, with nothing left attached. Features left out
+ *              in menuconfig report ESP_ERR_NOT_SUPPORTED when used.
+ */
+static esp_err_t ctx_attach(neil_ble_gatts_ctx_t *ctx) {
+
+    // --- Checks first, then stored values are the application's before a
+    //     client can connect
+    esp_err_t ret = neil_ble_gatts_pipe_check(ctx->dev_cfg);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Command pipes cannot run: %s", esp_err_to_name(ret));
+    } else if ((ret = neil_ble_gatts_journal_check(ctx->dev_cfg)) != ESP_OK) {
+        ESP_LOGE(TAG, "Change journal cannot be served: %s", esp_err_to_name(ret));
+    } else if ((ret = neil_ble_gatts_persist_attach(ctx, ctx->dev_cfg)) != ESP_OK) {
+        ESP_LOGE(TAG, "Persistent values cannot be kept: %s", esp_err_to_name(ret));
+    } else if ((ret = neil_ble_gatts_poll_attach(ctx, ctx->dev_cfg)) != ESP_OK) {
+        ESP_LOGE(TAG, "Polled characteristics cannot be sampled: %s",
+                 esp_err_to_name(ret));
+    } else if ((ret = neil_ble_gatts_demand_attach(ctx, ctx->dev_cfg)) != ESP_OK) {
+        ESP_LOGE(TAG, "Demand cannot be published: %s", esp_err_to_name(ret));
+    } else if (!ctx->dev_cfg->service_only &&
+               (ret = neil_ble_gatts_admit_init(ctx->dev_cfg->admit)) != ESP_OK) {
+        ESP_LOGE(TAG, "Admission control cannot start: %s", esp_err_to_name(ret));
+    }
+
+    if (ret != ESP_OK) {
+        ctx_detach(ctx);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief       Set up the features of the configuration, then bring up the
+ *              stack.
+ *
+ * @return      An error of `ctx_attach` or of the stack, the context then
+ *              stays stopped.
+ */
+static esp_err_t ctx_stack_init(neil_ble_gatts_ctx_t *ctx) {
+
+    esp_err_t ret = ctx_attach(ctx);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ret = stack_init();
+    if (ret != ESP_OK) {
+        ctx_detach(ctx);
+        return ret;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief       Bind the context to a configuration and bring up the stack.
+ */
+static esp_err_t ctx_start(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    if (ctx_main.state != SERVER_STOPPED) {
+        ESP_LOGE(TAG, "Server already started or memory released");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // --- Tables cached by a warm stop only apply to the same configuration
+    if (dev_cfg != ctx_main.dev_cfg) {
+        tables_clear();
+    }
+
+    ctx_main.dev_cfg = dev_cfg;
+
+    return ctx_stack_init(&ctx_main);
+}
+
+neil_ble_gatts_ctx_t *
+neil_ble_gatts_ctx_start(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+    return ctx_start(dev_cfg) == ESP_OK ? &ctx_main : NULL;
+}
+
+esp_err_t neil_ble_gatts_ctx_restart(neil_ble_gatts_ctx_t *ctx) {
+
+    if (ctx != &ctx_main || ctx->state != SERVER_STOPPED || ctx->dev_cfg == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ESP_LOGI(TAG, "Restarting (%s tables)", ctx->svc_db != NULL ? "cached" : "fresh");
+
+    return ctx_stack_init(ctx);
+}
+
+esp_err_t neil_ble_gatts_ctx_stop(neil_ble_gatts_ctx_t *ctx,
+                                  neil_ble_gatts_stop_mode_t mode) {
+
+    if (ctx != &ctx_main || ctx->state != SERVER_RUNNING) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    neil_ble_gatts_poll_detach(ctx);
+
+    // --- Prevents the disconnect handler from re-advertising
+    ctx->state = SERVER_STOPPING;
+
+    // ---------------------------------
+    // Peers
+    // ---------------------------------
+
+    ble_gap_adv_stop();
+    neil_ble_gatts_admit_deinit();
+
+    neil_ble_gatts_conn_disconnect_all();
+
+    for (uint32_t waited = 0;
+         neil_ble_gatts_conn_count() > 0 && waited < STOP_TIMEOUT_MS;
+         waited += STOP_POLL_MS) {
+        vTaskDelay(pdMS_TO_TICKS(STOP_POLL_MS));
+    }
+
+    if (neil_ble_gatts_conn_count() > 0) {
+        ESP_LOGW(TAG, "Peers still connected, forcing teardown");
+    }
+
+    // ---------------------------------
+    // Stack
+    // ---------------------------------
+
+    esp_err_t ret = stack_deinit();
+
+    neil_ble_gatts_l2cap_deinit();
+    neil_ble_gatts_notify_close_all();
+    neil_ble_gatts_link_close_all();
+    neil_ble_gatts_admit_close_all();
+    neil_ble_gatts_conn_deinit();
+
+    // --- Publishes the last disconnections
+    neil_ble_gatts_demand_detach(ctx);
+
+    // --- No client writes anymore, the last values are stored
+    neil_ble_gatts_persist_detach(ctx);
+
+    if (mode != NEIL_BLE_GATTS_STOP_WARM) {
+        tables_clear();
+    }
+
+    ctx->state = SERVER_STOPPED;
+
+    if (mode == NEIL_BLE_GATTS_STOP_RELEASE) {
+        ctx->dev_cfg = NULL;
+
+        esp_err_t rel = esp_bt_mem_release(ESP_BT_MODE_BTDM);
+        if (rel != ESP_OK) {
+            ESP_LOGE(TAG, "BT memory release failed: %s", esp_err_to_name(rel));
+            ret = ret == ESP_OK ? rel : ret;
+        }
+
+        ctx->state = SERVER_RELEASED;
+    }
+
+    ESP_LOGI(TAG, "Stopped");
+
+    return ret;
+}
+
+// -------------------------------------------------------------
+// Default Context
+// -------------------------------------------------------------
+
+void neil_ble_gatts_start(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    if (ctx_main.state != SERVER_STOPPED) {
+        ESP_LOGE(TAG, "Server already started or memory released");
+        return;
+    }
+
+    ESP_ERROR_CHECK(ctx_start(dev_cfg));
+}
+
+esp_err_t neil_ble_gatts_restart(void) { return neil_ble_gatts_ctx_restart(&ctx_main); }
+
+esp_err_t neil_ble_gatts_stop(neil_ble_gatts_stop_mode_t mode) {
+    return neil_ble_gatts_ctx_stop(&ctx_main, mode);
+}
+
+esp_err_t neil_ble_gatts_notify(uint8_t svc_idx, uint8_t chr_idx, const uint8_t *data,
+                                uint16_t len) {
+    return neil_ble_gatts_ctx_notify(&ctx_main, svc_idx, chr_idx, data, len);
+}
+
+esp_err_t neil_ble_gatts_notify_conn(uint16_t conn_id, uint8_t svc_idx, uint8_t chr_idx,
+                                     const uint8_t *data, uint16_t len) {
+    return neil_ble_gatts_ctx_notify_conn(&ctx_main, conn_id, svc_idx, chr_idx, data,
+                                          len);
+}
+
+// -------------------------------------------------------------
+// Notifications
+// -------------------------------------------------------------
+
+esp_err_t neil_ble_gatts_ctx_notify(neil_ble_gatts_ctx_t *ctx, uint8_t svc_idx,
+                                    uint8_t chr_idx, const uint8_t *data,
+                                    uint16_t len) {
+    return neil_ble_gatts_ctx_notify_conn(ctx, NEIL_BLE_GATTS_NOTIFY_CONN_ALL, svc_idx,
+                                          chr_idx, data, len);
+}
+
+esp_err_t neil_ble_gatts_ctx_notify_conn(neil_ble_gatts_ctx_t *ctx, uint16_t conn_id,
+                                         uint8_t svc_idx, uint8_t chr_idx,
+                                         const uint8_t *data, uint16_t len) {
+
+    if (ctx != &ctx_main || ctx->state != SERVER_RUNNING || ctx->svc_db == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (svc_idx >= ctx->dev_cfg->svc_tab_len ||
+        chr_idx >= ctx->dev_cfg->svc_tab[svc_idx].chr_tab_len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    neil_ble_gatts_cfg_chr_t *chr_cfg =
+        ctx->dev_cfg->svc_tab[svc_idx].chr_tab + chr_idx;
+
+    if (!chr_cfg->notify) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    neil_ble_gatts_journal_bump(chr_cfg);
+
+    const uint16_t handle =
+        neil_ble_gatts_nimble_db_handle(ctx->svc_db, ctx->dev_cfg, svc_idx, chr_idx);
+
+    // NOTE: NimBLE has no profile interface.
+    return neil_ble_gatts_notify_enqueue(0, conn_id, handle, data, len);
+}
+
+bool neil_ble_gatts_ctx_subscribed(neil_ble_gatts_ctx_t *ctx, uint8_t svc_idx,
+                                   uint8_t chr_idx) {
+    return neil_ble_gatts_ctx_subscribers(ctx, svc_idx, chr_idx) > 0;
+}
+
+uint8_t neil_ble_gatts_ctx_subscribers(neil_ble_gatts_ctx_t *ctx, uint8_t svc_idx,
+                                       uint8_t chr_idx) {
+
+    if (ctx != &ctx_main || ctx->state != SERVER_RUNNING || ctx->svc_db == NULL) {
+        return 0;
+    }
+
+    const uint16_t handle =
+        neil_ble_gatts_nimble_db_handle(ctx->svc_db, ctx->dev_cfg, svc_idx, chr_idx);
+
+    return neil_ble_gatts_notify_subscribers(handle);
+}
+
+// -------------------------------------------------------------
+// Event Dispatch
+// -------------------------------------------------------------
+
+// NOTE: Requests reach `chr_access_callback` from NimBLE as mbufs, there is no
+//       event entry-point to dispatch to.
+
+uint16_t neil_ble_gatts_ctx_handle(neil_ble_gatts_ctx_t *ctx, uint8_t svc_idx,
+                                   uint8_t chr_idx) {
+
+    if (ctx != &ctx_main || ctx->svc_db == NULL) {
+        return 0;
+    }
+
+    return neil_ble_gatts_nimble_db_handle(ctx->svc_db, ctx->dev_cfg, svc_idx, chr_idx);
+}
+
+// -------------------------------------------------------------
+// Stack Procedures
+// -------------------------------------------------------------
+
+esp_err_t neil_ble_gatts_stack_notify(uint8_t gatts_if, uint16_t conn_id,
+                                      uint16_t handle, const uint8_t *data,
+                                      uint16_t len) {
+
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(data, len);
+
+    if (om == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // NOTE: Consumes `om`, whatever the outcome.
+    const int rc = ble_gatts_notify_custom(conn_id, handle, om);
+
+    return rc == 0 ? ESP_OK : rc == BLE_HS_ENOMEM ? ESP_ERR_NO_MEM : ESP_FAIL;
+}
+
+void neil_ble_gatts_stack_disconnect(uint16_t conn_id, const esp_bd_addr_t bda) {
+    ble_gap_terminate(conn_id, BLE_ERR_REM_USER_CONN_TERM);
+}
+
+void neil_ble_gatts_stack_secure(uint16_t conn_id, const esp_bd_addr_t bda, bool mitm) {
+    // NOTE: The pairing requirements (MITM included) are set host-wide.
+    ble_gap_security_initiate(conn_id);
+}
+
+esp_err_t neil_ble_gatts_stack_read_rssi(uint16_t conn_id, const esp_bd_addr_t bda) {
+    int8_t rssi = 0;
+
+    // --- Answered from the controller state, reported before returning
+    if (ble_gap_conn_rssi(conn_id, &rssi) != 0) {
+        return ESP_FAIL;
+    }
+
+    neil_ble_gatts_link_on_rssi(conn_id, rssi);
+
+    return ESP_OK;
+}
+
+esp_err_t neil_ble_gatts_stack_update_params(uint16_t conn_id, const esp_bd_addr_t bda,
+                                             uint16_t interval_min,
+                                             uint16_t interval_max, uint16_t latency,
+                                             uint16_t timeout) {
+
+    const struct ble_gap_upd_params params = {
+        .itvl_min            = interval_min,
+        .itvl_max            = interval_max,
+        .latency             = latency,
+        .supervision_timeout = timeout,
+    };
+
+    return ble_gap_update_params(conn_id, &params) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t neil_ble_gatts_stack_set_phy(uint16_t conn_id, const esp_bd_addr_t bda,
+                                       uint8_t phy) {
+#if CONFIG_BT_NIMBLE_50_FEATURE_SUPPORT
+    const uint8_t mask = 1 << (phy - 1);
+
+    const int rc =
+        ble_gap_set_prefered_le_phy(conn_id, mask, mask, BLE_GAP_LE_PHY_CODED_ANY);
+
+    return rc == 0 ? ESP_OK : ESP_FAIL;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+// -------------------------------------------------------------
+// Characteristic Access
+// -------------------------------------------------------------
+
+/**
+ * @brief       Apply a complete write.
+ */
+static esp_gatt_status_t write_apply(uint16_t conn_handle, uint16_t attr_handle,
+                                     neil_ble_gatts_cfg_chr_t *chr_cfg, uint16_t len) {
+
+    // --- Change journal: remember what the client has seen
+    if (chr_cfg->journal) {
+        return neil_ble_gatts_journal_request(conn_handle, value_buf, len);
+    }
+
+    // --- Command pipe: dispatch the batch, then notify the writer its status
+    if (chr_cfg->pipe) {
+        uint8_t status[NEIL_BLE_GATTS_PIPE_STATUS_MAX];
+
+        const uint16_t status_len =
+            neil_ble_gatts_pipe_run(ctx_main.dev_cfg, conn_handle, value_buf, len,
+                                    status);
+
+        if (chr_cfg->notify) {
+            neil_ble_gatts_notify_enqueue(0, conn_handle, attr_handle, status,
+                                          status_len);
+        }
+        return ESP_GATT_OK;
+    }
+
+    if (chr_cfg->on_write != NULL) {
+        chr_cfg->on_write(value_buf, len);
+        neil_ble_gatts_journal_bump(chr_cfg);
+        neil_ble_gatts_persist_store(chr_cfg, value_buf, len);
+        return ESP_GATT_OK;
+    }
+
+    return ESP_GATT_WRITE_NOT_PERMIT;
+}
+
+/**
+ * @brief       Apply a complete write, telling `on_write` callbacks the
+ *              writer (`neil_ble_gatts_conn_writer`).
+ */
+static esp_gatt_status_t write_dispatch(uint16_t conn_handle, uint16_t attr_handle,
+                                        neil_ble_gatts_cfg_chr_t *chr_cfg,
+                                        uint16_t len) {
+
+    neil_ble_gatts_conn_set_writer(conn_handle);
+    const esp_gatt_status_t status =
+        write_apply(conn_handle, attr_handle, chr_cfg, len);
+    neil_ble_gatts_conn_set_writer(NEIL_BLE_GATTS_CONN_NONE);
+
+    return status;
+}
+
+/**
+ * @brief       Stage a characteristic value in `value_buf` for a read.
+ *
+ * @return      ESP_GATT_OK with the value length in `len`, or an ATT error.
+ */
+static esp_gatt_status_t read_dispatch(uint16_t conn_handle,
+                                       const neil_ble_gatts_cfg_chr_t *chr_cfg,
+                                       uint16_t *len) {
+
+    // --- Change journal: versions newer than the client last wrote
+    if (chr_cfg->journal) {
+        *len = neil_ble_gatts_journal_read(ctx_main.dev_cfg, conn_handle, value_buf,
+                                           sizeof(value_buf));
+        return ESP_GATT_OK;
+    }
+
+    // --- Batch: one response carrying several sibling values
+    if (chr_cfg->batch_len > 0) {
+        neil_ble_gatts_conn_t *conn = neil_ble_gatts_conn_get(conn_handle);
+
+        // Fit one ATT Read Response (1-byte opcode)
+        const uint16_t mtu = conn != NULL ? conn->mtu : ESP_GATT_DEF_BLE_MTU_SIZE;
+
+        return neil_ble_gatts_read_batch(svc_config_of(chr_cfg), chr_cfg, conn_handle,
+                                         value_buf, mtu - 1, len);
+    }
+
+    if (chr_cfg->on_read == NULL) {
+        return ESP_GATT_READ_NOT_PERMIT;
+    }
+
+    chr_cfg->on_read(value_buf);
+    *len = chr_cfg->size;
+
+    return ESP_GATT_OK;
+}
+
+/**
+ * @brief       Access callback of every configured characteristic.
+ *
+ *              NimBLE applies the offset of long reads, and assembles
+ *              prepared writes before calling.
+ *
+ * @return      0 or an ATT error code.
+ */
+static int chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                      struct ble_gatt_access_ctxt *ctxt, void *arg) {
+
+    neil_ble_gatts_cfg_chr_t *chr_cfg = arg;
+
+    neil_ble_gatts_admit_touch(conn_handle);
+
+    uint16_t len;
+    esp_gatt_status_t status =
+        neil_ble_gatts_conn_sec_check(conn_handle, chr_cfg->security);
+
+    // --- Protected characteristic on a link below its level
+    if (status != ESP_GATT_OK) {
+        return status;
+    }
+
+    switch (ctxt->op) {
+
+    case BLE_GATT_ACCESS_OP_READ_CHR:
+        status = read_dispatch(conn_handle, chr_cfg, &len);
+
+        if (status == ESP_GATT_OK && os_mbuf_append(ctxt->om, value_buf, len) != 0) {
+            status = ESP_GATT_INSUF_RESOURCE;
+        }
+        return status;
+
+    case BLE_GATT_ACCESS_OP_WRITE_CHR:
+        if (OS_MBUF_PKTLEN(ctxt->om) > sizeof(value_buf)) {
+            return ESP_GATT_INVALID_ATTR_LEN;
+        }
+
+        ble_hs_mbuf_to_flat(ctxt->om, value_buf, sizeof(value_buf), &len);
+
+        NEIL_BLE_GATTS_LOG(GATTS_WRITE, conn_handle, attr_handle, len);
+
+        return write_dispatch(conn_handle, attr_handle, chr_cfg, len);
+
+    default:
+        return ESP_GATT_REQ_NOT_SUPPORTED;
+    }
+}
+
+// -------------------------------------------------------------
+// GAP Events
+// -------------------------------------------------------------
+
+// --- A device address as two log arguments, printed "%08x%04x"
+#define ADDR_HI(addr)                                                                  \
+    ((uint32_t)(addr).val[5] << 24 | (addr).val[4] << 16 | (addr).val[3] << 8 |        \
+     (addr).val[2])
+#define ADDR_LO(addr) ((uint32_t)(addr).val[1] << 8 | (addr).val[0])
+
+/**
+ * @brief       Track a new connection.
+ *
+ *              Links start unencrypted; encryption is requested when a
+ *              protected characteristic is first accessed.
+ */
+static void conn_open(uint16_t conn_handle) {
+
+    struct ble_gap_conn_desc desc;
+
+    if (ble_gap_conn_find(conn_handle, &desc) != 0) {
+        return;
+    }
+
+    // --- NimBLE addresses are little-endian, the table holds them MSB first
+    esp_bd_addr_t bda;
+    for (size_t idx = 0; idx < sizeof(esp_bd_addr_t); idx++) {
+        bda[idx] = desc.peer_id_addr.val[sizeof(esp_bd_addr_t) - 1 - idx];
+    }
+
+    neil_ble_gatts_conn_add(conn_handle, bda);
+    neil_ble_gatts_notify_open(conn_handle);
+    neil_ble_gatts_link_open(conn_handle, bda);
+    neil_ble_gatts_link_on_params(conn_handle, true, desc.conn_itvl, desc.conn_latency);
+    neil_ble_gatts_admit_open(conn_handle, bda);
+    neil_ble_gatts_demand_refresh();
+}
+
+/**
+ * @brief       Answer a pairing action; the device has no input, so
+ *              comparisons are accepted and the static passkey is used.
+ */
+static void passkey_action(uint16_t conn_handle, uint8_t action, uint32_t numcmp) {
+
+    struct ble_sm_io io = {.action = action};
+
+    switch (action) {
+    case BLE_SM_IOACT_NUMCMP:
+        NEIL_BLE_GATTS_LOG(GAP_NC_REQ, numcmp, 0, 0);
+        io.numcmp_accept = 1;
+        break;
+
+    case BLE_SM_IOACT_DISP:
+        NEIL_BLE_GATTS_LOG(GAP_PASSKEY_NOTIF, STATIC_PASSKEY, 0, 0);
+        io.passkey = STATIC_PASSKEY;
+        break;
+
+    case BLE_SM_IOACT_OOB:
+        NEIL_BLE_GATTS_LOG(GAP_OOB_REQ, 0, 0, 0);
+        // If you paired with OOB, both devices need to use the same tk
+        memset(io.oob, 0, sizeof(io.oob));
+        io.oob[0] = 1;
+        break;
+
+    default:
+        NEIL_BLE_GATTS_LOG(GAP_PASSKEY_REQ, 0, 0, 0);
+        return;
+    }
+
+    ble_sm_inject_io(conn_handle, &io);
+}
+
+/**
+ * @brief       Handle GAP (and GATT server) events of the NimBLE host.
+ */
+static int gap_event_handler(struct ble_gap_event *event, void *arg) {
+
+    NEIL_BLE_GATTS_LOG(GAP_EVENT, event->type, 0, 0);
+
+    struct ble_gap_conn_desc desc;
+
+    switch (event->type) {
+
+    // ---------------------------------
+    // Connection Events
+    // ---------------------------------
+
+    // --- On Client Connection (or failed attempt)
+    case BLE_GAP_EVENT_CONNECT:
+        if (event->connect.status != 0) {
+            if (ctx_main.state == SERVER_RUNNING) {
+                advertise();
+            }
+            break;
+        }
+        NEIL_BLE_GATTS_LOG(GATTS_CONNECT, event->connect.conn_handle, 0, 0);
+        conn_open(event->connect.conn_handle);
+
+        // --- Advertising stops on connection, resumed while slots remain
+        if (ctx_main.state == SERVER_RUNNING && neil_ble_gatts_admit_advertise()) {
+            advertise();
+        }
+        break;
+
+    // --- On MTU Exchange
+    case BLE_GAP_EVENT_MTU: {
+        NEIL_BLE_GATTS_LOG(GATTS_MTU, event->mtu.conn_handle, event->mtu.value, 0);
+        neil_ble_gatts_admit_touch(event->mtu.conn_handle);
+        neil_ble_gatts_conn_t *conn = neil_ble_gatts_conn_get(event->mtu.conn_handle);
+        if (conn != NULL) {
+            conn->mtu = event->mtu.value;
+        }
+        break;
+    }
+
+    // --- On Client Disconnection
+    case BLE_GAP_EVENT_DISCONNECT: {
+        const uint16_t conn_handle = event->disconnect.conn.conn_handle;
+        NEIL_BLE_GATTS_LOG(GATTS_DISCONNECT, conn_handle, event->disconnect.reason, 0);
+        neil_ble_gatts_notify_close(conn_handle);
+        neil_ble_gatts_link_close(conn_handle);
+        neil_ble_gatts_admit_close(conn_handle);
+        neil_ble_gatts_conn_remove(conn_handle);
+        neil_ble_gatts_demand_refresh();
+        if (ctx_main.state == SERVER_RUNNING && neil_ble_gatts_admit_advertise()) {
+            advertise();
+        }
+        break;
+    }
+
+    // --- On Advertising End
+    case BLE_GAP_EVENT_ADV_COMPLETE:
+        if (ctx_main.state == SERVER_RUNNING && neil_ble_gatts_admit_advertise()) {
+            advertise();
+        }
+        break;
+
+    // ---------------------------------
+    // Link Events
+    // ---------------------------------
+
+    // --- On Connection Parameter Update
+    case BLE_GAP_EVENT_CONN_UPDATE:
+        if (ble_gap_conn_find(event->conn_update.conn_handle, &desc) == 0) {
+            neil_ble_gatts_link_on_params(event->conn_update.conn_handle,
+                                          event->conn_update.status == 0,
+                                          desc.conn_itvl, desc.conn_latency);
+        }
+        break;
+
+    // --- On PHY Update
+    case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+        neil_ble_gatts_link_on_phy(event->phy_updated.conn_handle,
+                                   event->phy_updated.status == 0,
+                                   event->phy_updated.tx_phy);
+        break;
+
+    // ---------------------------------
+    // Notification Events
+    // ---------------------------------
+
+    // --- On Client Configuration Write
+    //
+    // NOTE: NimBLE has stored the configuration already; a subscription to a
+    //       protected characteristic on a link below its level is not served.
+    case BLE_GAP_EVENT_SUBSCRIBE: {
+        neil_ble_gatts_admit_touch(event->subscribe.conn_handle);
+
+        const neil_ble_gatts_cfg_chr_t *chr_cfg = neil_ble_gatts_nimble_db_chr(
+            ctx_main.svc_db, ctx_main.dev_cfg, event->subscribe.attr_handle);
+
+        uint16_t cccd =
+            event->subscribe.cur_notify | event->subscribe.cur_indicate << 1;
+
+        if (cccd != 0 && chr_cfg != NULL &&
+            neil_ble_gatts_conn_sec_check(event->subscribe.conn_handle,
+                                          chr_cfg->security) != ESP_GATT_OK) {
+            cccd = 0;
+        }
+
+        neil_ble_gatts_notify_subscribe(event->subscribe.conn_handle,
+                                        event->subscribe.attr_handle, cccd);
+        neil_ble_gatts_demand_refresh();
+        break;
+    }
+
+    // --- On Notification Sent
+    case BLE_GAP_EVENT_NOTIFY_TX:
+        neil_ble_gatts_notify_on_sent(event->notify_tx.conn_handle,
+                                      event->notify_tx.status == 0 ? ESP_GATT_OK
+                                                                   : ESP_GATT_ERROR);
+        break;
+
+    // ---------------------------------
+    // Security Events
+    // ---------------------------------
+
+    // --- On Authentication Done
+    case BLE_GAP_EVENT_ENC_CHANGE: {
+        if (ble_gap_conn_find(event->enc_change.conn_handle, &desc) != 0) {
+            break;
+        }
+
+        // --- Record the level reached, checked on protected accesses
+        neil_ble_gatts_sec_t level = NEIL_BLE_GATTS_SEC_NONE;
+        if (event->enc_change.status == 0 && desc.sec_state.encrypted) {
+            level = desc.sec_state.authenticated ? NEIL_BLE_GATTS_SEC_MITM
+                                                 : NEIL_BLE_GATTS_SEC_ENCRYPT;
+        }
+
+        neil_ble_gatts_conn_sec_update(event->enc_change.conn_handle, level);
+
+        if (event->enc_change.status == 0) {
+            NEIL_BLE_GATTS_LOG(GAP_AUTH_OK, ADDR_HI(desc.peer_id_addr),
+                               ADDR_LO(desc.peer_id_addr),
+                               desc.sec_state.authenticated);
+        } else {
+            NEIL_BLE_GATTS_LOG(GAP_AUTH_FAIL, ADDR_HI(desc.peer_id_addr),
+                               ADDR_LO(desc.peer_id_addr), event->enc_change.status);
+        }
+        break;
+    }
+
+    // --- On Pairing Action (passkey, comparison, out-of-band)
+    case BLE_GAP_EVENT_PASSKEY_ACTION:
+        passkey_action(event->passkey.conn_handle, event->passkey.params.action,
+                       event->passkey.params.numcmp);
+        break;
+
+    // --- On Pairing of an Already Bonded Peer: forget the old bond
+    case BLE_GAP_EVENT_REPEAT_PAIRING:
+        if (ble_gap_conn_find(event->repeat_pairing.conn_handle, &desc) == 0) {
+            ble_store_util_delete_peer(&desc.peer_id_addr);
+            NEIL_BLE_GATTS_LOG(GAP_BOND_REMOVED, ADDR_HI(desc.peer_id_addr),
+                               ADDR_LO(desc.peer_id_addr), 0);
+        }
+        return BLE_GAP_REPEAT_PAIRING_RETRY;
+
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief       Entry-point for GAP events, measures stack depth if enabled.
+ */
+static int gap_event_callback(struct ble_gap_event *event, void *arg) {
+
+    const bool measured      = neil_ble_gatts_depth_active();
+    const uint32_t free_size = measured ? neil_ble_gatts_depth_free() : 0;
+
+    const int rc = gap_event_handler(event, arg);
+
+    if (measured) {
+        neil_ble_gatts_depth_record(NEIL_BLE_GATTS_DEPTH_SRC_GAP, event->type,
+                                    free_size);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief       Entry-point for characteristic access, measures stack depth
+ *              if enabled.
+ */
+static int chr_access_callback(uint16_t conn_handle, uint16_t attr_handle,
+                               struct ble_gatt_access_ctxt *ctxt, void *arg) {
+
+    const bool measured      = neil_ble_gatts_depth_active();
+    const uint32_t free_size = measured ? neil_ble_gatts_depth_free() : 0;
+
+    const int rc = chr_access(conn_handle, attr_handle, ctxt, arg);
+
+    if (measured) {
+        neil_ble_gatts_depth_record(NEIL_BLE_GATTS_DEPTH_SRC_GATTS, ctxt->op,
+                                    free_size);
+    }
+
+    return rc;
+}
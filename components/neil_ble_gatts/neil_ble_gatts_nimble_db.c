@@ -0,0 +1,238 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_nimble_db.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      NimBLE Service Definition implementation.
+///
+///             All tables share one block, laid out as:
+///
+///                 svc_def[svc + 1] chr_def[chr + svc] uuid[svc + chr] handle[chr]
+///
+///             (one terminator per service and per service list).
+
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "host/ble_gatt.h"
+#include "host/ble_uuid.h"
+
+#include "neil_ble_gatts_cfg.h"
+#include "neil_ble_gatts_mem.h"
+#include "neil_ble_gatts_nimble_db.h"
+#include "neil_ble_gatts_read.h"
+#include "neil_ble_gatts_util.h"
+
+static const char *const TAG = "neil_ble_gatts_nimble_db";
+
+// -------------------------------------------------------------
+// Layout
+// -------------------------------------------------------------
+
+static uint16_t chr_total(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    uint16_t count = 0;
+
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
+        count += dev_cfg->svc_tab[svc_idx].chr_tab_len;
+    }
+
+    return count;
+}
+
+/**
+ * @brief       Size of the shared table block.
+ */
+static size_t block_size(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    const size_t svc = dev_cfg->svc_tab_len;
+    const size_t chr = chr_total(dev_cfg);
+
+    return (svc + 1) * sizeof(struct ble_gatt_svc_def) +
+           (chr + svc) * sizeof(struct ble_gatt_chr_def) +
+           (svc + chr) * sizeof(ble_uuid_any_t) + chr * sizeof(uint16_t);
+}
+
+size_t neil_ble_gatts_nimble_db_footprint(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+    return sizeof(neil_ble_gatts_nimble_db_t) + block_size(dev_cfg);
+}
+
+// -------------------------------------------------------------
+// Validation
+// -------------------------------------------------------------
+
+/**
+ * @brief       Whether NimBLE can serve a characteristic configuration.
+ */
+static bool chr_valid(const neil_ble_gatts_cfg_svc_t *svc_cfg,
+                      const neil_ble_gatts_cfg_chr_t *chr_cfg, uint8_t svc_idx,
+                      uint8_t chr_idx) {
+
+    if (!neil_ble_gatts_util_uuid_len_valid(chr_cfg->uuid_len)) {
+        ESP_LOGE(TAG, "Characteristic (%d/%d) has invalid UUID length %d", svc_idx,
+                 chr_idx, chr_cfg->uuid_len);
+        return false;
+    }
+
+    if (chr_cfg->on_read_async != NULL) {
+        ESP_LOGE(TAG, "Characteristic (%d/%d) defers reads, unsupported on NimBLE",
+                 svc_idx, chr_idx);
+        return false;
+    }
+
+    if (chr_cfg->size > ESP_GATT_MAX_ATTR_LEN) {
+        ESP_LOGE(TAG, "Characteristic (%d/%d) exceeds %d bytes", svc_idx, chr_idx,
+                 ESP_GATT_MAX_ATTR_LEN);
+        return false;
+    }
+
+    if (chr_cfg->batch_len > 0 && !neil_ble_gatts_read_batch_valid(svc_cfg, chr_cfg)) {
+        ESP_LOGE(TAG, "Characteristic (%d/%d) has an invalid batch", svc_idx, chr_idx);
+        return false;
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------
+// Initialization / Deinitialization
+// -------------------------------------------------------------
+
+// --- Same properties as the Bluedroid attribute table
+static const ble_gatt_chr_flags CHR_FLAGS =
+    BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP;
+
+neil_ble_gatts_nimble_db_t *
+neil_ble_gatts_nimble_db_init(const neil_ble_gatts_cfg_dev_t *dev_cfg,
+                              ble_gatt_access_fn *access_cb) {
+
+    neil_ble_gatts_nimble_db_t *db = neil_ble_gatts_mem_alloc(
+        NEIL_BLE_GATTS_MEM_ATTR_DB, sizeof(neil_ble_gatts_nimble_db_t));
+
+    if (db == NULL) {
+        ESP_LOGE(TAG, "Out of memory allocating service definitions");
+        return NULL;
+    }
+
+    const uint8_t svc_len = dev_cfg->svc_tab_len;
+
+    db->chr_count = chr_total(dev_cfg);
+    db->svc_tab   = neil_ble_gatts_mem_calloc(NEIL_BLE_GATTS_MEM_ATTR_DB, 1,
+                                              block_size(dev_cfg));
+
+    if (db->svc_tab == NULL) {
+        ESP_LOGE(TAG, "Out of memory allocating %u characteristics", db->chr_count);
+        neil_ble_gatts_nimble_db_deinit(db);
+        return NULL;
+    }
+
+    // --- Carve the block (zeroed, so every list is already terminated)
+    struct ble_gatt_chr_def *chr_def =
+        (struct ble_gatt_chr_def *)(db->svc_tab + svc_len + 1);
+    ble_uuid_any_t *uuid = (ble_uuid_any_t *)(chr_def + db->chr_count + svc_len);
+    db->val_handles      = (uint16_t *)(uuid + svc_len + db->chr_count);
+
+    uint16_t *val_handle = db->val_handles;
+
+    for (uint8_t svc_idx = 0; svc_idx < svc_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+
+        if (!neil_ble_gatts_util_uuid_len_valid(svc_cfg->uuid_len)) {
+            ESP_LOGE(TAG, "Service (%d) has invalid UUID length %d", svc_idx,
+                     svc_cfg->uuid_len);
+            neil_ble_gatts_nimble_db_deinit(db);
+            return NULL;
+        }
+
+        // --- NimBLE takes UUIDs in their native size, 32-bit included
+        ble_uuid_init_from_buf(uuid, svc_cfg->uuid, neil_ble_gatts_UUID_LEN(svc_cfg));
+
+        db->svc_tab[svc_idx] = (struct ble_gatt_svc_def){
+            .type            = BLE_GATT_SVC_TYPE_PRIMARY,
+            .uuid            = &uuid->u,
+            .characteristics = chr_def,
+        };
+        uuid++;
+
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+            neil_ble_gatts_cfg_chr_t *chr_cfg = svc_cfg->chr_tab + chr_idx;
+
+            if (!chr_valid(svc_cfg, chr_cfg, svc_idx, chr_idx)) {
+                neil_ble_gatts_nimble_db_deinit(db);
+                return NULL;
+            }
+
+            ble_uuid_init_from_buf(uuid, chr_cfg->uuid,
+                                   neil_ble_gatts_UUID_LEN(chr_cfg));
+
+            *chr_def++ = (struct ble_gatt_chr_def){
+                .uuid       = &uuid->u,
+                .access_cb  = access_cb,
+                .arg        = chr_cfg,
+                .flags      = CHR_FLAGS | (chr_cfg->notify ? BLE_GATT_CHR_F_NOTIFY : 0),
+                .val_handle = val_handle++,
+            };
+            uuid++;
+        }
+
+        // --- Skip the terminator of this service's list
+        chr_def++;
+    }
+
+    return db;
+}
+
+uint16_t neil_ble_gatts_nimble_db_handle(const neil_ble_gatts_nimble_db_t *db,
+                                         const neil_ble_gatts_cfg_dev_t *dev_cfg,
+                                         uint8_t svc_idx, uint8_t chr_idx) {
+
+    if (db == NULL || svc_idx >= dev_cfg->svc_tab_len ||
+        chr_idx >= dev_cfg->svc_tab[svc_idx].chr_tab_len) {
+        return 0;
+    }
+
+    uint16_t flat_idx = chr_idx;
+
+    for (uint8_t idx = 0; idx < svc_idx; idx++) {
+        flat_idx += dev_cfg->svc_tab[idx].chr_tab_len;
+    }
+
+    return db->val_handles[flat_idx];
+}
+
+neil_ble_gatts_cfg_chr_t *
+neil_ble_gatts_nimble_db_chr(const neil_ble_gatts_nimble_db_t *db,
+                             const neil_ble_gatts_cfg_dev_t *dev_cfg, uint16_t handle) {
+
+    if (db == NULL || handle == 0) {
+        return NULL;
+    }
+
+    const uint16_t *val_handle = db->val_handles;
+
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+            if (*val_handle++ == handle) {
+                return svc_cfg->chr_tab + chr_idx;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+void neil_ble_gatts_nimble_db_deinit(neil_ble_gatts_nimble_db_t *db) {
+
+    if (db == NULL) {
+        return;
+    }
+
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_ATTR_DB, db->svc_tab);
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_ATTR_DB, db);
+}
@@ -0,0 +1,92 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_nimble_db.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      NimBLE Service Definition API.
+///
+///             Builds the `ble_gatt_svc_def` tables NimBLE registers from a
+///             device configuration, the counterpart of the Bluedroid
+///             attribute table (`neil_ble_gatts_attr_db.h`).
+
+#ifndef neil_ble_gatts_NIMBLE_DB_H_
+#define neil_ble_gatts_NIMBLE_DB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "host/ble_gatt.h"
+
+#include "neil_ble_gatts_cfg.h"
+
+// -------------------------------------------------------------
+// Domain Structures
+// -------------------------------------------------------------
+
+/**
+ * @brief       Service definitions of a device configuration.
+ *
+ *              NimBLE keeps pointers into the tables once registered, so they
+ *              must outlive the host.
+ */
+typedef struct {
+    struct ble_gatt_svc_def *svc_tab; ///< Service definitions, zero-terminated.
+    uint16_t *val_handles;            ///< Value handles in configuration order.
+    uint16_t chr_count;
+} neil_ble_gatts_nimble_db_t;
+
+/// Number of heap allocations made by `neil_ble_gatts_nimble_db_init`.
+#define NEIL_BLE_GATTS_NIMBLE_DB_ALLOC_COUNT 2
+
+// -------------------------------------------------------------
+// Procedures
+// -------------------------------------------------------------
+
+/**
+ * @brief       Build the service definitions of a device configuration.
+ *
+ *              Every characteristic is served by `access_cb`, with its
+ *              configuration as argument. Notifying characteristics get their
+ *              client configuration descriptor from NimBLE.
+ *
+ * @return      NULL on allocation failure or an invalid configuration
+ *              (including deferred reads, which NimBLE cannot serve).
+ */
+neil_ble_gatts_nimble_db_t *
+neil_ble_gatts_nimble_db_init(const neil_ble_gatts_cfg_dev_t *dev_cfg,
+                              ble_gatt_access_fn *access_cb);
+
+/**
+ * @brief       Get the value handle of a characteristic, by index.
+ *
+ * @return      0 if out of range or not yet registered.
+ */
+uint16_t neil_ble_gatts_nimble_db_handle(const neil_ble_gatts_nimble_db_t *db,
+                                         const neil_ble_gatts_cfg_dev_t *dev_cfg,
+                                         uint8_t svc_idx, uint8_t chr_idx);
+
+/**
+ * @brief       Get the characteristic configuration whose value is at `handle`.
+ *
+ * @return      NULL if no configured characteristic has this value handle.
+ */
+neil_ble_gatts_cfg_chr_t *
+neil_ble_gatts_nimble_db_chr(const neil_ble_gatts_nimble_db_t *db,
+                             const neil_ble_gatts_cfg_dev_t *dev_cfg, uint16_t handle);
+
+/**
+ * @brief       Release service definitions.
+ *
+ *              NULL is accepted and ignored. The host must be stopped.
+ */
+void neil_ble_gatts_nimble_db_deinit(neil_ble_gatts_nimble_db_t *db);
+
+/**
+ * @brief       Heap bytes the service definitions of `dev_cfg` will hold.
+ */
+size_t neil_ble_gatts_nimble_db_footprint(const neil_ble_gatts_cfg_dev_t *dev_cfg);
+
+#endif // neil_ble_gatts_NIMBLE_DB_H_
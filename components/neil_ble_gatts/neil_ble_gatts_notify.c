@@ -0,0 +1,687 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_notify.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Notification Scheduler implementation.
+///
+///             The scheduler has no task of its own: it is pumped by whoever
+///             makes progress possible (a new notification on the application
+///             task, a completed send or un-congestion on the BTC task). One
+///             pump runs at a time; a pump requested meanwhile makes the
+///             running one loop again.
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#include "neil_ble_gatts_conn.h"
+#include "neil_ble_gatts_log.h"
+#include "neil_ble_gatts_mem.h"
+#include "neil_ble_gatts_notify.h"
+#include "neil_ble_gatts_stack.h"
+
+static const char *const TAG = "neil_ble_gatts_notify";
+
+// -------------------------------------------------------------
+// State
+// -------------------------------------------------------------
+
+/**
+ * @brief       Payload shared by the queues of every subscriber.
+ */
+typedef struct {
+    uint16_t refs;
+    uint16_t len;
+    uint8_t data[];
+} notify_buf_t;
+
+/**
+ * @brief       A queued notification.
+ */
+typedef struct {
+    notify_buf_t *buf;
+    uint16_t handle;
+    uint8_t gatts_if; ///< Profile owning `handle` (Bluedroid).
+    int64_t queued_us;
+} notify_entry_t;
+
+/**
+ * @brief       A client configuration of one connection.
+ */
+typedef struct {
+    uint16_t handle; ///< Value handle, 0 if the slot is free.
+    uint16_t cccd;
+} notify_sub_t;
+
+/**
+ * @brief       Scheduler state of one connection.
+ */
+typedef struct {
+    bool active;
+    uint16_t conn_id;
+
+    notify_sub_t subs[NEIL_BLE_GATTS_NOTIFY_SUBS_MAX];
+
+    notify_entry_t queue[NEIL_BLE_GATTS_NOTIFY_QUEUE_LEN];
+    uint8_t head;  ///< Oldest entry.
+    uint8_t count; ///< Queued entries.
+
+    uint8_t weight;
+    uint8_t inflight;
+    bool congested;
+    bool starved; ///< The stack ran out of buffers, wait for a completion.
+
+    neil_ble_gatts_notify_stats_t stats;
+    uint32_t handed;      ///< Entries handed to the stack (latency samples).
+    uint64_t latency_sum; ///< Sum of latency samples.
+
+    uint32_t queued_bytes; ///< Payload bytes of queued entries.
+    uint32_t handed_bytes; ///< Payload bytes handed to the stack (wraps).
+} notify_conn_t;
+
+static notify_conn_t conns[NEIL_BLE_GATTS_CONN_MAX];
+
+// --- Round-robin cursor, the connection served first on the next pass.
+static uint8_t rr_next = 0;
+
+// --- Pump serialization
+static bool pump_busy  = false;
+static bool pump_again = false;
+
+// --- Queues are filled from application tasks and drained on the BTC task.
+static portMUX_TYPE notify_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// -------------------------------------------------------------
+// Helpers (call with the lock held)
+// -------------------------------------------------------------
+
+static notify_conn_t *conn_find(uint16_t conn_id) {
+    for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        if (conns[idx].active && conns[idx].conn_id == conn_id) {
+            return conns + idx;
+        }
+    }
+    return NULL;
+}
+
+static notify_sub_t *sub_find(notify_conn_t *conn, uint16_t handle) {
+    for (int idx = 0; idx < NEIL_BLE_GATTS_NOTIFY_SUBS_MAX; idx++) {
+        if (conn->subs[idx].handle == handle) {
+            return conn->subs + idx;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief       Drop a buffer reference.
+ *
+ * @return      The buffer if it is no longer referenced and must be freed
+ *              (outside the lock), NULL otherwise.
+ */
+static notify_buf_t *buf_unref(notify_buf_t *buf) {
+    return --buf->refs == 0 ? buf : NULL;
+}
+
+/**
+ * @brief       Free a buffer returned by `buf_unref` (NULL is ignored).
+ */
+static void buf_free(notify_buf_t *buf) {
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_NOTIFY, buf);
+}
+
+// -------------------------------------------------------------
+// Connections
+// -------------------------------------------------------------
+
+esp_err_t neil_ble_gatts_notify_open(uint16_t conn_id) {
+
+    esp_err_t ret = ESP_ERR_NO_MEM;
+
+    portENTER_CRITICAL(&notify_lock);
+    for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        // --- Every profile is told of the same link
+        if (conns[idx].active && conns[idx].conn_id == conn_id) {
+            ret = ESP_OK;
+            break;
+        }
+    }
+    for (int idx = 0; ret != ESP_OK && idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        if (!conns[idx].active) {
+            conns[idx] = (notify_conn_t){
+                .active  = true,
+                .conn_id = conn_id,
+                .weight  = NEIL_BLE_GATTS_NOTIFY_WEIGHT_DEFAULT,
+            };
+            ret = ESP_OK;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&notify_lock);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "No scheduler slot for conn_id %d", conn_id);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief       Empty a connection's queue, freeing unreferenced payloads.
+ */
+static void queue_flush(notify_conn_t *conn) {
+
+    for (;;) {
+        notify_buf_t *garbage = NULL;
+
+        portENTER_CRITICAL(&notify_lock);
+        if (conn->count > 0) {
+            garbage    = buf_unref(conn->queue[conn->head].buf);
+            conn->head = (conn->head + 1) % NEIL_BLE_GATTS_NOTIFY_QUEUE_LEN;
+            conn->count--;
+        } else {
+            conn->active = false;
+            portEXIT_CRITICAL(&notify_lock);
+            return;
+        }
+        portEXIT_CRITICAL(&notify_lock);
+
+        buf_free(garbage);
+    }
+}
+
+void neil_ble_gatts_notify_close(uint16_t conn_id) {
+    portENTER_CRITICAL(&notify_lock);
+    notify_conn_t *conn = conn_find(conn_id);
+    portEXIT_CRITICAL(&notify_lock);
+
+    if (conn != NULL) {
+        queue_flush(conn);
+    }
+}
+
+void neil_ble_gatts_notify_close_all(void) {
+    for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        portENTER_CRITICAL(&notify_lock);
+        const bool active = conns[idx].active;
+        portEXIT_CRITICAL(&notify_lock);
+
+        if (active) {
+            queue_flush(conns + idx);
+        }
+    }
+}
+
+// -------------------------------------------------------------
+// Subscriptions
+// -------------------------------------------------------------
+
+esp_gatt_status_t neil_ble_gatts_notify_subscribe(uint16_t conn_id, uint16_t handle,
+                                                  uint16_t cccd) {
+
+    esp_gatt_status_t status = ESP_GATT_OK;
+
+    portENTER_CRITICAL(&notify_lock);
+
+    notify_conn_t *conn = conn_find(conn_id);
+    notify_sub_t *sub   = conn != NULL ? sub_find(conn, handle) : NULL;
+
+    if (conn == NULL) {
+        status = ESP_GATT_INTERNAL_ERROR;
+    } else if (sub == NULL && cccd != 0) {
+        // --- New subscription takes a free slot
+        sub = sub_find(conn, 0);
+        if (sub == NULL) {
+            status = ESP_GATT_NO_RESOURCES;
+        } else {
+            *sub = (notify_sub_t){.handle = handle, .cccd = cccd};
+        }
+    } else if (sub != NULL) {
+        // --- Clearing the configuration frees the slot
+        *sub = (notify_sub_t){.handle = cccd ? handle : 0, .cccd = cccd};
+    }
+
+    portEXIT_CRITICAL(&notify_lock);
+
+    NEIL_BLE_GATTS_LOG(NOTIFY_SUBSCRIBE, conn_id, handle, cccd);
+
+    return status;
+}
+
+uint16_t neil_ble_gatts_notify_cccd(uint16_t conn_id, uint16_t handle) {
+
+    uint16_t cccd = 0;
+
+    portENTER_CRITICAL(&notify_lock);
+    notify_conn_t *conn = conn_find(conn_id);
+    notify_sub_t *sub   = conn != NULL ? sub_find(conn, handle) : NULL;
+    if (sub != NULL) {
+        cccd = sub->cccd;
+    }
+    portEXIT_CRITICAL(&notify_lock);
+
+    return cccd;
+}
+
+uint8_t neil_ble_gatts_notify_subscribers(uint16_t handle) {
+
+    uint8_t count = 0;
+
+    portENTER_CRITICAL(&notify_lock);
+    for (int idx = 0; handle != 0 && idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        notify_sub_t *sub = conns[idx].active ? sub_find(conns + idx, handle) : NULL;
+        count += sub != NULL && (sub->cccd & NEIL_BLE_GATTS_NOTIFY_CCCD_NOTIFY);
+    }
+    portEXIT_CRITICAL(&notify_lock);
+
+    return count;
+}
+
+// -------------------------------------------------------------
+// Scheduling
+// -------------------------------------------------------------
+
+/**
+ * @brief       Take the next sendable entry of a connection.
+ *
+ * @return      false if the connection cannot send now.
+ */
+static bool queue_take(notify_conn_t *conn, notify_entry_t *entry) {
+
+    bool taken = false;
+
+    portENTER_CRITICAL(&notify_lock);
+
+    if (conn->active && !conn->congested && !conn->starved &&
+        conn->inflight < NEIL_BLE_GATTS_NOTIFY_INFLIGHT_MAX && conn->count > 0) {
+
+        *entry     = conn->queue[conn->head];
+        conn->head = (conn->head + 1) % NEIL_BLE_GATTS_NOTIFY_QUEUE_LEN;
+        conn->count--;
+        conn->queued_bytes -= entry->buf->len;
+
+        notify_sub_t *sub = sub_find(conn, entry->handle);
+
+        if (sub == NULL || !(sub->cccd & NEIL_BLE_GATTS_NOTIFY_CCCD_NOTIFY)) {
+            // --- Unsubscribed while queued, `entry_send` only releases it
+            entry->handle = 0;
+        } else {
+            const uint32_t latency =
+                (uint32_t)(esp_timer_get_time() - entry->queued_us);
+
+            conn->inflight++;
+            conn->handed++;
+            conn->handed_bytes += entry->buf->len;
+            conn->latency_sum += latency;
+            if (latency > conn->stats.latency_max_us) {
+                conn->stats.latency_max_us = latency;
+            }
+        }
+
+        taken = true;
+    }
+
+    portEXIT_CRITICAL(&notify_lock);
+
+    return taken;
+}
+
+/**
+ * @brief       Put back an entry the stack had no buffer for, at the head.
+ *
+ * @return      false if the entry could not be kept and must be released.
+ */
+static bool queue_return(notify_conn_t *conn, const notify_entry_t *entry) {
+
+    bool kept = false;
+
+    portENTER_CRITICAL(&notify_lock);
+
+    conn->inflight--;
+
+    if (conn->active && conn->count < NEIL_BLE_GATTS_NOTIFY_QUEUE_LEN) {
+        conn->head = (conn->head + NEIL_BLE_GATTS_NOTIFY_QUEUE_LEN - 1) %
+                     NEIL_BLE_GATTS_NOTIFY_QUEUE_LEN;
+        conn->queue[conn->head] = *entry;
+        conn->count++;
+        conn->queued_bytes += entry->buf->len;
+        conn->handed_bytes -= entry->buf->len;
+        conn->starved = true;
+        kept          = true;
+    } else {
+        conn->stats.dropped++;
+    }
+
+    portEXIT_CRITICAL(&notify_lock);
+
+    return kept;
+}
+
+/**
+ * @brief       Hand one entry to the stack.
+ */
+static void entry_send(notify_conn_t *conn, notify_entry_t *entry) {
+
+    // --- Handle 0 marks a discarded entry
+    if (entry->handle != 0) {
+        neil_ble_gatts_conn_t *peer = neil_ble_gatts_conn_get(conn->conn_id);
+
+        // Fit one ATT Handle Value Notification (opcode and handle)
+        const uint16_t mtu = peer != NULL ? peer->mtu : ESP_GATT_DEF_BLE_MTU_SIZE;
+        const uint16_t len = entry->buf->len < mtu - 3 ? entry->buf->len : mtu - 3;
+
+        // NOTE: The stack copies the payload before returning.
+        esp_err_t ret = neil_ble_gatts_stack_notify(
+            entry->gatts_if, conn->conn_id, entry->handle, entry->buf->data, len);
+
+        // --- Out of stack buffers: retry once a send completes
+        if (ret == ESP_ERR_NO_MEM && queue_return(conn, entry)) {
+            return;
+        }
+
+        if (ret != ESP_OK && ret != ESP_ERR_NO_MEM) {
+            portENTER_CRITICAL(&notify_lock);
+            conn->inflight--;
+            conn->stats.dropped++;
+            portEXIT_CRITICAL(&notify_lock);
+        }
+    }
+
+    portENTER_CRITICAL(&notify_lock);
+    notify_buf_t *garbage = buf_unref(entry->buf);
+    portEXIT_CRITICAL(&notify_lock);
+
+    buf_free(garbage);
+}
+
+/**
+ * @brief       Serve connections round-robin until none can make progress.
+ */
+static void pump(void) {
+
+    portENTER_CRITICAL(&notify_lock);
+    if (pump_busy) {
+        pump_again = true;
+        portEXIT_CRITICAL(&notify_lock);
+        return;
+    }
+    pump_busy = true;
+    portEXIT_CRITICAL(&notify_lock);
+
+    bool again;
+
+    do {
+        portENTER_CRITICAL(&notify_lock);
+        pump_again = false;
+        portEXIT_CRITICAL(&notify_lock);
+
+        for (bool progress = true; progress;) {
+            progress = false;
+
+            for (int turn = 0; turn < NEIL_BLE_GATTS_CONN_MAX; turn++) {
+                notify_conn_t *conn =
+                    conns + (rr_next + turn) % NEIL_BLE_GATTS_CONN_MAX;
+
+                notify_entry_t entry;
+
+                for (uint8_t sent = 0;
+                     sent < conn->weight && queue_take(conn, &entry); sent++) {
+                    entry_send(conn, &entry);
+                    progress = true;
+                }
+            }
+
+            // --- Start the next pass one connection later
+            rr_next = (rr_next + 1) % NEIL_BLE_GATTS_CONN_MAX;
+        }
+
+        portENTER_CRITICAL(&notify_lock);
+        again     = pump_again;
+        pump_busy = again;
+        portEXIT_CRITICAL(&notify_lock);
+
+    } while (again);
+}
+
+esp_err_t neil_ble_gatts_notify_enqueue(uint8_t gatts_if, uint16_t conn_id,
+                                        uint16_t handle, const uint8_t *data,
+                                        uint16_t len) {
+
+    if (len > ESP_GATT_MAX_ATTR_LEN || (data == NULL && len > 0)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    notify_buf_t *buf =
+        neil_ble_gatts_mem_alloc(NEIL_BLE_GATTS_MEM_NOTIFY, sizeof(notify_buf_t) + len);
+
+    if (buf == NULL) {
+        ESP_LOGE(TAG, "Out of memory queueing %u bytes", len);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // --- The enqueue reference keeps the buffer alive until all queues hold it
+    buf->refs = 1;
+    buf->len  = len;
+    memcpy(buf->data, data, len);
+
+    const int64_t now = esp_timer_get_time();
+
+    notify_buf_t *dropped[NEIL_BLE_GATTS_CONN_MAX] = {0};
+
+    portENTER_CRITICAL(&notify_lock);
+
+    for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        notify_conn_t *conn = conns + idx;
+        notify_sub_t *sub   = conn->active ? sub_find(conn, handle) : NULL;
+
+        if (conn_id != NEIL_BLE_GATTS_NOTIFY_CONN_ALL && conn->conn_id != conn_id) {
+            continue;
+        }
+
+        if (sub == NULL || !(sub->cccd & NEIL_BLE_GATTS_NOTIFY_CCCD_NOTIFY)) {
+            continue;
+        }
+
+        // --- Full: drop the oldest, the freshest value matters most
+        if (conn->count == NEIL_BLE_GATTS_NOTIFY_QUEUE_LEN) {
+            conn->queued_bytes -= conn->queue[conn->head].buf->len;
+            dropped[idx] = buf_unref(conn->queue[conn->head].buf);
+            conn->head   = (conn->head + 1) % NEIL_BLE_GATTS_NOTIFY_QUEUE_LEN;
+            conn->count--;
+            conn->stats.dropped++;
+        }
+
+        const uint8_t tail =
+            (conn->head + conn->count) % NEIL_BLE_GATTS_NOTIFY_QUEUE_LEN;
+
+        conn->queue[tail] = (notify_entry_t){
+            .buf       = buf,
+            .handle    = handle,
+            .gatts_if  = gatts_if,
+            .queued_us = now,
+        };
+        conn->count++;
+        conn->queued_bytes += len;
+        conn->starved = false;
+        buf->refs++;
+
+        if (conn->count > conn->stats.depth_peak) {
+            conn->stats.depth_peak = conn->count;
+        }
+    }
+
+    notify_buf_t *garbage = buf_unref(buf);
+
+    portEXIT_CRITICAL(&notify_lock);
+
+    for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        buf_free(dropped[idx]);
+    }
+
+    // --- Nobody subscribed
+    if (garbage != NULL) {
+        buf_free(garbage);
+        return ESP_OK;
+    }
+
+    pump();
+
+    return ESP_OK;
+}
+
+void neil_ble_gatts_notify_on_congest(uint16_t conn_id, bool congested) {
+
+    portENTER_CRITICAL(&notify_lock);
+    notify_conn_t *conn = conn_find(conn_id);
+    // --- Reported to every profile of the link, count changes only
+    if (conn != NULL && conn->congested != congested) {
+        conn->congested = congested;
+        conn->stats.congestions += congested;
+    }
+    portEXIT_CRITICAL(&notify_lock);
+
+    if (!congested) {
+        pump();
+    }
+}
+
+void neil_ble_gatts_notify_on_sent(uint16_t conn_id, esp_gatt_status_t status) {
+
+    portENTER_CRITICAL(&notify_lock);
+    notify_conn_t *conn = conn_find(conn_id);
+    if (conn != NULL && conn->inflight > 0) {
+        conn->inflight--;
+        if (status == ESP_GATT_OK) {
+            conn->stats.sent++;
+        } else {
+            conn->stats.dropped++;
+        }
+    }
+    // --- Stack buffers are shared by every connection
+    for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        conns[idx].starved = false;
+    }
+    portEXIT_CRITICAL(&notify_lock);
+
+    pump();
+}
+
+// -------------------------------------------------------------
+// Statistics
+// -------------------------------------------------------------
+
+/**
+ * @brief       Snapshot of a connection's counters (call with the lock held).
+ */
+static neil_ble_gatts_notify_stats_t stats_of(const notify_conn_t *conn) {
+    neil_ble_gatts_notify_stats_t stats = conn->stats;
+    stats.depth                         = conn->count;
+    stats.latency_avg_us =
+        conn->handed ? (uint32_t)(conn->latency_sum / conn->handed) : 0;
+    return stats;
+}
+
+esp_err_t neil_ble_gatts_notify_set_weight(uint16_t conn_id, uint8_t weight) {
+
+    if (weight == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    portENTER_CRITICAL(&notify_lock);
+    notify_conn_t *conn = conn_find(conn_id);
+    if (conn != NULL) {
+        conn->weight = weight;
+        ret          = ESP_OK;
+    }
+    portEXIT_CRITICAL(&notify_lock);
+
+    return ret;
+}
+
+esp_err_t neil_ble_gatts_notify_load(uint16_t conn_id, uint32_t *queued_bytes,
+                                     uint32_t *handed_bytes) {
+
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    portENTER_CRITICAL(&notify_lock);
+    notify_conn_t *conn = conn_find(conn_id);
+    if (conn != NULL) {
+        *queued_bytes = conn->queued_bytes;
+        *handed_bytes = conn->handed_bytes;
+        ret           = ESP_OK;
+    }
+    portEXIT_CRITICAL(&notify_lock);
+
+    return ret;
+}
+
+esp_err_t neil_ble_gatts_notify_get_stats(uint16_t conn_id,
+                                          neil_ble_gatts_notify_stats_t *stats) {
+
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    portENTER_CRITICAL(&notify_lock);
+    notify_conn_t *conn = conn_find(conn_id);
+    if (conn != NULL) {
+        *stats = stats_of(conn);
+        ret    = ESP_OK;
+    }
+    portEXIT_CRITICAL(&notify_lock);
+
+    return ret;
+}
+
+void neil_ble_gatts_notify_get_total(neil_ble_gatts_notify_stats_t *stats) {
+
+    *stats = (neil_ble_gatts_notify_stats_t){0};
+
+    uint32_t handed      = 0;
+    uint64_t latency_sum = 0;
+
+    portENTER_CRITICAL(&notify_lock);
+
+    for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        if (!conns[idx].active) {
+            continue;
+        }
+
+        const neil_ble_gatts_notify_stats_t conn = stats_of(conns + idx);
+
+        stats->depth += conn.depth;
+        stats->sent += conn.sent;
+        stats->dropped += conn.dropped;
+        stats->congestions += conn.congestions;
+
+        if (conn.depth_peak > stats->depth_peak) {
+            stats->depth_peak = conn.depth_peak;
+        }
+        if (conn.latency_max_us > stats->latency_max_us) {
+            stats->latency_max_us = conn.latency_max_us;
+        }
+
+        handed += conns[idx].handed;
+        latency_sum += conns[idx].latency_sum;
+    }
+
+    portEXIT_CRITICAL(&notify_lock);
+
+    stats->latency_avg_us = handed ? (uint32_t)(latency_sum / handed) : 0;
+}
+
+void neil_ble_gatts_notify_reset_stats(void) {
+    portENTER_CRITICAL(&notify_lock);
+    for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        conns[idx].stats       = (neil_ble_gatts_notify_stats_t){0};
+        conns[idx].handed      = 0;
+        conns[idx].latency_sum = 0;
+    }
+    portEXIT_CRITICAL(&notify_lock);
+}
@@ -0,0 +1,179 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_notify.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Notification Scheduler API.
+///
+///             Notifications are queued per connection and handed to the stack
+///             by a weighted round-robin over connections. A connection that
+///             reports congestion (or has too many sends in flight) is skipped
+///             until it recovers, so one slow peer does not hold back others.
+
+#ifndef neil_ble_gatts_NOTIFY_H_
+#define neil_ble_gatts_NOTIFY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "neil_ble_gatts_stack.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Notifications queued per connection; once full the oldest is dropped.
+#ifdef CONFIG_NEIL_BLE_GATTS_NOTIFY_QUEUE_LEN
+#define NEIL_BLE_GATTS_NOTIFY_QUEUE_LEN CONFIG_NEIL_BLE_GATTS_NOTIFY_QUEUE_LEN
+#else
+#define NEIL_BLE_GATTS_NOTIFY_QUEUE_LEN 8
+#endif
+
+/// Characteristics a single connection may subscribe to.
+#ifdef CONFIG_NEIL_BLE_GATTS_NOTIFY_SUBS_MAX
+#define NEIL_BLE_GATTS_NOTIFY_SUBS_MAX CONFIG_NEIL_BLE_GATTS_NOTIFY_SUBS_MAX
+#else
+#define NEIL_BLE_GATTS_NOTIFY_SUBS_MAX 8
+#endif
+
+/// Notifications handed to the stack per connection and not yet reported
+/// sent (`ESP_GATTS_CONF_EVT`, NimBLE `BLE_GAP_EVENT_NOTIFY_TX`).
+#ifdef CONFIG_NEIL_BLE_GATTS_NOTIFY_INFLIGHT_MAX
+#define NEIL_BLE_GATTS_NOTIFY_INFLIGHT_MAX CONFIG_NEIL_BLE_GATTS_NOTIFY_INFLIGHT_MAX
+#else
+#define NEIL_BLE_GATTS_NOTIFY_INFLIGHT_MAX 4
+#endif
+
+/// Round-robin weight of a new connection (sends per turn).
+#define NEIL_BLE_GATTS_NOTIFY_WEIGHT_DEFAULT 1
+
+/// Target of `neil_ble_gatts_notify_enqueue` meaning every subscriber.
+#define NEIL_BLE_GATTS_NOTIFY_CONN_ALL 0xFFFF
+
+/// Client configuration bit enabling notifications.
+#define NEIL_BLE_GATTS_NOTIFY_CCCD_NOTIFY 0x0001
+
+// -------------------------------------------------------------
+// Domain Structures
+// -------------------------------------------------------------
+
+/**
+ * @brief       Scheduler counters of one connection (or all, summed).
+ */
+typedef struct {
+    uint16_t depth;          ///< Notifications currently queued.
+    uint16_t depth_peak;     ///< High-water mark of `depth`.
+    uint32_t sent;           ///< Reported sent by the stack.
+    uint32_t dropped;        ///< Overwritten while queued, or failed to send.
+    uint32_t congestions;    ///< Times the connection reported congestion.
+    uint32_t latency_avg_us; ///< Mean time from queue to stack.
+    uint32_t latency_max_us; ///< Longest time from queue to stack.
+} neil_ble_gatts_notify_stats_t;
+
+// -------------------------------------------------------------
+// Scheduling (public)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Set the round-robin weight of a connection.
+ *
+ *              A connection with weight N may send up to N notifications per
+ *              turn, e.g. to favour a gateway over phones.
+ */
+esp_err_t neil_ble_gatts_notify_set_weight(uint16_t conn_id, uint8_t weight);
+
+/**
+ * @brief       Get the scheduler counters of a connection.
+ *
+ * @return      ESP_ERR_NOT_FOUND if the connection is unknown.
+ */
+esp_err_t neil_ble_gatts_notify_get_stats(uint16_t conn_id,
+                                          neil_ble_gatts_notify_stats_t *stats);
+
+/**
+ * @brief       Get the scheduler counters summed over all connections.
+ *
+ *              Peaks, maxima and the mean are taken over connections.
+ */
+void neil_ble_gatts_notify_get_total(neil_ble_gatts_notify_stats_t *stats);
+
+/**
+ * @brief       Reset the counters of all connections.
+ */
+void neil_ble_gatts_notify_reset_stats(void);
+
+// -------------------------------------------------------------
+// Procedures (component-internal)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Start scheduling for a new connection.
+ *
+ *              Opening a connection already scheduled has no effect.
+ */
+esp_err_t neil_ble_gatts_notify_open(uint16_t conn_id);
+
+/**
+ * @brief       Drop the queue and subscriptions of a connection.
+ */
+void neil_ble_gatts_notify_close(uint16_t conn_id);
+
+/**
+ * @brief       Drop every queue and subscription (on stop).
+ */
+void neil_ble_gatts_notify_close_all(void);
+
+/**
+ * @brief       Apply a client configuration write to the value `handle`.
+ */
+esp_gatt_status_t neil_ble_gatts_notify_subscribe(uint16_t conn_id, uint16_t handle,
+                                                  uint16_t cccd);
+
+/**
+ * @brief       Client configuration of a connection for the value `handle`.
+ */
+uint16_t neil_ble_gatts_notify_cccd(uint16_t conn_id, uint16_t handle);
+
+/**
+ * @brief       Number of connections subscribed to notifications of `handle`.
+ */
+uint8_t neil_ble_gatts_notify_subscribers(uint16_t handle);
+
+/**
+ * @brief       Queue a notification of `handle` to the subscribed connection
+ *              `conn_id`, or every subscriber (NEIL_BLE_GATTS_NOTIFY_CONN_ALL).
+ *
+ *              The payload is copied once and shared by all queues; each
+ *              connection truncates it to its own MTU. It is sent through the
+ *              interface of the profile owning `handle` (Bluedroid).
+ */
+esp_err_t neil_ble_gatts_notify_enqueue(uint8_t gatts_if, uint16_t conn_id,
+                                        uint16_t handle, const uint8_t *data,
+                                        uint16_t len);
+
+/**
+ * @brief       Outbound load of a connection: payload bytes queued now, and
+ *              handed to the stack since it opened (wraps, take differences).
+ *
+ * @return      ESP_ERR_NOT_FOUND if the connection is unknown.
+ */
+esp_err_t neil_ble_gatts_notify_load(uint16_t conn_id, uint32_t *queued_bytes,
+                                     uint32_t *handed_bytes);
+
+/**
+ * @brief       Record a congestion change (`ESP_GATTS_CONGEST_EVT`).
+ */
+void neil_ble_gatts_notify_on_congest(uint16_t conn_id, bool congested);
+
+/**
+ * @brief       Record a completed send (`ESP_GATTS_CONF_EVT` or NimBLE
+ *              `BLE_GAP_EVENT_NOTIFY_TX`).
+ */
+void neil_ble_gatts_notify_on_sent(uint16_t conn_id, esp_gatt_status_t status);
+
+#endif // neil_ble_gatts_NOTIFY_H_
@@ -0,0 +1,522 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_persist.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Persistent Characteristics implementation.
+///
+///             Values are copied under a spinlock only, so a write from the
+///             Bluetooth task never waits for a flush in progress: the flush
+///             snapshots one dirty value at a time and stores it unlocked.
+///
+///             Each context keeps its entries, their values and the snapshot
+///             in a single block, sized from the configuration on attach.
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "nvs.h"
+
+#include "neil_ble_gatts_mem.h"
+#include "neil_ble_gatts_persist.h"
+
+static const char *const TAG = "neil_ble_gatts_persist";
+
+#if CONFIG_NEIL_BLE_GATTS_PERSIST
+
+// -------------------------------------------------------------
+// State
+// -------------------------------------------------------------
+
+typedef struct {
+    const neil_ble_gatts_cfg_chr_t *chr_cfg;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint8_t *value; ///< Last value, `size` bytes.
+    uint16_t len;
+    bool dirty; ///< Not stored since the last write.
+} persist_chr_t;
+
+typedef struct {
+    neil_ble_gatts_ctx_t *ctx; ///< NULL if the slot is free.
+    persist_chr_t *chrs;       ///< Block holding entries, values and snapshot.
+    uint16_t chr_count;
+    uint8_t *snapshot; ///< `largest` bytes, a value being stored.
+    uint16_t largest;  ///< Largest `size` of the entries.
+} persist_ctx_t;
+
+static persist_ctx_t ctxs[NEIL_BLE_GATTS_CTX_MAX];
+
+static neil_ble_gatts_persist_stats_t stats;
+
+static esp_timer_handle_t quiet_timer = NULL;
+
+// --- Serializes flushes with attach/detach, which replace the lists
+static SemaphoreHandle_t flush_mutex = NULL;
+
+// --- Guards values and counters, written on the Bluetooth task
+static portMUX_TYPE persist_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// -------------------------------------------------------------
+// Keys
+// -------------------------------------------------------------
+
+static uint32_t key_hash(uint32_t hash, const uint8_t *uuid, uint8_t uuid_len) {
+
+    const uint8_t len = uuid_len ? uuid_len : ESP_UUID_LEN_128;
+
+    // --- FNV-1a
+    for (uint8_t idx = 0; idx < len; idx++) {
+        hash = (hash ^ uuid[idx]) * 16777619UL;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief       NVS key of a characteristic, from its UUID and its service's.
+ */
+static void chr_key(const neil_ble_gatts_cfg_svc_t *svc_cfg,
+                    const neil_ble_gatts_cfg_chr_t *chr_cfg, char *key) {
+
+    uint32_t hash = key_hash(2166136261UL, svc_cfg->uuid, svc_cfg->uuid_len);
+    hash          = key_hash(hash, chr_cfg->uuid, chr_cfg->uuid_len);
+
+    snprintf(key, NVS_KEY_NAME_MAX_SIZE, "c%08" PRIx32, hash);
+}
+
+// -------------------------------------------------------------
+// Flush (call with the mutex held)
+// -------------------------------------------------------------
+
+static esp_err_t persist_flush(void) {
+
+    bool dirty = false;
+
+    portENTER_CRITICAL(&persist_lock);
+    for (uint8_t idx = 0; idx < NEIL_BLE_GATTS_CTX_MAX; idx++) {
+        for (uint16_t chr = 0; chr < ctxs[idx].chr_count; chr++) {
+            dirty |= ctxs[idx].chrs[chr].dirty;
+        }
+    }
+    portEXIT_CRITICAL(&persist_lock);
+
+    if (!dirty) {
+        return ESP_OK;
+    }
+
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(NEIL_BLE_GATTS_PERSIST_NAMESPACE, NVS_READWRITE, &nvs);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to flush: %s", esp_err_to_name(ret));
+        portENTER_CRITICAL(&persist_lock);
+        stats.failures++;
+        portEXIT_CRITICAL(&persist_lock);
+        return ret;
+    }
+
+    uint32_t stored = 0;
+
+    for (uint8_t idx = 0; idx < NEIL_BLE_GATTS_CTX_MAX; idx++) {
+        persist_ctx_t *slot = ctxs + idx;
+
+        for (uint16_t chr = 0; chr < slot->chr_count; chr++) {
+            persist_chr_t *entry = slot->chrs + chr;
+
+            // --- A write landing meanwhile marks it dirty again
+            portENTER_CRITICAL(&persist_lock);
+            const uint16_t len = entry->len;
+            const bool taken   = entry->dirty && len <= slot->largest;
+            if (taken) {
+                memcpy(slot->snapshot, entry->value, len);
+                entry->dirty = false;
+            }
+            portEXIT_CRITICAL(&persist_lock);
+
+            if (!taken) {
+                continue;
+            }
+
+            esp_err_t err = nvs_set_blob(nvs, entry->key, slot->snapshot, len);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Unable to store %s: %s", entry->key,
+                         esp_err_to_name(err));
+                portENTER_CRITICAL(&persist_lock);
+                entry->dirty = true;
+                stats.failures++;
+                portEXIT_CRITICAL(&persist_lock);
+                ret = err;
+                continue;
+            }
+
+            stored++;
+        }
+    }
+
+    esp_err_t err = stored > 0 ? nvs_commit(nvs) : ESP_OK;
+    nvs_close(nvs);
+
+    portENTER_CRITICAL(&persist_lock);
+    if (err == ESP_OK) {
+        stats.stored += stored;
+        stats.commits += stored > 0;
+    } else {
+        stats.failures++;
+    }
+    portEXIT_CRITICAL(&persist_lock);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to commit: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    return ret;
+}
+
+static void quiet_expired(void *arg) {
+    xSemaphoreTake(flush_mutex, portMAX_DELAY);
+    persist_flush();
+    xSemaphoreGive(flush_mutex);
+}
+
+esp_err_t neil_ble_gatts_persist_flush(void) {
+
+    if (flush_mutex == NULL) {
+        return ESP_OK;
+    }
+
+    xSemaphoreTake(flush_mutex, portMAX_DELAY);
+    esp_err_t ret = persist_flush();
+    xSemaphoreGive(flush_mutex);
+
+    return ret;
+}
+
+void neil_ble_gatts_persist_get_stats(neil_ble_gatts_persist_stats_t *out) {
+
+    if (out == NULL) {
+        return;
+    }
+
+    portENTER_CRITICAL(&persist_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&persist_lock);
+}
+
+// -------------------------------------------------------------
+// Lists
+// -------------------------------------------------------------
+
+static bool chr_persisted(const neil_ble_gatts_cfg_chr_t *chr_cfg) {
+    return chr_cfg->persistent && chr_cfg->on_write != NULL && chr_cfg->size > 0;
+}
+
+/**
+ * @brief       Size the block of a configuration.
+ *
+ * @return      Bytes of the block, 0 if nothing is persistent.
+ */
+static size_t persist_layout(const neil_ble_gatts_cfg_dev_t *dev_cfg, uint16_t *count,
+                             uint16_t *largest) {
+
+    size_t values = 0;
+
+    *count   = 0;
+    *largest = 0;
+
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+            const neil_ble_gatts_cfg_chr_t *chr_cfg = svc_cfg->chr_tab + chr_idx;
+
+            if (!chr_persisted(chr_cfg)) {
+                continue;
+            }
+
+            (*count)++;
+            values += chr_cfg->size;
+            if (chr_cfg->size > *largest) {
+                *largest = chr_cfg->size;
+            }
+        }
+    }
+
+    if (*count == 0) {
+        return 0;
+    }
+
+    return *count * sizeof(persist_chr_t) + values + *largest;
+}
+
+size_t neil_ble_gatts_persist_footprint(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    uint16_t count;
+    uint16_t largest;
+
+    return persist_layout(dev_cfg, &count, &largest);
+}
+
+/**
+ * @brief       Hand a stored value to `on_write`, if there is one.
+ */
+static void chr_restore(nvs_handle_t nvs, persist_chr_t *entry) {
+
+    size_t len    = entry->chr_cfg->size;
+    esp_err_t ret = nvs_get_blob(nvs, entry->key, entry->value, &len);
+
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        return;
+    }
+
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Unable to restore %s: %s", entry->key, esp_err_to_name(ret));
+        return;
+    }
+
+    entry->len = len;
+    entry->chr_cfg->on_write(entry->value, entry->len);
+
+    portENTER_CRITICAL(&persist_lock);
+    stats.restored++;
+    portEXIT_CRITICAL(&persist_lock);
+}
+
+/**
+ * @brief       Free the list of a slot (mutex held, values flushed).
+ */
+static void slot_clear(persist_ctx_t *slot) {
+
+    persist_chr_t *chrs = slot->chrs;
+
+    portENTER_CRITICAL(&persist_lock);
+    *slot = (persist_ctx_t){0};
+    portEXIT_CRITICAL(&persist_lock);
+
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_PERSIST, chrs);
+}
+
+esp_err_t neil_ble_gatts_persist_attach(neil_ble_gatts_ctx_t *ctx,
+                                        const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    if (ctx == NULL || dev_cfg == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint16_t count;
+    uint16_t largest;
+
+    const size_t block_len = persist_layout(dev_cfg, &count, &largest);
+
+    if (count == 0) {
+        neil_ble_gatts_persist_detach(ctx);
+        return ESP_OK;
+    }
+
+    if (flush_mutex == NULL) {
+        flush_mutex = xSemaphoreCreateMutex();
+    }
+
+    if (flush_mutex != NULL && quiet_timer == NULL) {
+        const esp_timer_create_args_t args = {
+            .callback = quiet_expired,
+            .name     = "neil_persist",
+        };
+        esp_timer_create(&args, &quiet_timer);
+    }
+
+    if (flush_mutex == NULL || quiet_timer == NULL) {
+        ESP_LOGE(TAG, "Unable to create flush timer");
+        return ESP_ERR_NO_MEM;
+    }
+
+    // --- Values of an earlier attach are stored before any is restored
+    neil_ble_gatts_persist_detach(ctx);
+
+    persist_chr_t *chrs = neil_ble_gatts_mem_calloc(NEIL_BLE_GATTS_MEM_PERSIST, 1,
+                                                    block_len);
+    if (chrs == NULL) {
+        ESP_LOGE(TAG, "Out of memory keeping %d characteristics", count);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // --- Values follow the entries, the snapshot follows the values
+    uint8_t *value = (uint8_t *)(chrs + count);
+    uint16_t added = 0;
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+            const neil_ble_gatts_cfg_chr_t *chr_cfg = svc_cfg->chr_tab + chr_idx;
+
+            if (!chr_persisted(chr_cfg)) {
+                if (chr_cfg->persistent) {
+                    ESP_LOGW(TAG, "Persistent characteristic without on_write or "
+                                  "size, skipped");
+                }
+                continue;
+            }
+
+            persist_chr_t *entry = chrs + added++;
+
+            entry->chr_cfg = chr_cfg;
+            entry->value   = value;
+            chr_key(svc_cfg, chr_cfg, entry->key);
+
+            value += chr_cfg->size;
+        }
+    }
+
+    // --- Stored values become the application's before any client connects
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(NEIL_BLE_GATTS_PERSIST_NAMESPACE, NVS_READONLY, &nvs);
+
+    if (ret == ESP_OK) {
+        for (uint16_t chr = 0; chr < count; chr++) {
+            chr_restore(nvs, chrs + chr);
+        }
+        nvs_close(nvs);
+    } else if (ret != ESP_ERR_NVS_NOT_FOUND) {
+        // --- Not found: nothing stored yet
+        ESP_LOGW(TAG, "Unable to restore values: %s", esp_err_to_name(ret));
+    }
+
+    xSemaphoreTake(flush_mutex, portMAX_DELAY);
+
+    persist_ctx_t *slot = NULL;
+
+    for (uint8_t idx = 0; slot == NULL && idx < NEIL_BLE_GATTS_CTX_MAX; idx++) {
+        if (ctxs[idx].ctx == NULL) {
+            slot = ctxs + idx;
+        }
+    }
+
+    // NOTE: There is one slot per context, one is always free.
+    portENTER_CRITICAL(&persist_lock);
+    *slot = (persist_ctx_t){
+        .ctx       = ctx,
+        .chrs      = chrs,
+        .chr_count = count,
+        .snapshot  = value,
+        .largest   = largest,
+    };
+    portEXIT_CRITICAL(&persist_lock);
+
+    xSemaphoreGive(flush_mutex);
+
+    return ESP_OK;
+}
+
+void neil_ble_gatts_persist_detach(neil_ble_gatts_ctx_t *ctx) {
+
+    if (flush_mutex == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(flush_mutex, portMAX_DELAY);
+
+    for (uint8_t idx = 0; idx < NEIL_BLE_GATTS_CTX_MAX; idx++) {
+        if (ctxs[idx].ctx == ctx) {
+            persist_flush();
+            slot_clear(ctxs + idx);
+        }
+    }
+
+    xSemaphoreGive(flush_mutex);
+}
+
+// -------------------------------------------------------------
+// Writes
+// -------------------------------------------------------------
+
+void neil_ble_gatts_persist_store(const neil_ble_gatts_cfg_chr_t *chr_cfg,
+                                  const uint8_t *value, uint16_t len) {
+
+    if (!chr_cfg->persistent || quiet_timer == NULL) {
+        return;
+    }
+
+    bool kept = false;
+
+    portENTER_CRITICAL(&persist_lock);
+    for (uint8_t idx = 0; !kept && idx < NEIL_BLE_GATTS_CTX_MAX; idx++) {
+        for (uint16_t chr = 0; !kept && chr < ctxs[idx].chr_count; chr++) {
+            persist_chr_t *entry = ctxs[idx].chrs + chr;
+
+            if (entry->chr_cfg != chr_cfg || len > chr_cfg->size) {
+                continue;
+            }
+
+            memcpy(entry->value, value, len);
+            entry->len   = len;
+            entry->dirty = true;
+            stats.writes++;
+            kept = true;
+        }
+    }
+    portEXIT_CRITICAL(&persist_lock);
+
+    if (!kept) {
+        ESP_LOGW(TAG, "Value of %d bytes not kept", len);
+        return;
+    }
+
+    // --- Every write pushes the flush back
+    esp_timer_stop(quiet_timer);
+    esp_timer_start_once(quiet_timer, NEIL_BLE_GATTS_PERSIST_QUIET_MS * 1000ULL);
+}
+
+#else
+
+// NOTE: Disabled in menuconfig (CONFIG_NEIL_BLE_GATTS_PERSIST), configurations
+//       with persistent characteristics are rejected.
+
+esp_err_t neil_ble_gatts_persist_flush(void) {
+    return ESP_OK;
+}
+
+void neil_ble_gatts_persist_get_stats(neil_ble_gatts_persist_stats_t *out) {
+    if (out != NULL) {
+        *out = (neil_ble_gatts_persist_stats_t){0};
+    }
+}
+
+esp_err_t neil_ble_gatts_persist_attach(neil_ble_gatts_ctx_t *ctx,
+                                        const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    if (ctx == NULL || dev_cfg == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+            if (svc_cfg->chr_tab[chr_idx].persistent) {
+                ESP_LOGE(TAG, "`persistent` set, but disabled in menuconfig");
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+        }
+    }
+
+    return ESP_OK;
+}
+
+void neil_ble_gatts_persist_detach(neil_ble_gatts_ctx_t *ctx) {}
+
+void neil_ble_gatts_persist_store(const neil_ble_gatts_cfg_chr_t *chr_cfg,
+                                  const uint8_t *value, uint16_t len) {}
+
+size_t neil_ble_gatts_persist_footprint(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,112 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_persist.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Persistent Characteristics.
+///
+///             The last value a client wrote to a `persistent` characteristic
+///             is kept in RAM and written behind to NVS:
+///
+///                 write       the value is copied and marked dirty, the
+///                             Bluetooth task never waits on flash
+///                 flush       once writes pause for
+///                             NEIL_BLE_GATTS_PERSIST_QUIET_MS, every dirty
+///                             value is stored and committed at once, on the
+///                             esp_timer task; also on stop and on demand
+///                 restore     on start, stored values are handed to
+///                             `on_write` before any client connects
+///
+///             Values are keyed by the UUIDs of the characteristic and of its
+///             service, so they survive reordered tables. The application
+///             initializes NVS (`nvs_flash_init`) before starting the server.
+
+#ifndef neil_ble_gatts_PERSIST_H_
+#define neil_ble_gatts_PERSIST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "neil_ble_gatts.h"
+#include "neil_ble_gatts_cfg.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// NVS namespace of the stored values.
+#define NEIL_BLE_GATTS_PERSIST_NAMESPACE "neil_gatts"
+
+/// Time without writes before dirty values are flushed (ms).
+#define NEIL_BLE_GATTS_PERSIST_QUIET_MS 2000
+
+/// Number of heap allocations made by `neil_ble_gatts_persist_attach`.
+#define NEIL_BLE_GATTS_PERSIST_ALLOC_COUNT 1
+
+// -------------------------------------------------------------
+// Domain Structures
+// -------------------------------------------------------------
+
+/**
+ * @brief       Persistence counters.
+ */
+typedef struct {
+    uint32_t writes;   ///< Values written by clients.
+    uint32_t stored;   ///< Values written to NVS.
+    uint32_t commits;  ///< NVS commits, one per flush.
+    uint32_t restored; ///< Values handed to `on_write` on start.
+    uint32_t failures; ///< NVS errors, the values stay dirty.
+} neil_ble_gatts_persist_stats_t;
+
+// -------------------------------------------------------------
+// Procedures (public)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Store every dirty value now, e.g. before deep sleep.
+ */
+esp_err_t neil_ble_gatts_persist_flush(void);
+
+/**
+ * @brief       Get the persistence counters.
+ */
+void neil_ble_gatts_persist_get_stats(neil_ble_gatts_persist_stats_t *stats);
+
+// -------------------------------------------------------------
+// Procedures (component-internal)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Keep the persistent characteristics of a context, restoring
+ *              their stored values through `on_write`.
+ *
+ *              Characteristics without `on_write` or `size` are logged and
+ *              skipped. Replaces the entries of an earlier attach.
+ */
+esp_err_t neil_ble_gatts_persist_attach(neil_ble_gatts_ctx_t *ctx,
+                                        const neil_ble_gatts_cfg_dev_t *dev_cfg);
+
+/**
+ * @brief       Flush the values of a context and stop keeping them.
+ */
+void neil_ble_gatts_persist_detach(neil_ble_gatts_ctx_t *ctx);
+
+/**
+ * @brief       Keep a value written by a client, after its `on_write`.
+ *
+ *              Ignores characteristics that are not persistent.
+ */
+void neil_ble_gatts_persist_store(const neil_ble_gatts_cfg_chr_t *chr_cfg,
+                                  const uint8_t *value, uint16_t len);
+
+/**
+ * @brief       Heap bytes the persistent characteristics of `dev_cfg` will hold.
+ */
+size_t neil_ble_gatts_persist_footprint(const neil_ble_gatts_cfg_dev_t *dev_cfg);
+
+#endif // neil_ble_gatts_PERSIST_H_
@@ -0,0 +1,125 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_pipe.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Command Pipe implementation.
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "neil_ble_gatts_conn.h"
+#include "neil_ble_gatts_journal.h"
+#include "neil_ble_gatts_persist.h"
+#include "neil_ble_gatts_pipe.h"
+
+static const char *const TAG = "neil_ble_gatts_pipe";
+
+#if CONFIG_NEIL_BLE_GATTS_PIPE
+
+esp_err_t neil_ble_gatts_pipe_check(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+    return ESP_OK;
+}
+
+/**
+ * @brief       Resolve the target of an operation.
+ *
+ * @return      NULL if it cannot be written through the pipe.
+ */
+static neil_ble_gatts_cfg_chr_t *
+op_target(const neil_ble_gatts_cfg_dev_t *dev_cfg, uint8_t svc_idx, uint8_t chr_idx) {
+
+    if (svc_idx >= dev_cfg->svc_tab_len ||
+        chr_idx >= dev_cfg->svc_tab[svc_idx].chr_tab_len) {
+        return NULL;
+    }
+
+    neil_ble_gatts_cfg_chr_t *chr_cfg = dev_cfg->svc_tab[svc_idx].chr_tab + chr_idx;
+
+    return chr_cfg->on_write != NULL && !chr_cfg->pipe ? chr_cfg : NULL;
+}
+
+uint16_t neil_ble_gatts_pipe_run(const neil_ble_gatts_cfg_dev_t *dev_cfg,
+                                 uint16_t conn_id, uint8_t *data, uint16_t len,
+                                 uint8_t *status) {
+
+    uint8_t ops = 0;
+
+    memset(status, 0, NEIL_BLE_GATTS_PIPE_STATUS_MAX);
+
+    for (uint16_t pos = 0; pos < len && ops < NEIL_BLE_GATTS_PIPE_OPS_MAX; ops++) {
+
+        const uint16_t left   = len - pos;
+        const uint16_t op_len = left >= NEIL_BLE_GATTS_PIPE_OP_HDR
+                                    ? data[pos + 2] | data[pos + 3] << 8
+                                    : UINT16_MAX;
+
+        // --- Truncated record ends the batch
+        if (op_len == UINT16_MAX || left - NEIL_BLE_GATTS_PIPE_OP_HDR < op_len) {
+            ESP_LOGW(TAG, "Truncated operation %d", ops);
+            status[1 + ops / 8] |= 1 << (ops % 8);
+            ops++;
+            break;
+        }
+
+        neil_ble_gatts_cfg_chr_t *chr_cfg =
+            op_target(dev_cfg, data[pos], data[pos + 1]);
+
+        // --- Each target keeps its own security level
+        if (chr_cfg != NULL &&
+            neil_ble_gatts_conn_sec_check(conn_id, chr_cfg->security) != ESP_GATT_OK) {
+            ESP_LOGW(TAG, "Operation %d targets %d/%d, link below its security", ops,
+                     data[pos], data[pos + 1]);
+            status[1 + ops / 8] |= 1 << (ops % 8);
+        } else if (chr_cfg != NULL) {
+            uint8_t *op_data = data + pos + NEIL_BLE_GATTS_PIPE_OP_HDR;
+
+            chr_cfg->on_write(op_data, op_len);
+            neil_ble_gatts_journal_bump(chr_cfg);
+            neil_ble_gatts_persist_store(chr_cfg, op_data, op_len);
+        } else {
+            ESP_LOGW(TAG, "Operation %d targets %d/%d, not writable", ops, data[pos],
+                     data[pos + 1]);
+            status[1 + ops / 8] |= 1 << (ops % 8);
+        }
+
+        pos += NEIL_BLE_GATTS_PIPE_OP_HDR + op_len;
+    }
+
+    status[0] = ops;
+
+    return 1 + (ops + 7) / 8;
+}
+
+#else
+
+// NOTE: Disabled in menuconfig (CONFIG_NEIL_BLE_GATTS_PIPE), configurations
+//       with command pipes are rejected.
+
+esp_err_t neil_ble_gatts_pipe_check(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+            if (svc_cfg->chr_tab[chr_idx].pipe) {
+                ESP_LOGE(TAG, "`pipe` set, but disabled in menuconfig");
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+        }
+    }
+
+    return ESP_OK;
+}
+
+uint16_t neil_ble_gatts_pipe_run(const neil_ble_gatts_cfg_dev_t *dev_cfg,
+                                 uint16_t conn_id, uint8_t *data, uint16_t len,
+                                 uint8_t *status) {
+    status[0] = 0;
+    return 1;
+}
+
+#endif
@@ -0,0 +1,83 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_pipe.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Command Pipe API.
+///
+///             A characteristic with `pipe` set accepts a batch of writes to
+///             other characteristics in a single ATT write (a write without
+///             response, or a prepared write for batches above the MTU).
+///             Operations are dispatched in order to their `on_write`
+///             callbacks; if the pipe also sets `notify`, the writer is then
+///             notified a status bitmap.
+
+#ifndef neil_ble_gatts_PIPE_H_
+#define neil_ble_gatts_PIPE_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "neil_ble_gatts_cfg.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Operations decoded per batch, later ones are ignored.
+#ifdef CONFIG_NEIL_BLE_GATTS_PIPE_OPS_MAX
+#define NEIL_BLE_GATTS_PIPE_OPS_MAX CONFIG_NEIL_BLE_GATTS_PIPE_OPS_MAX
+#else
+#define NEIL_BLE_GATTS_PIPE_OPS_MAX 64
+#endif
+
+/// Size of the largest status notification.
+#define NEIL_BLE_GATTS_PIPE_STATUS_MAX (1 + (NEIL_BLE_GATTS_PIPE_OPS_MAX + 7) / 8)
+
+// -------------------------------------------------------------
+// Wire Format
+// -------------------------------------------------------------
+//
+// Batch (write, little-endian), repeated:
+//
+//     [svc_idx u8][chr_idx u8][len u16][value]
+//
+// Status (notification):
+//
+//     [ops u8][failed bitmap, (ops + 7) / 8 bytes]
+//
+//     Bit N (LSB first) is set when operation N failed: unknown
+//     characteristic, no `on_write`, a nested pipe, a link below the
+//     target's `security`, or a truncated record.
+
+/// Size of an operation header.
+#define NEIL_BLE_GATTS_PIPE_OP_HDR 4
+
+// -------------------------------------------------------------
+// Procedures (component-internal)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Check that the command pipes of a device configuration can run.
+ *
+ * @return      ESP_ERR_NOT_SUPPORTED if a characteristic sets `pipe` while
+ *              pipes are disabled in menuconfig.
+ */
+esp_err_t neil_ble_gatts_pipe_check(const neil_ble_gatts_cfg_dev_t *dev_cfg);
+
+/**
+ * @brief       Decode a batch written on `conn_id` and dispatch its
+ *              operations, each checked against its target's security level.
+ *
+ * @return      Length of the status written to `status`
+ *              (at most NEIL_BLE_GATTS_PIPE_STATUS_MAX).
+ */
+uint16_t neil_ble_gatts_pipe_run(const neil_ble_gatts_cfg_dev_t *dev_cfg,
+                                 uint16_t conn_id, uint8_t *data, uint16_t len,
+                                 uint8_t *status);
+
+#endif // neil_ble_gatts_PIPE_H_
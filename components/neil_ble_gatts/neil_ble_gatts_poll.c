@@ -0,0 +1,483 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_poll.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Polled Characteristics implementation.
+///
+///             Entries hang off the wheel slot of their next due tick. Each
+///             tick the task takes the due entries of the current slot,
+///             samples them and hangs them back one period later. The wheel is
+///             guarded by a mutex the task holds while sampling, so a detach
+///             never frees an entry under a running callback. The entries of a
+///             context share one block, allocated on attach.
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "neil_ble_gatts_mem.h"
+#include "neil_ble_gatts_poll.h"
+
+static const char *const TAG = "neil_ble_gatts_poll";
+
+#if CONFIG_NEIL_BLE_GATTS_POLL
+
+// -------------------------------------------------------------
+// State
+// -------------------------------------------------------------
+
+typedef struct poll_entry_s {
+    struct poll_entry_s *next; ///< Next entry of the same slot.
+    neil_ble_gatts_ctx_t *ctx;
+    const neil_ble_gatts_cfg_chr_t *chr_cfg;
+    uint32_t period; ///< Sampling period (poll ticks).
+    uint32_t due;    ///< Next sampling (poll tick).
+    uint8_t svc_idx;
+    uint8_t chr_idx;
+    bool sent; ///< `data` holds the value last notified.
+
+    // --- `size` bytes of last notified value, then `size` bytes of sample
+    uint8_t data[];
+} poll_entry_t;
+
+static poll_entry_t *wheel[NEIL_BLE_GATTS_POLL_WHEEL_SLOTS];
+
+// --- Entry block of each attached context
+static struct {
+    neil_ble_gatts_ctx_t *ctx;
+    void *block;
+} blocks[NEIL_BLE_GATTS_CTX_MAX];
+
+// --- Entries on the wheel, the task sleeps while there are none
+static uint16_t entry_count = 0;
+
+// --- Poll ticks since the task started
+static uint32_t poll_now = 0;
+
+static SemaphoreHandle_t poll_mutex  = NULL;
+static TaskHandle_t poll_task_handle = NULL;
+
+// -------------------------------------------------------------
+// Wheel Access (call with the mutex held)
+// -------------------------------------------------------------
+
+static void wheel_insert(poll_entry_t *entry) {
+    poll_entry_t **slot = wheel + entry->due % NEIL_BLE_GATTS_POLL_WHEEL_SLOTS;
+
+    entry->next = *slot;
+    *slot       = entry;
+}
+
+/**
+ * @brief       Unlink every entry of a context.
+ */
+static void wheel_remove(neil_ble_gatts_ctx_t *ctx) {
+    for (uint16_t slot = 0; slot < NEIL_BLE_GATTS_POLL_WHEEL_SLOTS; slot++) {
+        poll_entry_t **link = wheel + slot;
+
+        while (*link != NULL) {
+            poll_entry_t *entry = *link;
+
+            if (entry->ctx != ctx) {
+                link = &entry->next;
+                continue;
+            }
+
+            *link = entry->next;
+            entry_count--;
+        }
+    }
+}
+
+// -------------------------------------------------------------
+// Change Detection
+// -------------------------------------------------------------
+
+/**
+ * @brief       Decode a little-endian integer of 1, 2 or 4 bytes.
+ */
+static int64_t integer_get(const uint8_t *data, uint16_t size, bool is_signed) {
+    uint32_t raw = 0;
+
+    for (uint16_t i = 0; i < size; i++) {
+        raw |= (uint32_t)data[i] << (8 * i);
+    }
+
+    // --- Sign-extend narrower values
+    if (is_signed && size < 4 && (raw & (1u << (8 * size - 1)))) {
+        raw |= ~0u << (8 * size);
+    }
+
+    return is_signed ? (int64_t)(int32_t)raw : (int64_t)raw;
+}
+
+static bool sample_changed(const poll_entry_t *entry) {
+    const neil_ble_gatts_cfg_poll_t *poll = entry->chr_cfg->poll;
+    const uint16_t size                   = entry->chr_cfg->size;
+    const uint8_t *last                   = entry->data;
+    const uint8_t *sample                 = entry->data + size;
+
+    if (!entry->sent) {
+        return true;
+    }
+
+    switch (poll->cmp) {
+    case NEIL_BLE_GATTS_POLL_INT:
+    case NEIL_BLE_GATTS_POLL_UINT: {
+        const bool is_signed = poll->cmp == NEIL_BLE_GATTS_POLL_INT;
+        const int64_t delta =
+            integer_get(sample, size, is_signed) - integer_get(last, size, is_signed);
+        const int64_t magnitude = delta < 0 ? -delta : delta;
+        return magnitude > 0 && (float)magnitude >= poll->deadband;
+    }
+    case NEIL_BLE_GATTS_POLL_FLOAT: {
+        float a, b;
+        memcpy(&a, sample, sizeof(float));
+        memcpy(&b, last, sizeof(float));
+
+        if (memcmp(sample, last, sizeof(float)) == 0) {
+            return false;
+        }
+
+        // --- NaN compares unequal to everything, report it once
+        if (a != a || b != b) {
+            return true;
+        }
+
+        const float magnitude = a > b ? a - b : b - a;
+        return magnitude >= poll->deadband;
+    }
+    case NEIL_BLE_GATTS_POLL_BYTES:
+    default:
+        return memcmp(sample, last, size) != 0;
+    }
+}
+
+// -------------------------------------------------------------
+// Sampling
+// -------------------------------------------------------------
+
+static void entry_sample(poll_entry_t *entry) {
+    const uint16_t size = entry->chr_cfg->size;
+
+    // --- Nobody would receive it, sample again once subscribed
+    if (!neil_ble_gatts_ctx_subscribed(entry->ctx, entry->svc_idx, entry->chr_idx)) {
+        entry->sent = false;
+        return;
+    }
+
+    entry->chr_cfg->on_read(entry->data + size);
+
+    if (!sample_changed(entry)) {
+        return;
+    }
+
+    esp_err_t ret = neil_ble_gatts_ctx_notify(entry->ctx, entry->svc_idx,
+                                              entry->chr_idx, entry->data + size, size);
+
+    // --- Retried next period on failure
+    if (ret == ESP_OK) {
+        memcpy(entry->data, entry->data + size, size);
+        entry->sent = true;
+    }
+}
+
+/**
+ * @brief       Sample the entries due at the current tick.
+ */
+static void poll_tick(void) {
+    poll_entry_t **link = wheel + poll_now % NEIL_BLE_GATTS_POLL_WHEEL_SLOTS;
+    poll_entry_t *due   = NULL;
+
+    // --- Entries hanging here for a later round stay
+    while (*link != NULL) {
+        poll_entry_t *entry = *link;
+
+        if ((int32_t)(entry->due - poll_now) > 0) {
+            link = &entry->next;
+            continue;
+        }
+
+        *link       = entry->next;
+        entry->next = due;
+        due         = entry;
+    }
+
+    while (due != NULL) {
+        poll_entry_t *entry = due;
+        due                 = entry->next;
+
+        entry_sample(entry);
+
+        // --- A late task skips missed periods rather than bursting
+        entry->due += entry->period;
+        if ((int32_t)(entry->due - poll_now) <= 0) {
+            entry->due = poll_now + entry->period;
+        }
+
+        wheel_insert(entry);
+    }
+}
+
+static void poll_task(void *arg) {
+    const TickType_t period = pdMS_TO_TICKS(NEIL_BLE_GATTS_POLL_TICK_MS) > 0
+                                  ? pdMS_TO_TICKS(NEIL_BLE_GATTS_POLL_TICK_MS)
+                                  : 1;
+    TickType_t wake = xTaskGetTickCount();
+
+    for (;;) {
+        xSemaphoreTake(poll_mutex, portMAX_DELAY);
+        const bool idle = entry_count == 0;
+        xSemaphoreGive(poll_mutex);
+
+        if (idle) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            wake = xTaskGetTickCount();
+        }
+
+        vTaskDelayUntil(&wake, period);
+
+        xSemaphoreTake(poll_mutex, portMAX_DELAY);
+        poll_now++;
+        poll_tick();
+        xSemaphoreGive(poll_mutex);
+    }
+}
+
+// -------------------------------------------------------------
+// Control
+// -------------------------------------------------------------
+
+/**
+ * @brief       Whether a characteristic can be polled, logs why not.
+ */
+static bool chr_pollable(const neil_ble_gatts_cfg_chr_t *chr_cfg) {
+    const neil_ble_gatts_cfg_poll_t *poll = chr_cfg->poll;
+
+    if (!chr_cfg->notify || chr_cfg->on_read == NULL || chr_cfg->size == 0) {
+        ESP_LOGE(TAG, "Polled characteristic needs notify, on_read and a size");
+        return false;
+    }
+
+    switch (poll->cmp) {
+    case NEIL_BLE_GATTS_POLL_INT:
+    case NEIL_BLE_GATTS_POLL_UINT:
+        if (chr_cfg->size == 1 || chr_cfg->size == 2 || chr_cfg->size == 4) {
+            return true;
+        }
+        break;
+    case NEIL_BLE_GATTS_POLL_FLOAT:
+        if (chr_cfg->size == sizeof(float)) {
+            return true;
+        }
+        break;
+    case NEIL_BLE_GATTS_POLL_BYTES:
+        return true;
+    default:
+        break;
+    }
+
+    ESP_LOGE(TAG, "Comparison %d does not apply to %d bytes", poll->cmp,
+             chr_cfg->size);
+    return false;
+}
+
+/**
+ * @brief       Bytes of an entry, its values and the padding to the next one.
+ */
+static size_t entry_size(const neil_ble_gatts_cfg_chr_t *chr_cfg) {
+    const size_t align = _Alignof(poll_entry_t);
+
+    return (sizeof(poll_entry_t) + 2 * chr_cfg->size + align - 1) & ~(align - 1);
+}
+
+static esp_err_t poll_init(void) {
+
+    if (poll_mutex == NULL) {
+        poll_mutex = xSemaphoreCreateMutex();
+        if (poll_mutex == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    if (poll_task_handle == NULL &&
+        xTaskCreate(poll_task, "neil_poll", NEIL_BLE_GATTS_POLL_TASK_STACK, NULL,
+                    NEIL_BLE_GATTS_POLL_TASK_PRIO, &poll_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Unable to create sampling task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t neil_ble_gatts_poll_attach(neil_ble_gatts_ctx_t *ctx,
+                                     const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    if (ctx == NULL || dev_cfg == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    neil_ble_gatts_poll_detach(ctx);
+
+    size_t block_len = 0;
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+            const neil_ble_gatts_cfg_chr_t *chr_cfg = svc_cfg->chr_tab + chr_idx;
+            if (chr_cfg->poll != NULL && chr_pollable(chr_cfg)) {
+                block_len += entry_size(chr_cfg);
+            }
+        }
+    }
+
+    // --- No task nor mutex for configurations without polled values
+    if (block_len == 0) {
+        return ESP_OK;
+    }
+
+    uint8_t slot = 0;
+    while (slot < NEIL_BLE_GATTS_CTX_MAX && blocks[slot].block != NULL) {
+        slot++;
+    }
+    if (slot == NEIL_BLE_GATTS_CTX_MAX) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint8_t *block = neil_ble_gatts_mem_alloc(NEIL_BLE_GATTS_MEM_POLL, block_len);
+    if (block == NULL) {
+        ESP_LOGE(TAG, "Out of memory polling %d bytes of entries", (int)block_len);
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t ret = poll_init();
+    if (ret != ESP_OK) {
+        neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_POLL, block);
+        return ret;
+    }
+
+    xSemaphoreTake(poll_mutex, portMAX_DELAY);
+
+    blocks[slot].ctx   = ctx;
+    blocks[slot].block = block;
+
+    uint16_t added = 0;
+
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+            const neil_ble_gatts_cfg_chr_t *chr_cfg = svc_cfg->chr_tab + chr_idx;
+
+            if (chr_cfg->poll == NULL || !chr_pollable(chr_cfg)) {
+                continue;
+            }
+
+            poll_entry_t *entry = (poll_entry_t *)block;
+            block += entry_size(chr_cfg);
+
+            const uint32_t period =
+                (chr_cfg->poll->period_ms + NEIL_BLE_GATTS_POLL_TICK_MS - 1) /
+                NEIL_BLE_GATTS_POLL_TICK_MS;
+
+            entry->ctx     = ctx;
+            entry->chr_cfg = chr_cfg;
+            entry->period  = period > 0 ? period : 1;
+            entry->svc_idx = svc_idx;
+            entry->chr_idx = chr_idx;
+            entry->sent    = false;
+
+            // --- Spread first samples over the period, same periods stay apart
+            entry->due = poll_now + 1 + added % entry->period;
+
+            wheel_insert(entry);
+            entry_count++;
+            added++;
+        }
+    }
+
+    xSemaphoreGive(poll_mutex);
+
+    xTaskNotifyGive(poll_task_handle);
+
+    ESP_LOGI(TAG, "Polling %d characteristics", added);
+
+    return ret;
+}
+
+void neil_ble_gatts_poll_detach(neil_ble_gatts_ctx_t *ctx) {
+
+    if (poll_mutex == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(poll_mutex, portMAX_DELAY);
+
+    wheel_remove(ctx);
+
+    for (uint8_t slot = 0; slot < NEIL_BLE_GATTS_CTX_MAX; slot++) {
+        if (blocks[slot].ctx == ctx && blocks[slot].block != NULL) {
+            neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_POLL, blocks[slot].block);
+            blocks[slot].ctx   = NULL;
+            blocks[slot].block = NULL;
+        }
+    }
+
+    xSemaphoreGive(poll_mutex);
+}
+
+size_t neil_ble_gatts_poll_footprint(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    size_t block_len = 0;
+
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+            if (svc_cfg->chr_tab[chr_idx].poll != NULL) {
+                block_len += entry_size(svc_cfg->chr_tab + chr_idx);
+            }
+        }
+    }
+
+    return block_len;
+}
+
+#else
+
+// NOTE: Disabled in menuconfig (CONFIG_NEIL_BLE_GATTS_POLL), configurations
+//       with polled characteristics are rejected.
+
+esp_err_t neil_ble_gatts_poll_attach(neil_ble_gatts_ctx_t *ctx,
+                                     const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+
+    if (ctx == NULL || dev_cfg == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (uint8_t svc_idx = 0; svc_idx < dev_cfg->svc_tab_len; svc_idx++) {
+        const neil_ble_gatts_cfg_svc_t *svc_cfg = dev_cfg->svc_tab + svc_idx;
+        for (uint8_t chr_idx = 0; chr_idx < svc_cfg->chr_tab_len; chr_idx++) {
+            if (svc_cfg->chr_tab[chr_idx].poll != NULL) {
+                ESP_LOGE(TAG, "`poll` set, but disabled in menuconfig");
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+        }
+    }
+
+    return ESP_OK;
+}
+
+void neil_ble_gatts_poll_detach(neil_ble_gatts_ctx_t *ctx) {}
+
+size_t neil_ble_gatts_poll_footprint(const neil_ble_gatts_cfg_dev_t *dev_cfg) {
+    return 0;
+}
+
+#endif
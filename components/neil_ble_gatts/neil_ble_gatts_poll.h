@@ -0,0 +1,76 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_poll.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Polled Characteristics.
+///
+///             A notifying characteristic with a `poll` configuration is
+///             sampled by the server through its `on_read` callback, and
+///             notified only when the sample changed. The application no
+///             longer runs one timer per value.
+///
+///             Every polled characteristic of every context shares one timer
+///             wheel served by one task. Sampling is skipped while no client
+///             subscribed, and the first sample after a subscription is always
+///             notified.
+
+#ifndef neil_ble_gatts_POLL_H_
+#define neil_ble_gatts_POLL_H_
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+#include "neil_ble_gatts.h"
+#include "neil_ble_gatts_cfg.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Resolution of sampling periods (ms).
+#define NEIL_BLE_GATTS_POLL_TICK_MS 10
+
+/// Timer wheel slots; periods longer than `slots * tick` take extra rounds.
+#define NEIL_BLE_GATTS_POLL_WHEEL_SLOTS 64
+
+/// Stack size of the sampling task (runs `on_read` callbacks).
+#define NEIL_BLE_GATTS_POLL_TASK_STACK 3072
+
+/// Priority of the sampling task.
+#define NEIL_BLE_GATTS_POLL_TASK_PRIO 5
+
+/// Number of heap allocations made by `neil_ble_gatts_poll_attach`.
+#define NEIL_BLE_GATTS_POLL_ALLOC_COUNT 1
+
+// -------------------------------------------------------------
+// Procedures (component-internal)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Schedule the polled characteristics of a context.
+ *
+ *              Characteristics without `notify`, `on_read` or a valid `size`
+ *              for their comparison are logged and skipped. Replaces the
+ *              entries of an earlier attach.
+ */
+esp_err_t neil_ble_gatts_poll_attach(neil_ble_gatts_ctx_t *ctx,
+                                     const neil_ble_gatts_cfg_dev_t *dev_cfg);
+
+/**
+ * @brief       Stop sampling the characteristics of a context.
+ *
+ *              Returns once no `on_read` of the context runs.
+ */
+void neil_ble_gatts_poll_detach(neil_ble_gatts_ctx_t *ctx);
+
+/**
+ * @brief       Heap bytes the polled characteristics of `dev_cfg` will hold.
+ */
+size_t neil_ble_gatts_poll_footprint(const neil_ble_gatts_cfg_dev_t *dev_cfg);
+
+#endif // neil_ble_gatts_POLL_H_
@@ -0,0 +1,366 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_read.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Read Response implementation.
+///
+///             ATT allows a single outstanding request per connection, but a
+///             Read Multiple request reaches the application as one read per
+///             handle sharing a transaction, so a connection may hold several
+///             pending slots for its current transaction.
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#include "neil_ble_gatts_conn.h"
+#include "neil_ble_gatts_read.h"
+#include "neil_ble_gatts_stack.h"
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+#include "esp_gatts_api.h"
+#endif
+
+static const char *const TAG = "neil_ble_gatts_read";
+
+// -------------------------------------------------------------
+// Token Layout
+// -------------------------------------------------------------
+//
+// Format:
+//     SS GGGGGG
+//
+//     SS:     slot index + 1 (0 marks an invalid token)
+//     GGGGGG: 24-bit generation, rejects completions of recycled slots
+#define TOKEN_GEN_MASK           0x00FFFFFFu
+#define TOKEN_MAKE(slot, gen)    ((((uint32_t)(slot) + 1) << 24) | TOKEN_GEN(gen))
+#define TOKEN_SLOT(token)        ((int)((token) >> 24) - 1)
+#define TOKEN_GEN(token)         ((token) & TOKEN_GEN_MASK)
+
+// -------------------------------------------------------------
+// State
+// -------------------------------------------------------------
+
+/**
+ * @brief       A read request awaiting its response.
+ */
+typedef struct {
+    bool active;
+    uint8_t gatts_if;
+    uint16_t conn_id;
+    uint32_t trans_id;
+    uint16_t handle;
+    uint16_t offset;
+    uint32_t gen;
+    int64_t deadline_us;
+} pending_read_t;
+
+/// Pending slots shared by all connections.
+#define PENDING_MAX (NEIL_BLE_GATTS_CONN_MAX * 2)
+
+static pending_read_t pending[PENDING_MAX];
+
+static uint32_t next_gen = 0;
+
+// --- Deferred reads are opened on the BTC task and closed from any task.
+static portMUX_TYPE pending_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// -------------------------------------------------------------
+// Responses
+// -------------------------------------------------------------
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+
+// --- Requests of a connection the table could not track
+static esp_gatt_rsp_t rsp_spare;
+
+esp_gatt_rsp_t *neil_ble_gatts_read_rsp(uint16_t conn_id) {
+
+    neil_ble_gatts_conn_t *conn = neil_ble_gatts_conn_get(conn_id);
+
+    return conn != NULL ? conn->rsp : &rsp_spare;
+}
+
+esp_gatt_status_t neil_ble_gatts_read_fill(esp_gatt_rsp_t *rsp, uint16_t handle,
+                                           uint16_t offset, const uint8_t *value,
+                                           uint16_t len) {
+
+    if (offset > len) {
+        return ESP_GATT_INVALID_OFFSET;
+    }
+
+    rsp->attr_value.handle   = handle;
+    rsp->attr_value.offset   = offset;
+    rsp->attr_value.len      = len - offset;
+    rsp->attr_value.auth_req = ESP_GATT_AUTH_REQ_NONE;
+
+    // --- `value` may alias the response buffer (in-place reads)
+    if (rsp->attr_value.value != value + offset) {
+        memmove(rsp->attr_value.value, value + offset, rsp->attr_value.len);
+    }
+
+    return ESP_GATT_OK;
+}
+
+#endif
+
+// -------------------------------------------------------------
+// Batching
+// -------------------------------------------------------------
+
+#if CONFIG_NEIL_BLE_GATTS_BATCH
+
+bool neil_ble_gatts_read_batch_valid(const neil_ble_gatts_cfg_svc_t *svc_cfg,
+                                     const neil_ble_gatts_cfg_chr_t *chr_cfg) {
+
+    for (uint8_t idx = 0; idx < chr_cfg->batch_len; idx++) {
+        const uint8_t member_idx = chr_cfg->batch[idx];
+
+        if (member_idx >= svc_cfg->chr_tab_len) {
+            ESP_LOGE(TAG, "Batch member %d out of range", member_idx);
+            return false;
+        }
+
+        const neil_ble_gatts_cfg_chr_t *member = svc_cfg->chr_tab + member_idx;
+
+        // --- Deferred and nested members cannot be answered in one pass
+        if (member->on_read == NULL || member->batch_len > 0) {
+            ESP_LOGE(TAG, "Batch member %d is not a synchronous read", member_idx);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+esp_gatt_status_t neil_ble_gatts_read_batch(const neil_ble_gatts_cfg_svc_t *svc_cfg,
+                                            const neil_ble_gatts_cfg_chr_t *chr_cfg,
+                                            uint16_t conn_id, uint8_t *value,
+                                            uint16_t cap, uint16_t *len) {
+
+    // --- Members keep their own security level, checked before any is read
+    for (uint8_t idx = 0; idx < chr_cfg->batch_len; idx++) {
+        const neil_ble_gatts_cfg_chr_t *member = svc_cfg->chr_tab + chr_cfg->batch[idx];
+
+        const esp_gatt_status_t status =
+            neil_ble_gatts_conn_sec_check(conn_id, member->security);
+
+        if (status != ESP_GATT_OK) {
+            return status;
+        }
+    }
+
+    *len = 0;
+
+    for (uint8_t idx = 0; idx < chr_cfg->batch_len; idx++) {
+        const neil_ble_gatts_cfg_chr_t *member = svc_cfg->chr_tab + chr_cfg->batch[idx];
+
+        if (*len + NEIL_BLE_GATTS_READ_BATCH_HDR + member->size > cap) {
+            break;
+        }
+
+        value[(*len)++] = member->size & 0xFF;
+        value[(*len)++] = member->size >> 8;
+
+        member->on_read(value + *len);
+        *len += member->size;
+    }
+
+    return ESP_GATT_OK;
+}
+
+#else
+
+// NOTE: Disabled in menuconfig (CONFIG_NEIL_BLE_GATTS_BATCH), configurations
+//       with batch characteristics are rejected.
+
+bool neil_ble_gatts_read_batch_valid(const neil_ble_gatts_cfg_svc_t *svc_cfg,
+                                     const neil_ble_gatts_cfg_chr_t *chr_cfg) {
+    ESP_LOGE(TAG, "`batch` set, but disabled in menuconfig");
+    return false;
+}
+
+esp_gatt_status_t neil_ble_gatts_read_batch(const neil_ble_gatts_cfg_svc_t *svc_cfg,
+                                            const neil_ble_gatts_cfg_chr_t *chr_cfg,
+                                            uint16_t conn_id, uint8_t *value,
+                                            uint16_t cap, uint16_t *len) {
+    *len = 0;
+    return ESP_GATT_REQ_NOT_SUPPORTED;
+}
+
+#endif
+
+// -------------------------------------------------------------
+// Deferral
+// -------------------------------------------------------------
+
+neil_ble_gatts_read_token_t neil_ble_gatts_read_defer(uint8_t gatts_if,
+                                                      uint16_t conn_id,
+                                                      uint32_t trans_id,
+                                                      uint16_t handle,
+                                                      uint16_t offset) {
+
+    neil_ble_gatts_read_token_t token = 0;
+    int free_slot                     = -1;
+    uint8_t stale                     = 0;
+
+    portENTER_CRITICAL(&pending_lock);
+
+    for (int idx = 0; idx < PENDING_MAX; idx++) {
+        // --- A new transaction on the same connection means the peer gave up
+        //     on the previous one, drop it.
+        if (pending[idx].active && pending[idx].conn_id == conn_id &&
+            pending[idx].trans_id != trans_id) {
+            pending[idx].active = false;
+            stale++;
+        }
+        if (!pending[idx].active && free_slot < 0) {
+            free_slot = idx;
+        }
+    }
+
+    if (free_slot >= 0) {
+        next_gen = (next_gen + 1) & TOKEN_GEN_MASK;
+
+        pending[free_slot] = (pending_read_t){
+            .active      = true,
+            .gatts_if    = gatts_if,
+            .conn_id     = conn_id,
+            .trans_id    = trans_id,
+            .handle      = handle,
+            .offset      = offset,
+            .gen         = next_gen,
+            .deadline_us =
+                esp_timer_get_time() + NEIL_BLE_GATTS_READ_TIMEOUT_MS * 1000LL,
+        };
+
+        token = TOKEN_MAKE(free_slot, next_gen);
+    }
+
+    portEXIT_CRITICAL(&pending_lock);
+
+    if (stale > 0) {
+        ESP_LOGW(TAG, "Replaced %d stale deferred read(s) on conn_id %d", stale,
+                 conn_id);
+    }
+
+    if (token == 0) {
+        ESP_LOGE(TAG, "No slot for deferred read on conn_id %d", conn_id);
+    }
+
+    return token;
+}
+
+/**
+ * @brief       Remove and return the pending read addressed by a token.
+ */
+static esp_err_t pending_take(neil_ble_gatts_read_token_t token, pending_read_t *out) {
+
+    const int slot = TOKEN_SLOT(token);
+
+    if (slot < 0 || slot >= PENDING_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    portENTER_CRITICAL(&pending_lock);
+    if (pending[slot].active && pending[slot].gen == TOKEN_GEN(token)) {
+        *out                 = pending[slot];
+        pending[slot].active = false;
+        ret                  = ESP_OK;
+    }
+    portEXIT_CRITICAL(&pending_lock);
+
+    if (ret == ESP_OK && esp_timer_get_time() > out->deadline_us) {
+        ret = ESP_ERR_TIMEOUT;
+    }
+
+    return ret;
+}
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+
+esp_err_t neil_ble_gatts_read_complete(neil_ble_gatts_read_token_t token,
+                                       const uint8_t *data, uint16_t len) {
+
+    if (len > ESP_GATT_MAX_ATTR_LEN || (data == NULL && len > 0)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    pending_read_t req;
+
+    esp_err_t ret = pending_take(token, &req);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    // NOTE: Built on the completing task's stack, not the BTC task.
+    esp_gatt_rsp_t rsp;
+
+    esp_gatt_status_t status = neil_ble_gatts_read_fill(&rsp, req.handle, req.offset,
+                                                        data, len);
+
+    return esp_ble_gatts_send_response(req.gatts_if, req.conn_id, req.trans_id, status,
+                                       status == ESP_GATT_OK ? &rsp : NULL);
+}
+
+esp_err_t neil_ble_gatts_read_error(neil_ble_gatts_read_token_t token,
+                                    esp_gatt_status_t status) {
+
+    pending_read_t req;
+
+    esp_err_t ret = pending_take(token, &req);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    return esp_ble_gatts_send_response(req.gatts_if, req.conn_id, req.trans_id, status,
+                                       NULL);
+}
+
+#else
+
+// NOTE: NimBLE answers reads within the access callback, see
+//       neil_ble_gatts_nimble.c, so no request is ever deferred.
+
+esp_err_t neil_ble_gatts_read_complete(neil_ble_gatts_read_token_t token,
+                                       const uint8_t *data, uint16_t len) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t neil_ble_gatts_read_error(neil_ble_gatts_read_token_t token,
+                                    esp_gatt_status_t status) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
+
+// -------------------------------------------------------------
+// Cancellation
+// -------------------------------------------------------------
+
+void neil_ble_gatts_read_cancel(uint16_t conn_id) {
+    portENTER_CRITICAL(&pending_lock);
+    for (int idx = 0; idx < PENDING_MAX; idx++) {
+        if (pending[idx].active && pending[idx].conn_id == conn_id) {
+            pending[idx].active = false;
+        }
+    }
+    portEXIT_CRITICAL(&pending_lock);
+}
+
+void neil_ble_gatts_read_cancel_all(void) {
+    portENTER_CRITICAL(&pending_lock);
+    for (int idx = 0; idx < PENDING_MAX; idx++) {
+        pending[idx].active = false;
+    }
+    portEXIT_CRITICAL(&pending_lock);
+}
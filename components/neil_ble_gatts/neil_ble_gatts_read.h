@@ -0,0 +1,125 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_read.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Read Response API (synchronous and deferred).
+
+#ifndef neil_ble_gatts_READ_H_
+#define neil_ble_gatts_READ_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "neil_ble_gatts_cfg.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Deferred reads older than this are rejected (ATT transaction timeout).
+#define NEIL_BLE_GATTS_READ_TIMEOUT_MS 30000
+
+/// Size of a batch record header (value length, u16 LE).
+#define NEIL_BLE_GATTS_READ_BATCH_HDR 2
+
+// -------------------------------------------------------------
+// Deferred Responses (public)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Complete a deferred read with a value.
+ *
+ *              May be called from any task. `data` holds the full
+ *              characteristic value; the library applies the request offset.
+ *
+ * @return      ESP_ERR_NOT_FOUND if the token is stale (already completed,
+ *              peer disconnected), ESP_ERR_TIMEOUT if the ATT transaction
+ *              timeout has passed, ESP_ERR_INVALID_SIZE if `len` exceeds
+ *              `ESP_GATT_MAX_ATTR_LEN`, ESP_ERR_NOT_SUPPORTED on NimBLE.
+ */
+esp_err_t neil_ble_gatts_read_complete(neil_ble_gatts_read_token_t token,
+                                       const uint8_t *data, uint16_t len);
+
+/**
+ * @brief       Complete a deferred read with an ATT error.
+ *
+ *              May be called from any task.
+ */
+esp_err_t neil_ble_gatts_read_error(neil_ble_gatts_read_token_t token,
+                                    esp_gatt_status_t status);
+
+// -------------------------------------------------------------
+// Procedures (component-internal)
+// -------------------------------------------------------------
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+/**
+ * @brief       Response buffer of a connection, for use on the BTC task.
+ *
+ *              Its contents are left from the previous response: callers
+ *              set every field they send, see `neil_ble_gatts_read_fill`.
+ */
+esp_gatt_rsp_t *neil_ble_gatts_read_rsp(uint16_t conn_id);
+
+/**
+ * @brief       Populate a read response from a full characteristic value,
+ *              applying the request offset.
+ *
+ * @return      ESP_GATT_INVALID_OFFSET if `offset` is past the value.
+ */
+esp_gatt_status_t neil_ble_gatts_read_fill(esp_gatt_rsp_t *rsp, uint16_t handle,
+                                           uint16_t offset, const uint8_t *value,
+                                           uint16_t len);
+#endif
+
+/**
+ * @brief       Whether a batch characteristic only lists synchronous siblings
+ *              (never, if batches are disabled in menuconfig).
+ */
+bool neil_ble_gatts_read_batch_valid(const neil_ble_gatts_cfg_svc_t *svc_cfg,
+                                     const neil_ble_gatts_cfg_chr_t *chr_cfg);
+
+/**
+ * @brief       Invoke each member of a batch characteristic once and pack the
+ *              values into `value`.
+ *
+ *              Members are written in place after their length header, so no
+ *              intermediate copies are made. Packing stops at the first member
+ *              that does not fit `cap`. Bytes written are stored in `len`.
+ *
+ * @return      ESP_GATT_INSUF_AUTHENTICATION, with no member invoked, if the
+ *              link of `conn_id` is below the `security` of any member.
+ */
+esp_gatt_status_t neil_ble_gatts_read_batch(const neil_ble_gatts_cfg_svc_t *svc_cfg,
+                                            const neil_ble_gatts_cfg_chr_t *chr_cfg,
+                                            uint16_t conn_id, uint8_t *value,
+                                            uint16_t cap, uint16_t *len);
+
+/**
+ * @brief       Record a read request whose response will be sent later.
+ *
+ * @return      Token to hand to the application.
+ */
+neil_ble_gatts_read_token_t neil_ble_gatts_read_defer(uint8_t gatts_if,
+                                                      uint16_t conn_id,
+                                                      uint32_t trans_id,
+                                                      uint16_t handle,
+                                                      uint16_t offset);
+
+/**
+ * @brief       Drop the pending read of a connection (on disconnect).
+ */
+void neil_ble_gatts_read_cancel(uint16_t conn_id);
+
+/**
+ * @brief       Drop every pending read (on stop).
+ */
+void neil_ble_gatts_read_cancel_all(void);
+
+#endif // neil_ble_gatts_READ_H_
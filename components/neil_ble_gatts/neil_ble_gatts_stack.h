@@ -0,0 +1,151 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_stack.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Bluetooth Host Stack Abstraction.
+///
+///             The component runs on Bluedroid (`neil_ble_gatts.c`) or NimBLE
+///             (`neil_ble_gatts_nimble.c`), following the host selected in
+///             menuconfig. Modules shared by both backends include this header
+///             rather than a host API, and reach the host only through the
+///             procedures below.
+///
+///             Configurations and shared modules are written against the
+///             Bluedroid names (`ESP_UUID_LEN_*`, `esp_gatt_status_t`, ...);
+///             under NimBLE they are provided here with their ATT values.
+
+#ifndef neil_ble_gatts_STACK_H_
+#define neil_ble_gatts_STACK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "sdkconfig.h"
+
+// -------------------------------------------------------------
+// Backend Selection
+// -------------------------------------------------------------
+
+#ifdef CONFIG_BT_NIMBLE_ENABLED
+#define NEIL_BLE_GATTS_STACK_NIMBLE 1
+#else
+#define NEIL_BLE_GATTS_STACK_NIMBLE 0
+#endif
+
+// -------------------------------------------------------------
+// Shared Definitions
+// -------------------------------------------------------------
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+
+#include "esp_bt_defs.h"
+#include "esp_gatt_defs.h"
+
+#else
+
+/// Bluetooth device address.
+typedef uint8_t esp_bd_addr_t[6];
+
+#define ESP_UUID_LEN_16  2
+#define ESP_UUID_LEN_32  4
+#define ESP_UUID_LEN_128 16
+
+/// Longest attribute value (ATT).
+#define ESP_GATT_MAX_ATTR_LEN 512
+
+/// Default and largest ATT MTU.
+#define ESP_GATT_DEF_BLE_MTU_SIZE 23
+#define ESP_GATT_MAX_MTU_SIZE     517
+
+/**
+ * @brief       ATT status, returned as is from NimBLE access callbacks.
+ */
+typedef enum {
+    ESP_GATT_OK                   = 0x00,
+    ESP_GATT_INVALID_HANDLE       = 0x01,
+    ESP_GATT_READ_NOT_PERMIT      = 0x02,
+    ESP_GATT_WRITE_NOT_PERMIT     = 0x03,
+    ESP_GATT_INSUF_AUTHENTICATION = 0x05,
+    ESP_GATT_REQ_NOT_SUPPORTED    = 0x06,
+    ESP_GATT_INVALID_OFFSET       = 0x07,
+    ESP_GATT_PREPARE_Q_FULL       = 0x09,
+    ESP_GATT_INVALID_ATTR_LEN     = 0x0D,
+    ESP_GATT_INSUF_RESOURCE       = 0x11,
+    ESP_GATT_NO_RESOURCES         = 0x80,
+    ESP_GATT_INTERNAL_ERROR       = 0x81,
+    ESP_GATT_BUSY                 = 0x84,
+    ESP_GATT_ERROR                = 0x85,
+} esp_gatt_status_t;
+
+#endif
+
+// -------------------------------------------------------------
+// Backend Procedures
+// -------------------------------------------------------------
+
+/**
+ * @brief       Hand a notification to the stack.
+ *
+ *              The stack copies `data` before returning. Completion is
+ *              reported through `neil_ble_gatts_notify_on_sent`.
+ *
+ * @return      ESP_ERR_NO_MEM if the stack is out of buffers for now (retry
+ *              after a completion), another error if the send was refused.
+ */
+esp_err_t neil_ble_gatts_stack_notify(uint8_t gatts_if, uint16_t conn_id,
+                                      uint16_t handle, const uint8_t *data,
+                                      uint16_t len);
+
+/**
+ * @brief       Request disconnection of a peer.
+ *
+ *              Completes asynchronously with the backend's disconnect event.
+ */
+void neil_ble_gatts_stack_disconnect(uint16_t conn_id, const esp_bd_addr_t bda);
+
+/**
+ * @brief       Request encryption of a link, authenticated if `mitm`.
+ *
+ *              Completes asynchronously; the backend reports the outcome
+ *              through `neil_ble_gatts_conn_sec_update`.
+ */
+void neil_ble_gatts_stack_secure(uint16_t conn_id, const esp_bd_addr_t bda, bool mitm);
+
+/**
+ * @brief       Request an RSSI sample of a link.
+ *
+ *              Reported through `neil_ble_gatts_link_on_rssi`, possibly before
+ *              returning.
+ */
+esp_err_t neil_ble_gatts_stack_read_rssi(uint16_t conn_id, const esp_bd_addr_t bda);
+
+/**
+ * @brief       Request connection parameters of a link: interval range
+ *              (1.25 ms), peripheral latency (intervals) and supervision
+ *              timeout (10 ms).
+ *
+ *              Reported through `neil_ble_gatts_link_on_params`.
+ */
+esp_err_t neil_ble_gatts_stack_update_params(uint16_t conn_id, const esp_bd_addr_t bda,
+                                             uint16_t interval_min,
+                                             uint16_t interval_max, uint16_t latency,
+                                             uint16_t timeout);
+
+/**
+ * @brief       Request a PHY (1: 1M, 2: 2M, 3: coded) in both directions of a
+ *              link.
+ *
+ *              Reported through `neil_ble_gatts_link_on_phy`.
+ *
+ * @return      ESP_ERR_NOT_SUPPORTED without the LE 5.0 features of the host.
+ */
+esp_err_t neil_ble_gatts_stack_set_phy(uint16_t conn_id, const esp_bd_addr_t bda,
+                                       uint8_t phy);
+
+#endif // neil_ble_gatts_STACK_H_
@@ -0,0 +1,320 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_trace.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      GATT/GAP Event Trace Recorder implementation.
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#include "neil_ble_gatts_mem.h"
+#include "neil_ble_gatts_trace.h"
+
+static const char *const TAG = "neil_ble_gatts_trace";
+
+#if CONFIG_NEIL_BLE_GATTS_TRACE
+
+// -------------------------------------------------------------
+// State
+// -------------------------------------------------------------
+
+static struct {
+    neil_ble_gatts_trace_rec_t *recs;
+    uint16_t capacity;
+    uint16_t head;  ///< Next slot to write.
+    uint16_t count; ///< Valid records.
+    uint16_t seq;
+    uint32_t dropped;
+    bool paused;
+} ring;
+
+// --- Records are written on the BTC task, control comes from any task.
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// -------------------------------------------------------------
+// Control
+// -------------------------------------------------------------
+
+esp_err_t neil_ble_gatts_trace_start(uint16_t capacity) {
+
+    if (capacity == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (ring.recs != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    neil_ble_gatts_trace_rec_t *recs = neil_ble_gatts_mem_calloc(
+        NEIL_BLE_GATTS_MEM_TRACE, capacity, sizeof(neil_ble_gatts_trace_rec_t));
+
+    if (recs == NULL) {
+        ESP_LOGE(TAG, "Out of memory allocating %u records", capacity);
+        return ESP_ERR_NO_MEM;
+    }
+
+    portENTER_CRITICAL(&ring_lock);
+    ring.capacity = capacity;
+    ring.head     = 0;
+    ring.count    = 0;
+    ring.seq      = 0;
+    ring.dropped  = 0;
+    ring.paused   = false;
+    ring.recs     = recs;
+    portEXIT_CRITICAL(&ring_lock);
+
+    return ESP_OK;
+}
+
+void neil_ble_gatts_trace_stop(void) {
+    portENTER_CRITICAL(&ring_lock);
+    neil_ble_gatts_trace_rec_t *recs = ring.recs;
+    ring.recs                        = NULL;
+    ring.count                       = 0;
+    portEXIT_CRITICAL(&ring_lock);
+
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_TRACE, recs);
+}
+
+void neil_ble_gatts_trace_pause(bool paused) {
+    portENTER_CRITICAL(&ring_lock);
+    ring.paused = paused;
+    portEXIT_CRITICAL(&ring_lock);
+}
+
+void neil_ble_gatts_trace_clear(void) {
+    portENTER_CRITICAL(&ring_lock);
+    ring.head    = 0;
+    ring.count   = 0;
+    ring.dropped = 0;
+    portEXIT_CRITICAL(&ring_lock);
+}
+
+bool neil_ble_gatts_trace_active(void) { return ring.recs != NULL && !ring.paused; }
+
+// -------------------------------------------------------------
+// Recording
+// -------------------------------------------------------------
+
+static void ring_push(uint8_t src, uint8_t event, uint16_t conn_id, uint16_t handle,
+                      uint16_t len, int64_t start_us) {
+
+    const int64_t elapsed = esp_timer_get_time() - start_us;
+
+    portENTER_CRITICAL(&ring_lock);
+
+    if (ring.recs != NULL && !ring.paused) {
+        ring.recs[ring.head] = (neil_ble_gatts_trace_rec_t){
+            .time_us     = (uint32_t)start_us,
+            .duration_us = elapsed > UINT16_MAX ? UINT16_MAX : (uint16_t)elapsed,
+            .src         = src,
+            .event       = event,
+            .conn_id     = conn_id,
+            .handle      = handle,
+            .len         = len,
+            .seq         = ring.seq++,
+        };
+
+        ring.head = (ring.head + 1) % ring.capacity;
+
+        if (ring.count < ring.capacity) {
+            ring.count++;
+        } else {
+            ring.dropped++;
+        }
+    }
+
+    portEXIT_CRITICAL(&ring_lock);
+}
+
+void neil_ble_gatts_trace_gatts(esp_gatts_cb_event_t event,
+                                const esp_ble_gatts_cb_param_t *param,
+                                int64_t start_us) {
+
+    uint16_t conn_id = NEIL_BLE_GATTS_TRACE_NO_CONN;
+    uint16_t handle  = 0;
+    uint16_t len     = 0;
+
+    // --- Pull the interesting fields out of the event-specific union member
+    switch (event) {
+    case ESP_GATTS_READ_EVT:
+        conn_id = param->read.conn_id;
+        handle  = param->read.handle;
+        break;
+    case ESP_GATTS_WRITE_EVT:
+        conn_id = param->write.conn_id;
+        handle  = param->write.handle;
+        len     = param->write.len;
+        break;
+    case ESP_GATTS_EXEC_WRITE_EVT:
+        conn_id = param->exec_write.conn_id;
+        break;
+    case ESP_GATTS_MTU_EVT:
+        conn_id = param->mtu.conn_id;
+        len     = param->mtu.mtu;
+        break;
+    case ESP_GATTS_CONF_EVT:
+        conn_id = param->conf.conn_id;
+        handle  = param->conf.handle;
+        len     = param->conf.len;
+        break;
+    case ESP_GATTS_CONNECT_EVT:
+        conn_id = param->connect.conn_id;
+        break;
+    case ESP_GATTS_DISCONNECT_EVT:
+        conn_id = param->disconnect.conn_id;
+        len     = param->disconnect.reason;
+        break;
+    case ESP_GATTS_CONGEST_EVT:
+        conn_id = param->congest.conn_id;
+        len     = param->congest.congested;
+        break;
+    case ESP_GATTS_CREAT_ATTR_TAB_EVT:
+        len = param->add_attr_tab.num_handle;
+        break;
+    default:
+        break;
+    }
+
+    ring_push(NEIL_BLE_GATTS_TRACE_SRC_GATTS, event, conn_id, handle, len, start_us);
+}
+
+void neil_ble_gatts_trace_gap(esp_gap_ble_cb_event_t event, int64_t start_us) {
+    ring_push(NEIL_BLE_GATTS_TRACE_SRC_GAP, event, NEIL_BLE_GATTS_TRACE_NO_CONN, 0, 0,
+              start_us);
+}
+
+// -------------------------------------------------------------
+// Export
+// -------------------------------------------------------------
+
+static neil_ble_gatts_trace_hdr_t header_get(void) {
+    neil_ble_gatts_trace_hdr_t hdr = {
+        .magic       = NEIL_BLE_GATTS_TRACE_MAGIC,
+        .version     = NEIL_BLE_GATTS_TRACE_VERSION,
+        .record_size = sizeof(neil_ble_gatts_trace_rec_t),
+    };
+
+    portENTER_CRITICAL(&ring_lock);
+    hdr.count   = ring.recs != NULL ? ring.count : 0;
+    hdr.dropped = ring.dropped;
+    portEXIT_CRITICAL(&ring_lock);
+
+    return hdr;
+}
+
+size_t neil_ble_gatts_trace_size(void) {
+    return sizeof(neil_ble_gatts_trace_hdr_t) +
+           header_get().count * sizeof(neil_ble_gatts_trace_rec_t);
+}
+
+size_t neil_ble_gatts_trace_read(size_t offset, uint8_t *buf, size_t len) {
+
+    const neil_ble_gatts_trace_hdr_t hdr = header_get();
+
+    size_t copied = 0;
+
+    // --- Header bytes
+    while (copied < len && offset < sizeof(hdr)) {
+        buf[copied++] = ((const uint8_t *)&hdr)[offset++];
+    }
+
+    // --- Record bytes, oldest first
+    portENTER_CRITICAL(&ring_lock);
+
+    const size_t oldest =
+        (ring.head + ring.capacity - hdr.count) % (ring.capacity ?: 1);
+
+    while (copied < len && ring.recs != NULL) {
+        const size_t rec_offset = offset - sizeof(hdr);
+        const size_t rec_idx    = rec_offset / sizeof(neil_ble_gatts_trace_rec_t);
+
+        if (rec_idx >= hdr.count) {
+            break;
+        }
+
+        const uint8_t *rec =
+            (const uint8_t *)&ring.recs[(oldest + rec_idx) % ring.capacity];
+        buf[copied++] = rec[rec_offset % sizeof(neil_ble_gatts_trace_rec_t)];
+        offset++;
+    }
+
+    portEXIT_CRITICAL(&ring_lock);
+
+    return copied;
+}
+
+esp_err_t neil_ble_gatts_trace_export(neil_ble_gatts_trace_sink_t sink, void *ctx) {
+
+    if (sink == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // --- Copy in chunks so the sink (possibly blocking) runs outside the lock
+    uint8_t chunk[8 * sizeof(neil_ble_gatts_trace_rec_t)];
+
+    const size_t total = neil_ble_gatts_trace_size();
+
+    for (size_t offset = 0; offset < total;) {
+        size_t len = neil_ble_gatts_trace_read(offset, chunk, sizeof(chunk));
+        if (len == 0) {
+            break;
+        }
+
+        esp_err_t ret = sink(chunk, len, ctx);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+
+        offset += len;
+    }
+
+    return ESP_OK;
+}
+
+#else
+
+// NOTE: Disabled in menuconfig (CONFIG_NEIL_BLE_GATTS_TRACE), nothing is
+//       ever recorded.
+
+esp_err_t neil_ble_gatts_trace_start(uint16_t capacity) {
+    ESP_LOGW(TAG, "Disabled in menuconfig");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void neil_ble_gatts_trace_stop(void) {}
+
+void neil_ble_gatts_trace_pause(bool paused) {}
+
+void neil_ble_gatts_trace_clear(void) {}
+
+size_t neil_ble_gatts_trace_size(void) {
+    return 0;
+}
+
+size_t neil_ble_gatts_trace_read(size_t offset, uint8_t *buf, size_t len) {
+    return 0;
+}
+
+esp_err_t neil_ble_gatts_trace_export(neil_ble_gatts_trace_sink_t sink, void *ctx) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void neil_ble_gatts_trace_gatts(esp_gatts_cb_event_t event,
+                                const esp_ble_gatts_cb_param_t *param,
+                                int64_t start_us) {}
+
+void neil_ble_gatts_trace_gap(esp_gap_ble_cb_event_t event, int64_t start_us) {}
+
+bool neil_ble_gatts_trace_active(void) {
+    return false;
+}
+
+#endif
@@ -0,0 +1,149 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_trace.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      GATT/GAP Event Trace Recorder API.
+
+#ifndef neil_ble_gatts_TRACE_H_
+#define neil_ble_gatts_TRACE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_gap_ble_api.h"
+#include "esp_gatts_api.h"
+
+// -------------------------------------------------------------
+// Binary Format
+// -------------------------------------------------------------
+//
+// An exported trace is one header followed by `count` records, oldest first,
+// all little-endian. `tools/trace_decode.py` decodes it on the host.
+
+/// Magic value of the export header ("NBGT").
+#define NEIL_BLE_GATTS_TRACE_MAGIC 0x5447424Eu
+
+/// Version of the export format.
+#define NEIL_BLE_GATTS_TRACE_VERSION 1
+
+/// Event source of a record.
+typedef enum {
+    NEIL_BLE_GATTS_TRACE_SRC_GATTS = 0,
+    NEIL_BLE_GATTS_TRACE_SRC_GAP   = 1,
+} neil_ble_gatts_trace_src_t;
+
+/// Conn ID of records that do not relate to a connection.
+#define NEIL_BLE_GATTS_TRACE_NO_CONN 0xFFFF
+
+/**
+ * @brief       Export header.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;       ///< NEIL_BLE_GATTS_TRACE_MAGIC
+    uint8_t version;      ///< NEIL_BLE_GATTS_TRACE_VERSION
+    uint8_t record_size;  ///< sizeof(neil_ble_gatts_trace_rec_t)
+    uint16_t count;       ///< Records that follow.
+    uint32_t dropped;     ///< Records overwritten before export.
+} neil_ble_gatts_trace_hdr_t;
+
+/**
+ * @brief       One recorded event.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t time_us;     ///< Event arrival (low 32 bits of esp_timer).
+    uint16_t duration_us; ///< Handler processing time (saturates at 0xFFFF).
+    uint8_t src;          ///< neil_ble_gatts_trace_src_t
+    uint8_t event;        ///< esp_gatts_cb_event_t or esp_gap_ble_cb_event_t
+    uint16_t conn_id;     ///< NEIL_BLE_GATTS_TRACE_NO_CONN if not applicable.
+    uint16_t handle;      ///< Attribute handle, 0 if not applicable.
+    uint16_t len;         ///< Payload length, 0 if not applicable.
+    uint16_t seq;         ///< Running sequence number.
+} neil_ble_gatts_trace_rec_t;
+
+/**
+ * @brief       Sink receiving serialized trace bytes (e.g. a UART writer).
+ */
+typedef esp_err_t (*neil_ble_gatts_trace_sink_t)(const uint8_t *data, size_t len,
+                                                 void *ctx);
+
+// -------------------------------------------------------------
+// Control
+// -------------------------------------------------------------
+
+/**
+ * @brief       Allocate a ring of `capacity` records and start recording.
+ *
+ *              Once full, the oldest records are overwritten.
+ */
+esp_err_t neil_ble_gatts_trace_start(uint16_t capacity);
+
+/**
+ * @brief       Stop recording and release the ring.
+ */
+void neil_ble_gatts_trace_stop(void);
+
+/**
+ * @brief       Suspend or resume recording without discarding the ring.
+ *
+ *              Pause before exporting to obtain a consistent snapshot.
+ */
+void neil_ble_gatts_trace_pause(bool paused);
+
+/**
+ * @brief       Discard recorded events.
+ */
+void neil_ble_gatts_trace_clear(void);
+
+// -------------------------------------------------------------
+// Export
+// -------------------------------------------------------------
+
+/**
+ * @brief       Size in bytes of the serialized trace (header and records).
+ */
+size_t neil_ble_gatts_trace_size(void);
+
+/**
+ * @brief       Copy up to `len` bytes of the serialized trace starting at
+ *              `offset`.
+ *
+ *              Random access makes it suitable for serving the trace through
+ *              a (long-read) characteristic.
+ *
+ * @return      Bytes copied.
+ */
+size_t neil_ble_gatts_trace_read(size_t offset, uint8_t *buf, size_t len);
+
+/**
+ * @brief       Stream the serialized trace to a sink, e.g. a UART.
+ */
+esp_err_t neil_ble_gatts_trace_export(neil_ble_gatts_trace_sink_t sink, void *ctx);
+
+// -------------------------------------------------------------
+// Hooks (component-internal)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Record a GATTS event after it has been handled.
+ */
+void neil_ble_gatts_trace_gatts(esp_gatts_cb_event_t event,
+                                const esp_ble_gatts_cb_param_t *param,
+                                int64_t start_us);
+
+/**
+ * @brief       Record a GAP event after it has been handled.
+ */
+void neil_ble_gatts_trace_gap(esp_gap_ble_cb_event_t event, int64_t start_us);
+
+/**
+ * @brief       Whether recording is active (lets callers skip timestamps).
+ */
+bool neil_ble_gatts_trace_active(void);
+
+#endif // neil_ble_gatts_TRACE_H_
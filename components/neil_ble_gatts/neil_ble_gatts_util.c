@@ -2,88 +2,36 @@
 //
 // SPDX-License-Identifier: Apache-2.0
 
+#include <string.h>
+
 #include "esp_log.h"
 
+#include "neil_ble_gatts_mem.h"
+#include "neil_ble_gatts_stack.h"
 #include "neil_ble_gatts_util.h"
 
-char *neil_ble_gatts_util_esp_key_to_str(esp_ble_key_type_t key_type) {
-    char *key_str = NULL;
-    switch (key_type) {
-    case ESP_LE_KEY_NONE:
-        key_str = "ESP_LE_KEY_NONE";
-        break;
-    case ESP_LE_KEY_PENC:
-        key_str = "ESP_LE_KEY_PENC";
-        break;
-    case ESP_LE_KEY_PID:
-        key_str = "ESP_LE_KEY_PID";
-        break;
-    case ESP_LE_KEY_PCSRK:
-        key_str = "ESP_LE_KEY_PCSRK";
-        break;
-    case ESP_LE_KEY_PLK:
-        key_str = "ESP_LE_KEY_PLK";
-        break;
-    case ESP_LE_KEY_LLK:
-        key_str = "ESP_LE_KEY_LLK";
-        break;
-    case ESP_LE_KEY_LENC:
-        key_str = "ESP_LE_KEY_LENC";
-        break;
-    case ESP_LE_KEY_LID:
-        key_str = "ESP_LE_KEY_LID";
-        break;
-    case ESP_LE_KEY_LCSRK:
-        key_str = "ESP_LE_KEY_LCSRK";
-        break;
-    default:
-        key_str = "INVALID BLE KEY TYPE";
-        break;
-    }
+// -------------------------------------------------------------
+// Bluedroid Security Utilities
+// -------------------------------------------------------------
 
-    return key_str;
-}
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
 
-char *neil_ble_gatts_util_esp_auth_req_to_str(esp_ble_auth_req_t auth_req) {
-    char *auth_str = NULL;
-    switch (auth_req) {
-    case ESP_LE_AUTH_NO_BOND:
-        auth_str = "ESP_LE_AUTH_NO_BOND";
-        break;
-    case ESP_LE_AUTH_BOND:
-        auth_str = "ESP_LE_AUTH_BOND";
-        break;
-    case ESP_LE_AUTH_REQ_MITM:
-        auth_str = "ESP_LE_AUTH_REQ_MITM";
-        break;
-    case ESP_LE_AUTH_REQ_BOND_MITM:
-        auth_str = "ESP_LE_AUTH_REQ_BOND_MITM";
-        break;
-    case ESP_LE_AUTH_REQ_SC_ONLY:
-        auth_str = "ESP_LE_AUTH_REQ_SC_ONLY";
-        break;
-    case ESP_LE_AUTH_REQ_SC_BOND:
-        auth_str = "ESP_LE_AUTH_REQ_SC_BOND";
-        break;
-    case ESP_LE_AUTH_REQ_SC_MITM:
-        auth_str = "ESP_LE_AUTH_REQ_SC_MITM";
-        break;
-    case ESP_LE_AUTH_REQ_SC_MITM_BOND:
-        auth_str = "ESP_LE_AUTH_REQ_SC_MITM_BOND";
-        break;
-    default:
-        auth_str = "INVALID BLE AUTH REQ";
-        break;
+void neil_ble_gatts_util_show_bonded_devices(const char *const tag) {
+    int dev_num = esp_ble_get_bond_device_num();
+
+    if (dev_num <= 0) {
+        ESP_LOGI(tag, "Bonded devices number : 0\n");
+        return;
     }
 
-    return auth_str;
-}
+    esp_ble_bond_dev_t *dev_list = (esp_ble_bond_dev_t *)neil_ble_gatts_mem_alloc(
+        NEIL_BLE_GATTS_MEM_UTIL, sizeof(esp_ble_bond_dev_t) * dev_num);
 
-void neil_ble_gatts_util_show_bonded_devices(const char *const tag) {
-    int dev_num = esp_ble_get_bond_device_num();
+    if (dev_list == NULL) {
+        ESP_LOGE(tag, "Out of memory listing %d bonded devices", dev_num);
+        return;
+    }
 
-    esp_ble_bond_dev_t *dev_list =
-        (esp_ble_bond_dev_t *)malloc(sizeof(esp_ble_bond_dev_t) * dev_num);
     esp_ble_get_bond_device_list(&dev_num, dev_list);
     ESP_LOGI(tag, "Bonded devices number : %d\n", dev_num);
 
@@ -93,18 +41,68 @@ void neil_ble_gatts_util_show_bonded_devices(const char *const tag) {
                            sizeof(esp_bd_addr_t));
     }
 
-    free(dev_list);
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_UTIL, dev_list);
+}
+
+#endif
+
+// -------------------------------------------------------------
+// UUID Utilities
+// -------------------------------------------------------------
+
+/// Bluetooth Base UUID 00000000-0000-1000-8000-00805F9B34FB (little-endian).
+static const uint8_t BASE_UUID[ESP_UUID_LEN_128] = {
+    0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
+    0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+/**
+ * @brief       Whether a configured UUID length is supported (0 means 128-bit).
+ */
+bool neil_ble_gatts_util_uuid_len_valid(uint8_t uuid_len) {
+    return uuid_len == 0 || uuid_len == ESP_UUID_LEN_16 ||
+           uuid_len == ESP_UUID_LEN_32 || uuid_len == ESP_UUID_LEN_128;
+}
+
+/**
+ * @brief       Expand a 16/32-bit UUID onto the Bluetooth Base UUID.
+ *
+ *              128-bit UUIDs are copied unchanged.
+ */
+void neil_ble_gatts_util_uuid_expand(const uint8_t *uuid, uint8_t uuid_len,
+                                     uint8_t *uuid128) {
+    if (uuid_len == 0 || uuid_len == ESP_UUID_LEN_128) {
+        memcpy(uuid128, uuid, ESP_UUID_LEN_128);
+        return;
+    }
+
+    // The short form occupies bytes 12..15 of the little-endian base.
+    memcpy(uuid128, BASE_UUID, ESP_UUID_LEN_128);
+    memcpy(uuid128 + 12, uuid, uuid_len);
 }
 
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+
 static void __attribute__((unused)) remove_all_bonded_devices(void) {
     int dev_num = esp_ble_get_bond_device_num();
 
-    esp_ble_bond_dev_t *dev_list =
-        (esp_ble_bond_dev_t *)malloc(sizeof(esp_ble_bond_dev_t) * dev_num);
+    if (dev_num <= 0) {
+        return;
+    }
+
+    esp_ble_bond_dev_t *dev_list = (esp_ble_bond_dev_t *)neil_ble_gatts_mem_alloc(
+        NEIL_BLE_GATTS_MEM_UTIL, sizeof(esp_ble_bond_dev_t) * dev_num);
+
+    if (dev_list == NULL) {
+        return;
+    }
+
     esp_ble_get_bond_device_list(&dev_num, dev_list);
     for (int i = 0; i < dev_num; i++) {
         esp_ble_remove_bond_device(dev_list[i].bd_addr);
     }
 
-    free(dev_list);
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_UTIL, dev_list);
 }
+
+#endif
@@ -5,10 +5,19 @@
 #ifndef neil_ble_gatts_UTIL_H_
 #define neil_ble_gatts_UTIL_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "neil_ble_gatts_stack.h"
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
 #include "esp_gap_ble_api.h"
 
-char *neil_ble_gatts_util_esp_key_to_str(esp_ble_key_type_t key_type);
-char *neil_ble_gatts_util_esp_auth_req_to_str(esp_ble_auth_req_t auth_req);
 void neil_ble_gatts_util_show_bonded_devices(const char *const tag);
+#endif
+
+bool neil_ble_gatts_util_uuid_len_valid(uint8_t uuid_len);
+void neil_ble_gatts_util_uuid_expand(const uint8_t *uuid, uint8_t uuid_len,
+                                     uint8_t *uuid128);
 
 #endif // neil_ble_gatts_UTIL_H_
@@ -0,0 +1,145 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_write.c
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Prepared (Long) Write implementation.
+///
+///             Prepare and execute requests of a connection arrive in order on
+///             the BTC task, which is the only user of this state.
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "neil_ble_gatts_conn.h"
+#include "neil_ble_gatts_mem.h"
+#include "neil_ble_gatts_write.h"
+
+static const char *const TAG = "neil_ble_gatts_write";
+
+// -------------------------------------------------------------
+// State
+// -------------------------------------------------------------
+
+/**
+ * @brief       A value being assembled from prepared writes.
+ */
+typedef struct {
+    bool active;
+    uint16_t conn_id;
+    uint16_t handle;
+    uint16_t len;
+    uint8_t *buf;
+} prep_write_t;
+
+static prep_write_t prep[NEIL_BLE_GATTS_CONN_MAX];
+
+static prep_write_t *prep_find(uint16_t conn_id) {
+    for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        if (prep[idx].active && prep[idx].conn_id == conn_id) {
+            return prep + idx;
+        }
+    }
+    return NULL;
+}
+
+// -------------------------------------------------------------
+// Procedures
+// -------------------------------------------------------------
+
+esp_gatt_status_t neil_ble_gatts_write_prepare(uint16_t conn_id, uint16_t handle,
+                                               uint16_t offset, const uint8_t *value,
+                                               uint16_t len) {
+
+    prep_write_t *entry = prep_find(conn_id);
+
+    if (entry == NULL) {
+        // --- First part, claim a slot
+        for (int idx = 0; entry == NULL && idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+            if (!prep[idx].active) {
+                entry = prep + idx;
+            }
+        }
+
+        if (entry == NULL) {
+            return ESP_GATT_NO_RESOURCES;
+        }
+
+        uint8_t *buf = neil_ble_gatts_mem_alloc(NEIL_BLE_GATTS_MEM_WRITE,
+                                                NEIL_BLE_GATTS_WRITE_PREP_MAX);
+
+        if (buf == NULL) {
+            ESP_LOGE(TAG, "Out of memory preparing write on conn_id %d", conn_id);
+            return ESP_GATT_NO_RESOURCES;
+        }
+
+        *entry = (prep_write_t){
+            .active  = true,
+            .conn_id = conn_id,
+            .handle  = handle,
+            .buf     = buf,
+        };
+    }
+
+    if (entry->handle != handle) {
+        return ESP_GATT_REQ_NOT_SUPPORTED;
+    }
+
+    if (offset > entry->len) {
+        return ESP_GATT_INVALID_OFFSET;
+    }
+
+    if (offset + len > NEIL_BLE_GATTS_WRITE_PREP_MAX) {
+        return ESP_GATT_PREPARE_Q_FULL;
+    }
+
+    memcpy(entry->buf + offset, value, len);
+
+    if (offset + len > entry->len) {
+        entry->len = offset + len;
+    }
+
+    return ESP_GATT_OK;
+}
+
+uint8_t *neil_ble_gatts_write_take(uint16_t conn_id, uint16_t *handle, uint16_t *len) {
+
+    prep_write_t *entry = prep_find(conn_id);
+
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    *handle = entry->handle;
+    *len    = entry->len;
+
+    return entry->buf;
+}
+
+void neil_ble_gatts_write_release(uint16_t conn_id) {
+
+    prep_write_t *entry = prep_find(conn_id);
+
+    if (entry == NULL) {
+        return;
+    }
+
+    neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_WRITE, entry->buf);
+    *entry = (prep_write_t){0};
+}
+
+void neil_ble_gatts_write_release_all(void) {
+    for (int idx = 0; idx < NEIL_BLE_GATTS_CONN_MAX; idx++) {
+        neil_ble_gatts_mem_free(NEIL_BLE_GATTS_MEM_WRITE, prep[idx].buf);
+        prep[idx] = (prep_write_t){0};
+    }
+}
+
+size_t neil_ble_gatts_write_footprint(void) {
+    return (size_t)NEIL_BLE_GATTS_CONN_MAX * NEIL_BLE_GATTS_WRITE_PREP_MAX;
+}
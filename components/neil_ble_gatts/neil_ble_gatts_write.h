@@ -0,0 +1,76 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// neil_ble_gatts_write.h
+///
+/// @author     Nicholas H.R. Sims
+///
+/// @brief      Prepared (Long) Write API.
+
+#ifndef neil_ble_gatts_WRITE_H_
+#define neil_ble_gatts_WRITE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_gatt_defs.h"
+
+#include "sdkconfig.h"
+
+// -------------------------------------------------------------
+// Settings
+// -------------------------------------------------------------
+
+/// Largest value assembled from prepared writes.
+#ifdef CONFIG_NEIL_BLE_GATTS_WRITE_PREP_MAX
+#define NEIL_BLE_GATTS_WRITE_PREP_MAX CONFIG_NEIL_BLE_GATTS_WRITE_PREP_MAX
+#else
+#define NEIL_BLE_GATTS_WRITE_PREP_MAX ESP_GATT_MAX_ATTR_LEN
+#endif
+
+// -------------------------------------------------------------
+// Procedures (component-internal)
+// -------------------------------------------------------------
+
+/**
+ * @brief       Queue a prepared write of a connection.
+ *
+ *              The buffer is allocated on the first part. Parts must target
+ *              a single handle.
+ *
+ * @return      ESP_GATT_PREPARE_Q_FULL when the value would exceed
+ *              `NEIL_BLE_GATTS_WRITE_PREP_MAX`, ESP_GATT_INVALID_OFFSET or
+ *              ESP_GATT_REQ_NOT_SUPPORTED (several handles).
+ */
+esp_gatt_status_t neil_ble_gatts_write_prepare(uint16_t conn_id, uint16_t handle,
+                                               uint16_t offset, const uint8_t *value,
+                                               uint16_t len);
+
+/**
+ * @brief       Take the assembled value of a connection for execution.
+ *
+ *              The buffer stays valid until `neil_ble_gatts_write_release`.
+ *
+ * @return      NULL if nothing was prepared.
+ */
+uint8_t *neil_ble_gatts_write_take(uint16_t conn_id, uint16_t *handle, uint16_t *len);
+
+/**
+ * @brief       Drop the prepared value of a connection (after execution,
+ *              on cancel or disconnect).
+ */
+void neil_ble_gatts_write_release(uint16_t conn_id);
+
+/**
+ * @brief       Drop every prepared value (on stop).
+ */
+void neil_ble_gatts_write_release_all(void);
+
+/**
+ * @brief       Heap bytes the prepared writes hold at most, one buffer per
+ *              connection.
+ */
+size_t neil_ble_gatts_write_footprint(void);
+
+#endif // neil_ble_gatts_WRITE_H_
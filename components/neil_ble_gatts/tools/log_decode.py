@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+
+# SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Format a neil_ble_gatts deferred binary log.
+
+The log is the byte stream handed to the sink of `neil_ble_gatts_log_start`,
+see `neil_ble_gatts_log.h` for the format. Message formats are read from the
+NEIL_BLE_GATTS_LOG_MESSAGES table of that header, so the decoder must be given
+the header the firmware was built with.
+
+Usage:
+    log_decode.py LOG [--header PATH] [--hex] [--json]
+
+With --hex, LOG is a text log in which the stream was printed as lines of
+the form "LOG <hex bytes>" (other lines are ignored).
+"""
+
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+MAGIC = 0x4C47424E
+VERSION = 1
+
+HDR = struct.Struct("<IBB")
+REC = struct.Struct("<IHHIII")
+
+LEVELS = {"ERROR": "E", "WARN": "W", "INFO": "I", "DEBUG": "D"}
+
+DEFAULT_HEADER = os.path.join(
+    os.path.dirname(os.path.abspath(__file__)), os.pardir, "neil_ble_gatts_log.h")
+
+MESSAGE_RE = re.compile(r'X\((\w+),\s*(\w+),\s*(\w+),\s*"((?:[^"\\]|\\.)*)"\)')
+
+CONVERSION_RE = re.compile(r"%[-+ #0]*\d*[ux]")
+
+
+def load_messages(path):
+    with open(path) as header:
+        text = header.read()
+
+    table = text.split("#define NEIL_BLE_GATTS_LOG_MESSAGES(X)", 1)[1]
+    table = table.split("\n\n", 1)[0]
+
+    return [
+        {"id": ident, "sub": sub, "level": LEVELS.get(level, "?"), "fmt": fmt}
+        for ident, sub, level, fmt in MESSAGE_RE.findall(table)
+    ]
+
+
+def format_message(msg, args):
+    # Like snprintf on the device, ignore arguments the format does not use.
+    used = len(CONVERSION_RE.findall(msg["fmt"]))
+    return msg["fmt"] % tuple(args[:used])
+
+
+def decode(data, messages):
+    if len(data) < HDR.size:
+        raise ValueError("log shorter than header")
+
+    magic, version, rec_size = HDR.unpack_from(data, 0)
+
+    if magic != MAGIC:
+        raise ValueError("bad magic 0x%08x" % magic)
+    if version != VERSION or rec_size != REC.size:
+        raise ValueError("unsupported version %d / record size %d" % (version, rec_size))
+
+    recs = []
+    for offset in range(HDR.size, len(data) - REC.size + 1, REC.size):
+        time_us, msg_id, seq, *args = REC.unpack_from(data, offset)
+
+        if msg_id < len(messages):
+            msg = messages[msg_id]
+            text = format_message(msg, args)
+        else:
+            msg = {"id": "MSG%d" % msg_id, "sub": "?", "level": "?"}
+            text = " ".join("0x%x" % arg for arg in args)
+
+        recs.append({
+            "time_us": time_us,
+            "seq": seq,
+            "level": msg["level"],
+            "sub": msg["sub"],
+            "id": msg["id"],
+            "text": text,
+        })
+
+    return recs
+
+
+def from_hex_log(text):
+    return bytes.fromhex("".join(
+        line.split("LOG ", 1)[1].strip()
+        for line in text.splitlines() if "LOG " in line
+    ))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", help="binary log file ('-' for stdin)")
+    parser.add_argument("--header", default=DEFAULT_HEADER,
+                        help="neil_ble_gatts_log.h the firmware was built with")
+    parser.add_argument("--hex", action="store_true", help="LOG is a hex text log")
+    parser.add_argument("--json", action="store_true", help="machine-readable output")
+    args = parser.parse_args()
+
+    if args.log == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(args.log, "rb") as log_file:
+            data = log_file.read()
+
+    if args.hex:
+        data = from_hex_log(data.decode(errors="replace"))
+
+    recs = decode(data, load_messages(args.header))
+
+    if args.json:
+        json.dump(recs, sys.stdout, indent=2)
+        print()
+        return
+
+    for rec in recs:
+        print("%s (%10u) %-6s %s" % (rec["level"], rec["time_us"], rec["sub"], rec["text"]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+
+# SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Compare two trace replay reports and flag regressions.
+
+Reports are the JSON printed by a host build run with `--replay` (see
+`host/neil_ble_gatts_host_replay.c`), typically of the same trace before and
+after a change.
+
+Usage:
+    replay_compare.py BASE NEW [--stat p50_ns] [--tolerance 10]
+
+An event regresses when its statistic grows by more than the tolerance
+(percent) over the base. Exits non-zero on any regression, or if the reports
+did not replay the same events.
+"""
+
+import argparse
+import json
+import sys
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("base", help="report of the reference build")
+    parser.add_argument("new", help="report of the build under test")
+    parser.add_argument("--stat", default="p50_ns",
+                        help="statistic compared (min_ns, avg_ns, p50_ns, p99_ns, max_ns)")
+    parser.add_argument("--tolerance", type=float, default=10.0,
+                        help="allowed growth, percent (default 10)")
+    args = parser.parse_args()
+
+    with open(args.base) as base_file:
+        base = json.load(base_file)
+    with open(args.new) as new_file:
+        new = json.load(new_file)
+
+    failed = False
+
+    print("%-26s %7s %10s %10s %8s" % ("event", "count", "base", "new", "change"))
+    for name in sorted(set(base["events"]) | set(new["events"])):
+        base_stats = base["events"].get(name)
+        new_stats = new["events"].get(name)
+
+        if base_stats is None or new_stats is None or \
+                base_stats["count"] != new_stats["count"]:
+            print("%-26s %7s  replayed %s, was %s" % (
+                name, "", new_stats and new_stats["count"],
+                base_stats and base_stats["count"]))
+            failed = True
+            continue
+
+        before = base_stats[args.stat]
+        after = new_stats[args.stat]
+        change = (after - before) * 100.0 / before if before else 0.0
+        regressed = change > args.tolerance
+        failed |= regressed
+
+        print("%-26s %7u %10u %10u %+7.1f%%%s" % (
+            name, new_stats["count"], before, after, change,
+            "  REGRESSED" if regressed else ""))
+
+    base_total = base["total_ns"]
+    new_total = new["total_ns"]
+    print("%-26s %7u %10u %10u %+7.1f%%" % (
+        "total", new["replayed"], base_total, new_total,
+        (new_total - base_total) * 100.0 / base_total if base_total else 0.0))
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
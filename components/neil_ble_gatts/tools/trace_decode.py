@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+
+# SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Decode and summarize a neil_ble_gatts event trace.
+
+The trace is the byte stream produced by `neil_ble_gatts_trace_export` (or read
+back through `neil_ble_gatts_trace_read`), see `neil_ble_gatts_trace.h` for the
+format.
+
+Usage:
+    trace_decode.py TRACE [--hex] [--records] [--json]
+
+With --hex, TRACE is a text log in which the trace was printed as lines of
+the form "TRACE <hex bytes>" (other lines are ignored).
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = 0x5447424E
+VERSION = 1
+
+HDR = struct.Struct("<IBBHI")
+REC = struct.Struct("<IHBBHHHH")
+
+NO_CONN = 0xFFFF
+
+SRC_NAMES = {0: "gatts", 1: "gap"}
+
+# esp_gatts_cb_event_t (stable across ESP-IDF releases)
+GATTS_EVENTS = {
+    0: "REG", 1: "READ", 2: "WRITE", 3: "EXEC_WRITE", 4: "MTU", 5: "CONF",
+    6: "UNREG", 7: "CREATE", 8: "ADD_INCL_SRVC", 9: "ADD_CHAR",
+    10: "ADD_CHAR_DESCR", 11: "DELETE", 12: "START", 13: "STOP",
+    14: "CONNECT", 15: "DISCONNECT", 16: "OPEN", 17: "CANCEL_OPEN",
+    18: "CLOSE", 19: "LISTEN", 20: "CONGEST", 21: "RESPONSE",
+    22: "CREAT_ATTR_TAB", 23: "SET_ATTR_VAL", 24: "SEND_SERVICE_CHANGE",
+}
+
+
+def event_name(src, event):
+    # esp_gap_ble_cb_event_t numbering depends on the enabled BLE features,
+    # so GAP events are reported by number.
+    if src == 0:
+        return "gatts." + GATTS_EVENTS.get(event, str(event))
+    return "%s.%d" % (SRC_NAMES.get(src, "src%d" % src), event)
+
+
+def decode(data):
+    if len(data) < HDR.size:
+        raise ValueError("trace shorter than header")
+
+    magic, version, rec_size, count, dropped = HDR.unpack_from(data, 0)
+
+    if magic != MAGIC:
+        raise ValueError("bad magic 0x%08x" % magic)
+    if version != VERSION or rec_size != REC.size:
+        raise ValueError("unsupported version %d / record size %d" % (version, rec_size))
+
+    recs = []
+    for idx in range(count):
+        offset = HDR.size + idx * REC.size
+        if offset + REC.size > len(data):
+            break
+        time_us, duration_us, src, event, conn_id, handle, length, seq = \
+            REC.unpack_from(data, offset)
+        recs.append({
+            "time_us": time_us,
+            "duration_us": duration_us,
+            "event": event_name(src, event),
+            "conn_id": None if conn_id == NO_CONN else conn_id,
+            "handle": handle,
+            "len": length,
+            "seq": seq,
+        })
+
+    return {"dropped": dropped, "records": recs}
+
+
+def from_hex_log(text):
+    return bytes.fromhex("".join(
+        line.split("TRACE ", 1)[1].strip()
+        for line in text.splitlines() if "TRACE " in line
+    ))
+
+
+def percentile(values, pct):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * pct / 100))]
+
+
+def summarize(trace):
+    recs = trace["records"]
+
+    per_event = {}
+    for rec in recs:
+        per_event.setdefault(rec["event"], []).append(rec["duration_us"])
+
+    events = {}
+    for name, durations in sorted(per_event.items()):
+        events[name] = {
+            "count": len(durations),
+            "min_us": min(durations),
+            "avg_us": round(sum(durations) / len(durations), 1),
+            "p99_us": percentile(durations, 99),
+            "max_us": max(durations),
+            "total_us": sum(durations),
+        }
+
+    # Sequence gaps indicate records lost in transit (not ring overwrites).
+    gaps = sum(
+        1 for prev, cur in zip(recs, recs[1:]) if (prev["seq"] + 1) & 0xFFFF != cur["seq"]
+    )
+
+    span_us = 0
+    if len(recs) > 1:
+        span_us = (recs[-1]["time_us"] - recs[0]["time_us"]) & 0xFFFFFFFF
+
+    return {
+        "records": len(recs),
+        "dropped": trace["dropped"],
+        "sequence_gaps": gaps,
+        "span_us": span_us,
+        "busy_us": sum(r["duration_us"] for r in recs),
+        "events": events,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("trace", help="binary trace file ('-' for stdin)")
+    parser.add_argument("--hex", action="store_true", help="TRACE is a hex text log")
+    parser.add_argument("--records", action="store_true", help="list every record")
+    parser.add_argument("--json", action="store_true", help="machine-readable output")
+    args = parser.parse_args()
+
+    if args.trace == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(args.trace, "rb") as trace_file:
+            data = trace_file.read()
+
+    if args.hex:
+        data = from_hex_log(data.decode(errors="replace"))
+
+    trace = decode(data)
+    summary = summarize(trace)
+
+    if args.json:
+        out = {"summary": summary}
+        if args.records:
+            out["records"] = trace["records"]
+        json.dump(out, sys.stdout, indent=2)
+        print()
+        return
+
+    if args.records:
+        for rec in trace["records"]:
+            print("%10u %6u us  %-26s conn=%-4s handle=0x%04x len=%u" % (
+                rec["time_us"], rec["duration_us"], rec["event"],
+                "-" if rec["conn_id"] is None else rec["conn_id"],
+                rec["handle"], rec["len"]))
+        print()
+
+    print("records %(records)u  dropped %(dropped)u  gaps %(sequence_gaps)u  "
+          "span %(span_us)u us  busy %(busy_us)u us" % summary)
+    print("%-26s %7s %8s %8s %8s %8s" % ("event", "count", "min", "avg", "p99", "max"))
+    for name, stats in summary["events"].items():
+        print("%-26s %7u %8u %8.1f %8u %8u" % (
+            name, stats["count"], stats["min_us"], stats["avg_us"],
+            stats["p99_us"], stats["max_us"]))
+
+
+if __name__ == "__main__":
+    main()
@@ -45,7 +45,9 @@ typedef union {
 void read_attr_0(uint8_t *buffer) {
     attr_0_dto_t attr_0_dto = {.value = ATTR_0_DEFAULT_VALUE};
     memcpy(buffer, attr_0_dto.raw, sizeof(float));
-    ESP_LOGI(TAG, "Attribute 0 Read: Type(float) Value(%f)", attr_0_dto.value);
+    // NOTE: Runs on every read; formatting floats on the BTC task costs
+    //       throughput, so it is compiled out unless debugging.
+    ESP_LOGD(TAG, "Attribute 0 Read: Type(float) Value(%f)", attr_0_dto.value);
 }
 
 /**
@@ -56,7 +58,7 @@ void read_attr_0(uint8_t *buffer) {
 void write_attr_0(uint8_t *data, uint16_t len) {
     attr_0_dto_t attr_0_dto;
     memcpy(attr_0_dto.raw, data, len);
-    ESP_LOGI(TAG, "Attribute 0 Write: Type(float) Value(%f)", attr_0_dto.value);
+    ESP_LOGD(TAG, "Attribute 0 Write: Type(float) Value(%f)", attr_0_dto.value);
 }
 
 // --- Top-level device configuration.
@@ -91,6 +93,10 @@ static neil_ble_gatts_cfg_dev_t bluetooth_device_config = {
 
                             .on_read  = read_attr_0,
                             .on_write = write_attr_0,
+
+                            // Pair before use (Just Works suffices, as the
+                            // default IO capability offers nothing more)
+                            .security = NEIL_BLE_GATTS_SEC_ENCRYPT,
                         },
                     },
             },
@@ -102,6 +108,9 @@ static neil_ble_gatts_cfg_dev_t bluetooth_device_config = {
  * @brief       Application entry-point.
  */
 void app_main(void) {
+    // Log server events through a ring drained by a low-priority task.
+    neil_ble_gatts_log_start(64, NULL, NULL);
+
     // Start a new Bluetooth Low-Energy GATT Server using the above specified
     // config.
     neil_ble_gatts_start(&bluetooth_device_config);
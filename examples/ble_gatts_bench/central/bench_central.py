@@ -0,0 +1,417 @@
+#!/usr/bin/env python3
+
+# SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Scripted BLE central driving the neil_ble_gatts benchmark peripheral.
+
+Runs read latency, long-read, batched-read, write-without-response streaming
+and notification phases
+against `neil_ble_gatts_bench` and prints a JSON report combining client-side
+timings with the server-side counters of the report characteristic.
+
+When the peripheral runs NimBLE, the same payloads are also sent in both
+directions over an L2CAP connection-oriented channel, for comparison with
+notifications and writes. The channel is opened through a BlueZ socket, so
+this phase needs Linux; elsewhere, or with `--no-l2cap`, it is skipped.
+
+Requires `bleak` (pip install bleak). With `--adapter` the central uses that
+BlueZ adapter, such as a virtual controller of `btvirt` serving the Linux host
+build of the peripheral (see components/neil_ble_gatts/README.md).
+
+Usage:
+    bench_central.py [--name NEIL-BENCH] [--reads 200] [--duration 5]
+                     [--payloads 20,64,128,244,509] [--notifications 1000]
+                     [--addr-type public|random] [--no-l2cap]
+                     [--adapter hci0] [--output report.json]
+"""
+
+import argparse
+import asyncio
+import ctypes
+import ctypes.util
+import json
+import socket
+import statistics
+import struct
+import sys
+import time
+
+from bleak import BleakClient, BleakScanner
+
+BENCH_SVC = 0xB0
+
+
+def chr_uuid(index):
+    # neil_ble_gatts_UUID_128(BENCH_SVC, index)
+    return "c2d5b9d6-%02x%02x-452e-84d1-0a0c537a36d7" % (BENCH_SVC, index)
+
+
+SMALL = chr_uuid(1)
+LARGE = chr_uuid(2)
+SINK = chr_uuid(3)
+CONTROL = chr_uuid(4)
+REPORT = chr_uuid(5)
+BATCH = chr_uuid(6)
+STREAM = chr_uuid(7)
+PSM = chr_uuid(8)
+
+CTRL_SYNC = b"\x00"
+CTRL_RESET = b"\x01"
+CTRL_NOTIFY = 0x03
+CTRL_L2CAP = 0x04
+
+REPORT_FIELDS = (
+    "small_reads", "large_reads", "sink_writes", "sink_bytes", "sink_first_us",
+    "sink_last_us", "trace_events", "trace_busy_us", "heap_used", "heap_peak",
+    "notify_sent", "notify_dropped", "notify_congestions", "notify_latency_avg_us",
+    "notify_latency_max_us", "l2cap_rx_sdus", "l2cap_rx_bytes", "l2cap_rx_first_us",
+    "l2cap_rx_last_us", "l2cap_tx_sdus", "l2cap_tx_stalls",
+)
+REPORT_FMT = struct.Struct("<%dI" % len(REPORT_FIELDS))
+
+
+def latency_stats(samples_s):
+    samples_ms = sorted(s * 1000.0 for s in samples_s)
+    return {
+        "count": len(samples_ms),
+        "min_ms": round(samples_ms[0], 3),
+        "avg_ms": round(statistics.mean(samples_ms), 3),
+        "p50_ms": round(samples_ms[len(samples_ms) // 2], 3),
+        "p99_ms": round(samples_ms[min(len(samples_ms) - 1, len(samples_ms) * 99 // 100)], 3),
+        "max_ms": round(samples_ms[-1], 3),
+    }
+
+
+async def read_report(client):
+    raw = await client.read_gatt_char(REPORT)
+    return dict(zip(REPORT_FIELDS, REPORT_FMT.unpack(raw[:REPORT_FMT.size])))
+
+
+async def reset(client):
+    await client.write_gatt_char(CONTROL, CTRL_RESET, response=True)
+
+
+def cpu_per_op(report, ops):
+    return round(report["trace_busy_us"] / ops, 2) if ops else None
+
+
+async def phase_reads(client, uuid, count):
+    await reset(client)
+
+    samples = []
+    size = 0
+    for _ in range(count):
+        start = time.perf_counter()
+        value = await client.read_gatt_char(uuid)
+        samples.append(time.perf_counter() - start)
+        size = len(value)
+
+    server = await read_report(client)
+    elapsed = sum(samples)
+
+    return {
+        "value_size": size,
+        "latency": latency_stats(samples),
+        "throughput_Bps": round(size * count / elapsed, 1),
+        "server_us_per_event": cpu_per_op(server, server["trace_events"]),
+        "server": server,
+    }
+
+
+def batch_unpack(raw):
+    # [len u16 LE][value] records, see neil_ble_gatts_cfg_chr_t.batch
+    values = []
+    while len(raw) >= 2:
+        (size,) = struct.unpack_from("<H", raw)
+        values.append(raw[2:2 + size])
+        raw = raw[2 + size:]
+    return values
+
+
+async def phase_batch(client, count):
+    """Small + report per refresh, sequentially and through the batch."""
+    await reset(client)
+
+    sequential = []
+    for _ in range(count):
+        start = time.perf_counter()
+        await client.read_gatt_char(SMALL)
+        await client.read_gatt_char(REPORT)
+        sequential.append(time.perf_counter() - start)
+
+    batched = []
+    members = 0
+    for _ in range(count):
+        start = time.perf_counter()
+        members = len(batch_unpack(await client.read_gatt_char(BATCH)))
+        batched.append(time.perf_counter() - start)
+
+    return {
+        "members": members,
+        "sequential": latency_stats(sequential),
+        "batched": latency_stats(batched),
+    }
+
+
+async def phase_stream(client, payload, duration):
+    await reset(client)
+
+    data = bytes(range(256)) * (payload // 256 + 1)
+    data = data[:payload]
+
+    sent = 0
+    start = time.perf_counter()
+    while time.perf_counter() - start < duration:
+        await client.write_gatt_char(SINK, data, response=False)
+        sent += 1
+    elapsed = time.perf_counter() - start
+
+    # A confirmed write drains the queue before the report is read
+    await client.write_gatt_char(CONTROL, CTRL_SYNC, response=True)
+    server = await read_report(client)
+
+    server_span_s = ((server["sink_last_us"] - server["sink_first_us"]) & 0xFFFFFFFF) / 1e6
+
+    return {
+        "payload": payload,
+        "writes_sent": sent,
+        "writes_received": server["sink_writes"],
+        "bytes_received": server["sink_bytes"],
+        "client_Bps": round(sent * payload / elapsed, 1),
+        "server_Bps": round(server["sink_bytes"] / server_span_s, 1) if server_span_s else None,
+        "server_us_per_event": cpu_per_op(server, server["trace_events"]),
+        "server": server,
+    }
+
+
+async def phase_notify(client, payload, count, timeout):
+    await reset(client)
+
+    received = []
+    done = asyncio.Event()
+
+    def on_notify(_, data):
+        received.append((time.perf_counter(), len(data), int.from_bytes(data[:2], "little")))
+        if len(received) >= count:
+            done.set()
+
+    await client.start_notify(STREAM, on_notify)
+    start = time.perf_counter()
+    await client.write_gatt_char(
+        CONTROL, struct.pack("<BHH", CTRL_NOTIFY, payload, count), response=True)
+
+    try:
+        await asyncio.wait_for(done.wait(), timeout)
+    except asyncio.TimeoutError:
+        pass
+    await client.stop_notify(STREAM)
+
+    server = await read_report(client)
+    elapsed = (received[-1][0] - start) if received else 0
+    seqs = {seq for _, _, seq in received}
+
+    return {
+        "payload": payload,
+        "requested": count,
+        "received": len(received),
+        "missing": count - len(seqs),
+        "client_Bps": round(sum(size for _, size, _ in received) / elapsed, 1) if elapsed else None,
+        "server": server,
+    }
+
+
+# Linux <bluetooth/l2cap.h>, <bluetooth/bluetooth.h>
+BDADDR_LE_PUBLIC = 0x01
+BDADDR_LE_RANDOM = 0x02
+
+
+class SockaddrL2(ctypes.Structure):
+    _fields_ = [
+        ("l2_family", ctypes.c_ushort),
+        ("l2_psm", ctypes.c_ushort),
+        ("l2_bdaddr", ctypes.c_ubyte * 6),
+        ("l2_cid", ctypes.c_ushort),
+        ("l2_bdaddr_type", ctypes.c_ubyte),
+    ]
+
+
+def l2cap_connect(address, psm, addr_type):
+    """LE credit-based channel over the existing link (BlueZ socket).
+
+    Python's socket module cannot express an LE address type, so the address
+    is passed to connect(2) directly.
+    """
+    sock = socket.socket(socket.AF_BLUETOOTH, socket.SOCK_SEQPACKET, socket.BTPROTO_L2CAP)
+
+    addr = SockaddrL2()
+    addr.l2_family = socket.AF_BLUETOOTH
+    addr.l2_psm = psm  # little-endian on the wire, as the host
+    addr.l2_bdaddr[:] = bytes.fromhex(address.replace(":", ""))[::-1]
+    addr.l2_bdaddr_type = addr_type
+
+    libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
+    if libc.connect(sock.fileno(), ctypes.byref(addr), ctypes.sizeof(addr)) != 0:
+        errno = ctypes.get_errno()
+        sock.close()
+        raise OSError(errno, "L2CAP connect to PSM 0x%x failed" % psm)
+
+    return sock
+
+
+async def phase_l2cap_down(client, sock, payload, count, timeout):
+    """Peripheral to central SDUs, compare with notifications."""
+    await reset(client)
+
+    loop = asyncio.get_running_loop()
+    received = []
+
+    def receive():
+        sock.settimeout(timeout)
+        try:
+            while len(received) < count:
+                data = sock.recv(65535)
+                received.append((time.perf_counter(), len(data), int.from_bytes(data[:2], "little")))
+        except socket.timeout:
+            pass
+
+    start = time.perf_counter()
+    reader = loop.run_in_executor(None, receive)
+    await client.write_gatt_char(
+        CONTROL, struct.pack("<BHH", CTRL_L2CAP, payload, count), response=True)
+    await reader
+
+    server = await read_report(client)
+    elapsed = (received[-1][0] - start) if received else 0
+    seqs = {seq for _, _, seq in received}
+
+    return {
+        "payload": payload,
+        "requested": count,
+        "received": len(received),
+        "missing": count - len(seqs),
+        "client_Bps": round(sum(size for _, size, _ in received) / elapsed, 1) if elapsed else None,
+        "server": server,
+    }
+
+
+async def phase_l2cap_up(client, sock, payload, duration):
+    """Central to peripheral SDUs, compare with writes without response."""
+    await reset(client)
+
+    data = (bytes(range(256)) * (payload // 256 + 1))[:payload]
+    loop = asyncio.get_running_loop()
+
+    def send():
+        sock.settimeout(None)
+        sent = 0
+        start = time.perf_counter()
+        while time.perf_counter() - start < duration:
+            sock.send(data)
+            sent += 1
+        return sent, time.perf_counter() - start
+
+    sent, elapsed = await loop.run_in_executor(None, send)
+
+    # SDUs still in flight are not drained by a GATT round trip, let them land
+    await asyncio.sleep(1.0)
+    server = await read_report(client)
+
+    server_span_s = ((server["l2cap_rx_last_us"] - server["l2cap_rx_first_us"]) & 0xFFFFFFFF) / 1e6
+
+    return {
+        "payload": payload,
+        "sdus_sent": sent,
+        "sdus_received": server["l2cap_rx_sdus"],
+        "bytes_received": server["l2cap_rx_bytes"],
+        "client_Bps": round(sent * payload / elapsed, 1),
+        "server_Bps": round(server["l2cap_rx_bytes"] / server_span_s, 1) if server_span_s else None,
+        "server": server,
+    }
+
+
+async def run_l2cap(client, device, args):
+    (psm,) = struct.unpack("<H", await client.read_gatt_char(PSM))
+    if psm == 0:
+        return {"skipped": "no L2CAP channel server (Bluedroid peripheral)"}
+    if not sys.platform.startswith("linux") or args.no_l2cap:
+        return {"skipped": "L2CAP phase disabled or not on Linux", "psm": psm}
+
+    addr_type = BDADDR_LE_RANDOM if args.addr_type == "random" else BDADDR_LE_PUBLIC
+    sock = l2cap_connect(device.address, psm, addr_type)
+
+    result = {"psm": psm, "down": [], "up": []}
+    try:
+        for payload in args.payloads:
+            result["down"].append(
+                await phase_l2cap_down(client, sock, payload, args.notifications, args.duration * 4))
+            result["up"].append(await phase_l2cap_up(client, sock, payload, args.duration))
+    finally:
+        sock.close()
+
+    return result
+
+
+async def run(args):
+    adapter = {"adapter": args.adapter} if args.adapter else {}
+
+    device = await BleakScanner.find_device_by_name(
+        args.name, timeout=args.scan_timeout, **adapter)
+    if device is None:
+        sys.exit("device '%s' not found" % args.name)
+
+    async with BleakClient(device, **adapter) as client:
+        mtu = client.mtu_size
+        result = {
+            "device": args.name,
+            "address": device.address,
+            "adapter": args.adapter,
+            "mtu": mtu,
+            "reads_small": await phase_reads(client, SMALL, args.reads),
+            "reads_large": await phase_reads(client, LARGE, max(1, args.reads // 10)),
+            "reads_batch": await phase_batch(client, max(1, args.reads // 4)),
+            "write_nr": [],
+            "notify": [],
+        }
+
+        for payload in args.payloads:
+            # Payloads above the negotiated MTU are capped to one ATT PDU
+            effective = min(payload, mtu - 3)
+            result["write_nr"].append(await phase_stream(client, effective, args.duration))
+            result["notify"].append(
+                await phase_notify(client, effective, args.notifications, args.duration * 4))
+
+        # SDUs are not bound to the ATT MTU, payloads go as given
+        result["l2cap"] = await run_l2cap(client, device, args)
+
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--name", default="NEIL-BENCH")
+    parser.add_argument("--scan-timeout", type=float, default=10.0)
+    parser.add_argument("--reads", type=int, default=200)
+    parser.add_argument("--duration", type=float, default=5.0)
+    parser.add_argument("--notifications", type=int, default=1000)
+    parser.add_argument("--payloads", default="20,64,128,244,509",
+                        type=lambda s: [int(v) for v in s.split(",")])
+    parser.add_argument("--addr-type", choices=("public", "random"), default="public",
+                        help="peripheral address type, for the L2CAP socket")
+    parser.add_argument("--no-l2cap", action="store_true", help="skip the L2CAP phase")
+    parser.add_argument("--adapter", help="BlueZ adapter to connect through (Linux)")
+    parser.add_argument("--output", help="write the JSON report to a file")
+    args = parser.parse_args()
+
+    result = asyncio.run(run(args))
+
+    text = json.dumps(result, indent=2)
+    if args.output:
+        with open(args.output, "w") as out:
+            out.write(text + "\n")
+    print(text)
+
+
+if __name__ == "__main__":
+    main()
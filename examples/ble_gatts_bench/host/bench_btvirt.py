@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+
+# SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Run the benchmark on Linux between two virtual controllers.
+
+Starts BlueZ `btvirt` with one local controller (registered with the kernel,
+so BlueZ and bleak drive it) and its H4 servers, serves the host build of the
+benchmark peripheral through `/tmp/bt-server-le`, and runs
+`central/bench_central.py` through the local controller, once per offered ATT
+MTU. The reports are combined into one JSON document.
+
+Needs root (btvirt creates the controller through /dev/vhci), a running
+bluetoothd and bleak.
+
+Usage:
+    bench_btvirt.py [--bench build-host/neil_ble_gatts_bench] [--btvirt btvirt]
+                    [--mtus 23,247,517] [--output report.json]
+                    [-- CENTRAL_ARGS...]
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CENTRAL = os.path.join(HERE, "..", "central", "bench_central.py")
+
+H4_SOCKET = "/tmp/bt-server-le"
+
+
+def adapters():
+    try:
+        return set(os.listdir("/sys/class/bluetooth"))
+    except FileNotFoundError:
+        return set()
+
+
+def wait_for(predicate, timeout, what):
+    deadline = time.monotonic() + timeout
+    while not predicate():
+        if time.monotonic() > deadline:
+            sys.exit("timed out waiting for %s" % what)
+        time.sleep(0.1)
+
+
+def run_mtu(args, adapter, mtu, central_args):
+    bench = subprocess.Popen([args.bench, "--h4", H4_SOCKET, "--mtu", str(mtu)])
+    try:
+        # The peripheral advertises once its application has started
+        time.sleep(args.settle)
+
+        with tempfile.NamedTemporaryFile(suffix=".json") as out:
+            subprocess.run([sys.executable, CENTRAL, "--adapter", adapter, "--output",
+                            out.name] + central_args, check=True,
+                           stdout=subprocess.DEVNULL)
+            with open(out.name) as report:
+                return json.load(report)
+    finally:
+        bench.terminate()
+        bench.wait()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--bench", default="build-host/neil_ble_gatts_bench",
+                        help="host build of the benchmark peripheral")
+    parser.add_argument("--btvirt", default="btvirt", help="BlueZ emulator")
+    parser.add_argument("--mtus", default="23,247,517",
+                        type=lambda s: [int(v) for v in s.split(",")],
+                        help="ATT MTUs the peripheral offers, one run each")
+    parser.add_argument("--settle", type=float, default=1.0,
+                        help="seconds given to the peripheral to start advertising")
+    parser.add_argument("--output", help="write the JSON report to a file")
+    parser.add_argument("central_args", nargs="*", help="passed to bench_central.py")
+    args = parser.parse_args()
+
+    before = adapters()
+    btvirt = subprocess.Popen([args.btvirt, "-l1", "-s"])
+
+    try:
+        wait_for(lambda: os.path.exists(H4_SOCKET), 10, H4_SOCKET)
+        wait_for(lambda: adapters() - before, 10, "the local virtual controller")
+
+        adapter = sorted(adapters() - before)[0]
+        subprocess.run(["btmgmt", "--index", adapter[3:], "power", "on"], check=False,
+                       stdout=subprocess.DEVNULL)
+
+        result = {
+            "target": "linux-btvirt",
+            "adapter": adapter,
+            "runs": [{"server_mtu": mtu, "report": run_mtu(args, adapter, mtu,
+                                                           args.central_args)}
+                     for mtu in args.mtus],
+        }
+    finally:
+        btvirt.terminate()
+        btvirt.wait()
+
+    text = json.dumps(result, indent=2)
+    if args.output:
+        with open(args.output, "w") as out:
+            out.write(text + "\n")
+    print(text)
+
+
+if __name__ == "__main__":
+    main()
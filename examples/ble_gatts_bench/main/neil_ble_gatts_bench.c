@@ -0,0 +1,452 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// @brief       Throughput benchmark peripheral.
+/// @author      Nicholas H.R. Sims
+///
+/// Exposes a benchmark service driven by `central/bench_central.py`:
+///
+///     B0/01  small     read      4-byte counter (round-trip latency)
+///     B0/02  large     read      512-byte pattern (long reads)
+///     B0/03  sink      write-NR  discards payload, counts bytes
+///     B0/04  control   write     0x00 sync, 0x01 reset counters,
+///                                0x02 dump trace to UART (Bluedroid),
+///                                0x03 <size u16> <count u16> notify burst
+///                                0x04 <size u16> <count u16> L2CAP burst
+///     B0/05  report    read      bench_report_t (server-side counters)
+///     B0/06  batch     read      small + report in one response
+///     B0/07  stream    notify    notify burst payloads
+///     B0/08  psm       read      L2CAP channel PSM, 0 without channels
+///
+/// On NimBLE an L2CAP channel server on BENCH_PSM sends bursts as SDUs and
+/// counts received SDUs like the sink, to compare with notifications and
+/// writes without response.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "neil_ble_gatts.h"
+#include "neil_ble_gatts_cfg.h"
+
+#if NEIL_BLE_GATTS_STACK_NIMBLE
+#include "neil_ble_gatts_l2cap.h"
+#endif
+
+/// Advertised device name.
+#define BLE_DEVICE_NAME "NEIL-BENCH"
+
+/// Advertised device manufacturer.
+#define BLE_MFR_NAME "NEIL"
+
+/// Benchmark service index (see neil_ble_gatts_UUID_128).
+#define BENCH_SVC 0xB0
+
+/// Size of the long-read characteristic.
+#define LARGE_SIZE 512
+
+/// Event trace capacity (records).
+#define TRACE_CAPACITY 1024
+
+/// Index of the stream characteristic within the benchmark service.
+#define STREAM_CHR_IDX 6
+
+/// L2CAP channel PSM (dynamic range).
+#define BENCH_PSM 0x0081
+
+/// Wait for channel credits before a burst is abandoned.
+#define L2CAP_SEND_TIMEOUT_MS 2000
+
+/// Control commands.
+#define CTRL_SYNC       0x00
+#define CTRL_RESET      0x01
+#define CTRL_DUMP_TRACE 0x02
+#define CTRL_NOTIFY     0x03
+#define CTRL_L2CAP      0x04
+
+/// Logging tag.
+static const char *TAG = "NEIL BLE GATTS Bench";
+
+/**
+ * @brief       Server-side counters, read by the central after each phase.
+ *
+ *              Little-endian, packed; mirrored by `bench_central.py`.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t small_reads;
+    uint32_t large_reads;
+    uint32_t sink_writes;
+    uint32_t sink_bytes;
+    uint32_t sink_first_us;
+    uint32_t sink_last_us;
+    uint32_t trace_events;
+    uint32_t trace_busy_us;
+    uint32_t heap_used;
+    uint32_t heap_peak;
+    uint32_t notify_sent;
+    uint32_t notify_dropped;
+    uint32_t notify_congestions;
+    uint32_t notify_latency_avg_us;
+    uint32_t notify_latency_max_us;
+    uint32_t l2cap_rx_sdus;
+    uint32_t l2cap_rx_bytes;
+    uint32_t l2cap_rx_first_us;
+    uint32_t l2cap_rx_last_us;
+    uint32_t l2cap_tx_sdus;
+    uint32_t l2cap_tx_stalls;
+} bench_report_t;
+
+static bench_report_t report;
+
+/**
+ * @brief       Pending notify burst, set by the control characteristic.
+ */
+static struct {
+    uint16_t size;
+    uint16_t count;
+    bool l2cap; ///< Over the L2CAP channel rather than notifications.
+} burst;
+
+#if NEIL_BLE_GATTS_STACK_NIMBLE
+/// Connection of the open L2CAP channel.
+static uint16_t l2cap_conn_id;
+static bool l2cap_open = false;
+#endif
+
+static TaskHandle_t stream_task_handle = NULL;
+
+// -------------------------------------------------------------
+// Characteristic Callbacks
+// -------------------------------------------------------------
+
+void read_small(uint8_t *buffer) {
+    report.small_reads++;
+    memcpy(buffer, &report.small_reads, sizeof(uint32_t));
+}
+
+void read_large(uint8_t *buffer) {
+    report.large_reads++;
+    for (uint16_t idx = 0; idx < LARGE_SIZE; idx++) {
+        buffer[idx] = (uint8_t)idx;
+    }
+}
+
+void write_sink(uint8_t *data, uint16_t len) {
+    const uint32_t now = (uint32_t)esp_timer_get_time();
+    if (report.sink_writes == 0) {
+        report.sink_first_us = now;
+    }
+    report.sink_last_us = now;
+    report.sink_writes++;
+    report.sink_bytes += len;
+}
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+/**
+ * @brief       Sum handler time over the recorded trace.
+ */
+static void report_trace_totals(void) {
+    neil_ble_gatts_trace_rec_t rec;
+
+    report.trace_events  = 0;
+    report.trace_busy_us = 0;
+
+    for (size_t offset = sizeof(neil_ble_gatts_trace_hdr_t);
+         neil_ble_gatts_trace_read(offset, (uint8_t *)&rec, sizeof(rec)) == sizeof(rec);
+         offset += sizeof(rec)) {
+        report.trace_events++;
+        report.trace_busy_us += rec.duration_us;
+    }
+}
+#endif
+
+void read_report(uint8_t *buffer) {
+    neil_ble_gatts_mem_stats_t mem;
+    neil_ble_gatts_mem_get_total(&mem);
+
+    report.heap_used = mem.used;
+    report.heap_peak = mem.peak;
+
+    neil_ble_gatts_notify_stats_t notify;
+    neil_ble_gatts_notify_get_total(&notify);
+
+    report.notify_sent           = notify.sent;
+    report.notify_dropped        = notify.dropped;
+    report.notify_congestions    = notify.congestions;
+    report.notify_latency_avg_us = notify.latency_avg_us;
+    report.notify_latency_max_us = notify.latency_max_us;
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+    report_trace_totals();
+#endif
+
+    memcpy(buffer, &report, sizeof(report));
+}
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+/**
+ * @brief       Trace sink printing hex lines, decode with
+ *              `trace_decode.py --hex`.
+ */
+static esp_err_t uart_hex_sink(const uint8_t *data, size_t len, void *ctx) {
+    printf("TRACE ");
+    for (size_t idx = 0; idx < len; idx++) {
+        printf("%02x", data[idx]);
+    }
+    printf("\n");
+    return ESP_OK;
+}
+#endif
+
+void write_control(uint8_t *data, uint16_t len) {
+    if (len < 1) {
+        return;
+    }
+
+    switch (data[0]) {
+    case CTRL_SYNC:
+        // Confirmed no-op, lets the central drain queued writes.
+        break;
+
+    case CTRL_RESET:
+        memset(&report, 0, sizeof(report));
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+        neil_ble_gatts_trace_clear();
+#endif
+        neil_ble_gatts_mem_reset_peak();
+        neil_ble_gatts_notify_reset_stats();
+        break;
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+    case CTRL_DUMP_TRACE:
+        neil_ble_gatts_trace_pause(true);
+        neil_ble_gatts_trace_export(uart_hex_sink, NULL);
+        neil_ble_gatts_trace_pause(false);
+        break;
+#endif
+
+    case CTRL_NOTIFY:
+    case CTRL_L2CAP:
+        if (len < 5) {
+            break;
+        }
+        // Runs on the BTC task, hand the burst to the stream task.
+        burst.size  = data[1] | data[2] << 8;
+        burst.count = data[3] | data[4] << 8;
+        burst.l2cap = data[0] == CTRL_L2CAP;
+        xTaskNotifyGive(stream_task_handle);
+        break;
+
+    default:
+        ESP_LOGW(TAG, "Unknown control command %x", data[0]);
+        break;
+    }
+}
+
+void read_psm(uint8_t *buffer) {
+#if NEIL_BLE_GATTS_STACK_NIMBLE
+    neil_ble_gatts_l2cap_psm_read(buffer);
+#else
+    memset(buffer, 0, sizeof(uint16_t));
+#endif
+}
+
+#if NEIL_BLE_GATTS_STACK_NIMBLE
+/**
+ * @brief       Count SDUs received over the channel, like the sink.
+ */
+static void l2cap_recv(uint16_t conn_id, neil_ble_gatts_l2cap_buf_t *sdu) {
+    const uint32_t now = (uint32_t)esp_timer_get_time();
+    if (report.l2cap_rx_sdus == 0) {
+        report.l2cap_rx_first_us = now;
+    }
+    report.l2cap_rx_last_us = now;
+    report.l2cap_rx_sdus++;
+    report.l2cap_rx_bytes += neil_ble_gatts_l2cap_buf_len(sdu);
+
+    neil_ble_gatts_l2cap_buf_free(sdu);
+}
+
+static void l2cap_state(uint16_t conn_id, bool connected) {
+    l2cap_conn_id = conn_id;
+    l2cap_open    = connected;
+}
+
+/**
+ * @brief       Send one burst as SDUs, each paced by the peer's credits.
+ */
+static void l2cap_burst(const uint8_t *payload, uint16_t size) {
+    for (uint16_t seq = 0; seq < burst.count && l2cap_open; seq++) {
+        neil_ble_gatts_l2cap_buf_t *sdu = neil_ble_gatts_l2cap_buf_alloc();
+
+        // First two bytes carry the sequence number, written in place
+        uint8_t *head = neil_ble_gatts_l2cap_buf_reserve(sdu, 2);
+        if (head == NULL ||
+            neil_ble_gatts_l2cap_buf_append(sdu, payload + 2, size - 2) != ESP_OK) {
+            ESP_LOGW(TAG, "Out of channel buffers at SDU %d", seq);
+            neil_ble_gatts_l2cap_buf_free(sdu);
+            return;
+        }
+        head[0] = seq & 0xFF;
+        head[1] = seq >> 8;
+
+        if (neil_ble_gatts_l2cap_send(l2cap_conn_id, sdu,
+                                      pdMS_TO_TICKS(L2CAP_SEND_TIMEOUT_MS)) != ESP_OK) {
+            ESP_LOGW(TAG, "Burst abandoned at SDU %d", seq);
+            return;
+        }
+    }
+
+    neil_ble_gatts_l2cap_stats_t stats;
+    if (neil_ble_gatts_l2cap_get_stats(l2cap_conn_id, &stats) == ESP_OK) {
+        report.l2cap_tx_sdus   = stats.tx_sdus;
+        report.l2cap_tx_stalls = stats.stalls;
+    }
+}
+
+static const neil_ble_gatts_cfg_l2cap_t l2cap_config = {
+    .psm      = BENCH_PSM,
+    .mtu      = LARGE_SIZE,
+    .on_recv  = l2cap_recv,
+    .on_state = l2cap_state,
+};
+#endif
+
+/**
+ * @brief       Send notify bursts requested through the control
+ *              characteristic, keeping the scheduler queue short of full so
+ *              the burst measures throughput rather than drops.
+ */
+static void stream_task(void *arg) {
+    static uint8_t payload[LARGE_SIZE];
+
+    for (uint16_t idx = 0; idx < LARGE_SIZE; idx++) {
+        payload[idx] = (uint8_t)idx;
+    }
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        const uint16_t size = burst.size < LARGE_SIZE ? burst.size : LARGE_SIZE;
+
+        if (burst.l2cap) {
+#if NEIL_BLE_GATTS_STACK_NIMBLE
+            if (size >= 2) {
+                l2cap_burst(payload, size);
+            }
+#endif
+            continue;
+        }
+
+        for (uint16_t seq = 0; seq < burst.count; seq++) {
+            neil_ble_gatts_notify_stats_t stats;
+            neil_ble_gatts_notify_get_total(&stats);
+
+            while (stats.depth >= NEIL_BLE_GATTS_NOTIFY_QUEUE_LEN - 1) {
+                vTaskDelay(1);
+                neil_ble_gatts_notify_get_total(&stats);
+            }
+
+            // First two bytes carry the sequence number for loss detection
+            payload[0] = seq & 0xFF;
+            payload[1] = seq >> 8;
+
+            neil_ble_gatts_notify(0, STREAM_CHR_IDX, payload, size);
+        }
+    }
+}
+
+// --- Top-level device configuration.
+//
+// @see: neil_ble_gatts_cfg.h
+static neil_ble_gatts_cfg_dev_t bluetooth_device_config = {
+
+    .name_len = sizeof(BLE_DEVICE_NAME),
+    .name     = BLE_DEVICE_NAME,
+
+    .mfr_len = sizeof(BLE_MFR_NAME),
+    .mfr     = BLE_MFR_NAME,
+
+    .svc_tab_len = 1,
+    .svc_tab =
+
+        (neil_ble_gatts_cfg_svc_t[]){
+
+            // --- Benchmark Service ---
+            {
+                .uuid = neil_ble_gatts_UUID_128(BENCH_SVC, 0),
+
+                .chr_tab_len = 8,
+                .chr_tab =
+                    (neil_ble_gatts_cfg_chr_t[]){
+                        {
+                            .uuid    = neil_ble_gatts_UUID_128(BENCH_SVC, 1),
+                            .size    = sizeof(uint32_t),
+                            .on_read = read_small,
+                        },
+                        {
+                            .uuid    = neil_ble_gatts_UUID_128(BENCH_SVC, 2),
+                            .size    = LARGE_SIZE,
+                            .on_read = read_large,
+                        },
+                        {
+                            .uuid     = neil_ble_gatts_UUID_128(BENCH_SVC, 3),
+                            .size     = 0,
+                            .on_write = write_sink,
+                        },
+                        {
+                            .uuid     = neil_ble_gatts_UUID_128(BENCH_SVC, 4),
+                            .size     = 0,
+                            .on_write = write_control,
+                        },
+                        {
+                            .uuid    = neil_ble_gatts_UUID_128(BENCH_SVC, 5),
+                            .size    = sizeof(bench_report_t),
+                            .on_read = read_report,
+                        },
+                        {
+                            .uuid      = neil_ble_gatts_UUID_128(BENCH_SVC, 6),
+                            .batch     = (const uint8_t[]){0, 4},
+                            .batch_len = 2,
+                        },
+                        {
+                            .uuid   = neil_ble_gatts_UUID_128(BENCH_SVC, 7),
+                            .notify = true,
+                        },
+                        {
+                            .uuid    = neil_ble_gatts_UUID_128(BENCH_SVC, 8),
+                            .size    = sizeof(uint16_t),
+                            .on_read = read_psm,
+                        },
+                    },
+            },
+        },
+
+#if NEIL_BLE_GATTS_STACK_NIMBLE
+    .l2cap = &l2cap_config,
+#endif
+};
+
+/**
+ * @brief       Application entry-point.
+ */
+void app_main(void) {
+    ESP_LOGW(TAG, "Host stack: %s",
+             NEIL_BLE_GATTS_STACK_NIMBLE ? "NimBLE" : "Bluedroid");
+    ESP_LOGW(TAG, "Estimated component heap: %u bytes",
+             (unsigned)neil_ble_gatts_mem_estimate(&bluetooth_device_config));
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+    ESP_ERROR_CHECK(neil_ble_gatts_trace_start(TRACE_CAPACITY));
+#endif
+
+    xTaskCreate(stream_task, "bench_stream", 3072, NULL, 5, &stream_task_handle);
+
+    neil_ble_gatts_start(&bluetooth_device_config);
+}
@@ -0,0 +1,554 @@
+// SPDX-FileCopyrightText: 2023 Nicholas H.R. Sims <nickhrsims@gmail.com>
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/// @brief       Server construction and lookup micro-benchmarks.
+/// @author      Nicholas H.R. Sims
+///
+/// Builds synthetic device configurations of 1 to 4096 characteristics and
+/// times the server's startup and per-event building blocks on each:
+///
+///     table_init      attribute table (Bluedroid) or service definitions
+///                     (NimBLE) built from the configuration
+///     table_deinit    ... and released
+///     map_init        handle-to-configuration map (Bluedroid)
+///     map_get         handle lookup, as done by every read and write event
+///     gap_init        advertising payload of the configuration (Bluedroid)
+///     read_dispatch   read request through the GATTS event entry-point of a
+///                     running context, response included (Bluedroid,
+///                     CONFIG_NEIL_BLE_GATTS_BENCH_HOOKS)
+///     write_dispatch  write command, likewise
+///
+/// Each result is printed as one JSON object per line, prefixed with
+/// `MICROBENCH `, carrying the time and component allocations per operation:
+///
+///     idf.py monitor | grep -o '{.*}' > microbench.jsonl
+///
+/// The host build (`host/`, see the component README) runs the same code on
+/// Linux over the port of the stack, and adds every heap allocation per
+/// operation (`heap_allocs_per_op`), the port's included:
+///
+///     build-host/neil_ble_gatts_microbench --exit | grep -o '{.*}' > microbench.jsonl
+///
+/// Sizes whose tables do not fit the heap, or the stack, are reported with
+/// `"skipped":true`: on the target, Bluedroid takes at most
+/// CONFIG_BT_GATT_MAX_SR_ATTRIBUTES attributes per table (100 by default, 500
+/// at most), which bounds the sizes requests are dispatched to. The host
+/// build lifts those limits and runs every size. Event handler time of a live server is measured by
+/// `ble_gatts_bench` (trace recorder).
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "neil_ble_gatts.h"
+#include "neil_ble_gatts_cfg.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include "neil_ble_gatts_host.h"
+#endif
+
+#if NEIL_BLE_GATTS_STACK_NIMBLE
+#include "neil_ble_gatts_nimble_db.h"
+#else
+#include "neil_ble_gatts_attr_db.h"
+#include "neil_ble_gatts_bench.h"
+#include "neil_ble_gatts_gap.h"
+#include "neil_ble_gatts_handle_map.h"
+#endif
+
+/// Characteristics per synthetic service.
+#define SYNTH_CHR_PER_SVC 200
+
+/// Every n-th synthetic characteristic notifies (adds a descriptor).
+#define SYNTH_NOTIFY_EVERY 4
+
+/// Characteristics built per measurement, spread over repetitions.
+#define BENCH_WORK 1024
+
+/// Most tables held at once by one measurement.
+#define BENCH_REPS_MAX 64
+
+/// Handle lookups per measurement.
+#define BENCH_LOOKUPS 65536
+
+/// First handle of the synthetic handle space.
+#define BENCH_HANDLE_BASE 0x28
+
+/// Requests per dispatch measurement.
+#define BENCH_REQUESTS 4096
+
+/// Connection of dispatched requests, never linked: the stack refuses the
+/// responses, after the component has built them.
+#define BENCH_CONN_ID 0
+
+/// Time allowed for a context's attribute table to be created.
+#define BENCH_START_TIMEOUT_MS 1000
+
+/// Logging tag of the Bluedroid GATT layer, which reports refused responses.
+#define BENCH_GATT_TAG "BT_GATT"
+
+/// Logging tag of the component's GAP module, which reports service UUIDs
+/// left out of the advertising payload.
+#define BENCH_GAP_TAG "neil_ble_gatts_GAP"
+
+/// Logging tag.
+static const char *TAG = "NEIL BLE GATTS Microbench";
+
+/// Synthetic configuration sizes, in characteristics.
+static const uint16_t SIZES[] = {1, 16, 128, 1024, 4096};
+
+// -------------------------------------------------------------
+// Synthetic Configurations
+// -------------------------------------------------------------
+
+static void synth_read(uint8_t *data) { memset(data, 0, sizeof(uint32_t)); }
+
+static void synth_write(uint8_t *val, uint16_t len) {}
+
+/**
+ * @brief       Build a configuration of `chr_count` characteristics.
+ *
+ * @return      NULL on allocation failure.
+ */
+static neil_ble_gatts_cfg_dev_t *synth_init(uint16_t chr_count) {
+
+    static const uint8_t BASE_UUID[ESP_UUID_LEN_128] = neil_ble_gatts_UUID_128(0, 0);
+
+    const uint16_t svc_count = (chr_count + SYNTH_CHR_PER_SVC - 1) / SYNTH_CHR_PER_SVC;
+
+    neil_ble_gatts_cfg_dev_t *dev_cfg = calloc(1, sizeof(neil_ble_gatts_cfg_dev_t));
+    neil_ble_gatts_cfg_svc_t *svc_tab =
+        calloc(svc_count, sizeof(neil_ble_gatts_cfg_svc_t));
+    neil_ble_gatts_cfg_chr_t *chr_tab =
+        calloc(chr_count, sizeof(neil_ble_gatts_cfg_chr_t));
+
+    if (dev_cfg == NULL || svc_tab == NULL || chr_tab == NULL) {
+        free(dev_cfg);
+        free(svc_tab);
+        free(chr_tab);
+        return NULL;
+    }
+
+    dev_cfg->name        = "NEIL-MICROBENCH";
+    dev_cfg->name_len    = sizeof("NEIL-MICROBENCH");
+    dev_cfg->svc_tab     = svc_tab;
+    dev_cfg->svc_tab_len = svc_count;
+
+    for (uint16_t chr_idx = 0; chr_idx < chr_count; chr_idx++) {
+        neil_ble_gatts_cfg_svc_t *svc_cfg = svc_tab + chr_idx / SYNTH_CHR_PER_SVC;
+        neil_ble_gatts_cfg_chr_t *chr_cfg = chr_tab + chr_idx;
+
+        if (svc_cfg->chr_tab == NULL) {
+            svc_cfg->chr_tab = chr_cfg;
+            memcpy(svc_cfg->uuid, BASE_UUID, ESP_UUID_LEN_128);
+            neil_ble_gatts_UUID_128_GET_SVC_INDEX(svc_cfg->uuid) = svc_cfg - svc_tab;
+        }
+
+        memcpy(chr_cfg->uuid, svc_cfg->uuid, ESP_UUID_LEN_128);
+        chr_cfg->uuid[10] = svc_cfg->chr_tab_len + 1;
+
+        chr_cfg->size     = sizeof(uint32_t);
+        chr_cfg->on_read  = synth_read;
+        chr_cfg->on_write = synth_write;
+        chr_cfg->notify   = chr_idx % SYNTH_NOTIFY_EVERY == 0;
+
+        svc_cfg->chr_tab_len++;
+    }
+
+    return dev_cfg;
+}
+
+static void synth_deinit(neil_ble_gatts_cfg_dev_t *dev_cfg) {
+    if (dev_cfg == NULL) {
+        return;
+    }
+    free(dev_cfg->svc_tab[0].chr_tab);
+    free(dev_cfg->svc_tab);
+    free(dev_cfg);
+}
+
+// -------------------------------------------------------------
+// Measurement
+// -------------------------------------------------------------
+
+/**
+ * @brief       Running measurement of one operation.
+ */
+typedef struct {
+    const char *op;
+    uint16_t chr_count;
+    int64_t start_us;
+    uint32_t start_allocs;
+    uint32_t start_heap_allocs;
+} bench_t;
+
+static uint32_t mem_allocs(void) {
+    neil_ble_gatts_mem_stats_t stats;
+    neil_ble_gatts_mem_get_total(&stats);
+    return stats.allocs;
+}
+
+/**
+ * @brief       Heap allocations of any origin so far, counted by the host
+ *              build only.
+ */
+static uint32_t heap_alloc_count(void) {
+#if CONFIG_IDF_TARGET_LINUX
+    return neil_ble_gatts_host_alloc_count();
+#else
+    return 0;
+#endif
+}
+
+static void bench_begin(bench_t *bench, const char *op, uint16_t chr_count) {
+    bench->op                = op;
+    bench->chr_count         = chr_count;
+    bench->start_allocs      = mem_allocs();
+    bench->start_heap_allocs = heap_alloc_count();
+    bench->start_us          = esp_timer_get_time();
+}
+
+/**
+ * @brief       Print the result of a measurement of `count` operations.
+ */
+static void bench_end(bench_t *bench, uint32_t count) {
+
+    const int64_t elapsed_us = esp_timer_get_time() - bench->start_us;
+    const uint32_t allocs    = mem_allocs() - bench->start_allocs;
+    const uint32_t ops       = count ? count : 1;
+
+    printf("MICROBENCH {\"target\":\"%s\",\"stack\":\"%s\",\"op\":\"%s\",\"chr\":%u,"
+           "\"count\":%" PRIu32 ",\"ns_per_op\":%" PRIu64 ",\"allocs_per_op\":%.2f",
+           CONFIG_IDF_TARGET, NEIL_BLE_GATTS_STACK_NIMBLE ? "nimble" : "bluedroid",
+           bench->op, bench->chr_count, count, (uint64_t)elapsed_us * 1000 / ops,
+           (double)allocs / ops);
+#if CONFIG_IDF_TARGET_LINUX
+    const uint32_t heap_allocs = heap_alloc_count() - bench->start_heap_allocs;
+    printf(",\"heap_allocs_per_op\":%.2f", (double)heap_allocs / ops);
+#endif
+    printf("}\n");
+}
+
+static void bench_skip(const char *op, uint16_t chr_count) {
+    printf("MICROBENCH {\"target\":\"%s\",\"stack\":\"%s\",\"op\":\"%s\",\"chr\":%u,"
+           "\"skipped\":true}\n",
+           CONFIG_IDF_TARGET, NEIL_BLE_GATTS_STACK_NIMBLE ? "nimble" : "bluedroid", op,
+           chr_count);
+}
+
+/**
+ * @brief       Tables held at once when measuring `chr_count`.
+ */
+static uint16_t bench_reps(uint16_t chr_count) {
+    const uint16_t reps = BENCH_WORK / chr_count;
+    return reps < 1 ? 1 : reps > BENCH_REPS_MAX ? BENCH_REPS_MAX : reps;
+}
+
+// -------------------------------------------------------------
+// Benchmarks
+// -------------------------------------------------------------
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+
+static void bench_tables(const neil_ble_gatts_cfg_dev_t *dev_cfg, uint16_t chr_count) {
+
+    const uint16_t reps = bench_reps(chr_count);
+    const size_t need   = reps * (neil_ble_gatts_attr_db_footprint(dev_cfg) +
+                                neil_ble_gatts_handle_map_footprint(dev_cfg));
+
+    if (need > heap_caps_get_free_size(MALLOC_CAP_DEFAULT)) {
+        bench_skip("table_init", chr_count);
+        return;
+    }
+
+    neil_ble_gatts_attr_db_t *attr_tabs[BENCH_REPS_MAX];
+    neil_ble_gatts_handle_map_t *maps[BENCH_REPS_MAX];
+    bench_t bench;
+
+    bench_begin(&bench, "table_init", chr_count);
+    for (uint16_t rep = 0; rep < reps; rep++) {
+        attr_tabs[rep] = neil_ble_gatts_attr_db_init(dev_cfg);
+    }
+    bench_end(&bench, reps);
+
+    // --- Handles as the stack assigns them: consecutive, after GAP and GATT
+    const uint16_t attr_len = attr_tabs[0] != NULL ? attr_tabs[0]->len : 0;
+    uint16_t *handles       = attr_len ? calloc(attr_len, sizeof(uint16_t)) : NULL;
+
+    for (uint16_t idx = 0; handles != NULL && idx < attr_len; idx++) {
+        handles[idx] = BENCH_HANDLE_BASE + idx;
+    }
+
+    if (handles != NULL) {
+        bench_begin(&bench, "map_init", chr_count);
+        for (uint16_t rep = 0; rep < reps; rep++) {
+            maps[rep] = neil_ble_gatts_handle_map_init(dev_cfg, handles, attr_len);
+        }
+        bench_end(&bench, reps);
+
+        // --- Every handle in turn: values, declarations and descriptors
+        volatile uintptr_t sink = 0;
+
+        bench_begin(&bench, "map_get", chr_count);
+        for (uint32_t lookup = 0; lookup < BENCH_LOOKUPS; lookup++) {
+            sink ^= (uintptr_t)neil_ble_gatts_handle_map_get(
+                maps[0], BENCH_HANDLE_BASE + lookup % attr_len);
+        }
+        bench_end(&bench, BENCH_LOOKUPS);
+
+        for (uint16_t rep = 0; rep < reps; rep++) {
+            neil_ble_gatts_handle_map_deinit(maps[rep]);
+        }
+        free(handles);
+    }
+
+    bench_begin(&bench, "table_deinit", chr_count);
+    for (uint16_t rep = 0; rep < reps; rep++) {
+        neil_ble_gatts_attr_db_deinit(attr_tabs[rep]);
+    }
+    bench_end(&bench, reps);
+}
+
+static void bench_gap(const neil_ble_gatts_cfg_dev_t *dev_cfg, uint16_t chr_count) {
+
+    static neil_ble_gatts_gap_t gap;
+
+    const uint16_t reps = bench_reps(chr_count);
+    bench_t bench;
+
+    // --- Services past the payload are reported, not timed
+    const esp_log_level_t gap_level = esp_log_level_get(BENCH_GAP_TAG);
+    esp_log_level_set(BENCH_GAP_TAG, ESP_LOG_NONE);
+
+    // --- Released every time, advertising has a single owner
+    bench_begin(&bench, "gap_init", chr_count);
+    for (uint16_t rep = 0; rep < reps; rep++) {
+        neil_ble_gatts_gap_init(&gap, dev_cfg);
+        neil_ble_gatts_gap_deinit(&gap);
+    }
+    bench_end(&bench, reps);
+
+    esp_log_level_set(BENCH_GAP_TAG, gap_level);
+}
+
+/**
+ * @brief       Time reads and writes of every characteristic in turn, through
+ *              the event entry-point of a service-only context serving
+ *              `dev_cfg`.
+ */
+static void bench_dispatch(neil_ble_gatts_cfg_dev_t *dev_cfg, uint16_t chr_count) {
+
+#if !CONFIG_NEIL_BLE_GATTS_BENCH_HOOKS
+    bench_skip("read_dispatch", chr_count);
+    bench_skip("write_dispatch", chr_count);
+#else
+    dev_cfg->service_only = true;
+
+    neil_ble_gatts_ctx_t *ctx = neil_ble_gatts_ctx_start(dev_cfg);
+    uint16_t *handles         = calloc(chr_count, sizeof(uint16_t));
+
+    // --- The table is created on the BTC task, the stack may refuse it
+    for (uint32_t waited_ms = 0;
+         ctx != NULL && neil_ble_gatts_ctx_handle(ctx, 0, 0) == 0 &&
+         waited_ms < BENCH_START_TIMEOUT_MS;
+         waited_ms += 10) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    if (ctx == NULL || handles == NULL || neil_ble_gatts_ctx_handle(ctx, 0, 0) == 0) {
+        bench_skip("read_dispatch", chr_count);
+        bench_skip("write_dispatch", chr_count);
+        free(handles);
+        if (ctx != NULL) {
+            neil_ble_gatts_ctx_stop(ctx, NEIL_BLE_GATTS_STOP_COLD);
+        }
+        return;
+    }
+
+    for (uint16_t chr_idx = 0; chr_idx < chr_count; chr_idx++) {
+        handles[chr_idx] = neil_ble_gatts_ctx_handle(ctx, chr_idx / SYNTH_CHR_PER_SVC,
+                                                     chr_idx % SYNTH_CHR_PER_SVC);
+    }
+
+    // --- Every response is refused, quietly
+    const esp_log_level_t gatt_level = esp_log_level_get(BENCH_GATT_TAG);
+    esp_log_level_set(BENCH_GATT_TAG, ESP_LOG_NONE);
+
+    uint8_t value[sizeof(uint32_t)] = {0};
+    bench_t bench;
+
+    bench_begin(&bench, "read_dispatch", chr_count);
+    for (uint32_t request = 0; request < BENCH_REQUESTS; request++) {
+        neil_ble_gatts_bench_dispatch_read(ctx, BENCH_CONN_ID,
+                                           handles[request % chr_count], 0);
+    }
+    bench_end(&bench, BENCH_REQUESTS);
+
+    bench_begin(&bench, "write_dispatch", chr_count);
+    for (uint32_t request = 0; request < BENCH_REQUESTS; request++) {
+        neil_ble_gatts_bench_dispatch_write(ctx, BENCH_CONN_ID,
+                                            handles[request % chr_count], value,
+                                            sizeof(value), false);
+    }
+    bench_end(&bench, BENCH_REQUESTS);
+
+    neil_ble_gatts_ctx_stop(ctx, NEIL_BLE_GATTS_STOP_COLD);
+    esp_log_level_set(BENCH_GATT_TAG, gatt_level);
+
+    free(handles);
+#endif
+}
+
+#else
+
+static int synth_access(uint16_t conn_handle, uint16_t attr_handle,
+                        struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    return 0;
+}
+
+static void bench_tables(const neil_ble_gatts_cfg_dev_t *dev_cfg, uint16_t chr_count) {
+
+    const uint16_t reps = bench_reps(chr_count);
+    const size_t need   = reps * neil_ble_gatts_nimble_db_footprint(dev_cfg);
+
+    if (need > heap_caps_get_free_size(MALLOC_CAP_DEFAULT)) {
+        bench_skip("table_init", chr_count);
+        return;
+    }
+
+    neil_ble_gatts_nimble_db_t *dbs[BENCH_REPS_MAX];
+    bench_t bench;
+
+    bench_begin(&bench, "table_init", chr_count);
+    for (uint16_t rep = 0; rep < reps; rep++) {
+        dbs[rep] = neil_ble_gatts_nimble_db_init(dev_cfg, synth_access);
+    }
+    bench_end(&bench, reps);
+
+    // --- Value handles as NimBLE assigns them: declaration, value, descriptor
+    neil_ble_gatts_nimble_db_t *db = dbs[0];
+    uint16_t handle                = BENCH_HANDLE_BASE;
+
+    for (uint16_t idx = 0; db != NULL && idx < db->chr_count; idx++) {
+        db->val_handles[idx] = handle + 1;
+        handle += idx % SYNTH_NOTIFY_EVERY == 0 ? 3 : 2;
+    }
+
+    if (db != NULL) {
+        volatile uintptr_t sink = 0;
+
+        bench_begin(&bench, "map_get", chr_count);
+        for (uint32_t lookup = 0; lookup < BENCH_LOOKUPS; lookup++) {
+            sink ^= (uintptr_t)neil_ble_gatts_nimble_db_chr(
+                db, dev_cfg, BENCH_HANDLE_BASE + lookup % (handle - BENCH_HANDLE_BASE));
+        }
+        bench_end(&bench, BENCH_LOOKUPS);
+    }
+
+    bench_begin(&bench, "table_deinit", chr_count);
+    for (uint16_t rep = 0; rep < reps; rep++) {
+        neil_ble_gatts_nimble_db_deinit(dbs[rep]);
+    }
+    bench_end(&bench, reps);
+}
+
+#endif
+
+// -------------------------------------------------------------
+// Entry-point
+// -------------------------------------------------------------
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+/// Smallest server, brings the host up for advertising measurements.
+static neil_ble_gatts_cfg_dev_t probe_config = {
+    .service_only = true,
+
+    .svc_tab_len = 1,
+    .svc_tab =
+        (neil_ble_gatts_cfg_svc_t[]){
+            {
+                .uuid = neil_ble_gatts_UUID_128(0xB1, 0),
+
+                .chr_tab_len = 1,
+                .chr_tab =
+                    (neil_ble_gatts_cfg_chr_t[]){
+                        {
+                            .uuid    = neil_ble_gatts_UUID_128(0xB1, 1),
+                            .size    = sizeof(uint32_t),
+                            .on_read = synth_read,
+                        },
+                    },
+            },
+        },
+};
+#endif
+
+/**
+ * @brief       Application entry-point.
+ */
+void app_main(void) {
+    ESP_LOGW(TAG, "Host stack: %s",
+             NEIL_BLE_GATTS_STACK_NIMBLE ? "NimBLE" : "Bluedroid");
+
+    // --- Tables first, with the whole heap to themselves
+    for (size_t idx = 0; idx < sizeof(SIZES) / sizeof(SIZES[0]); idx++) {
+        neil_ble_gatts_cfg_dev_t *dev_cfg = synth_init(SIZES[idx]);
+
+        if (dev_cfg == NULL) {
+            bench_skip("table_init", SIZES[idx]);
+            continue;
+        }
+
+        bench_tables(dev_cfg, SIZES[idx]);
+        synth_deinit(dev_cfg);
+    }
+
+#if !NEIL_BLE_GATTS_STACK_NIMBLE
+    // --- Advertising needs the host, taken by a context that does not advertise
+    neil_ble_gatts_ctx_t *ctx = neil_ble_gatts_ctx_start(&probe_config);
+
+    if (ctx == NULL) {
+        ESP_LOGE(TAG, "Host failed to start, advertising not measured");
+        return;
+    }
+
+    for (size_t idx = 0; idx < sizeof(SIZES) / sizeof(SIZES[0]); idx++) {
+        neil_ble_gatts_cfg_dev_t *dev_cfg = synth_init(SIZES[idx]);
+
+        if (dev_cfg == NULL) {
+            bench_skip("gap_init", SIZES[idx]);
+            continue;
+        }
+
+        bench_gap(dev_cfg, SIZES[idx]);
+        synth_deinit(dev_cfg);
+    }
+
+    // --- Requests, beside the probe (tables past the stack's limit are refused)
+    for (size_t idx = 0; idx < sizeof(SIZES) / sizeof(SIZES[0]); idx++) {
+        neil_ble_gatts_cfg_dev_t *dev_cfg = synth_init(SIZES[idx]);
+
+        if (dev_cfg == NULL) {
+            bench_skip("read_dispatch", SIZES[idx]);
+            bench_skip("write_dispatch", SIZES[idx]);
+            continue;
+        }
+
+        bench_dispatch(dev_cfg, SIZES[idx]);
+        synth_deinit(dev_cfg);
+    }
+
+    neil_ble_gatts_ctx_stop(ctx, NEIL_BLE_GATTS_STOP_COLD);
+#endif
+
+    ESP_LOGW(TAG, "Done");
+}